@@ -22,6 +22,7 @@
 #include <locale.h>
 #include "gcode_util.h"
 #include "gcode_sim.h"
+#include "gcode_voxel.h"
 
 
 void
@@ -215,6 +216,7 @@ gcode_list_make (gcode_t *gcode)
   {
     /* Make the G-Code */
     block->make (block);
+    gcode_block_trim (block);
 
     if (gcode->progress_callback)
       gcode->progress_callback (gcode->gui, (gfloat_t) i / (gfloat_t) num);
@@ -243,6 +245,213 @@ gcode_list_free (gcode_block_t **list)
 }
 
 
+/*
+* Visit a block and every block it owns.  Blocks that are derived from
+* the geometry of their parent (stl slices, bolt hole arcs) are visited
+* with the cache flag set so callers may account for them separately.
+*/
+typedef void (*gcode_visit_t) (gcode_block_t *block, void *data, uint8_t cache);
+
+static void gcode_visit_list (gcode_block_t *list, gcode_visit_t visit, void *data, uint8_t cache);
+
+static void
+gcode_visit_block (gcode_block_t *block, gcode_visit_t visit, void *data, uint8_t cache)
+{
+  int i;
+
+  visit (block, data, cache);
+
+  switch (block->type)
+  {
+    case GCODE_TYPE_TEMPLATE:
+      gcode_visit_list (((gcode_template_t *) block->pdata)->list, visit, data, cache);
+      break;
+
+    case GCODE_TYPE_EXTRUSION:
+      gcode_visit_list (((gcode_extrusion_t *) block->pdata)->list, visit, data, cache);
+      break;
+
+    case GCODE_TYPE_SKETCH:
+      gcode_visit_list (((gcode_sketch_t *) block->pdata)->extrusion, visit, data, cache);
+      gcode_visit_list (((gcode_sketch_t *) block->pdata)->list, visit, data, cache);
+      break;
+
+    case GCODE_TYPE_BOLT_HOLES:
+      gcode_visit_list (((gcode_bolt_holes_t *) block->pdata)->extrusion, visit, data, cache);
+      gcode_visit_list (((gcode_bolt_holes_t *) block->pdata)->arc_list, visit, data, 1);
+      break;
+
+    case GCODE_TYPE_DRILL_HOLES:
+      gcode_visit_list (((gcode_drill_holes_t *) block->pdata)->list, visit, data, cache);
+      break;
+
+    case GCODE_TYPE_STL:
+      {
+        gcode_stl_t *stl;
+
+        stl = (gcode_stl_t *) block->pdata;
+        for (i = 0; i < stl->alloc_slices; i++)
+          gcode_visit_list (stl->slice_list[i], visit, data, 1);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+static void
+gcode_visit_list (gcode_block_t *list, gcode_visit_t visit, void *data, uint8_t cache)
+{
+  gcode_block_t *block;
+
+  for (block = list; block; block = block->next)
+    gcode_visit_block (block, visit, data, cache);
+}
+
+
+/*
+* Bytes held by the type specific data of a block, not including any child blocks.
+*/
+static size_t
+gcode_block_pdata_size (gcode_block_t *block)
+{
+  switch (block->type)
+  {
+    case GCODE_TYPE_BEGIN:
+      return (sizeof (gcode_begin_t));
+
+    case GCODE_TYPE_END:
+      return (sizeof (gcode_end_t));
+
+    case GCODE_TYPE_TEMPLATE:
+      return (sizeof (gcode_template_t));
+
+    case GCODE_TYPE_TOOL:
+      return (sizeof (gcode_tool_t));
+
+    case GCODE_TYPE_EXTRUSION:
+      return (sizeof (gcode_extrusion_t));
+
+    case GCODE_TYPE_SKETCH:
+      return (sizeof (gcode_sketch_t));
+
+    case GCODE_TYPE_LINE:
+      return (sizeof (gcode_line_t));
+
+    case GCODE_TYPE_ARC:
+      return (sizeof (gcode_arc_t));
+
+    case GCODE_TYPE_IMAGE:
+      {
+        gcode_image_t *image;
+
+        image = (gcode_image_t *) block->pdata;
+        return (sizeof (gcode_image_t) + sizeof (gfloat_t) * image->res[0] * image->res[1]);
+      }
+
+    case GCODE_TYPE_BOLT_HOLES:
+      return (sizeof (gcode_bolt_holes_t));
+
+    case GCODE_TYPE_DRILL_HOLES:
+      return (sizeof (gcode_drill_holes_t));
+
+    case GCODE_TYPE_POINT:
+      return (sizeof (gcode_point_t));
+
+    case GCODE_TYPE_STL:
+      {
+        gcode_stl_t *stl;
+
+        stl = (gcode_stl_t *) block->pdata;
+        return (sizeof (gcode_stl_t) + sizeof (float) * 12 * stl->tri_num + sizeof (gcode_block_t *) * stl->alloc_slices);
+      }
+
+    default:
+      return (0);
+  }
+}
+
+
+static void
+gcode_memory_visit (gcode_block_t *block, void *data, uint8_t cache)
+{
+  gcode_memory_t *memory;
+  size_t size;
+
+  memory = (gcode_memory_t *) data;
+
+  size = sizeof (gcode_block_t) + gcode_block_pdata_size (block);
+  if (cache)
+  {
+    memory->cache += size + block->code_alloc;
+  }
+  else
+  {
+    memory->geometry += size;
+    memory->code += block->code_alloc;
+    memory->slack += block->code_alloc - block->code_len;
+  }
+}
+
+
+/*
+* Bytes used by a block and all of the blocks it owns.
+*/
+void
+gcode_block_memory (gcode_block_t *block, gcode_memory_t *memory)
+{
+  memset (memory, 0, sizeof (gcode_memory_t));
+  gcode_visit_block (block, gcode_memory_visit, memory, 0);
+}
+
+
+/*
+* Bytes used by the entire project including the simulation stock.
+*/
+void
+gcode_memory (gcode_t *gcode, gcode_memory_t *memory)
+{
+  int i;
+
+  memset (memory, 0, sizeof (gcode_memory_t));
+  gcode_visit_list (gcode->list, gcode_memory_visit, memory, 0);
+
+  if (gcode->voxel_map)
+    memory->stock = gcode->voxel_size;
+
+  for (i = 0; i < gcode->sim_snapshot_num; i++)
+    memory->cache += sizeof (gcode_sim_snapshot_t) + gcode->sim_snapshot[i].rle_len;
+}
+
+
+static void
+gcode_trim_visit (gcode_block_t *block, void *data, uint8_t cache)
+{
+  /* GCODE_APPEND reserves 64kB at a time, give back what was not used. */
+  if (block->code && block->code_alloc > block->code_len)
+  {
+    block->code = (char *) realloc (block->code, block->code_len);
+    block->code_alloc = block->code_len;
+  }
+}
+
+
+void
+gcode_block_trim (gcode_block_t *block)
+{
+  gcode_visit_block (block, gcode_trim_visit, NULL, 0);
+}
+
+
+void
+gcode_list_trim (gcode_block_t *list)
+{
+  gcode_visit_list (list, gcode_trim_visit, NULL, 0);
+}
+
+
 void
 gcode_init (gcode_t *gcode)
 {
@@ -259,12 +468,27 @@ gcode_init (gcode_t *gcode)
   gcode->material_origin[2] = 0.0;
 
   gcode->voxel_res = 0;
+  gcode->voxel_roi = 0;
+  GCODE_MATH_VEC3D_SET (gcode->voxel_min, 0.0, 0.0, 0.0);
+  GCODE_MATH_VEC3D_SET (gcode->voxel_span, 0.0, 0.0, 0.0);
+  gcode->voxel_layout = GCODE_VOXEL_LAYOUT_COLUMN;
+  gcode->voxel_size = 0;
   gcode->voxel_map = NULL;
+  gcode->voxel_fd = -1;
+  gcode->voxel_mapped = 0;
+  gcode->voxel_touched = 0;
+  gcode->voxel_resident = NULL;
+  gcode->voxel_dirty = NULL;
+
+  gcode->sim_snapshot = NULL;
+  gcode->sim_snapshot_num = 0;
+  strcpy (gcode->sim_cache, "");
 
   /* Depth at which to traverse along XY plane */
   gcode->ztraverse = 0.0;
 
   gcode->progress_callback = NULL;
+  gcode->preview_callback = NULL;
 
   strcpy (gcode->machine_name, "");
   gcode->machine_options = 0;
@@ -272,27 +496,37 @@ gcode_init (gcode_t *gcode)
   gcode->decimal = 5;
 
   gcode->project_number = 0;
+
+  gcode->feed_max = 0.0;
+
+  gcode->draw_tol = 0.0;
 }
 
 
 void
 gcode_prep (gcode_t *gcode)
 {
-  uint32_t size;
   gcode_vec3d_t portion;
   gfloat_t inv_den;
 
-  inv_den = 1.0 / (gcode->material_size[0] + gcode->material_size[1] + gcode->material_size[2]);
+  /* Without a region of interest the whole of the material is simulated */
+  if (!gcode->voxel_roi)
+  {
+    GCODE_MATH_VEC3D_SET (gcode->voxel_min, 0.0, 0.0, 0.0);
+    GCODE_MATH_VEC3D_COPY (gcode->voxel_span, gcode->material_size);
+  }
 
+  inv_den = 1.0 / (gcode->voxel_span[0] + gcode->voxel_span[1] + gcode->voxel_span[2]);
 
-  portion[0] = gcode->material_size[0] * inv_den;
-  portion[1] = gcode->material_size[1] * inv_den;
-  portion[2] = gcode->material_size[2] * inv_den;
+
+  portion[0] = gcode->voxel_span[0] * inv_den;
+  portion[1] = gcode->voxel_span[1] * inv_den;
+  portion[2] = gcode->voxel_span[2] * inv_den;
 
   /* Setup voxels */
-  gcode->voxel_num[0] = (uint16_t) (gcode->voxel_res * portion[0]);
-  gcode->voxel_num[1] = (uint16_t) (gcode->voxel_res * portion[1]);
-  gcode->voxel_num[2] = (uint16_t) (gcode->voxel_res * portion[2]);
+  gcode->voxel_num[0] = (uint32_t) (gcode->voxel_res * portion[0]);
+  gcode->voxel_num[1] = (uint32_t) (gcode->voxel_res * portion[1]);
+  gcode->voxel_num[2] = (uint32_t) (gcode->voxel_res * portion[2]);
 
   if (gcode->voxel_num[0] == 0)
     gcode->voxel_num[0] = 1;
@@ -301,10 +535,28 @@ gcode_prep (gcode_t *gcode)
   if (gcode->voxel_num[2] == 0)
     gcode->voxel_num[2] = 1;
 
-  size = gcode->voxel_num[0] * gcode->voxel_num[1] * gcode->voxel_num[2];
+  gcode->voxel_brick[0] = (gcode->voxel_num[0] + 7) >> 3;
+  gcode->voxel_brick[1] = (gcode->voxel_num[1] + 7) >> 3;
+  gcode->voxel_brick[2] = (gcode->voxel_num[2] + 7) >> 3;
+
+  /* Bricks are padded out to a multiple of 8 along each axis. */
+  if (gcode->voxel_layout == GCODE_VOXEL_LAYOUT_BRICK)
+  {
+    gcode->voxel_size = ((size_t) gcode->voxel_brick[0] * gcode->voxel_brick[1] * gcode->voxel_brick[2]) << 9;
+  }
+  else
+  {
+    gcode->voxel_size = (size_t) gcode->voxel_num[0] * gcode->voxel_num[1] * gcode->voxel_num[2];
+  }
+
+  /* Leave no stock at all rather than a partial one */
+  if (gcode_voxel_alloc (gcode))
+  {
+    gcode_voxel_free (gcode);
+    return;
+  }
 
-  gcode->voxel_map = (uint8_t *) realloc (gcode->voxel_map, size);
-  memset (gcode->voxel_map, 1, size);
+  gcode_voxel_fill (gcode, 1);
 }
 
 
@@ -312,7 +564,8 @@ void
 gcode_free (gcode_t *gcode)
 {
   gcode_list_free (&gcode->list);
-  free (gcode->voxel_map);
+  gcode_voxel_free (gcode);
+  gcode_sim_snapshot_free (gcode);
 }
 
 
@@ -759,6 +1012,9 @@ gcode_export (gcode_t *gcode, const char *filename)
   /* Make all */
   gcode_list_make (gcode);
 
+  if (gcode->feed_max > 0.0)
+    gcode_optimize_feed (gcode, gcode->feed_max);
+
   for (block = gcode->list; block; block = block->next)
   {
     if (size == 1)
@@ -771,213 +1027,617 @@ gcode_export (gcode_t *gcode, const char *filename)
 }
 
 
-void
-gcode_render_final (gcode_t *gcode, gfloat_t *time_elapsed)
+/*
+* Simulate a single line of g-code, the line is modified in the process.
+*/
+static void
+gcode_render_line (gcode_t *gcode, gcode_sim_t *sim, char *line, uint32_t *mode, gfloat_t *G83_depth, gfloat_t *G83_retract)
 {
-  char *source, line[256], *sp, *tsp, *gv;
-  gcode_block_t *block;
-  gcode_sim_t sim;
-  uint32_t size, line_num, line_ind, mode = 0;
-  gfloat_t G83_depth = 0.0, G83_retract = 0.0;
+  char *gv;
+  uint8_t sind;
 
-  /* Make all */
-  gcode_list_make (gcode);
+  sind = 0;
 
-  gcode_sim_init (gcode, &sim);
+  /*
+  * Parse the line
+  */
 
-  GCODE_MATH_VEC3D_SET (sim.vn_inv, 1.0 / (gfloat_t) gcode->voxel_num[0], 1.0 / (gfloat_t) gcode->voxel_num[1], 1.0 / (gfloat_t) gcode->voxel_num[2]);
+  /* Remove the spaces */
+  gcode_util_remove_spaces (line);
+
+  /* Scan for GCAM Variables of the form (GCAM:TOOL_DIAMETER:VALUE) */
+  gv = strstr (line, "GCAM:TOOL_DIAMETER:");
+  if (gv)
+  {
+    char string[256];
+    uint8_t len;
+
+    gv = strpbrk (line, ".0123456789");
+    len = strspn (gv, ".0123456789");
+    memset (string, 0, 256);
+    memcpy (string, gv, len);
+    sim->tool_diameter = atof (string);
+
+    /* Only shaped tools write their shape after it, a flat end mill writes none */
+    sim->tool_shape = GCODE_TOOL_SHAPE_FLAT;
+    sim->tool_angle = 90.0;
+    sim->tool_corner = 0.0;
+  }
 
-  /* Turn all the voxels back on */
-  size = gcode->voxel_num[0] * gcode->voxel_num[1] * gcode->voxel_num[2];
-  memset (gcode->voxel_map, 1, size);
+  /* Scan for GCAM Variables of the form (GCAM:TOOL_SHAPE:SHAPE:ANGLE:CORNER) */
+  gv = strstr (line, "GCAM:TOOL_SHAPE:");
+  if (gv)
+  {
+    int shape;
 
-  source = (char *) malloc (1);
-  source[0] = 0;
+    if (sscanf (gv + strlen ("GCAM:TOOL_SHAPE:"), "%d:%lf:%lf", &shape, &sim->tool_angle, &sim->tool_corner) == 3)
+      sim->tool_shape = (uint8_t) shape;
+  }
 
-  for (block = gcode->list; block; block = block->next)
+  /* Scan for GCAM Variables of the form (GCAM:ORIGIN:VALUE VALUE VALUE) */
+  gv = strstr (line, "GCAM:ORIGIN:");
+  if (gv)
   {
-    source = (char *) realloc (source, strlen (source) + strlen (block->code) + 1);
-    strcat (source, block->code);
+    char string[256];
+    uint8_t len;
+
+    gv = strpbrk (gv, ".0123456789");
+    len = strspn (gv, ".0123456789");
+    memset (string, 0, 256);
+    memcpy (string, gv, len);
+    sim->origin[0] = atof (string);
+    sim->pos[0] += sim->origin[0];
+
+    gv += len;
+    gv = strpbrk (gv, ".0123456789");
+    len = strspn (gv, ".0123456789");
+    memset (string, 0, 256);
+    memcpy (string, gv, len);
+    sim->origin[1] = atof (string);
+    sim->pos[1] += sim->origin[1];
+
+    gv += len;
+    gv = strpbrk (gv, ".0123456789");
+    len = strspn (gv, ".0123456789");
+    memset (string, 0, 256);
+    memcpy (string, gv, len);
+    sim->origin[2] = atof (string);
+    sim->pos[2] += sim->origin[2];
   }
 
-  /* Count the number of lines */
-  line_num = 0;
-  sp = source;
-  while ((tsp = strchr (sp, '\n')))
+  /* Strip comments */
+  gcode_util_remove_comment (line);
+
+/*    printf ("line: %s\n", line);*/
+  switch (line[sind])
   {
-    sp = tsp + 1;
-    line_num++;
+    case 'G':
+      {
+        uint8_t len;
+        char string[256];
+
+        sind++;
+
+        /* The Number */
+        len = strspn (&line[sind], "0123456789");
+        memset (string, 0, 256);
+        memcpy (string, &line[sind], len);
+        sind += len;
+/*          printf ("code: %s, %d\n", string, sind); */
+
+        switch (atoi (string))
+        {
+          case 0:
+            gcode_sim_G00 (gcode, sim, &line[sind]);
+            break;
+
+          case 1:
+            gcode_sim_G01 (gcode, sim, &line[sind]);
+            break;
+
+          case 2:
+            gcode_sim_G02 (gcode, sim, &line[sind]);
+            break;
+
+          case 3:
+            gcode_sim_G03 (gcode, sim, &line[sind]);
+            break;
+
+          case 4:
+            /* Dwell */
+            break;
+
+          case 20:
+            break;
+
+          case 21:
+            break;
+
+          case 81:
+          case 83:
+            gcode_sim_G83 (gcode, sim, &line[sind], G83_depth, G83_retract, 1);
+            *mode = 83;
+            break;
+
+          case 90:
+            sim->absolute = 1;
+            break;
+
+          case 91:
+            sim->absolute = 0;
+            break;
+
+          default:
+            break;
+        }
+      }
+      break;
+
+    case 'F':
+      {
+        char string[256];
+        uint8_t len;
+
+        sind++;
+
+        len = strspn (&line[sind], ".0123456789");
+        memset (string, 0, 256);
+        memcpy (string, &line[sind], len);
+        sim->feed = atof (string);
+      }
+      break;
+
+    case 'X':
+    case 'Y':
+      {
+        if (*mode == 83)
+        {
+          gcode_sim_G83 (gcode, sim, &line[sind], G83_depth, G83_retract, 0);
+        }
+      }
+      break;
+
+    default:
+      break;
   }
+}
+
+
+/*
+* Simulate the g-code of a single block, advancing *line_ind as each line is consumed.
+*/
+static void
+gcode_render_code (gcode_t *gcode, gcode_sim_t *sim, char *code, uint32_t *mode, gfloat_t *G83_depth, gfloat_t *G83_retract, uint32_t *line_ind, uint32_t line_num)
+{
+  char line[256], *sp, *tsp;
 
   /* Isolate each line */
-  line_ind = 0;
-  sp = source;
+  sp = code;
   while ((tsp = strchr (sp, '\n')))
   {
-    uint8_t sind;
-
     if (gcode->progress_callback)
-      gcode->progress_callback (gcode->gui, (gfloat_t) line_ind++ / (gfloat_t) line_num);
+      gcode->progress_callback (gcode->gui, (gfloat_t) (*line_ind)++ / (gfloat_t) line_num);
+
+    if (gcode->preview_callback)
+      gcode->preview_callback (gcode->gui);
 
     memset (line, 0, 256);
     memcpy (line, sp, tsp - sp);
     sp = tsp+1;
-    sind = 0;
 
-    /*
-    * Parse the line
-    */
+    gcode_render_line (gcode, sim, line, mode, G83_depth, G83_retract);
+  }
+}
+
+
+static uint64_t
+gcode_render_hash (uint64_t hash, const void *data, size_t len)
+{
+  const uint8_t *bytes;
+  size_t i;
+
+  /* 64 bit FNV-1a */
+  bytes = (const uint8_t *) data;
+  for (i = 0; i < len; i++)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
 
-    /* Remove the spaces */
-    gcode_util_remove_spaces (line);
+  return (hash);
+}
+
+
+/*
+* Hash the code the simulator acts on, adding how many bytes of it there
+* are to len.  Comments are left out, other than GCAM variables, so a new
+* creation date does not make the stock stale.
+*/
+static uint64_t
+gcode_render_hash_code (uint64_t hash, const char *code, uint64_t *len)
+{
+  const char *sp;
 
-    /* Scan for GCAM Variables of the form (GCAM:TOOL_DIAMETER:VALUE) */
-    gv = strstr (line, "GCAM:TOOL_DIAMETER:");
-    if (gv)
+  sp = code;
+  while (*sp)
+  {
+    if (*sp == '(' || *sp == ';')
     {
-      char string[256];
-      uint8_t len;
-
-      gv = strpbrk (line, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.tool_diameter = atof (string);
+      const char *cp;
+      char end;
+
+      for (cp = sp + 1; *cp == ' '; cp++);
+      if (strncmp (cp, "GCAM:", 5))
+      {
+        /* Parenthesized comments end at the parenthesis, the others at the end of the line */
+        end = *sp == '(' ? ')' : '\n';
+        while (*sp && *sp != '\n' && *sp != end)
+          sp++;
+        if (*sp == ')')
+          sp++;
+        continue;
+      }
     }
 
-    /* Scan for GCAM Variables of the form (GCAM:ORIGIN:VALUE VALUE VALUE) */
-    gv = strstr (line, "GCAM:ORIGIN:");
-    if (gv)
+    hash = (hash ^ (uint8_t) *sp) * 1099511628211ull;
+    sp++;
+    (*len)++;
+  }
+
+  return (hash);
+}
+
+
+void
+gcode_render_final (gcode_t *gcode, gfloat_t *time_elapsed)
+{
+  gcode_block_t *block;
+  gcode_sim_t sim;
+  gcode_sim_snapshot_t *snapshot, cached;
+  uint64_t *hash, *code_len;
+  uint32_t line_num, line_ind, mode = 0;
+  gfloat_t G83_depth = 0.0, G83_retract = 0.0;
+  char *sp, *tsp;
+  int i, num, resume;
+
+  /* Make all */
+  gcode_list_make (gcode);
+
+  num = 0;
+  for (block = gcode->list; block; block = block->next)
+    num++;
+
+  /*
+  * hash[i] identifies everything simulated before block i: the stock
+  * dimensions followed by the code of each preceding block in order.
+  * Comments are not simulated and are left out, above all the creation
+  * date the begin block writes on every make, or no snapshot would ever
+  * match the code it was taken from.
+  */
+  hash = (uint64_t *) malloc ((num + 1) * sizeof (uint64_t));
+  code_len = (uint64_t *) malloc ((num + 1) * sizeof (uint64_t));
+  hash[0] = gcode_render_hash (14695981039346656037ull, &gcode->voxel_res, sizeof (gcode->voxel_res));
+  hash[0] = gcode_render_hash (hash[0], gcode->voxel_num, sizeof (gcode->voxel_num));
+  hash[0] = gcode_render_hash (hash[0], &gcode->voxel_layout, sizeof (gcode->voxel_layout));
+  hash[0] = gcode_render_hash (hash[0], gcode->material_size, sizeof (gcode->material_size));
+  hash[0] = gcode_render_hash (hash[0], gcode->voxel_min, sizeof (gcode->voxel_min));
+  hash[0] = gcode_render_hash (hash[0], gcode->voxel_span, sizeof (gcode->voxel_span));
+  code_len[0] = 0;
+  for (i = 0, block = gcode->list; block; block = block->next, i++)
+  {
+    code_len[i+1] = code_len[i];
+    hash[i+1] = gcode_render_hash_code (hash[i], block->code, &code_len[i+1]);
+  }
+
+  /* Resume from the last snapshot that every block before it still agrees with */
+  resume = num < gcode->sim_snapshot_num - 1 ? num : gcode->sim_snapshot_num - 1;
+  while (resume > 0 && (gcode->sim_snapshot[resume].rle == NULL || gcode->sim_snapshot[resume].hash != hash[resume] || gcode->sim_snapshot[resume].code_len != code_len[resume]))
+    resume--;
+  if (resume < 0)
+    resume = 0;
+
+  /*
+  * If the stock cached by an earlier session was made from the same code
+  * with the same tools it is the final part as it stands.  Regions are not
+  * cached, they would only push out the whole part.
+  */
+  if (resume < num && gcode->sim_cache[0] && !gcode->voxel_roi && gcode_sim_cache_load (gcode, &cached, gcode->sim_cache, hash[num], code_len[num]) == 0)
+  {
+    gcode_sim_snapshot_free (gcode);
+    gcode->sim_snapshot = (gcode_sim_snapshot_t *) malloc ((num + 1) * sizeof (gcode_sim_snapshot_t));
+    for (i = 0; i < num; i++)
     {
-      char string[256];
-      uint8_t len;
-
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[0] = atof (string);
-      sim.pos[0] += sim.origin[0];
-
-      gv += len;
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[1] = atof (string);
-      sim.pos[1] += sim.origin[1];
-
-      gv += len;
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[2] = atof (string);
-      sim.pos[2] += sim.origin[2];
+      gcode->sim_snapshot[i].rle = NULL;
+      gcode->sim_snapshot[i].rle_len = 0;
     }
+    gcode->sim_snapshot[num] = cached;
+    gcode->sim_snapshot_num = num + 1;
+    resume = num;
+  }
 
-    /* Strip comments */
-    gcode_util_remove_comment (line);
+  gcode_sim_init (gcode, &sim);
 
-/*    printf ("line: %s\n", line);*/
-    switch (line[sind])
+  GCODE_MATH_VEC3D_SET (sim.vn_inv, 1.0 / (gfloat_t) gcode->voxel_num[0], 1.0 / (gfloat_t) gcode->voxel_num[1], 1.0 / (gfloat_t) gcode->voxel_num[2]);
+
+  if (resume > 0)
+  {
+    snapshot = &gcode->sim_snapshot[resume];
+    gcode_sim_snapshot_load (gcode, snapshot, &sim);
+    mode = snapshot->mode;
+    G83_depth = snapshot->G83_depth;
+    G83_retract = snapshot->G83_retract;
+  }
+  else
+  {
+    /* Turn all the voxels back on */
+    gcode_voxel_fill (gcode, 1);
+  }
+
+  /* Snapshots after the resume point are about to be replaced */
+  for (i = resume + 1; i < gcode->sim_snapshot_num; i++)
+    free (gcode->sim_snapshot[i].rle);
+  gcode->sim_snapshot = (gcode_sim_snapshot_t *) realloc (gcode->sim_snapshot, (num + 1) * sizeof (gcode_sim_snapshot_t));
+  for (i = resume > 0 ? resume + 1 : 0; i <= num; i++)
+  {
+    gcode->sim_snapshot[i].rle = NULL;
+    gcode->sim_snapshot[i].rle_len = 0;
+  }
+  gcode->sim_snapshot_num = num + 1;
+
+  /* Count the number of lines left to simulate */
+  line_num = 0;
+  for (i = 0, block = gcode->list; block; block = block->next, i++)
+  {
+    if (i < resume)
+      continue;
+
+    sp = block->code;
+    while ((tsp = strchr (sp, '\n')))
     {
-      case 'G':
-        {
-          uint8_t len;
-          char string[256];
+      sp = tsp + 1;
+      line_num++;
+    }
+  }
+
+  line_ind = 0;
+  for (i = 0, block = gcode->list; block; block = block->next, i++)
+  {
+    if (i < resume)
+      continue;
+
+    gcode_render_code (gcode, &sim, block->code, &mode, &G83_depth, &G83_retract, &line_ind, line_num);
+
+    snapshot = &gcode->sim_snapshot[i+1];
+    gcode_sim_snapshot_save (gcode, snapshot, &sim);
+    snapshot->hash = hash[i+1];
+    snapshot->code_len = code_len[i+1];
+    snapshot->mode = mode;
+    snapshot->G83_depth = G83_depth;
+    snapshot->G83_retract = G83_retract;
+  }
 
-          sind++;
+  free (hash);
+  free (code_len);
 
-          /* The Number */
-          len = strspn (&line[sind], "0123456789");
-          memset (string, 0, 256);
-          memcpy (string, &line[sind], len);
-          sind += len;
-/*          printf ("code: %s, %d\n", string, sind); */
+  /* Anything simulated just now is worth keeping for the next session */
+  if (gcode->sim_cache[0] && !gcode->voxel_roi && resume < num)
+    gcode_sim_cache_save (gcode, &gcode->sim_snapshot[num], gcode->sim_cache);
 
-          switch (atoi (string))
-          {
-            case 0:
-              gcode_sim_G00 (gcode, &sim, &line[sind]);
-              break;
+  /* Calculate elapsed time */
+  sim.time_elapsed = 60 * sim.time_elapsed / sim.feed;
+
+  *time_elapsed = sim.time_elapsed;
+  gcode_sim_free (&sim);
+}
 
-            case 1:
-              gcode_sim_G01 (gcode, &sim, &line[sind]);
-              break;
 
-            case 2:
-              gcode_sim_G02 (gcode, &sim, &line[sind]);
-              break;
+/*
+* Insert "F<feed>" ahead of any comment on a line of code.
+*/
+static void
+gcode_feed_append (gcode_block_t *block, char *line, gfloat_t feed)
+{
+  /* Lines are at most 255 characters, with room for a space and the terminator */
+  char string[257], *comment;
+  int len;
+
+  comment = strpbrk (line, "(;");
+  len = comment ? comment - line : strlen (line);
+
+  memcpy (string, line, len);
+  string[len] = 0;
+  if (len && string[len-1] != ' ')
+    strcat (string, " ");
+  GCODE_APPEND (block, string);
 
-            case 3:
-              gcode_sim_G03 (gcode, &sim, &line[sind]);
-              break;
+  sprintf (string, "F%.3f ", feed);
+  GCODE_APPEND (block, string);
+
+  if (comment)
+    GCODE_APPEND (block, comment);
+}
+
+
+/*
+* Replay the made program through the stock simulator, measuring the
+* largest cross section each feed move cuts, and rewrite the feed rates.
+* The programmed feed is kept for the heaviest cut of each tool, or for a
+* full width slot GCODE_SIM_FEED_SLOT diameters deep if that is lighter.
+* Other cuts are sped up or slowed down to keep the same rate of removal,
+* slowed to no less than GCODE_SIM_FEED_MIN of the programmed feed, and
+* moves through air run at feed_max.  Plunges and canned cycles always get
+* the programmed feed.  The stock is put back as it was once measured.
+*/
+int
+gcode_optimize_feed (gcode_t *gcode, gfloat_t feed_max)
+{
+  gcode_block_t *block;
+  gcode_sim_t sim;
+  gcode_sim_snapshot_t stock;
+  gcode_vec3d_t delta;
+  gfloat_t G83_depth = 0.0, G83_retract = 0.0, *area, *peak, *slot, programmed, emitted, feed, rated;
+  uint32_t mode = 0, line_num, line_ind;
+  int *tool, tool_num, code;
+  char line[256], parse[256], *sp, *tsp, *old_code;
+
+  if (gcode->voxel_map == NULL)
+    return (1);
 
-            case 4:
-              /* Dwell */
-              break;
+  line_num = 0;
+  for (block = gcode->list; block; block = block->next)
+    for (sp = block->code; (tsp = strchr (sp, '\n')); sp = tsp + 1)
+      line_num++;
 
-            case 20:
-              break;
+  area = (gfloat_t *) malloc ((line_num + 1) * sizeof (gfloat_t));
+  tool = (int *) malloc ((line_num + 1) * sizeof (int));
+  peak = NULL;
+  slot = NULL;
+  tool_num = 0;
 
-            case 21:
-              break;
+  gcode_sim_init (gcode, &sim);
+  GCODE_MATH_VEC3D_SET (sim.vn_inv, 1.0 / (gfloat_t) gcode->voxel_num[0], 1.0 / (gfloat_t) gcode->voxel_num[1], 1.0 / (gfloat_t) gcode->voxel_num[2]);
 
-            case 81:
-            case 83:
-              gcode_sim_G83 (gcode, &sim, &line[sind], &G83_depth, &G83_retract, 1);
-              mode = 83;
-              break;
+  /* Measure on fresh material, keeping whatever stock was rendered to put back after */
+  stock.rle = NULL;
+  gcode_sim_snapshot_save (gcode, &stock, &sim);
+  gcode_voxel_fill (gcode, 1);
+  sim.measure = 1;
 
-            case 90:
-              sim.absolute = 1;
-              break;
+  /* Measure every line, area is negative for lines that are not sped up */
+  line_ind = 0;
+  for (block = gcode->list; block; block = block->next)
+  {
+    for (sp = block->code; (tsp = strchr (sp, '\n')); sp = tsp + 1, line_ind++)
+    {
+      if (gcode->progress_callback)
+        gcode->progress_callback (gcode->gui, (gfloat_t) line_ind / (gfloat_t) line_num);
 
-            case 91:
-              sim.absolute = 0;
-              break;
+      memset (line, 0, 256);
+      memcpy (line, sp, tsp - sp < 255 ? tsp - sp : 255);
 
-            default:
-              break;
-          }
-        }
-        break;
+      if (strstr (line, "GCAM:TOOL_DIAMETER:") || tool_num == 0)
+      {
+        peak = (gfloat_t *) realloc (peak, (tool_num + 1) * sizeof (gfloat_t));
+        slot = (gfloat_t *) realloc (slot, (tool_num + 1) * sizeof (gfloat_t));
+        peak[tool_num] = 0.0;
+        slot[tool_num++] = 0.0;
+      }
+      tool[line_ind] = tool_num - 1;
 
-      case 'F':
-        {
-          char string[256];
-          uint8_t len;
+      strcpy (parse, line);
+      gcode_util_remove_spaces (parse);
+      gcode_util_remove_comment (parse);
+      code = parse[0] == 'G' ? atoi (&parse[1]) : -1;
 
-          sind++;
+      /* Feed moves carrying their own F are plunges */
+      if (code < 1 || code > 3 || strchr (parse, 'F'))
+      {
+        area[line_ind] = -1.0;
+        gcode_render_line (gcode, &sim, line, &mode, &G83_depth, &G83_retract);
+        continue;
+      }
 
-          len = strspn (&line[sind], ".0123456789");
-          memset (string, 0, 256);
-          memcpy (string, &line[sind], len);
-          sim.feed = atof (string);
+      GCODE_MATH_VEC3D_COPY (delta, sim.pos);
+      sim.measure_voxels = 0;
+      sim.measure_len = 0.0;
+      sim.measure_peak = 0.0;
+      sim.measure_window = 0.5 * sim.tool_diameter;
+
+      gcode_render_line (gcode, &sim, line, &mode, &G83_depth, &G83_retract);
+      gcode_sim_measure_close (gcode, &sim);
+
+      /* Moves to where the tool already is are left alone, Z only moves get the programmed feed */
+      GCODE_MATH_VEC3D_SUB (delta, delta, sim.pos);
+      if (code == 1 && delta[0]*delta[0] + delta[1]*delta[1] < GCODE_PRECISION*GCODE_PRECISION)
+      {
+        area[line_ind] = fabs (delta[2]) < GCODE_PRECISION ? -2.0 : -1.0;
+        continue;
+      }
+
+      area[line_ind] = sim.measure_peak;
+      if (sim.measure_peak > peak[tool_num - 1])
+        peak[tool_num - 1] = sim.measure_peak;
+      slot[tool_num - 1] = GCODE_SIM_FEED_SLOT * sim.tool_diameter * sim.tool_diameter;
+    }
+  }
+
+  gcode_sim_snapshot_load (gcode, &stock, &sim);
+  free (stock.rle);
+  gcode_sim_free (&sim);
+
+  /* Rewrite each block with an F word wherever the feed has to change */
+  programmed = emitted = 0.0;
+  line_ind = 0;
+  for (block = gcode->list; block; block = block->next)
+  {
+    old_code = block->code;
+    block->code = NULL;
+    GCODE_CLEAR (block);
+
+    for (sp = old_code; (tsp = strchr (sp, '\n')); sp = tsp + 1, line_ind++)
+    {
+      memset (line, 0, 256);
+      memcpy (line, sp, tsp - sp < 255 ? tsp - sp : 255);
+
+      strcpy (parse, line);
+      gcode_util_remove_spaces (parse);
+      gcode_util_remove_comment (parse);
+      code = parse[0] == 'G' ? atoi (&parse[1]) : -1;
+
+      if (parse[0] == 'F')
+      {
+        programmed = emitted = atof (&parse[1]);
+      }
+      else if (strchr (parse, 'F'))
+      {
+        emitted = atof (strchr (parse, 'F') + 1);
+      }
+      else if (area[line_ind] >= 0.0)
+      {
+        /* The cross section the programmed feed is meant for */
+        rated = peak[tool[line_ind]] < slot[tool[line_ind]] ? peak[tool[line_ind]] : slot[tool[line_ind]];
+
+        if (area[line_ind] <= GCODE_SIM_FEED_AIR * rated)
+        {
+          feed = feed_max;
         }
-        break;
+        else
+        {
+          feed = programmed * rated / area[line_ind];
+          if (feed > feed_max)
+            feed = feed_max;
+        }
+        if (feed < GCODE_SIM_FEED_MIN * programmed)
+          feed = GCODE_SIM_FEED_MIN * programmed;
 
-      case 'X':
-      case 'Y':
+        if (fabs (feed - emitted) > 0.0005)
         {
-          if (mode == 83)
-          {
-            gcode_sim_G83 (gcode, &sim, &line[sind], &G83_depth, &G83_retract, 0);
-          }
+          gcode_feed_append (block, line, feed);
+          GCODE_APPEND (block, "\n");
+          emitted = feed;
+          continue;
         }
-        break;
+      }
+      else if (area[line_ind] > -2.0 && ((code >= 1 && code <= 3) || code == 81 || code == 83 || parse[0] == 'X' || parse[0] == 'Y') && fabs (programmed - emitted) > 0.0005)
+      {
+        /* Any other feed move goes back to the programmed feed */
+        gcode_feed_append (block, line, programmed);
+        GCODE_APPEND (block, "\n");
+        emitted = programmed;
+        continue;
+      }
 
-      default:
-        break;
+      GCODE_APPEND (block, line);
+      GCODE_APPEND (block, "\n");
     }
+
+    free (old_code);
   }
 
-  free (source);
+  if (gcode->progress_callback)
+    gcode->progress_callback (gcode->gui, 1.0);
 
-  /* Calculate elapsed time */
-  sim.time_elapsed = 60 * sim.time_elapsed / sim.feed;
+  free (area);
+  free (tool);
+  free (peak);
+  free (slot);
 
-  *time_elapsed = sim.time_elapsed;
-  gcode_sim_free (&sim);
+  return (0);
 }
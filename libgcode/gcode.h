@@ -21,6 +21,15 @@
 
 #include "gcode_internal.h"
 
+typedef struct gcode_memory_s
+{
+  size_t geometry;	/* blocks and their parametric data */
+  size_t code;		/* generated g-code buffers */
+  size_t slack;		/* portion of code buffers not holding g-code */
+  size_t cache;		/* derived data, e.g. stl slices and stock snapshots */
+  size_t stock;		/* simulation voxels */
+} gcode_memory_t;
+
 void	gcode_list_insert (gcode_block_t **list, gcode_block_t *block);
 void	gcode_list_splice (gcode_block_t **list, gcode_block_t *block);
 void	gcode_list_remove (gcode_block_t *block);
@@ -28,16 +37,22 @@ void	gcode_list_move_prev (gcode_block_t *block);
 void	gcode_list_move_next (gcode_block_t *block);
 void	gcode_list_make (gcode_t *gcode);
 void	gcode_list_free (gcode_block_t **list);
+void	gcode_list_trim (gcode_block_t *list);
+
+void	gcode_block_trim (gcode_block_t *block);
+void	gcode_block_memory (gcode_block_t *block, gcode_memory_t *memory);
 
 void	gcode_init (gcode_t *gcode);
 void	gcode_prep (gcode_t *gcode);
 void	gcode_free (gcode_t *gcode);
+void	gcode_memory (gcode_t *gcode, gcode_memory_t *memory);
 
 int	gcode_save (gcode_t *gcode, const char *filename);
 int	gcode_load (gcode_t *gcode, const char *filename);
 int	gcode_export (gcode_t *gcode, const char *filename);
 
 void	gcode_render_final (gcode_t *gcode, gfloat_t *time_elapsed);
+int	gcode_optimize_feed (gcode_t *gcode, gfloat_t feed_max);
 
 #include "gcode_begin.h"
 #include "gcode_end.h"
@@ -63,6 +63,7 @@ gcode_arc_free (gcode_block_t **block)
 {
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -319,7 +320,7 @@ gcode_arc_draw (gcode_block_t *block, gcode_block_t *selected)
 {
 #if GCODE_USE_OPENGL
   gcode_arc_t *arc;
-  uint32_t i, sind;
+  uint32_t i, sind, tess;
   gcode_vec2d_t start_pos, xform_pos;
   gfloat_t arc_radius_offset, flip, xform_angle, coef, t;
 
@@ -342,7 +343,7 @@ gcode_arc_draw (gcode_block_t *block, gcode_block_t *selected)
   if (block != selected && arc_radius_offset == 0.0)
     return;
 
-/*  tess = (uint32_t) (fabs(arc->sweep / 360.0) * (gfloat_t) 32); */
+  tess = gcode_internal_tess (block->gcode, arc_radius_offset, arc->sweep, TESS);
 
   start_pos[0] = arc->radius * cos (xform_angle * GCODE_DEG2RAD);
   start_pos[1] = arc->radius * sin (xform_angle * GCODE_DEG2RAD);
@@ -355,13 +356,13 @@ gcode_arc_draw (gcode_block_t *block, gcode_block_t *selected)
       sind = 1;
 
   if (block->parent->type == GCODE_TYPE_SKETCH)
-    glLoadName ((GLuint) block->name); /* Set Name to block pointer value only if part of a sketch */
+    gcode_internal_draw_name (block->name); /* Set Name only if part of a sketch */
 
   glLineWidth (1);
   glBegin (GL_LINE_STRIP);
-  for (i = 0; i < TESS; i++)
+  for (i = 0; i < tess; i++)
   {
-    t = (gfloat_t) i / (gfloat_t) (TESS-1);
+    t = (gfloat_t) i / (gfloat_t) (tess-1);
 
     if (block == selected && block->parent->type == GCODE_TYPE_SKETCH) /* Because this could be used in bolt holes */
       coef = t;
@@ -46,6 +46,7 @@ gcode_begin_init (GCODE_INIT_PARAMETERS)
 void
 gcode_begin_free (gcode_block_t **block)
 {
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
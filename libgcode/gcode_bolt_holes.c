@@ -99,6 +99,7 @@ gcode_bolt_holes_free (gcode_block_t **block)
 
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -198,7 +199,7 @@ gcode_bolt_holes_make (gcode_block_t *block)
         gcode_extrusion_evaluate_offset (bolt_holes->extrusion, z, &bolt_holes->offset.eval);
 
         gcode_util_duplicate_list (child_block, child_block->next, &evaluated_offset_list);
-        gcode_util_push_offset (evaluated_offset_list);
+        gcode_util_push_offset (&evaluated_offset_list);
 
         /* Pocketing if mode is set */
         if (bolt_holes->pocket)
@@ -478,7 +479,7 @@ gcode_bolt_holes_draw (gcode_block_t *block, gcode_block_t *selected)
     /* Mill down to the specified depth */
     z = p0[1];
 
-    glLoadName ((GLuint) block->name);
+    gcode_internal_draw_name (block->name);
     while (z >= p1[1])
     {
       gcode_block_t *evaluated_offset_list;
@@ -486,7 +487,7 @@ gcode_bolt_holes_draw (gcode_block_t *block, gcode_block_t *selected)
       gcode_extrusion_evaluate_offset (bolt_holes->extrusion, z, &bolt_holes->offset.eval);
  
       gcode_util_duplicate_list (child_block, child_block->next, &evaluated_offset_list);
-      gcode_util_push_offset (evaluated_offset_list);
+      gcode_util_push_offset (&evaluated_offset_list);
 
       evaluated_offset_list->offset->z[0] = z;
       evaluated_offset_list->offset->z[1] = z;
@@ -618,7 +619,7 @@ gcode_bolt_holes_rebuild (gcode_block_t *block)
       gfloat_t angle;
 
       gcode_arc_init (block->gcode, &child_block, block);
-      child_block->name = (uint32_t) ((uint64_t) block - (uint64_t) block->gcode) >> 3; /* assign each arc a name ptr to bolt_holes */
+      child_block->name = block->name; /* assign each arc the name of bolt_holes */
 
       arc = (gcode_arc_t *) child_block->pdata;
 
@@ -653,7 +654,7 @@ gcode_bolt_holes_rebuild (gcode_block_t *block)
       for (j = 0; j < bolt_holes->num[1]; j++)
       {
         gcode_arc_init (block->gcode, &child_block, block);
-        child_block->name = (uint32_t) ((uint64_t) block - (uint64_t) block->gcode) >> 3; /* assign each arc a name ptr to bolt_holes */
+        child_block->name = block->name; /* assign each arc the name of bolt_holes */
 
         arc = (gcode_arc_t *) child_block->pdata;
 
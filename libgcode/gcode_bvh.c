@@ -0,0 +1,456 @@
+/*
+*  gcode_bvh.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_bvh.h"
+#include "gcode.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Bounding volume hierarchy over what the top-level blocks draw.  The
+* leaves are the lines and arcs of each sketch, looking through templates,
+* and any other block with an aabb, so a query can tell a sketch whose
+* outline surrounds the view from one that is really in it.  Boxes only
+* come from the aabb callbacks, which follow the offsets left by the last
+* make or draw, so sketch boxes are padded by the tool, the extrusion and
+* the taper.  A block with something that has no aabb is always visible.
+*/
+
+typedef struct gcode_bvh_item_s
+{
+  gcode_block_t *block;
+  gfloat_t min[3];
+  gfloat_t max[3];
+} gcode_bvh_item_t;
+
+typedef struct gcode_bvh_items_s
+{
+  int num;
+  int max;
+  gcode_bvh_item_t *item;
+} gcode_bvh_items_t;
+
+
+static gfloat_t
+gcode_bvh_sketch_pad (gcode_block_t *block)
+{
+  gcode_sketch_t *sketch;
+  gcode_extrusion_t *extrusion;
+  gcode_tool_t *tool;
+  gcode_block_t *child_block;
+  gcode_vec2d_t min, max;
+  gfloat_t pad, widest;
+
+  sketch = (gcode_sketch_t *) block->pdata;
+
+  tool = gcode_tool_find (block);
+  pad = tool ? tool->diam : 0.0;
+
+  pad += sqrt (sketch->taper_offset[0]*sketch->taper_offset[0] + sketch->taper_offset[1]*sketch->taper_offset[1]);
+
+  /* Widest offset of the extrusion profile, x is the offset and y the depth */
+  extrusion = (gcode_extrusion_t *) sketch->extrusion->pdata;
+  widest = 0.0;
+  for (child_block = extrusion->list; child_block; child_block = child_block->next)
+  {
+    if (!child_block->aabb || !child_block->offset)
+      continue;
+
+    child_block->aabb (child_block, min, max);
+    if (fabs (min[0]) > widest)
+      widest = fabs (min[0]);
+    if (fabs (max[0]) > widest)
+      widest = fabs (max[0]);
+  }
+
+  return (pad + widest);
+}
+
+
+static void
+gcode_bvh_add (gcode_bvh_items_t *items, gcode_block_t *block, gfloat_t pad)
+{
+  gcode_bvh_item_t *item;
+  gcode_vec2d_t min, max;
+
+  if (items->num == items->max)
+  {
+    items->max = items->max ? 2 * items->max : 64;
+    items->item = (gcode_bvh_item_t *) realloc (items->item, items->max * sizeof (gcode_bvh_item_t));
+  }
+
+  block->aabb (block, min, max);
+
+  item = &items->item[items->num++];
+  item->block = block;
+  item->min[0] = min[0] - pad;
+  item->min[1] = min[1] - pad;
+  item->max[0] = max[0] + pad;
+  item->max[1] = max[1] + pad;
+
+  /* Everything is drawn within the material depth above or below zero */
+  item->min[2] = -block->gcode->material_size[2];
+  item->max[2] = block->gcode->material_size[2];
+}
+
+
+/*
+* Append the boxes of what this block draws, returns 0 when some of it has
+* no box and can only be treated as visible everywhere.
+*/
+static int
+gcode_bvh_collect (gcode_block_t *block, gcode_bvh_items_t *items)
+{
+  gcode_block_t *child_block;
+  gfloat_t pad;
+  int bounded;
+
+  if (!block->draw)
+    return (1);
+
+  bounded = 1;
+  switch (block->type)
+  {
+    case GCODE_TYPE_SKETCH:
+      pad = gcode_bvh_sketch_pad (block);
+      for (child_block = ((gcode_sketch_t *) block->pdata)->list; child_block; child_block = child_block->next)
+      {
+        if (child_block->aabb && child_block->offset)
+        {
+          gcode_bvh_add (items, child_block, pad);
+        }
+        else
+        {
+          bounded = 0;
+        }
+      }
+      break;
+
+    case GCODE_TYPE_TEMPLATE:
+      for (child_block = ((gcode_template_t *) block->pdata)->list; child_block; child_block = child_block->next)
+        if (!gcode_bvh_collect (child_block, items))
+          bounded = 0;
+      break;
+
+    default:
+      if (block->aabb)
+      {
+        gcode_bvh_add (items, block, 0.0);
+      }
+      else
+      {
+        bounded = 0;
+      }
+      break;
+  }
+
+  return (bounded);
+}
+
+
+static void
+gcode_bvh_union (gcode_bvh_node_t *node, gfloat_t min[3], gfloat_t max[3])
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    if (min[i] < node->min[i])
+      node->min[i] = min[i];
+    if (max[i] > node->max[i])
+      node->max[i] = max[i];
+  }
+}
+
+
+/*
+* Split the leaves at the middle of their centers along the longest axis of
+* the centers, or in half when they all fall on one side.
+*/
+static int
+gcode_bvh_build_node (gcode_bvh_t *bvh, int *index, int num, int parent)
+{
+  gcode_bvh_node_t *node, *leaf_node;
+  gfloat_t cmin[3], cmax[3], c, mid;
+  int i, j, n, axis, tmp;
+
+  n = bvh->node_num++;
+  node = &bvh->node[n];
+  node->parent = parent;
+  node->child[0] = -1;
+  node->child[1] = -1;
+  node->leaf = -1;
+
+  if (num == 1)
+  {
+    leaf_node = &bvh->node[bvh->leaf[index[0]].node];
+    memcpy (node->min, leaf_node->min, sizeof (node->min));
+    memcpy (node->max, leaf_node->max, sizeof (node->max));
+    node->leaf = index[0];
+    bvh->leaf[index[0]].node = n;
+    return (n);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    leaf_node = &bvh->node[bvh->leaf[index[i]].node];
+    for (j = 0; j < 3; j++)
+    {
+      c = 0.5 * (leaf_node->min[j] + leaf_node->max[j]);
+      if (i == 0 || c < cmin[j])
+        cmin[j] = c;
+      if (i == 0 || c > cmax[j])
+        cmax[j] = c;
+    }
+  }
+
+  axis = 0;
+  for (j = 1; j < 3; j++)
+    if (cmax[j] - cmin[j] > cmax[axis] - cmin[axis])
+      axis = j;
+  mid = 0.5 * (cmin[axis] + cmax[axis]);
+
+  i = 0;
+  j = num - 1;
+  while (i <= j)
+  {
+    leaf_node = &bvh->node[bvh->leaf[index[i]].node];
+    if (0.5 * (leaf_node->min[axis] + leaf_node->max[axis]) < mid)
+    {
+      i++;
+    }
+    else
+    {
+      tmp = index[i];
+      index[i] = index[j];
+      index[j--] = tmp;
+    }
+  }
+  if (i == 0 || i == num)
+    i = num / 2;
+
+  /* Children are stored after their parent, so the node array may not move */
+  node->child[0] = gcode_bvh_build_node (bvh, index, i, n);
+  node->child[1] = gcode_bvh_build_node (bvh, &index[i], num - i, n);
+
+  node = &bvh->node[n];
+  memcpy (node->min, bvh->node[node->child[0]].min, sizeof (node->min));
+  memcpy (node->max, bvh->node[node->child[0]].max, sizeof (node->max));
+  gcode_bvh_union (node, bvh->node[node->child[1]].min, bvh->node[node->child[1]].max);
+
+  return (n);
+}
+
+
+void
+gcode_bvh_init (gcode_bvh_t *bvh)
+{
+  memset (bvh, 0, sizeof (gcode_bvh_t));
+}
+
+
+void
+gcode_bvh_free (gcode_bvh_t *bvh)
+{
+  free (bvh->node);
+  free (bvh->leaf);
+  free (bvh->top);
+  free (bvh->unbounded);
+  free (bvh->visible);
+  gcode_bvh_init (bvh);
+}
+
+
+void
+gcode_bvh_build (gcode_bvh_t *bvh, gcode_t *gcode)
+{
+  gcode_bvh_items_t items;
+  gcode_bvh_node_t *leaf_node;
+  gcode_block_t *block;
+  int i, top, *index;
+
+  gcode_bvh_free (bvh);
+
+  for (block = gcode->list; block; block = block->next)
+    bvh->top_num++;
+
+  bvh->top = (gcode_block_t **) malloc ((bvh->top_num + 1) * sizeof (gcode_block_t *));
+  bvh->unbounded = (uint8_t *) malloc (bvh->top_num + 1);
+  bvh->visible = (uint8_t *) malloc (bvh->top_num + 1);
+
+  /* Leaves of each top-level block are kept together and in list order */
+  items.num = 0;
+  items.max = 0;
+  items.item = NULL;
+  bvh->leaf = NULL;
+  for (top = 0, block = gcode->list; block; top++, block = block->next)
+  {
+    i = items.num;
+    bvh->top[top] = block;
+    bvh->unbounded[top] = !gcode_bvh_collect (block, &items);
+
+    bvh->leaf = (gcode_bvh_leaf_t *) realloc (bvh->leaf, (items.num + 1) * sizeof (gcode_bvh_leaf_t));
+    for (; i < items.num; i++)
+    {
+      bvh->leaf[i].block = items.item[i].block;
+      bvh->leaf[i].top = top;
+    }
+  }
+  bvh->leaf_num = items.num;
+
+  if (!bvh->leaf_num)
+  {
+    free (items.item);
+    return;
+  }
+
+  /*
+  * Leaf boxes are parked at the end of the node array and moved into place
+  * as the tree is built in front of them.
+  */
+  bvh->node = (gcode_bvh_node_t *) malloc ((3 * bvh->leaf_num) * sizeof (gcode_bvh_node_t));
+  index = (int *) malloc (bvh->leaf_num * sizeof (int));
+  for (i = 0; i < bvh->leaf_num; i++)
+  {
+    bvh->leaf[i].node = 2 * bvh->leaf_num + i;
+    leaf_node = &bvh->node[bvh->leaf[i].node];
+    memcpy (leaf_node->min, items.item[i].min, sizeof (leaf_node->min));
+    memcpy (leaf_node->max, items.item[i].max, sizeof (leaf_node->max));
+    index[i] = i;
+  }
+
+  bvh->node_num = 0;
+  gcode_bvh_build_node (bvh, index, bvh->leaf_num, -1);
+
+  free (index);
+  free (items.item);
+}
+
+
+/*
+* Take new boxes for what a top-level block draws after it was edited and
+* grow or shrink the boxes above them.  Returns 1 when the block now draws a
+* different number of things and the hierarchy has to be built again.
+*/
+int
+gcode_bvh_refit (gcode_bvh_t *bvh, gcode_block_t *block)
+{
+  gcode_bvh_items_t items;
+  gcode_bvh_node_t *node;
+  int i, n, top, first, bounded;
+
+  while (block->parent)
+    block = block->parent;
+
+  for (top = 0; top < bvh->top_num; top++)
+    if (bvh->top[top] == block)
+      break;
+
+  if (top == bvh->top_num)
+    return (1);
+
+  items.num = 0;
+  items.max = 0;
+  items.item = NULL;
+  bounded = gcode_bvh_collect (block, &items);
+  if (bounded == bvh->unbounded[top])
+  {
+    free (items.item);
+    return (1);
+  }
+
+  for (first = 0; first < bvh->leaf_num && bvh->leaf[first].top != top; first++);
+
+  for (i = 0; first + i < bvh->leaf_num && bvh->leaf[first + i].top == top; i++)
+    if (i >= items.num || bvh->leaf[first + i].block != items.item[i].block)
+      break;
+
+  if (i != items.num || (first + i < bvh->leaf_num && bvh->leaf[first + i].top == top))
+  {
+    free (items.item);
+    return (1);
+  }
+
+  for (i = 0; i < items.num; i++)
+  {
+    node = &bvh->node[bvh->leaf[first + i].node];
+    memcpy (node->min, items.item[i].min, sizeof (node->min));
+    memcpy (node->max, items.item[i].max, sizeof (node->max));
+
+    for (n = node->parent; n >= 0; n = bvh->node[n].parent)
+    {
+      node = &bvh->node[n];
+      memcpy (node->min, bvh->node[node->child[0]].min, sizeof (node->min));
+      memcpy (node->max, bvh->node[node->child[0]].max, sizeof (node->max));
+      gcode_bvh_union (node, bvh->node[node->child[1]].min, bvh->node[node->child[1]].max);
+    }
+  }
+
+  free (items.item);
+  return (0);
+}
+
+
+/*
+* Fill visible with the top-level blocks that have a leaf passing the test
+* or something without a box.
+*/
+void
+gcode_bvh_query (gcode_bvh_t *bvh, gcode_bvh_test_t *test, void *data)
+{
+  int stack[64], stack_num, n;
+  gcode_bvh_node_t *node;
+
+  memcpy (bvh->visible, bvh->unbounded, bvh->top_num);
+
+  if (!bvh->node_num)
+    return;
+
+  stack_num = 0;
+  stack[stack_num++] = 0;
+  while (stack_num)
+  {
+    n = stack[--stack_num];
+    node = &bvh->node[n];
+
+    if (node->leaf < 0 || !bvh->visible[bvh->leaf[node->leaf].top])
+      if (!test (node->min, node->max, data))
+        continue;
+
+    if (node->leaf >= 0)
+    {
+      bvh->visible[bvh->leaf[node->leaf].top] = 1;
+    }
+    else if (stack_num < 63)
+    {
+      stack[stack_num++] = node->child[0];
+      stack[stack_num++] = node->child[1];
+    }
+    else
+    {
+      /* Deeper than the stack, take everything below as visible */
+      int first, last;
+
+      for (first = n; bvh->node[first].leaf < 0; first = bvh->node[first].child[0]);
+      for (last = n; bvh->node[last].leaf < 0; last = bvh->node[last].child[1]);
+      for (; first <= last; first++)
+        if (bvh->node[first].leaf >= 0)
+          bvh->visible[bvh->leaf[bvh->node[first].leaf].top] = 1;
+    }
+  }
+}
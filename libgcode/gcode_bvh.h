@@ -0,0 +1,62 @@
+/*
+*  gcode_bvh.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_BVH_H
+#define _GCODE_BVH_H
+
+#include "gcode_internal.h"
+
+typedef struct gcode_bvh_node_s
+{
+  gfloat_t min[3];
+  gfloat_t max[3];
+  int parent;			/* -1 for the root */
+  int child[2];			/* -1 for a leaf */
+  int leaf;			/* index into leaf when a leaf node */
+} gcode_bvh_node_t;
+
+typedef struct gcode_bvh_leaf_s
+{
+  gcode_block_t *block;		/* block bounded, a top-level block or one of its children */
+  int top;			/* position of its top-level block in the list */
+  int node;
+} gcode_bvh_leaf_t;
+
+typedef struct gcode_bvh_s
+{
+  int node_num;
+  gcode_bvh_node_t *node;
+  int leaf_num;
+  gcode_bvh_leaf_t *leaf;
+
+  int top_num;			/* top-level blocks when built */
+  gcode_block_t **top;
+  uint8_t *unbounded;		/* per top-level block, set when part of it has no aabb */
+  uint8_t *visible;		/* per top-level block, filled by gcode_bvh_query */
+} gcode_bvh_t;
+
+/* Whether anything inside the box can be seen */
+typedef int gcode_bvh_test_t (gfloat_t min[3], gfloat_t max[3], void *data);
+
+void gcode_bvh_init (gcode_bvh_t *bvh);
+void gcode_bvh_free (gcode_bvh_t *bvh);
+void gcode_bvh_build (gcode_bvh_t *bvh, gcode_t *gcode);
+int gcode_bvh_refit (gcode_bvh_t *bvh, gcode_block_t *block);
+void gcode_bvh_query (gcode_bvh_t *bvh, gcode_bvh_test_t *test, void *data);
+
+#endif
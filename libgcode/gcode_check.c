@@ -0,0 +1,229 @@
+/*
+*  gcode_check.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode.h"
+#include "gcode_sketch.h"
+#include "gcode_extrusion.h"
+#include "gcode_template.h"
+#include "gcode_pocket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Samples pocketed in rings, relative to the source directory */
+static const char *check_sample[] = { "../samples/fish.gcam", "../samples/hub.gcam" };
+
+
+/*
+* Pocket the inside of every sketch in rings, templates included.
+*/
+static void
+check_rings (gcode_block_t *block)
+{
+  gcode_sketch_t *sketch;
+
+  for (; block; block = block->next)
+  {
+    if (block->type == GCODE_TYPE_SKETCH)
+    {
+      sketch = (gcode_sketch_t *) block->pdata;
+      sketch->pocket = 1;
+      sketch->pocket_style = GCODE_SKETCH_POCKET_RINGS;
+      ((gcode_extrusion_t *) sketch->extrusion->pdata)->cut_side = GCODE_EXTRUSION_INSIDE;
+    }
+    else if (block->type == GCODE_TYPE_TEMPLATE)
+    {
+      check_rings (((gcode_template_t *) block->pdata)->list);
+    }
+  }
+}
+
+
+/*
+* Code of every top-level block but the begin block, which is dated.
+*/
+static char *
+check_code (gcode_t *gcode)
+{
+  gcode_block_t *block;
+  size_t len;
+  char *code;
+
+  len = 1;
+  for (block = gcode->list; block; block = block->next)
+    if (block->code && block->type != GCODE_TYPE_BEGIN)
+      len += strlen (block->code);
+
+  code = (char *) malloc (len);
+  code[0] = 0;
+  for (block = gcode->list; block; block = block->next)
+    if (block->code && block->type != GCODE_TYPE_BEGIN)
+      strcat (code, block->code);
+
+  return (code);
+}
+
+
+/*
+* Making the same project twice must give the same code, anything left
+* over from the first make or read before it is set shows up here.
+*/
+static int
+check_make (const char *filename)
+{
+  gcode_t gcode;
+  char *code[2];
+  int i, line;
+
+  gcode_init (&gcode);
+  if (gcode_load (&gcode, filename))
+  {
+    fprintf (stderr, "%s: cannot load\n", filename);
+    return (1);
+  }
+
+  check_rings (gcode.list);
+
+  for (i = 0; i < 2; i++)
+  {
+    gcode_list_make (&gcode);
+    code[i] = check_code (&gcode);
+  }
+
+  for (i = 0, line = 1; code[0][i] && code[0][i] == code[1][i]; i++)
+    if (code[0][i] == '\n')
+      line++;
+
+  if (code[0][i] != code[1][i])
+    fprintf (stderr, "%s: ring pocketing differs between makes at line %d\n", filename, line);
+
+  i = code[0][i] != code[1][i];
+
+  free (code[0]);
+  free (code[1]);
+  gcode_free (&gcode);
+
+  return (i);
+}
+
+
+/*
+* Fill a pocket with rows of lines, each row ended by a pair of zeros.
+*/
+static void
+check_pocket (gcode_pocket_t *pocket, int row_num, const gfloat_t *line)
+{
+  int i, j;
+
+  gcode_pocket_init (pocket, 1.0);
+  pocket->row_num = row_num;
+  pocket->row_array = (gcode_pocket_row_t *) calloc (row_num, sizeof (gcode_pocket_row_t));
+
+  for (i = 0; i < row_num; i++)
+  {
+    for (j = 0; line[2*j] != 0.0 || line[2*j+1] != 0.0; j++);
+    pocket->row_array[i].line_num = j;
+    pocket->row_array[i].line_max = j;
+    pocket->row_array[i].line_array = (gcode_vec2d_t *) malloc ((j ? j : 1) * sizeof (gcode_vec2d_t));
+    for (j = 0; j < pocket->row_array[i].line_num; j++)
+    {
+      pocket->row_array[i].line_array[j][0] = line[2*j];
+      pocket->row_array[i].line_array[j][1] = line[2*j+1];
+    }
+    pocket->row_array[i].y = (gfloat_t) i;
+    line += 2 * (j + 1);
+  }
+}
+
+
+/*
+* Merge two rows of lines against one with each op and compare what is
+* left with what should be.  The second row of a has nothing to merge with.
+*/
+static int
+check_merge (void)
+{
+  static const gfloat_t a[] = { 0.5, 4, 6, 10, 11, 12, 0, 0,  3, 5, 0, 0 };
+  static const gfloat_t b[] = { 2, 7, 9, 11, 0, 0 };
+  static const gfloat_t result[3][14] = {
+    { 0.5, 12, 0, 0,  3, 5, 0, 0 },			/* GCODE_POCKET_UNION, lines that touch join up */
+    { 0.5, 2, 7, 9, 11, 12, 0, 0,  3, 5, 0, 0 },	/* GCODE_POCKET_SUBTRACT */
+    { 2, 4, 6, 7, 9, 10, 0, 0,  0, 0 } };		/* GCODE_POCKET_INTERSECT */
+  static const char *name[3] = { "union", "subtract", "intersect" };
+  gcode_pocket_t pocket_a, pocket_b, expect;
+  int op, i, j, same, fail;
+
+  fail = 0;
+  for (op = GCODE_POCKET_UNION; op <= GCODE_POCKET_INTERSECT; op++)
+  {
+    check_pocket (&pocket_a, 2, a);
+    check_pocket (&pocket_b, 1, b);
+    check_pocket (&expect, 2, result[op]);
+
+    gcode_pocket_merge (&pocket_a, &pocket_b, op);
+
+    for (i = 0; i < 2; i++)
+    {
+      same = pocket_a.row_array[i].line_num == expect.row_array[i].line_num;
+      for (j = 0; same && j < expect.row_array[i].line_num; j++)
+        same = fabs (pocket_a.row_array[i].line_array[j][0] - expect.row_array[i].line_array[j][0]) < GCODE_PRECISION &&
+               fabs (pocket_a.row_array[i].line_array[j][1] - expect.row_array[i].line_array[j][1]) < GCODE_PRECISION;
+
+      if (!same)
+      {
+        fprintf (stderr, "pocket %s: row %d differs\n", name[op], i);
+        fail = 1;
+      }
+    }
+
+    if (pocket_a.seg_num != expect.row_array[0].line_num + expect.row_array[1].line_num)
+    {
+      fprintf (stderr, "pocket %s: %d lines counted\n", name[op], pocket_a.seg_num);
+      fail = 1;
+    }
+
+    gcode_pocket_free (&pocket_a);
+    gcode_pocket_free (&pocket_b);
+    gcode_pocket_free (&expect);
+  }
+
+  return (fail);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char filename[256];
+  int i, fail;
+
+  srcdir = getenv ("srcdir");
+  if (!srcdir)
+    srcdir = ".";
+
+  fail = check_merge ();
+  for (i = 0; i < (int) (sizeof (check_sample) / sizeof (check_sample[0])); i++)
+  {
+    snprintf (filename, 256, "%s/%s", srcdir, check_sample[i]);
+    fail |= check_make (filename);
+  }
+
+  return (fail);
+}
@@ -39,6 +39,7 @@ gcode_code_init (GCODE_INIT_PARAMETERS)
 void
 gcode_code_free (gcode_block_t **block)
 {
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
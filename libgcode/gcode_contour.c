@@ -0,0 +1,1443 @@
+/*
+*  gcode_contour.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_contour.h"
+#include "gcode.h"
+#include "gcode_arc.h"
+#include "gcode_line.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* Offsets of closed contours made of lines and arcs.  Each segment is
+* pushed to the side by the distance, arcs by changing their radius, and
+* the gaps opened at convex corners are closed by arcs about the corner.
+* Wherever the contour comes closer to itself than the distance, anywhere
+* along it, the pushed curve crosses itself, so every pair of segments
+* with overlapping boxes is intersected while sweeping the boxes along x.
+* The curve is split at the crossings and a piece is kept only when its
+* middle is no closer than the distance to the contour, which a hierarchy
+* over runs of the contour answers.  Kept pieces are joined end to end into
+* loops.  All of it is O(n log n) in the segments plus the crossings.
+*
+* A positive distance is to the right of the direction of travel.
+*/
+
+/*
+* Kept pieces are the distance away up to rounding, while those cut off at
+* a shallow corner dip in by as little as the distance times the square of
+* the angle, so pieces are cut and measured much finer than ends are joined.
+*/
+#define GCODE_CONTOUR_NEAR	(0.01 * GCODE_PRECISION)
+#define GCODE_CONTOUR_DEPTH	6	/* times a pushed segment may be halved */
+
+typedef struct gcode_contour_key_s
+{
+  gfloat_t x;
+  int index;
+} gcode_contour_key_t;
+
+/* Bounds of a run of consecutive segments */
+typedef struct gcode_contour_node_s
+{
+  gfloat_t min[2];
+  gfloat_t max[2];
+  gcode_vec2d_t p0;		/* chord from the start of the run to its end */
+  gcode_vec2d_t p1;
+  gfloat_t thick;		/* farthest the run strays from the chord */
+  int child[2];			/* -1 for a leaf */
+  int seg;			/* segment of a leaf */
+} gcode_contour_node_t;
+
+typedef struct gcode_contour_tree_s
+{
+  int node_num;
+  gcode_contour_node_t *node;
+} gcode_contour_tree_t;
+
+typedef struct gcode_contour_split_s
+{
+  int seg;
+  gfloat_t t;
+} gcode_contour_split_t;
+
+typedef struct gcode_contour_splits_s
+{
+  int num;
+  int max;
+  gcode_contour_split_t *split;
+} gcode_contour_splits_t;
+
+
+void
+gcode_contour_init (gcode_contour_t *contour)
+{
+  contour->seg_num = 0;
+  contour->seg_max = 0;
+  contour->seg = NULL;
+}
+
+
+void
+gcode_contour_free (gcode_contour_t *contour)
+{
+  free (contour->seg);
+  gcode_contour_init (contour);
+}
+
+
+static gcode_contour_seg_t *
+gcode_contour_add (gcode_contour_t *contour)
+{
+  if (contour->seg_num == contour->seg_max)
+  {
+    contour->seg_max = contour->seg_max ? 2 * contour->seg_max : 16;
+    contour->seg = (gcode_contour_seg_t *) realloc (contour->seg, contour->seg_max * sizeof (gcode_contour_seg_t));
+  }
+
+  return (&contour->seg[contour->seg_num++]);
+}
+
+
+void
+gcode_contour_add_line (gcode_contour_t *contour, gcode_vec2d_t p0, gcode_vec2d_t p1, gcode_block_t *block)
+{
+  gcode_contour_seg_t *seg;
+
+  seg = gcode_contour_add (contour);
+  seg->type = GCODE_CONTOUR_LINE;
+  seg->p0[0] = p0[0];
+  seg->p0[1] = p0[1];
+  seg->p1[0] = p1[0];
+  seg->p1[1] = p1[1];
+  seg->block = block;
+}
+
+
+void
+gcode_contour_add_arc (gcode_contour_t *contour, gcode_vec2d_t center, gfloat_t radius, gfloat_t angle, gfloat_t sweep, gcode_block_t *block)
+{
+  gcode_contour_seg_t *seg;
+
+  seg = gcode_contour_add (contour);
+  seg->type = GCODE_CONTOUR_ARC;
+  seg->center[0] = center[0];
+  seg->center[1] = center[1];
+  seg->radius = radius;
+  seg->angle = angle;
+  seg->sweep = sweep;
+  seg->p0[0] = center[0] + radius * cos (angle);
+  seg->p0[1] = center[1] + radius * sin (angle);
+  seg->p1[0] = center[0] + radius * cos (angle + sweep);
+  seg->p1[1] = center[1] + radius * sin (angle + sweep);
+  seg->block = block;
+}
+
+
+static gfloat_t
+gcode_contour_seg_length (gcode_contour_seg_t *seg)
+{
+  if (seg->type == GCODE_CONTOUR_ARC)
+    return (seg->radius * fabs (seg->sweep));
+
+  return (sqrt ((seg->p1[0]-seg->p0[0])*(seg->p1[0]-seg->p0[0]) + (seg->p1[1]-seg->p0[1])*(seg->p1[1]-seg->p0[1])));
+}
+
+
+/* Unit direction of travel at t along the segment */
+static void
+gcode_contour_seg_tangent (gcode_contour_seg_t *seg, gfloat_t t, gcode_vec2d_t tangent)
+{
+  gfloat_t angle, dir;
+
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    angle = seg->angle + t * seg->sweep;
+    dir = seg->sweep < 0.0 ? -1.0 : 1.0;
+    tangent[0] = -dir * sin (angle);
+    tangent[1] = dir * cos (angle);
+  }
+  else
+  {
+    GCODE_MATH_VEC2D_SUB (tangent, seg->p1, seg->p0);
+    GCODE_MATH_VEC2D_UNITIZE (tangent);
+  }
+}
+
+
+static void
+gcode_contour_seg_point (gcode_contour_seg_t *seg, gfloat_t t, gcode_vec2d_t p)
+{
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    p[0] = seg->center[0] + seg->radius * cos (seg->angle + t * seg->sweep);
+    p[1] = seg->center[1] + seg->radius * sin (seg->angle + t * seg->sweep);
+  }
+  else
+  {
+    p[0] = seg->p0[0] + t * (seg->p1[0] - seg->p0[0]);
+    p[1] = seg->p0[1] + t * (seg->p1[1] - seg->p0[1]);
+  }
+}
+
+
+/* The part of seg from t0 to t1 */
+static void
+gcode_contour_seg_part (gcode_contour_seg_t *seg, gfloat_t t0, gfloat_t t1, gcode_contour_seg_t *part)
+{
+  *part = *seg;
+
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    part->angle = seg->angle + t0 * seg->sweep;
+    part->sweep = (t1 - t0) * seg->sweep;
+  }
+
+  gcode_contour_seg_point (seg, t0, part->p0);
+  gcode_contour_seg_point (seg, t1, part->p1);
+}
+
+
+static void
+gcode_contour_seg_box (gcode_contour_seg_t *seg, gfloat_t min[2], gfloat_t max[2])
+{
+  int i, j;
+
+  for (j = 0; j < 2; j++)
+  {
+    min[j] = seg->p0[j] < seg->p1[j] ? seg->p0[j] : seg->p1[j];
+    max[j] = seg->p0[j] > seg->p1[j] ? seg->p0[j] : seg->p1[j];
+  }
+
+  if (seg->type != GCODE_CONTOUR_ARC)
+    return;
+
+  /* Take in each of the four extremes of the circle the arc passes through */
+  for (i = 0; i < 4; i++)
+  {
+    gfloat_t delta;
+
+    delta = fmod (i * GCODE_HPI - seg->angle, GCODE_2PI);
+    if (seg->sweep < 0.0)
+    {
+      if (delta > 0.0)
+        delta -= GCODE_2PI;
+    }
+    else if (delta < 0.0)
+    {
+      delta += GCODE_2PI;
+    }
+
+    if (delta / seg->sweep > 1.0)
+      continue;
+
+    j = i & 1;
+    if (i < 2)
+      max[j] = seg->center[j] + seg->radius;
+    else
+      min[j] = seg->center[j] - seg->radius;
+  }
+}
+
+
+/*
+* Where q falls along the segment, 0 at p0 and 1 at p1.  Returns 0 when
+* the point is beyond either end by more than the tolerance.
+*/
+static int
+gcode_contour_seg_param (gcode_contour_seg_t *seg, gcode_vec2d_t q, gfloat_t *t)
+{
+  gfloat_t e, delta, wrap;
+
+  e = GCODE_CONTOUR_TOL / gcode_contour_seg_length (seg);
+
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    delta = fmod (atan2 (q[1] - seg->center[1], q[0] - seg->center[0]) - seg->angle, GCODE_2PI);
+    if (seg->sweep < 0.0)
+    {
+      if (delta > 0.0)
+        delta -= GCODE_2PI;
+      wrap = GCODE_2PI;
+    }
+    else
+    {
+      if (delta < 0.0)
+        delta += GCODE_2PI;
+      wrap = -GCODE_2PI;
+    }
+
+    *t = delta / seg->sweep;
+
+    /* Just before the start comes out a full turn later */
+    if (*t > 1.0 + e && (delta + wrap) / seg->sweep > -e)
+      *t = (delta + wrap) / seg->sweep;
+  }
+  else
+  {
+    gcode_vec2d_t d, v;
+
+    GCODE_MATH_VEC2D_SUB (d, seg->p1, seg->p0);
+    GCODE_MATH_VEC2D_SUB (v, q, seg->p0);
+    *t = (v[0]*d[0] + v[1]*d[1]) / (d[0]*d[0] + d[1]*d[1]);
+  }
+
+  return (*t >= -e && *t <= 1.0 + e);
+}
+
+
+static gfloat_t
+gcode_contour_seg_distance (gcode_contour_seg_t *seg, gcode_vec2d_t q)
+{
+  gcode_vec2d_t p;
+  gfloat_t t, d0, d1;
+
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    if (gcode_contour_seg_param (seg, q, &t) && t >= 0.0 && t <= 1.0)
+      return (fabs (sqrt ((q[0]-seg->center[0])*(q[0]-seg->center[0]) + (q[1]-seg->center[1])*(q[1]-seg->center[1])) - seg->radius));
+
+    d0 = sqrt ((q[0]-seg->p0[0])*(q[0]-seg->p0[0]) + (q[1]-seg->p0[1])*(q[1]-seg->p0[1]));
+    d1 = sqrt ((q[0]-seg->p1[0])*(q[0]-seg->p1[0]) + (q[1]-seg->p1[1])*(q[1]-seg->p1[1]));
+    return (d0 < d1 ? d0 : d1);
+  }
+
+  gcode_contour_seg_param (seg, q, &t);
+  if (t < 0.0)
+    t = 0.0;
+  if (t > 1.0)
+    t = 1.0;
+  gcode_contour_seg_point (seg, t, p);
+
+  return (sqrt ((q[0]-p[0])*(q[0]-p[0]) + (q[1]-p[1])*(q[1]-p[1])));
+}
+
+
+/*
+* Fill ta and tb with where a and b cross along each, returning how many
+* times they do.  Overlapping lines and concentric arcs count as missing.
+*/
+static int
+gcode_contour_intersect (gcode_contour_seg_t *a, gcode_contour_seg_t *b, gfloat_t ta[2], gfloat_t tb[2])
+{
+  gcode_vec2d_t ip_array[2];
+  int i, ip_num, num;
+
+  if (a->type == GCODE_CONTOUR_ARC && b->type != GCODE_CONTOUR_ARC)
+    return (gcode_contour_intersect (b, a, tb, ta));
+
+  ip_num = 0;
+
+  if (b->type != GCODE_CONTOUR_ARC)
+  {
+    gcode_vec2d_t r, s, v;
+    gfloat_t den, t, u, ea, eb;
+
+    GCODE_MATH_VEC2D_SUB (r, a->p1, a->p0);
+    GCODE_MATH_VEC2D_SUB (s, b->p1, b->p0);
+    GCODE_MATH_VEC2D_SUB (v, b->p0, a->p0);
+
+    den = r[0]*s[1] - r[1]*s[0];
+    if (fabs (den) < 1e-12 * (fabs (r[0]) + fabs (r[1])) * (fabs (s[0]) + fabs (s[1])))
+      return (0);
+
+    t = (v[0]*s[1] - v[1]*s[0]) / den;
+    u = (v[0]*r[1] - v[1]*r[0]) / den;
+    ea = GCODE_CONTOUR_TOL / gcode_contour_seg_length (a);
+    eb = GCODE_CONTOUR_TOL / gcode_contour_seg_length (b);
+
+    if (t < -ea || t > 1.0 + ea || u < -eb || u > 1.0 + eb)
+      return (0);
+
+    ta[0] = t;
+    tb[0] = u;
+    return (1);
+  }
+
+  if (a->type != GCODE_CONTOUR_ARC)
+  {
+    gcode_vec2d_t r, v;
+    gfloat_t qa, qb, qc, disc, t;
+
+    /* Solve |p0 + t*r - center| = radius */
+    GCODE_MATH_VEC2D_SUB (r, a->p1, a->p0);
+    GCODE_MATH_VEC2D_SUB (v, a->p0, b->center);
+    qa = r[0]*r[0] + r[1]*r[1];
+    qb = 2.0 * (r[0]*v[0] + r[1]*v[1]);
+    qc = v[0]*v[0] + v[1]*v[1] - b->radius*b->radius;
+
+    disc = qb*qb - 4.0*qa*qc;
+    if (disc < 0.0)
+      return (0);
+    disc = sqrt (disc);
+
+    for (i = 0; i < (disc > 0.0 ? 2 : 1); i++)
+    {
+      t = (-qb + (i ? disc : -disc)) / (2.0 * qa);
+      gcode_contour_seg_point (a, t, ip_array[ip_num]);
+      ip_num++;
+    }
+  }
+  else
+  {
+    gcode_vec2d_t d;
+    gfloat_t dist, l, h;
+
+    /* Circle-Circle, along the line between the centers and across it */
+    GCODE_MATH_VEC2D_SUB (d, b->center, a->center);
+    GCODE_MATH_VEC2D_MAG (dist, d);
+
+    if (dist < GCODE_PRECISION)
+      return (0);
+    if (dist > a->radius + b->radius || dist < fabs (a->radius - b->radius))
+      return (0);
+
+    l = (a->radius*a->radius - b->radius*b->radius + dist*dist) / (2.0 * dist);
+    h = a->radius*a->radius - l*l;
+    h = h > 0.0 ? sqrt (h) : 0.0;
+
+    for (i = 0; i < (h > 0.0 ? 2 : 1); i++)
+    {
+      ip_array[ip_num][0] = a->center[0] + (d[0]*l + (i ? d[1] : -d[1])*h) / dist;
+      ip_array[ip_num][1] = a->center[1] + (d[1]*l + (i ? -d[0] : d[0])*h) / dist;
+      ip_num++;
+    }
+  }
+
+  num = 0;
+  for (i = 0; i < ip_num; i++)
+    if (gcode_contour_seg_param (a, ip_array[i], &ta[num]) && gcode_contour_seg_param (b, ip_array[i], &tb[num]))
+      num++;
+
+  return (num);
+}
+
+
+static int
+gcode_contour_key_compare (const void *a, const void *b)
+{
+  gfloat_t x, y;
+
+  x = ((gcode_contour_key_t *) a)->x;
+  y = ((gcode_contour_key_t *) b)->x;
+
+  return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+
+static int
+gcode_contour_split_compare (const void *a, const void *b)
+{
+  gcode_contour_split_t *x, *y;
+
+  x = (gcode_contour_split_t *) a;
+  y = (gcode_contour_split_t *) b;
+
+  if (x->seg != y->seg)
+    return (x->seg < y->seg ? -1 : 1);
+
+  return (x->t < y->t ? -1 : x->t > y->t ? 1 : 0);
+}
+
+
+/* Distance from q to the chord from p0 to p1 */
+static gfloat_t
+gcode_contour_chord_distance (gcode_vec2d_t p0, gcode_vec2d_t p1, gcode_vec2d_t q)
+{
+  gcode_vec2d_t v, w;
+  gfloat_t t, len2;
+
+  GCODE_MATH_VEC2D_SUB (v, p1, p0);
+  GCODE_MATH_VEC2D_SUB (w, q, p0);
+  len2 = v[0]*v[0] + v[1]*v[1];
+
+  t = len2 > 0.0 ? (w[0]*v[0] + w[1]*v[1]) / len2 : 0.0;
+  t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+
+  return (sqrt ((w[0] - t*v[0]) * (w[0] - t*v[0]) + (w[1] - t*v[1]) * (w[1] - t*v[1])));
+}
+
+
+/*
+* Split the segments from first up to last in half by their order along
+* the contour.  Runs of consecutive segments hug their chord, so a point
+* on the offset, the distance from many segments almost alike, is cut off
+* from most of them by the chord long before their boxes would.
+*/
+static int
+gcode_contour_tree_build (gcode_contour_tree_t *tree, gcode_contour_t *contour, int first, int last)
+{
+  gcode_contour_node_t *node, *child;
+  gfloat_t d0, d1;
+  int i, j, n;
+
+  n = tree->node_num++;
+  node = &tree->node[n];
+
+  if (first == last)
+  {
+    gcode_contour_seg_t *seg;
+
+    seg = &contour->seg[first];
+    gcode_contour_seg_box (seg, node->min, node->max);
+    node->child[0] = -1;
+    node->child[1] = -1;
+    node->seg = first;
+
+    node->thick = 0.0;
+    if (seg->type == GCODE_CONTOUR_ARC)
+      node->thick = fabs (seg->sweep) < GCODE_PI ? seg->radius * (1.0 - cos (0.5 * seg->sweep)) : 2.0 * seg->radius;
+  }
+  else
+  {
+    node->child[0] = gcode_contour_tree_build (tree, contour, first, (first + last) / 2);
+    node->child[1] = gcode_contour_tree_build (tree, contour, (first + last) / 2 + 1, last);
+
+    node = &tree->node[n];
+    node->seg = -1;
+    node->thick = 0.0;
+    for (j = 0; j < 2; j++)
+    {
+      node->min[j] = tree->node[node->child[0]].min[j];
+      node->max[j] = tree->node[node->child[0]].max[j];
+      if (tree->node[node->child[1]].min[j] < node->min[j])
+        node->min[j] = tree->node[node->child[1]].min[j];
+      if (tree->node[node->child[1]].max[j] > node->max[j])
+        node->max[j] = tree->node[node->child[1]].max[j];
+    }
+  }
+
+  node->p0[0] = contour->seg[first].p0[0];
+  node->p0[1] = contour->seg[first].p0[1];
+  node->p1[0] = contour->seg[last].p1[0];
+  node->p1[1] = contour->seg[last].p1[1];
+
+  /* Every point of a child is within its thickness of its chord, which is nearest the chord here at an end */
+  for (i = 0; i < 2 && node->child[0] >= 0; i++)
+  {
+    child = &tree->node[node->child[i]];
+    d0 = gcode_contour_chord_distance (node->p0, node->p1, child->p0);
+    d1 = gcode_contour_chord_distance (node->p0, node->p1, child->p1);
+    if (child->thick + (d0 > d1 ? d0 : d1) > node->thick)
+      node->thick = child->thick + (d0 > d1 ? d0 : d1);
+  }
+
+  return (n);
+}
+
+
+/* Least distance from q to anything under node n */
+static gfloat_t
+gcode_contour_tree_bound (gcode_contour_node_t *node, gcode_vec2d_t q)
+{
+  gfloat_t dx, dy, box, chord;
+
+  dx = q[0] < node->min[0] ? node->min[0] - q[0] : q[0] > node->max[0] ? q[0] - node->max[0] : 0.0;
+  dy = q[1] < node->min[1] ? node->min[1] - q[1] : q[1] > node->max[1] ? q[1] - node->max[1] : 0.0;
+  box = sqrt (dx*dx + dy*dy);
+  chord = gcode_contour_chord_distance (node->p0, node->p1, q) - node->thick;
+
+  return (box > chord ? box : chord);
+}
+
+
+/* Distance from q to the nearest segment under node n, or best when none is nearer */
+static gfloat_t
+gcode_contour_tree_distance (gcode_contour_tree_t *tree, int n, gcode_contour_t *contour, gcode_vec2d_t q, gfloat_t best)
+{
+  gcode_contour_node_t *node;
+  gfloat_t dist, bound[2];
+  int near;
+
+  node = &tree->node[n];
+  if (node->child[0] < 0)
+  {
+    dist = gcode_contour_seg_distance (&contour->seg[node->seg], q);
+    return (dist < best ? dist : best);
+  }
+
+  /* The nearer child first, to shrink best sooner */
+  bound[0] = gcode_contour_tree_bound (&tree->node[node->child[0]], q);
+  bound[1] = gcode_contour_tree_bound (&tree->node[node->child[1]], q);
+  near = bound[1] < bound[0] ? 1 : 0;
+
+  if (bound[near] < best)
+    best = gcode_contour_tree_distance (tree, node->child[near], contour, q, best);
+  if (bound[1-near] < best)
+    best = gcode_contour_tree_distance (tree, node->child[1-near], contour, q, best);
+
+  return (best);
+}
+
+
+/*
+* Nearness to the contour changes no faster than moving along a segment,
+* so a pushed segment whose middle is nearer than the distance less half
+* its length is cut off all along.  Segments cut off in the middle but not
+* that deep are halved a few times to find out more.  Only what is left
+* goes on to kept, so few crossings remain to be found even where the
+* contour is much finer than the distance.
+*/
+static void
+gcode_contour_trim (gcode_contour_tree_t *tree, gcode_contour_t *contour, gfloat_t distance, gcode_contour_seg_t *seg, int depth, gcode_contour_t *kept)
+{
+  gcode_contour_seg_t half;
+  gcode_vec2d_t mid;
+  gfloat_t length, dist;
+
+  length = gcode_contour_seg_length (seg);
+  gcode_contour_seg_point (seg, 0.5, mid);
+  dist = gcode_contour_tree_distance (tree, 0, contour, mid, distance);
+
+  if (dist < distance - 0.5 * length)
+    return;
+
+  if (dist < distance - GCODE_CONTOUR_NEAR && depth < GCODE_CONTOUR_DEPTH && length > GCODE_CONTOUR_TOL)
+  {
+    gcode_contour_seg_part (seg, 0.0, 0.5, &half);
+    gcode_contour_trim (tree, contour, distance, &half, depth + 1, kept);
+    gcode_contour_seg_part (seg, 0.5, 1.0, &half);
+    gcode_contour_trim (tree, contour, distance, &half, depth + 1, kept);
+    return;
+  }
+
+  *gcode_contour_add (kept) = *seg;
+}
+
+
+/* Signed angle turned from the end of seg to the start of next, positive to the left */
+static gfloat_t
+gcode_contour_turn (gcode_contour_seg_t *seg, gcode_contour_seg_t *next)
+{
+  gcode_vec2d_t t0, t1;
+
+  gcode_contour_seg_tangent (seg, 1.0, t0);
+  gcode_contour_seg_tangent (next, 0.0, t1);
+
+  return (atan2 (t0[0]*t1[1] - t0[1]*t1[0], t0[0]*t1[0] + t0[1]*t1[1]));
+}
+
+
+/*
+* Push every segment by the distance and close the gaps between them,
+* with arcs about the corner where the gap opens away from the contour.
+* Where it closes instead, neighbors cross by the corner and whatever lies
+* past the crossing is nearer the other neighbor than the distance.  That
+* is cut here, where the neighbors are known, as nearly parallel ones cross
+* too shallow for the pieces to be told apart later.
+*/
+static void
+gcode_contour_push (gcode_contour_t *contour, gfloat_t distance, gcode_contour_t *raw)
+{
+  gcode_contour_t pushed;
+  gcode_contour_seg_t *seg, *a, *b;
+  gcode_vec2d_t t0, p0, p1, v;
+  gfloat_t *start, *end, ta[2], tb[2], radius, turn;
+  uint8_t *cut;
+  int i, j, k, n, ip_num;
+
+  n = contour->seg_num;
+  gcode_contour_init (&pushed);
+  start = (gfloat_t *) malloc (n * sizeof (gfloat_t));
+  end = (gfloat_t *) malloc (n * sizeof (gfloat_t));
+  cut = (uint8_t *) calloc (n, sizeof (uint8_t));
+
+  for (i = 0; i < n; i++)
+  {
+    seg = &contour->seg[i];
+
+    gcode_contour_seg_tangent (seg, 0.0, t0);
+    p0[0] = seg->p0[0] + distance * t0[1];
+    p0[1] = seg->p0[1] - distance * t0[0];
+    gcode_contour_seg_tangent (seg, 1.0, t0);
+    p1[0] = seg->p1[0] + distance * t0[1];
+    p1[1] = seg->p1[1] - distance * t0[0];
+
+    /* The right of a counter clockwise arc is outside */
+    radius = seg->radius + (seg->sweep < 0.0 ? -distance : distance);
+
+    if (seg->type == GCODE_CONTOUR_ARC && radius > GCODE_CONTOUR_TOL)
+    {
+      gcode_contour_add_arc (&pushed, seg->center, radius, seg->angle, seg->sweep, seg->block);
+    }
+    else
+    {
+      /* An arc collapsed past its center leaves a line that is never kept */
+      gcode_contour_add_line (&pushed, p0, p1, seg->block);
+    }
+
+    start[i] = 0.0;
+    end[i] = 1.0;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    j = (i+1) % n;
+    a = &pushed.seg[i];
+    b = &pushed.seg[j];
+
+    if (gcode_contour_turn (&contour->seg[i], &contour->seg[j]) * distance >= 0.0)
+      continue;
+    if (gcode_contour_seg_length (a) < 0.1 * GCODE_CONTOUR_TOL || gcode_contour_seg_length (b) < 0.1 * GCODE_CONTOUR_TOL)
+      continue;
+
+    /* The crossing nearest the corner */
+    ip_num = gcode_contour_intersect (a, b, ta, tb);
+    for (k = 0; k < ip_num; k++)
+    {
+      if (cut[i] && ta[k] < end[i])
+        continue;
+      end[i] = ta[k] < 1.0 ? ta[k] : 1.0;
+      start[j] = tb[k] > 0.0 ? tb[k] : 0.0;
+      cut[i] = 1;
+    }
+  }
+
+  /* A segment cut from both ends past each other is left whole and joined */
+  for (i = 0; i < n; i++)
+  {
+    if (start[i] < end[i])
+      continue;
+
+    j = (i+n-1) % n;
+    cut[j] = 0;
+    end[j] = 1.0;
+    start[i] = 0.0;
+
+    cut[i] = 0;
+    end[i] = 1.0;
+    start[(i+1) % n] = 0.0;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    j = (i+1) % n;
+    a = &pushed.seg[i];
+    b = &pushed.seg[j];
+
+    if (gcode_contour_seg_length (a) * (end[i] - start[i]) > 0.1 * GCODE_CONTOUR_TOL)
+      gcode_contour_seg_part (a, start[i], end[i], gcode_contour_add (raw));
+
+    if (cut[i])
+      continue;
+
+    /* Join the end of this one to the start of the next */
+    turn = gcode_contour_turn (&contour->seg[i], &contour->seg[j]);
+    if (turn * distance > 0.0 && fabs (turn * distance) > 0.1 * GCODE_CONTOUR_TOL)
+    {
+      GCODE_MATH_VEC2D_SUB (v, a->p1, contour->seg[i].p1);
+      gcode_contour_add_arc (raw, contour->seg[i].p1, fabs (distance), atan2 (v[1], v[0]), turn, NULL);
+    }
+    else if (fabs (a->p1[0]-b->p0[0]) + fabs (a->p1[1]-b->p0[1]) > 0.1 * GCODE_CONTOUR_TOL)
+    {
+      gcode_contour_add_line (raw, a->p1, b->p0, NULL);
+    }
+  }
+
+  free (cut);
+  free (end);
+  free (start);
+  gcode_contour_free (&pushed);
+}
+
+
+static void
+gcode_contour_split_add (gcode_contour_splits_t *splits, int seg, gfloat_t t)
+{
+  if (splits->num == splits->max)
+  {
+    splits->max = splits->max ? 2 * splits->max : 64;
+    splits->split = (gcode_contour_split_t *) realloc (splits->split, splits->max * sizeof (gcode_contour_split_t));
+  }
+
+  splits->split[splits->num].seg = seg;
+  splits->split[splits->num].t = t;
+  splits->num++;
+}
+
+
+/*
+* Whether a ends where b starts, at p.  Pushing leaves no wider gap than a
+* tenth of the tolerance, wider ones are where trimming took something out.
+*/
+static int
+gcode_contour_joined (gcode_contour_seg_t *a, gcode_contour_seg_t *b, gcode_vec2d_t p)
+{
+  return (fabs (a->p1[0] - b->p0[0]) + fabs (a->p1[1] - b->p0[1]) < 0.2 * GCODE_CONTOUR_TOL &&
+          fabs (a->p1[0] - p[0]) + fabs (a->p1[1] - p[1]) < GCODE_CONTOUR_TOL);
+}
+
+
+/*
+* Find every crossing of the pushed curve with itself by sweeping the
+* boxes of its segments along x, keeping those still reaching the sweep.
+*/
+static void
+gcode_contour_crossings (gcode_contour_t *raw, gcode_contour_splits_t *splits)
+{
+  gcode_contour_node_t *box;
+  gcode_contour_key_t *key;
+  gcode_vec2d_t ip;
+  gfloat_t ta[2], tb[2], e;
+  int *active, active_num, i, j, k, a, ip_num;
+
+  box = (gcode_contour_node_t *) malloc (raw->seg_num * sizeof (gcode_contour_node_t));
+  key = (gcode_contour_key_t *) malloc (raw->seg_num * sizeof (gcode_contour_key_t));
+  active = (int *) malloc (raw->seg_num * sizeof (int));
+
+  for (i = 0; i < raw->seg_num; i++)
+  {
+    gcode_contour_seg_box (&raw->seg[i], box[i].min, box[i].max);
+    key[i].x = box[i].min[0];
+    key[i].index = i;
+  }
+  if (raw->seg_num)
+    qsort (key, raw->seg_num, sizeof (gcode_contour_key_t), gcode_contour_key_compare);
+
+  active_num = 0;
+  for (i = 0; i < raw->seg_num; i++)
+  {
+    a = key[i].index;
+
+    for (j = k = 0; j < active_num; j++)
+      if (box[active[j]].max[0] >= box[a].min[0] - GCODE_CONTOUR_TOL)
+        active[k++] = active[j];
+    active_num = k;
+
+    for (j = 0; j < active_num; j++)
+    {
+      gcode_contour_node_t *b;
+
+      b = &box[active[j]];
+      if (b->max[1] < box[a].min[1] - GCODE_CONTOUR_TOL || b->min[1] > box[a].max[1] + GCODE_CONTOUR_TOL)
+        continue;
+
+      ip_num = gcode_contour_intersect (&raw->seg[a], &raw->seg[active[j]], ta, tb);
+      for (k = 0; k < ip_num; k++)
+      {
+        /* Where neighbors meet is no crossing */
+        gcode_contour_seg_point (&raw->seg[a], ta[k], ip);
+        if (gcode_contour_joined (&raw->seg[a], &raw->seg[active[j]], ip) || gcode_contour_joined (&raw->seg[active[j]], &raw->seg[a], ip))
+          continue;
+
+        e = GCODE_CONTOUR_NEAR / gcode_contour_seg_length (&raw->seg[a]);
+        if (ta[k] > e && ta[k] < 1.0 - e)
+          gcode_contour_split_add (splits, a, ta[k]);
+        e = GCODE_CONTOUR_NEAR / gcode_contour_seg_length (&raw->seg[active[j]]);
+        if (tb[k] > e && tb[k] < 1.0 - e)
+          gcode_contour_split_add (splits, active[j], tb[k]);
+      }
+    }
+
+    active[active_num++] = a;
+  }
+
+  free (active);
+  free (key);
+  free (box);
+}
+
+
+/* Index of an unused piece starting at p, preferring hint, or -1 */
+static int
+gcode_contour_find_next (gcode_contour_t *piece, uint8_t *used, gcode_contour_key_t *key, gcode_vec2d_t p, int hint)
+{
+  int lo, hi, mid, k, n;
+
+  if (hint < piece->seg_num && !used[hint] && fabs (piece->seg[hint].p0[0] - p[0]) + fabs (piece->seg[hint].p0[1] - p[1]) < GCODE_CONTOUR_TOL)
+    return (hint);
+
+  /* First key no less than p[0] - tol */
+  lo = 0;
+  hi = piece->seg_num;
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (key[mid].x < p[0] - GCODE_CONTOUR_TOL)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (k = lo; k < piece->seg_num && key[k].x <= p[0] + GCODE_CONTOUR_TOL; k++)
+  {
+    n = key[k].index;
+    if (!used[n] && fabs (piece->seg[n].p0[0] - p[0]) + fabs (piece->seg[n].p0[1] - p[1]) < GCODE_CONTOUR_TOL)
+      return (n);
+  }
+
+  return (-1);
+}
+
+
+/*
+* Join the pieces end to end.  Chains that do not close are dropped, as
+* are loops turning the other way than the contour when pushed inward.
+* Each loop starts with the piece found first along the contour.
+*/
+static void
+gcode_contour_stitch (gcode_contour_t *piece, gfloat_t area, gfloat_t distance, gcode_contour_ring_t *ring)
+{
+  gcode_contour_key_t *key;
+  gcode_contour_t *loop;
+  uint8_t *used;
+  int *chain, chain_num, i, k, n, first, closed;
+  gfloat_t length, loop_area;
+
+  key = (gcode_contour_key_t *) malloc (piece->seg_num * sizeof (gcode_contour_key_t));
+  used = (uint8_t *) calloc (piece->seg_num, sizeof (uint8_t));
+  chain = (int *) malloc (piece->seg_num * sizeof (int));
+
+  for (i = 0; i < piece->seg_num; i++)
+  {
+    key[i].x = piece->seg[i].p0[0];
+    key[i].index = i;
+  }
+  if (piece->seg_num)
+    qsort (key, piece->seg_num, sizeof (gcode_contour_key_t), gcode_contour_key_compare);
+
+  for (i = 0; i < piece->seg_num; i++)
+  {
+    if (used[i])
+      continue;
+
+    chain_num = 0;
+    n = i;
+    closed = 0;
+    length = 0.0;
+    while (n >= 0)
+    {
+      used[n] = 1;
+      chain[chain_num++] = n;
+      length += gcode_contour_seg_length (&piece->seg[n]);
+
+      /* Pieces shorter than the tolerance end where they start and close nothing */
+      if (length > 4.0 * GCODE_CONTOUR_TOL && fabs (piece->seg[n].p1[0] - piece->seg[i].p0[0]) + fabs (piece->seg[n].p1[1] - piece->seg[i].p0[1]) < GCODE_CONTOUR_TOL)
+      {
+        closed = 1;
+        break;
+      }
+
+      n = gcode_contour_find_next (piece, used, key, piece->seg[n].p1, n+1);
+    }
+
+    if (!closed)
+      continue;
+
+    ring->loop = (gcode_contour_t *) realloc (ring->loop, (ring->loop_num + 1) * sizeof (gcode_contour_t));
+    loop = &ring->loop[ring->loop_num];
+    gcode_contour_init (loop);
+
+    first = 0;
+    for (k = 1; k < chain_num; k++)
+      if (chain[k] < chain[first])
+        first = k;
+
+    for (k = 0; k < chain_num; k++)
+    {
+      *gcode_contour_add (loop) = piece->seg[chain[(first + k) % chain_num]];
+
+      /* Close the small gaps left between lines */
+      if (k && loop->seg[k].type == GCODE_CONTOUR_LINE)
+      {
+        loop->seg[k].p0[0] = loop->seg[k-1].p1[0];
+        loop->seg[k].p0[1] = loop->seg[k-1].p1[1];
+      }
+    }
+
+    loop_area = gcode_contour_area (loop);
+    if (fabs (loop_area) < GCODE_CONTOUR_TOL * GCODE_CONTOUR_TOL || (distance * area < 0.0 && loop_area * area < 0.0))
+    {
+      gcode_contour_free (loop);
+      continue;
+    }
+
+    ring->loop_num++;
+  }
+
+  free (chain);
+  free (used);
+  free (key);
+}
+
+
+/*
+* Reads the lines and arcs from start_block up to end_block where they
+* would be without the tool and eval offsets.  Returns 1 when something
+* else is in the list or the blocks do not form a closed chain.
+*/
+int
+gcode_contour_from_list (gcode_contour_t *contour, gcode_block_t *start_block, gcode_block_t *end_block)
+{
+  gcode_block_t *index_block;
+  gcode_offset_t *offset, zero_offset;
+  gcode_contour_seg_t *seg, *next;
+  int i;
+
+  for (index_block = start_block; index_block != end_block; index_block = index_block->next)
+  {
+    offset = index_block->offset;
+    zero_offset = *offset;
+    zero_offset.tool = 0.0;
+    zero_offset.eval = 0.0;
+    index_block->offset = &zero_offset;
+
+    switch (index_block->type)
+    {
+      case GCODE_TYPE_LINE:
+      {
+        gcode_vec2d_t line_p0, line_p1, line_normal;
+
+        gcode_line_with_offset (index_block, line_p0, line_p1, line_normal);
+        if (fabs (line_p0[0]-line_p1[0]) + fabs (line_p0[1]-line_p1[1]) > 0.1 * GCODE_CONTOUR_TOL)
+          gcode_contour_add_line (contour, line_p0, line_p1, index_block);
+      }
+      break;
+
+      case GCODE_TYPE_ARC:
+      {
+        gcode_arc_t *arc;
+        gcode_vec2d_t arc_origin, arc_center, arc_p1;
+        gfloat_t arc_radius, arc_start_angle;
+
+        arc = (gcode_arc_t *) index_block->pdata;
+        gcode_arc_with_offset (index_block, arc_origin, arc_center, arc_p1, &arc_radius, &arc_start_angle);
+        if (arc_radius * fabs (arc->sweep) * GCODE_DEG2RAD > 0.1 * GCODE_CONTOUR_TOL)
+          gcode_contour_add_arc (contour, arc_center, arc_radius, arc_start_angle * GCODE_DEG2RAD, arc->sweep * GCODE_DEG2RAD, index_block);
+      }
+      break;
+
+      default:
+        index_block->offset = offset;
+        return (1);
+    }
+
+    index_block->offset = offset;
+  }
+
+  if (!contour->seg_num)
+    return (1);
+
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    next = &contour->seg[(i+1) % contour->seg_num];
+    if (fabs (seg->p1[0]-next->p0[0]) + fabs (seg->p1[1]-next->p0[1]) > GCODE_CONTOUR_TOL)
+      return (1);
+  }
+
+  return (0);
+}
+
+
+/* Signed area, positive when the contour runs counter clockwise */
+gfloat_t
+gcode_contour_area (gcode_contour_t *contour)
+{
+  gcode_contour_seg_t *seg;
+  gfloat_t area;
+  int i;
+
+  area = 0.0;
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    area += 0.5 * (seg->p0[0]*seg->p1[1] - seg->p1[0]*seg->p0[1]);
+
+    /* Between the chord and the arc */
+    if (seg->type == GCODE_CONTOUR_ARC)
+      area += 0.5 * seg->radius*seg->radius * (seg->sweep - sin (seg->sweep));
+  }
+
+  return (area);
+}
+
+
+/*
+* Whether q is inside the contour, by the turns the chords between ends
+* make about it.  Each arc adds a turn its way for points between it and
+* its chord, which the chords alone miss.
+*/
+int
+gcode_contour_inside (gcode_contour_t *contour, gcode_vec2d_t q)
+{
+  gcode_contour_seg_t *seg;
+  gcode_vec2d_t v0, v1;
+  gfloat_t turn, side;
+  int i, arc_turns;
+
+  turn = 0.0;
+  arc_turns = 0;
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    GCODE_MATH_VEC2D_SUB (v0, seg->p0, q);
+    GCODE_MATH_VEC2D_SUB (v1, seg->p1, q);
+    turn += atan2 (v0[0]*v1[1] - v0[1]*v1[0], v0[0]*v1[0] + v0[1]*v1[1]);
+
+    if (seg->type != GCODE_CONTOUR_ARC)
+      continue;
+    if ((q[0]-seg->center[0])*(q[0]-seg->center[0]) + (q[1]-seg->center[1])*(q[1]-seg->center[1]) >= seg->radius*seg->radius)
+      continue;
+
+    /* Positive on the side of the chord the arc bulges to, the right when counter clockwise */
+    side = (seg->p1[1]-seg->p0[1])*(q[0]-seg->p0[0]) - (seg->p1[0]-seg->p0[0])*(q[1]-seg->p0[1]);
+    if (seg->sweep < 0.0)
+      side = -side;
+
+    /* Past half a turn the arc takes in all of the circle but the far side */
+    if (side > 0.0 || (fabs (seg->sweep) > GCODE_PI && side == 0.0))
+      arc_turns += seg->sweep > 0.0 ? 1 : -1;
+  }
+
+  return ((int) floor (turn / GCODE_2PI + 0.5) + arc_turns != 0);
+}
+
+
+/* How far q is from the nearest point of the contour */
+gfloat_t
+gcode_contour_distance (gcode_contour_t *contour, gcode_vec2d_t q)
+{
+  gfloat_t dist, best;
+  int i;
+
+  best = -1.0;
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    dist = gcode_contour_seg_distance (&contour->seg[i], q);
+    if (best < 0.0 || dist < best)
+      best = dist;
+  }
+
+  return (best);
+}
+
+
+/* Turn the contour to start at its point nearest q, splitting the segment there */
+void
+gcode_contour_start_at (gcode_contour_t *contour, gcode_vec2d_t q)
+{
+  gcode_contour_seg_t *seg;
+  gcode_contour_t turned;
+  gcode_vec2d_t p;
+  gfloat_t t, best_t, dist, best;
+  int i, n;
+
+  n = -1;
+  best = 0.0;
+  best_t = 0.0;
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    gcode_contour_seg_param (seg, q, &t);
+    t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+    gcode_contour_seg_point (seg, t, p);
+
+    /* Arcs take the nearer end when q is off their sweep */
+    if (seg->type == GCODE_CONTOUR_ARC && (t == 0.0 || t == 1.0))
+    {
+      t = (q[0]-seg->p0[0])*(q[0]-seg->p0[0]) + (q[1]-seg->p0[1])*(q[1]-seg->p0[1]) <
+          (q[0]-seg->p1[0])*(q[0]-seg->p1[0]) + (q[1]-seg->p1[1])*(q[1]-seg->p1[1]) ? 0.0 : 1.0;
+      gcode_contour_seg_point (seg, t, p);
+    }
+
+    dist = (q[0]-p[0])*(q[0]-p[0]) + (q[1]-p[1])*(q[1]-p[1]);
+    if (n < 0 || dist < best)
+    {
+      n = i;
+      best = dist;
+      best_t = t;
+    }
+  }
+
+  if (n < 0)
+    return;
+
+  gcode_contour_init (&turned);
+
+  if (best_t < 1.0)
+    gcode_contour_seg_part (&contour->seg[n], best_t, 1.0, gcode_contour_add (&turned));
+  for (i = 1; i < contour->seg_num; i++)
+    *gcode_contour_add (&turned) = contour->seg[(n + i) % contour->seg_num];
+  if (best_t > 0.0)
+    gcode_contour_seg_part (&contour->seg[n], 0.0, best_t, gcode_contour_add (&turned));
+
+  gcode_contour_free (contour);
+  *contour = turned;
+}
+
+
+/*
+* Points every step along the contour from its start, with the direction
+* of travel at each.  The arrays are the caller's to free.  Returns how
+* many points there are, at least one.
+*/
+int
+gcode_contour_sample (gcode_contour_t *contour, gfloat_t step, gcode_vec2d_t **point, gcode_vec2d_t **tangent)
+{
+  gfloat_t length, seg_length, at;
+  int i, n, num;
+
+  length = 0.0;
+  for (i = 0; i < contour->seg_num; i++)
+    length += gcode_contour_seg_length (&contour->seg[i]);
+
+  num = step > GCODE_PRECISION ? (int) ceil (length / step - GCODE_PRECISION) : 1;
+  if (num < 1)
+    num = 1;
+
+  *point = (gcode_vec2d_t *) malloc (num * sizeof (gcode_vec2d_t));
+  *tangent = (gcode_vec2d_t *) malloc (num * sizeof (gcode_vec2d_t));
+
+  /* at is how far into segment i the next point falls */
+  i = 0;
+  at = 0.0;
+  for (n = 0; n < num; n++)
+  {
+    seg_length = contour->seg_num ? gcode_contour_seg_length (&contour->seg[i]) : 0.0;
+    while (at > seg_length && i < contour->seg_num - 1)
+    {
+      at -= seg_length;
+      i++;
+      seg_length = gcode_contour_seg_length (&contour->seg[i]);
+    }
+
+    if (contour->seg_num)
+    {
+      gcode_contour_seg_point (&contour->seg[i], seg_length > 0.0 ? (at < seg_length ? at / seg_length : 1.0) : 0.0, (*point)[n]);
+      gcode_contour_seg_tangent (&contour->seg[i], seg_length > 0.0 ? (at < seg_length ? at / seg_length : 1.0) : 0.0, (*tangent)[n]);
+    }
+    else
+    {
+      (*point)[n][0] = (*point)[n][1] = 0.0;
+      (*tangent)[n][0] = 1.0;
+      (*tangent)[n][1] = 0.0;
+    }
+
+    at += step;
+  }
+
+  return (num);
+}
+
+
+/*
+* The stretch of the contour from length from along it to length to, into
+* part.  It goes on past the start of the contour when to comes before from.
+*/
+void
+gcode_contour_part (gcode_contour_t *contour, gfloat_t from, gfloat_t to, gcode_contour_t *part)
+{
+  gcode_contour_seg_t *seg;
+  gfloat_t at, len;
+  int n;
+
+  gcode_contour_init (part);
+
+  if (to < from)
+    for (n = 0; n < contour->seg_num; n++)
+      to += gcode_contour_seg_length (&contour->seg[n]);
+
+  at = 0.0;
+  for (n = 0; n < 2 * contour->seg_num && at < to - GCODE_PRECISION; n++)
+  {
+    seg = &contour->seg[n % contour->seg_num];
+    len = gcode_contour_seg_length (seg);
+
+    if (len > GCODE_PRECISION && at + len > from + GCODE_PRECISION)
+      gcode_contour_seg_part (seg, from > at ? (from - at) / len : 0.0, to < at + len ? (to - at) / len : 1.0, gcode_contour_add (part));
+
+    at += len;
+  }
+}
+
+
+/*
+* Offset the contour by each distance, filling a ring per distance.  The
+* hierarchy over the contour is built once and shared, so stepover rings
+* for clearing come cheaper in one call than one at a time.
+*/
+void
+gcode_contour_offset (gcode_contour_t *contour, gfloat_t *distance, int distance_num, gcode_contour_ring_t *ring)
+{
+  gcode_contour_tree_t tree;
+  gcode_contour_splits_t splits;
+  gcode_contour_t raw, trim, piece;
+  gcode_contour_seg_t *seg;
+  gcode_vec2d_t mid;
+  gfloat_t area, t0, t1, e;
+  int i, j, k;
+
+  for (i = 0; i < distance_num; i++)
+  {
+    ring[i].distance = distance[i];
+    ring[i].loop_num = 0;
+    ring[i].loop = NULL;
+  }
+
+  if (!contour->seg_num)
+    return;
+
+  area = gcode_contour_area (contour);
+
+  tree.node_num = 0;
+  tree.node = (gcode_contour_node_t *) malloc ((2 * contour->seg_num - 1) * sizeof (gcode_contour_node_t));
+  gcode_contour_tree_build (&tree, contour, 0, contour->seg_num - 1);
+
+  splits.num = 0;
+  splits.max = 0;
+  splits.split = NULL;
+
+  for (i = 0; i < distance_num; i++)
+  {
+    gcode_contour_init (&raw);
+    gcode_contour_init (&trim);
+    gcode_contour_init (&piece);
+    splits.num = 0;
+
+    gcode_contour_push (contour, distance[i], &raw);
+    for (j = 0; j < raw.seg_num; j++)
+      gcode_contour_trim (&tree, contour, fabs (distance[i]), &raw.seg[j], 0, &trim);
+
+    gcode_contour_crossings (&trim, &splits);
+    if (splits.num)
+      qsort (splits.split, splits.num, sizeof (gcode_contour_split_t), gcode_contour_split_compare);
+
+    /* Cut each segment at its crossings and keep what is far enough away */
+    k = 0;
+    for (j = 0; j < trim.seg_num; j++)
+    {
+      seg = &trim.seg[j];
+      e = GCODE_CONTOUR_NEAR / gcode_contour_seg_length (seg);
+
+      t0 = 0.0;
+      while (t0 < 1.0)
+      {
+        t1 = 1.0;
+        for (; k < splits.num && splits.split[k].seg == j; k++)
+        {
+          if (splits.split[k].t > t0 + e)
+          {
+            t1 = splits.split[k++].t;
+            break;
+          }
+        }
+
+        gcode_contour_seg_point (seg, 0.5 * (t0 + t1), mid);
+        if (t1 - t0 > e && gcode_contour_tree_distance (&tree, 0, contour, mid, fabs (distance[i])) > fabs (distance[i]) - GCODE_CONTOUR_NEAR)
+          gcode_contour_seg_part (seg, t0, t1, gcode_contour_add (&piece));
+
+        t0 = t1;
+      }
+    }
+
+    gcode_contour_stitch (&piece, area, distance[i], &ring[i]);
+
+    gcode_contour_free (&piece);
+    gcode_contour_free (&trim);
+    gcode_contour_free (&raw);
+  }
+
+  free (splits.split);
+  free (tree.node);
+}
+
+
+void
+gcode_contour_ring_free (gcode_contour_ring_t *ring)
+{
+  int i;
+
+  for (i = 0; i < ring->loop_num; i++)
+    gcode_contour_free (&ring->loop[i]);
+  free (ring->loop);
+
+  ring->loop_num = 0;
+  ring->loop = NULL;
+}
+
+
+/*
+* Make a line or arc block for each segment.  Blocks take the parent, name
+* and comment of the block their segment came from, joins those of the
+* block before them, and all of them share offset.
+*/
+void
+gcode_contour_to_list (gcode_contour_t *contour, gcode_t *gcode, gcode_block_t *parent, gcode_offset_t *offset, gcode_block_t **list)
+{
+  gcode_block_t *block, *last_block, *source;
+  gcode_contour_seg_t *seg;
+  int i;
+
+  *list = NULL;
+  last_block = NULL;
+
+  /* Joins at the head of the loop follow the last block */
+  source = NULL;
+  for (i = contour->seg_num - 1; i >= 0 && !source; i--)
+    source = contour->seg[i].block;
+
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    if (seg->block)
+      source = seg->block;
+
+    if (seg->type == GCODE_CONTOUR_ARC)
+    {
+      gcode_arc_t *arc;
+
+      gcode_arc_init (gcode, &block, source ? source->parent : parent);
+      arc = (gcode_arc_t *) block->pdata;
+      arc->pos[0] = seg->p0[0];
+      arc->pos[1] = seg->p0[1];
+      arc->radius = seg->radius;
+      arc->start_angle = fmod (seg->angle * GCODE_RAD2DEG, 360.0);
+      if (arc->start_angle < 0.0)
+        arc->start_angle += 360.0;
+      arc->sweep = seg->sweep * GCODE_RAD2DEG;
+    }
+    else
+    {
+      gcode_line_t *line;
+
+      gcode_line_init (gcode, &block, source ? source->parent : parent);
+      line = (gcode_line_t *) block->pdata;
+      line->p0[0] = seg->p0[0];
+      line->p0[1] = seg->p0[1];
+      line->p1[0] = seg->p1[0];
+      line->p1[1] = seg->p1[1];
+    }
+
+    if (seg->block)
+      strcpy (block->comment, seg->block->comment);
+    if (source)
+      block->name = source->name;
+    block->offset = offset;
+
+    if (*list)
+    {
+      gcode_list_insert (&last_block, block);
+    }
+    else
+    {
+      gcode_list_insert (list, block);
+    }
+    last_block = block;
+  }
+}
@@ -0,0 +1,75 @@
+/*
+*  gcode_contour.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_CONTOUR_H
+#define _GCODE_CONTOUR_H
+
+#include "gcode_internal.h"
+
+#define GCODE_CONTOUR_LINE	0x0
+#define GCODE_CONTOUR_ARC	0x1
+
+#define GCODE_CONTOUR_TOL	0.0001	/* ends closer than this are joined, as in sketches */
+
+typedef struct gcode_contour_seg_s
+{
+  uint8_t type;
+  gcode_vec2d_t p0;
+  gcode_vec2d_t p1;
+
+  /* GCODE_CONTOUR_ARC */
+  gcode_vec2d_t center;
+  gfloat_t radius;
+  gfloat_t angle;		/* radians, of p0 about the center */
+  gfloat_t sweep;		/* radians, positive is counter clockwise */
+
+  gcode_block_t *block;		/* block it came from, NULL when made to join two others */
+} gcode_contour_seg_t;
+
+/* A closed chain of segments, each starting where the one before ends */
+typedef struct gcode_contour_s
+{
+  int seg_num;
+  int seg_max;
+  gcode_contour_seg_t *seg;
+} gcode_contour_t;
+
+/* Every loop of one offset, islands included */
+typedef struct gcode_contour_ring_s
+{
+  gfloat_t distance;
+  int loop_num;
+  gcode_contour_t *loop;
+} gcode_contour_ring_t;
+
+void gcode_contour_init (gcode_contour_t *contour);
+void gcode_contour_free (gcode_contour_t *contour);
+void gcode_contour_add_line (gcode_contour_t *contour, gcode_vec2d_t p0, gcode_vec2d_t p1, gcode_block_t *block);
+void gcode_contour_add_arc (gcode_contour_t *contour, gcode_vec2d_t center, gfloat_t radius, gfloat_t angle, gfloat_t sweep, gcode_block_t *block);
+int gcode_contour_from_list (gcode_contour_t *contour, gcode_block_t *start_block, gcode_block_t *end_block);
+gfloat_t gcode_contour_area (gcode_contour_t *contour);
+int gcode_contour_inside (gcode_contour_t *contour, gcode_vec2d_t q);
+gfloat_t gcode_contour_distance (gcode_contour_t *contour, gcode_vec2d_t q);
+void gcode_contour_start_at (gcode_contour_t *contour, gcode_vec2d_t q);
+void gcode_contour_part (gcode_contour_t *contour, gfloat_t from, gfloat_t to, gcode_contour_t *part);
+int gcode_contour_sample (gcode_contour_t *contour, gfloat_t step, gcode_vec2d_t **point, gcode_vec2d_t **tangent);
+void gcode_contour_offset (gcode_contour_t *contour, gfloat_t *distance, int distance_num, gcode_contour_ring_t *ring);
+void gcode_contour_ring_free (gcode_contour_ring_t *ring);
+void gcode_contour_to_list (gcode_contour_t *contour, gcode_t *gcode, gcode_block_t *parent, gcode_offset_t *offset, gcode_block_t **list);
+
+#endif
@@ -70,6 +70,7 @@ gcode_drill_holes_free (gcode_block_t **block)
 {
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -386,7 +387,7 @@ gcode_drill_holes_draw (gcode_block_t *block, gcode_block_t *selected)
     drill_holes->offset.rotation = block->offset->rotation;
   }
 
-  tess = 32;
+  tess = gcode_internal_tess (block->gcode, tool_rad, 360.0, 32);
 
   iter_block = drill_holes->list;
   while (iter_block)
@@ -404,7 +405,7 @@ gcode_drill_holes_draw (gcode_block_t *block, gcode_block_t *selected)
     if (block == selected || iter_block == selected)
       sind = 1;
 
-    glLoadName ((GLuint) iter_block->name); /* Set Name to block pointer value */
+    gcode_internal_draw_name (iter_block->name);
     glLineWidth (2);
     glBegin (GL_LINE_STRIP);
     for (i = 0; i < tess; i++)
@@ -504,11 +505,11 @@ gcode_drill_holes_scale (gcode_block_t *block, gfloat_t scale)
 }
 
 
-void
+gcode_block_t *
 gcode_drill_holes_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation)
 {
   gcode_drill_holes_t *drill_holes;
-  gcode_block_t *child_block, *pattern_block, **pattern_list, *last_block;
+  gcode_block_t *child_block, *pattern_block, **pattern_list, *last_block, *old_list;
   gfloat_t inc_rotation, inc_translate_x, inc_translate_y;
   int i;
 
@@ -559,6 +560,13 @@ gcode_drill_holes_pattern (gcode_block_t *block, int iterations, gfloat_t transl
     }
   }
 
-  gcode_list_free (&drill_holes->list);
+  /* The list is handed back rather than freed so the edit can be undone */
+  old_list = drill_holes->list;
   drill_holes->list = *pattern_list;
+  free (pattern_list);
+
+  for (child_block = drill_holes->list; child_block; child_block = child_block->next)
+    child_block->parent_list = &drill_holes->list;
+
+  return (old_list);
 }
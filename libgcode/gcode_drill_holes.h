@@ -44,6 +44,6 @@ void gcode_drill_holes_load (gcode_block_t *block, FILE *fh);
 void gcode_drill_holes_draw (gcode_block_t *block, gcode_block_t *selected);
 void gcode_drill_holes_duplicate (gcode_block_t *block, gcode_block_t **duplicate);
 void gcode_drill_holes_scale (gcode_block_t *block, gfloat_t scale);
-void gcode_drill_holes_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation);
+gcode_block_t *gcode_drill_holes_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation);
 
 #endif
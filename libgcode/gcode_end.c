@@ -50,6 +50,7 @@ gcode_end_init (GCODE_INIT_PARAMETERS)
 void
 gcode_end_free (gcode_block_t **block)
 {
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -0,0 +1,598 @@
+/*
+*  gcode_estimate.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_estimate.h"
+#include "gcode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+* Cycle time is estimated straight from the generated code without
+* touching the stock.  Every move becomes a segment with a length, a top
+* speed limited by the feed and the rapid rate of each axis, and the
+* direction it starts and ends in.  Speeds at the junctions are bounded by
+* how sharply the path turns, then a backward and a forward pass make
+* them reachable with the machine acceleration, and each segment is timed
+* as a trapezoidal speed profile.
+*/
+
+#define GCODE_ESTIMATE_STOP	0x01	/* machine is at rest before this segment */
+#define GCODE_ESTIMATE_RAPID	0x02
+
+typedef struct gcode_estimate_segment_s
+{
+  gfloat_t len;
+  gfloat_t vmax;		/* units per second */
+  gfloat_t u0[3];		/* direction at the start */
+  gfloat_t u1[3];		/* direction at the end */
+  int block;
+  int tool;
+  uint8_t flags;
+} gcode_estimate_segment_t;
+
+typedef struct gcode_estimate_state_s
+{
+  gcode_estimate_t *estimate;
+  gcode_estimate_segment_t *seg;
+  int seg_num;
+  int seg_max;
+
+  gfloat_t pos[3];
+  gfloat_t feed;		/* units per minute */
+  uint8_t absolute;
+  int motion;			/* G00 through G03 */
+  int cycle;			/* 81 or 83 while a canned cycle is active */
+  gfloat_t cycle_z;
+  gfloat_t cycle_r;
+  gfloat_t cycle_q;
+
+  int block;
+  int tool;
+  uint8_t stop;
+} gcode_estimate_state_t;
+
+
+void
+gcode_estimate_init (gcode_estimate_t *estimate, gfloat_t rapid[3], gfloat_t accel)
+{
+  estimate->rapid[0] = rapid[0];
+  estimate->rapid[1] = rapid[1];
+  estimate->rapid[2] = rapid[2];
+  estimate->accel = accel;
+
+  estimate->time = 0.0;
+  estimate->rapid_time = 0.0;
+  estimate->feed_time = 0.0;
+  estimate->distance = 0.0;
+
+  estimate->block_num = 0;
+  estimate->block = NULL;
+  estimate->tool_num = 0;
+  estimate->tool = NULL;
+}
+
+
+void
+gcode_estimate_free (gcode_estimate_t *estimate)
+{
+  free (estimate->block);
+  free (estimate->tool);
+
+  estimate->block_num = 0;
+  estimate->block = NULL;
+  estimate->tool_num = 0;
+  estimate->tool = NULL;
+}
+
+
+/* Fastest speed along unit direction u that keeps every axis within its rapid rate */
+static gfloat_t
+gcode_estimate_axis_limit (gcode_estimate_t *estimate, gfloat_t u[3])
+{
+  gfloat_t v;
+  int i;
+
+  v = 0.0;
+  for (i = 0; i < 3; i++)
+  {
+    if (fabs (u[i]) < GCODE_PRECISION || estimate->rapid[i] <= 0.0)
+      continue;
+
+    if (v == 0.0 || estimate->rapid[i] / (60.0 * fabs (u[i])) < v)
+      v = estimate->rapid[i] / (60.0 * fabs (u[i]));
+  }
+
+  return (v);
+}
+
+
+static gfloat_t
+gcode_estimate_speed (gcode_estimate_state_t *state, gfloat_t u[3], int rapid)
+{
+  gfloat_t v;
+
+  v = gcode_estimate_axis_limit (state->estimate, u);
+
+  if (!rapid && state->feed > 0.0 && (v == 0.0 || state->feed / 60.0 < v))
+    v = state->feed / 60.0;
+
+  /* No rate known at all, charge one unit per second rather than nothing */
+  if (v <= 0.0)
+    v = 1.0;
+
+  return (v);
+}
+
+
+static void
+gcode_estimate_add (gcode_estimate_state_t *state, gfloat_t len, gfloat_t vmax, gfloat_t u0[3], gfloat_t u1[3], int rapid)
+{
+  gcode_estimate_segment_t *seg;
+
+  if (state->seg_num == state->seg_max)
+  {
+    state->seg_max = state->seg_max ? 2 * state->seg_max : 1024;
+    state->seg = (gcode_estimate_segment_t *) realloc (state->seg, state->seg_max * sizeof (gcode_estimate_segment_t));
+  }
+
+  seg = &state->seg[state->seg_num++];
+  seg->len = len;
+  seg->vmax = vmax;
+  GCODE_MATH_VEC3D_COPY (seg->u0, u0);
+  GCODE_MATH_VEC3D_COPY (seg->u1, u1);
+  seg->block = state->block;
+  seg->tool = state->tool;
+  seg->flags = (rapid ? GCODE_ESTIMATE_RAPID : 0) | (state->stop ? GCODE_ESTIMATE_STOP : 0);
+
+  state->stop = 0;
+}
+
+
+static void
+gcode_estimate_line (gcode_estimate_state_t *state, gfloat_t target[3], int rapid)
+{
+  gfloat_t u[3], len;
+
+  GCODE_MATH_VEC3D_SUB (u, target, state->pos);
+  GCODE_MATH_VEC3D_MAG (len, u);
+  if (len < GCODE_PRECISION)
+    return;
+
+  GCODE_MATH_VEC3D_MUL_SCALAR (u, u, 1.0 / len);
+  gcode_estimate_add (state, len, gcode_estimate_speed (state, u, rapid), u, u, rapid);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, target);
+}
+
+
+static void
+gcode_estimate_arc (gcode_estimate_state_t *state, gfloat_t target[3], gfloat_t ijk[3], int cw)
+{
+  gfloat_t center[2], rad, a0, a1, sweep, arc, dz, len, u0[3], u1[3], vmax, vcen;
+
+  center[0] = state->pos[0] + ijk[0];
+  center[1] = state->pos[1] + ijk[1];
+  rad = sqrt ((state->pos[0] - center[0]) * (state->pos[0] - center[0]) + (state->pos[1] - center[1]) * (state->pos[1] - center[1]));
+  if (rad < GCODE_PRECISION)
+  {
+    gcode_estimate_line (state, target, 0);
+    return;
+  }
+
+  a0 = atan2 (state->pos[1] - center[1], state->pos[0] - center[0]);
+  a1 = atan2 (target[1] - center[1], target[0] - center[0]);
+  sweep = cw ? a0 - a1 : a1 - a0;
+  if (sweep < 0.0)
+    sweep += 2.0 * GCODE_PI;
+
+  /* Coincident end points describe a full circle */
+  if (sweep * rad < GCODE_PRECISION)
+    sweep = 2.0 * GCODE_PI;
+
+  arc = rad * sweep;
+  dz = target[2] - state->pos[2];
+  len = sqrt (arc * arc + dz * dz);
+
+  /* Tangents at both ends, tilted by the helix */
+  GCODE_MATH_VEC3D_SET (u0, (cw ? sin (a0) : -sin (a0)) * arc / len, (cw ? -cos (a0) : cos (a0)) * arc / len, dz / len);
+  GCODE_MATH_VEC3D_SET (u1, (cw ? sin (a1) : -sin (a1)) * arc / len, (cw ? -cos (a1) : cos (a1)) * arc / len, dz / len);
+
+  vmax = gcode_estimate_speed (state, u0, 0);
+
+  /* Centripetal acceleration on small arcs */
+  if (state->estimate->accel > 0.0)
+  {
+    vcen = sqrt (state->estimate->accel * rad);
+    if (vcen < vmax)
+      vmax = vcen;
+  }
+
+  gcode_estimate_add (state, len, vmax, u0, u1, 0);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, target);
+}
+
+
+/*
+* One hole of a G81/G83 cycle: rapid over the hole and down to the
+* retract plane, feed to depth in pecks of cycle_q with a rapid out and
+* back in between them, and rapid back out to the retract plane.
+*/
+static void
+gcode_estimate_hole (gcode_estimate_state_t *state, gfloat_t x, gfloat_t y)
+{
+  gfloat_t target[3], bottom, next;
+
+  GCODE_MATH_VEC3D_SET (target, x, y, state->pos[2]);
+  gcode_estimate_line (state, target, 1);
+  target[2] = state->cycle_r;
+  gcode_estimate_line (state, target, 1);
+
+  bottom = state->cycle_r;
+  while (bottom > state->cycle_z + GCODE_PRECISION)
+  {
+    next = state->cycle == 83 && state->cycle_q > GCODE_PRECISION ? bottom - state->cycle_q : state->cycle_z;
+    if (next < state->cycle_z)
+      next = state->cycle_z;
+
+    if (bottom < state->cycle_r)
+    {
+      target[2] = bottom;
+      gcode_estimate_line (state, target, 1);
+    }
+
+    target[2] = next;
+    gcode_estimate_line (state, target, 0);
+    target[2] = state->cycle_r;
+    gcode_estimate_line (state, target, 1);
+
+    bottom = next;
+  }
+}
+
+
+/*
+* Copy as much of string as fits in an entry label, always terminated.
+*/
+static void
+gcode_estimate_label (gcode_estimate_entry_t *entry, const char *string)
+{
+  size_t len;
+
+  len = strlen (string);
+  if (len > sizeof (entry->label) - 1)
+    len = sizeof (entry->label) - 1;
+  memcpy (entry->label, string, len);
+  entry->label[len] = 0;
+}
+
+
+static int
+gcode_estimate_tool (gcode_estimate_t *estimate, char *label)
+{
+  int i;
+
+  for (i = 0; i < estimate->tool_num; i++)
+    if (!strcmp (estimate->tool[i].label, label))
+      return (i);
+
+  estimate->tool = (gcode_estimate_entry_t *) realloc (estimate->tool, (estimate->tool_num + 1) * sizeof (gcode_estimate_entry_t));
+  gcode_estimate_label (&estimate->tool[i], label);
+  estimate->tool[i].time = 0.0;
+  estimate->tool[i].distance = 0.0;
+  estimate->tool_num++;
+
+  return (i);
+}
+
+
+static void
+gcode_estimate_line_parse (gcode_estimate_state_t *state, char *code)
+{
+  gfloat_t word[3], target[3], ijk[3], value, p, r, q;
+  int i, g, has[3], motion, cycle, dwell, depth;
+  char line[256], *sp, *end, letter;
+
+  /* Tool blocks name themselves in a comment */
+  sp = strstr (code, "Tool Change: ");
+  if (sp)
+  {
+    sp += strlen ("Tool Change: ");
+    i = strcspn (sp, ")\n");
+    if (i > 63)
+      i = 63;
+    memcpy (line, sp, i);
+    line[i] = 0;
+    state->tool = gcode_estimate_tool (state->estimate, line);
+  }
+
+  /* Copy the line without comments or spaces */
+  i = 0;
+  depth = 0;
+  for (sp = code; *sp && *sp != '\n' && *sp != ';' && i < 255; sp++)
+  {
+    if (*sp == '(')
+      depth++;
+    else if (*sp == ')')
+      depth--;
+    else if (!depth && *sp != ' ' && *sp != '\t')
+      line[i++] = *sp;
+  }
+  line[i] = 0;
+
+  has[0] = has[1] = has[2] = 0;
+  GCODE_MATH_VEC3D_SET (word, 0.0, 0.0, 0.0);
+  GCODE_MATH_VEC3D_SET (ijk, 0.0, 0.0, 0.0);
+  motion = -1;
+  cycle = -1;
+  dwell = 0;
+  p = r = q = 0.0;
+
+  for (sp = line; *sp;)
+  {
+    letter = toupper (*sp++);
+    value = strtod (sp, &end);
+    if (end == sp)
+      continue;
+    sp = end;
+
+    switch (letter)
+    {
+      case 'G':
+        g = (int) floor (value + 0.5);
+        if (g >= 0 && g <= 3)
+          motion = g;
+        else if (g == 4)
+          dwell = 1;
+        else if (g == 80)
+          state->cycle = 0;
+        else if (g == 81 || g == 83)
+          cycle = g;
+        else if (g == 90)
+          state->absolute = 1;
+        else if (g == 91)
+          state->absolute = 0;
+        break;
+
+      case 'X':
+      case 'Y':
+      case 'Z':
+        word[letter - 'X'] = value;
+        has[letter - 'X'] = 1;
+        break;
+
+      case 'I':
+      case 'J':
+      case 'K':
+        ijk[letter - 'I'] = value;
+        break;
+
+      case 'F':
+        state->feed = value;
+        break;
+
+      case 'P':
+        p = value;
+        break;
+
+      case 'Q':
+        q = value;
+        break;
+
+      case 'R':
+        r = value;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if (dwell)
+  {
+    state->estimate->time += p;
+    if (state->block < state->estimate->block_num)
+      state->estimate->block[state->block].time += p;
+    if (state->tool >= 0)
+      state->estimate->tool[state->tool].time += p;
+    state->stop = 1;
+  }
+
+  for (i = 0; i < 3; i++)
+    target[i] = has[i] ? (state->absolute ? word[i] : state->pos[i] + word[i]) : state->pos[i];
+
+  if (cycle > 0)
+  {
+    state->cycle = cycle;
+    if (has[2])
+      state->cycle_z = word[2];
+    state->cycle_r = r;
+    state->cycle_q = q;
+    if (has[0] || has[1])
+      gcode_estimate_hole (state, target[0], target[1]);
+    return;
+  }
+
+  if (motion >= 0)
+    state->motion = motion;
+  else if (state->cycle && (has[0] || has[1]))
+  {
+    gcode_estimate_hole (state, target[0], target[1]);
+    return;
+  }
+
+  if (!has[0] && !has[1] && !has[2])
+    return;
+
+  switch (state->motion)
+  {
+    case 0:
+      gcode_estimate_line (state, target, 1);
+      break;
+
+    case 1:
+      gcode_estimate_line (state, target, 0);
+      break;
+
+    case 2:
+    case 3:
+      gcode_estimate_arc (state, target, ijk, state->motion == 2);
+      break;
+  }
+}
+
+
+/* Time to cover len starting at v0 and ending at v1 without exceeding vmax */
+static gfloat_t
+gcode_estimate_trapezoid (gfloat_t len, gfloat_t v0, gfloat_t v1, gfloat_t vmax, gfloat_t accel)
+{
+  gfloat_t vpeak, d0, d1;
+
+  vpeak = sqrt (0.5 * (2.0 * accel * len + v0 * v0 + v1 * v1));
+  if (vpeak <= vmax)
+    return ((2.0 * vpeak - v0 - v1) / accel);
+
+  d0 = (vmax * vmax - v0 * v0) / (2.0 * accel);
+  d1 = (vmax * vmax - v1 * v1) / (2.0 * accel);
+
+  return ((2.0 * vmax - v0 - v1) / accel + (len - d0 - d1) / vmax);
+}
+
+
+int
+gcode_estimate (gcode_t *gcode, gcode_estimate_t *estimate)
+{
+  gcode_estimate_state_t state;
+  gcode_estimate_segment_t *seg;
+  gcode_block_t *block;
+  gfloat_t *junction, accel, t, c, v;
+  char *sp, *tsp;
+  int i, n;
+
+  gcode_estimate_free (estimate);
+  estimate->time = 0.0;
+  estimate->rapid_time = 0.0;
+  estimate->feed_time = 0.0;
+  estimate->distance = 0.0;
+
+  gcode_list_make (gcode);
+
+  for (block = gcode->list; block; block = block->next)
+    estimate->block_num++;
+  estimate->block = (gcode_estimate_entry_t *) malloc (estimate->block_num * sizeof (gcode_estimate_entry_t));
+  if (estimate->block_num && !estimate->block)
+    return (1);
+
+  memset (&state, 0, sizeof (gcode_estimate_state_t));
+  state.estimate = estimate;
+  state.absolute = 1;
+  state.tool = -1;
+  state.stop = 1;
+
+  for (i = 0, block = gcode->list; block; block = block->next, i++)
+  {
+    if (block->comment[0])
+      gcode_estimate_label (&estimate->block[i], block->comment);
+    else
+      gcode_estimate_label (&estimate->block[i], GCODE_TYPE_STRING[block->type]);
+    estimate->block[i].time = 0.0;
+    estimate->block[i].distance = 0.0;
+
+    state.block = i;
+    if (!block->code)
+      continue;
+
+    for (sp = block->code; (tsp = strchr (sp, '\n')); sp = tsp + 1)
+      gcode_estimate_line_parse (&state, sp);
+  }
+
+  n = state.seg_num;
+  seg = state.seg;
+  accel = estimate->accel;
+
+  junction = (gfloat_t *) malloc ((n + 1) * sizeof (gfloat_t));
+  if (!junction)
+  {
+    free (seg);
+    return (1);
+  }
+
+  /* Corner speed: full speed straight through, at rest for a right angle or sharper */
+  junction[0] = 0.0;
+  junction[n] = 0.0;
+  for (i = 1; i < n; i++)
+  {
+    c = seg[i-1].u1[0]*seg[i].u0[0] + seg[i-1].u1[1]*seg[i].u0[1] + seg[i-1].u1[2]*seg[i].u0[2];
+    v = seg[i-1].vmax < seg[i].vmax ? seg[i-1].vmax : seg[i].vmax;
+    junction[i] = (seg[i].flags & GCODE_ESTIMATE_STOP) || c <= 0.0 ? 0.0 : c * v;
+  }
+
+  if (accel > 0.0)
+  {
+    for (i = n - 1; i >= 0; i--)
+    {
+      v = sqrt (junction[i+1] * junction[i+1] + 2.0 * accel * seg[i].len);
+      if (junction[i] > v)
+        junction[i] = v;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      v = sqrt (junction[i] * junction[i] + 2.0 * accel * seg[i].len);
+      if (junction[i+1] > v)
+        junction[i+1] = v;
+    }
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (accel > 0.0)
+    {
+      t = gcode_estimate_trapezoid (seg[i].len, junction[i], junction[i+1], seg[i].vmax, accel);
+    }
+    else
+    {
+      t = seg[i].len / seg[i].vmax;
+    }
+
+    estimate->time += t;
+    estimate->distance += seg[i].len;
+    if (seg[i].flags & GCODE_ESTIMATE_RAPID)
+    {
+      estimate->rapid_time += t;
+    }
+    else
+    {
+      estimate->feed_time += t;
+    }
+
+    estimate->block[seg[i].block].time += t;
+    estimate->block[seg[i].block].distance += seg[i].len;
+    if (seg[i].tool >= 0)
+    {
+      estimate->tool[seg[i].tool].time += t;
+      estimate->tool[seg[i].tool].distance += seg[i].len;
+    }
+  }
+
+  free (junction);
+  free (seg);
+
+  return (0);
+}
@@ -0,0 +1,51 @@
+/*
+*  gcode_estimate.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_ESTIMATE_H
+#define _GCODE_ESTIMATE_H
+
+#include "gcode_internal.h"
+
+typedef struct gcode_estimate_entry_s
+{
+  char label[64];
+  gfloat_t time;		/* seconds */
+  gfloat_t distance;		/* path length in project units */
+} gcode_estimate_entry_t;
+
+typedef struct gcode_estimate_s
+{
+  gfloat_t rapid[3];		/* rapid rate of each axis in units per minute */
+  gfloat_t accel;		/* units per second squared, 0 for instant changes of speed */
+
+  gfloat_t time;		/* seconds */
+  gfloat_t rapid_time;
+  gfloat_t feed_time;
+  gfloat_t distance;
+
+  int block_num;
+  gcode_estimate_entry_t *block;	/* one per top-level block */
+  int tool_num;
+  gcode_estimate_entry_t *tool;		/* one per tool label, in order of first use */
+} gcode_estimate_t;
+
+void gcode_estimate_init (gcode_estimate_t *estimate, gfloat_t rapid[3], gfloat_t accel);
+void gcode_estimate_free (gcode_estimate_t *estimate);
+int gcode_estimate (gcode_t *gcode, gcode_estimate_t *estimate);
+
+#endif
@@ -91,6 +91,7 @@ gcode_extrusion_free (gcode_block_t **block)
 
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -37,6 +37,7 @@ gcode_image_init (GCODE_INIT_PARAMETERS)
   (*block)->draw = gcode_image_draw;
   (*block)->duplicate = gcode_image_duplicate;
   (*block)->scale = gcode_image_scale;
+  (*block)->aabb = gcode_image_aabb;
   (*block)->pdata = malloc (sizeof (gcode_image_t));
 
   strcpy ((*block)->comment, "Image");
@@ -64,6 +65,7 @@ gcode_image_free (gcode_block_t **block)
 
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -397,3 +399,17 @@ gcode_image_scale (gcode_block_t *block, gfloat_t scale)
   image->size[1] *= scale;
   image->size[2] *= scale;
 }
+
+
+void
+gcode_image_aabb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max)
+{
+  gcode_image_t *image;
+
+  image = (gcode_image_t *) block->pdata;
+
+  min[0] = 0.0;
+  min[1] = 0.0;
+  max[0] = image->size[0];
+  max[1] = image->size[1];
+}
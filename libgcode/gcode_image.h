@@ -41,5 +41,6 @@ void gcode_image_open (gcode_block_t *block, char *filename);
 void gcode_image_draw (gcode_block_t *block, gcode_block_t *selected);
 void gcode_image_duplicate (gcode_block_t *block, gcode_block_t **duplicate);
 void gcode_image_scale (gcode_block_t *block, gfloat_t scale);
+void gcode_image_aabb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max);
 
 #endif
@@ -19,16 +19,63 @@
 #include "gcode_internal.h"
 
 
+/*
+* Blocks are named by their slot in this registry rather than by address, so a
+* name always fits the 24 bits drawn by gcode_internal_draw_name and can never
+* collide.  Released slots are handed out again before the registry grows.
+*/
+static gcode_block_t **gcode_handle;
+static uint32_t gcode_handle_num;
+static uint32_t gcode_handle_max;
+static uint32_t *gcode_handle_free;
+static uint32_t gcode_handle_free_num;
+
+/* Set while the view draws names rather than colors */
+static uint8_t gcode_draw_pick;
+
+
+static uint32_t
+gcode_handle_alloc (gcode_block_t *block)
+{
+  uint32_t handle;
+
+  if (gcode_handle_free_num)
+  {
+    handle = gcode_handle_free[--gcode_handle_free_num];
+    gcode_handle[handle] = block;
+    return (handle);
+  }
+
+  /* Slot 0 is never handed out */
+  if (!gcode_handle_num)
+    gcode_handle_num = 1;
+
+  if (gcode_handle_num > GCODE_NAME_MAX)
+    return (0);
+
+  if (gcode_handle_num >= gcode_handle_max)
+  {
+    gcode_handle_max = gcode_handle_max ? 2 * gcode_handle_max : 256;
+    gcode_handle = (gcode_block_t **) realloc (gcode_handle, gcode_handle_max * sizeof (gcode_block_t *));
+    gcode_handle_free = (uint32_t *) realloc (gcode_handle_free, gcode_handle_max * sizeof (uint32_t));
+  }
+
+  handle = gcode_handle_num++;
+  gcode_handle[handle] = block;
+
+  return (handle);
+}
+
+
 void
 gcode_internal_init (gcode_block_t *block, gcode_block_t *parent, gcode_t *gcode, uint8_t type, uint8_t flags)
 {
   /*
-  * The name is a unique identifier based on the pointer address.
-  * lowest 3-bits are always 0, so we can divide by 8
-  * OpenGL only allows 32-bits for names, so condense the address as much as possible.
-  * In the long term this may need to become a lookup table.
+  * The name links what this block draws back to it when picking, duplicates
+  * made for drawing carry the name of the block they were made from.
   */
-  block->name = (uint32_t) ((uint64_t) block - (uint64_t) gcode) >> 3;
+  block->handle = gcode_handle_alloc (block);
+  block->name = block->handle;
   block->parent = parent;
   block->gcode = gcode;
   block->type = type;
@@ -52,6 +99,92 @@ gcode_internal_init (gcode_block_t *block, gcode_block_t *parent, gcode_t *gcode
 }
 
 
+void
+gcode_internal_free (gcode_block_t *block)
+{
+  if (!block->handle || gcode_handle[block->handle] != block)
+    return;
+
+  gcode_handle[block->handle] = NULL;
+  gcode_handle_free[gcode_handle_free_num++] = block->handle;
+  block->handle = 0;
+}
+
+
+gcode_block_t *
+gcode_internal_lookup (uint32_t name)
+{
+  if (!name || name >= gcode_handle_num)
+    return (NULL);
+
+  return (gcode_handle[name]);
+}
+
+
+/*
+* Emission is ignored while lighting is off, so normal drawing is unaffected.
+* Picking draws with lighting on and every light off, so each pixel takes the
+* color of the last name set.
+*/
+void
+gcode_internal_draw_name (uint32_t name)
+{
+#if GCODE_USE_OPENGL
+  GLfloat color[4];
+
+  color[0] = (GLfloat) (name & 0xff) / 255.0;
+  color[1] = (GLfloat) ((name >> 8) & 0xff) / 255.0;
+  color[2] = (GLfloat) ((name >> 16) & 0xff) / 255.0;
+  color[3] = 1.0;
+  glMaterialfv (GL_FRONT_AND_BACK, GL_EMISSION, color);
+#endif
+}
+
+
+/*
+* Blocks that turn lighting on to shade themselves leave it alone while
+* picking, or the lights would add to the color of the name.
+*/
+void
+gcode_internal_draw_pick (uint8_t pick)
+{
+  gcode_draw_pick = pick;
+}
+
+
+uint8_t
+gcode_internal_draw_picking (void)
+{
+  return (gcode_draw_pick);
+}
+
+
+/*
+* Points to draw along a curve of this radius and sweep in degrees so that no
+* chord strays more than draw_tol from it, or the fixed number without one.
+*/
+uint32_t
+gcode_internal_tess (gcode_t *gcode, gfloat_t radius, gfloat_t sweep, uint32_t fixed)
+{
+  gfloat_t step, num;
+
+  if (gcode->draw_tol <= 0.0)
+    return (fixed);
+
+  if (radius <= 0.5 * gcode->draw_tol)
+    return (2);
+
+  /* Angle of the longest chord within tolerance */
+  step = 2.0 * acos (1.0 - gcode->draw_tol / radius);
+
+  num = ceil (fabs (sweep) * GCODE_DEG2RAD / step) + 1.0;
+  if (num > GCODE_TESS_MAX)
+    num = GCODE_TESS_MAX;
+
+  return ((uint32_t) num);
+}
+
+
 void
 format_z (char *format, char **format2, unsigned int num)
 {
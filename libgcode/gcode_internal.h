@@ -35,6 +35,12 @@
 #endif
 
 
+/* Most points drawn along one curve */
+#define GCODE_TESS_MAX			1024
+
+/* Names are drawn as 24-bit colors when picking, 0 names nothing */
+#define GCODE_NAME_MAX			0xffffff
+
 #define	GCODE_FILE_HEADER		0x4743414d
 #define	GCODE_VERSION			0x20100727
 
@@ -90,6 +96,10 @@
 #define GCODE_FLAGS_LOCK		0x01
 #define	GCODE_FLAGS_SUPPRESS		0x02
 
+#define GCODE_VOXEL_LAYOUT_ROW		0x00	/* x innermost, z outermost */
+#define GCODE_VOXEL_LAYOUT_COLUMN	0x01	/* z innermost, y outermost */
+#define GCODE_VOXEL_LAYOUT_BRICK	0x02	/* 8x8x8 bricks, each brick stored x innermost */
+
 #define GCODE_INIT_PARAMETERS		gcode_t *gcode, gcode_block_t **block, gcode_block_t *parent
 
 enum
@@ -147,6 +157,7 @@ typedef void gcode_aabb_t (struct gcode_block_s *block, gcode_vec2d_t min, gcode
 
 typedef void gcode_progress_callback_t (void *gui, gfloat_t progress);
 typedef void gcode_message_callback_t (void *gui, char *message);
+typedef void gcode_preview_callback_t (void *gui);
 
 typedef struct gcode_offset_s
 {
@@ -169,6 +180,7 @@ typedef struct gcode_block_s
   char comment[64];
   char status[64];
 
+  uint32_t handle; /* registered by gcode_internal_init, released by gcode_internal_free */
   uint32_t name; /* This is used primarily for opengl picking, so that this blocks rendered lines link back to something in the treeview */
   struct gcode_block_s *parent;
   struct gcode_block_s **parent_list;
@@ -212,10 +224,27 @@ typedef struct gcode_s
   void *gui;
   gcode_progress_callback_t *progress_callback;
   gcode_message_callback_t *message_callback;
-
-  uint16_t voxel_res;
-  uint16_t voxel_num[3];
+  gcode_preview_callback_t *preview_callback;
+
+  uint32_t voxel_res;
+  uint8_t voxel_roi;		/* simulate only the box at voxel_min rather than all of the material */
+  gfloat_t voxel_min[3];	/* corner of the simulated box from the left, back, bottom of the material */
+  gfloat_t voxel_span[3];	/* size of the simulated box, set to material_size by gcode_prep without a region */
+  uint32_t voxel_num[3];
+  uint8_t voxel_layout;		/* chosen before gcode_prep */
+  uint32_t voxel_brick[3];	/* number of bricks along each axis */
+  size_t voxel_size;		/* bytes in voxel_map, including brick padding */
   uint8_t *voxel_map;
+  int voxel_fd;			/* scratch file backing voxel_map, -1 when on the heap */
+  size_t voxel_mapped;		/* length of the scratch mapping, which voxel_size may no longer match */
+  size_t voxel_touched;		/* bytes of the chunks of a mapped voxel_map accessed since they were last released */
+  uint8_t *voxel_resident;	/* per chunk of a mapped voxel_map, set when accessed since chunks were last released */
+  uint32_t voxel_tile_num[3];
+  uint8_t *voxel_dirty;		/* per tile of voxels, set when the simulator writes into it */
+
+  struct gcode_sim_snapshot_s *sim_snapshot;	/* stock after each top-level block, see gcode_render_final */
+  int sim_snapshot_num;
+  char sim_cache[512];		/* file keeping the final stock between sessions, empty for none */
 
   uint8_t driver;
 
@@ -225,10 +254,33 @@ typedef struct gcode_s
   uint32_t decimal;	/* number of decimal places to print */
 
   uint32_t project_number; /* For Haas Machines only */
+
+  gfloat_t feed_max;	/* optimize feed rates on export up to this, 0 keeps the tool feeds */
+
+  gfloat_t draw_tol;	/* chord error allowed when drawing curves, 0 for a fixed number of segments */
 } gcode_t;
 
 
+/*
+* Offset of voxel (x, y, z) in voxel_map for the layout selected at gcode_prep.
+* All readers and writers of voxel_map must index through this.
+*/
+#define GCODE_VOXEL_INDEX(_gcode, _x, _y, _z) \
+	((_gcode)->voxel_layout == GCODE_VOXEL_LAYOUT_COLUMN ? \
+	  (((size_t) (_y) * (_gcode)->voxel_num[0] + (_x)) * (_gcode)->voxel_num[2] + (_z)) : \
+	 (_gcode)->voxel_layout == GCODE_VOXEL_LAYOUT_BRICK ? \
+	  (((((size_t) ((_z) >> 3) * (_gcode)->voxel_brick[1] + ((_y) >> 3)) * (_gcode)->voxel_brick[0] + ((_x) >> 3)) << 9) + \
+	   ((((_z) & 7) << 6) | (((_y) & 7) << 3) | ((_x) & 7))) : \
+	  (((size_t) (_z) * (_gcode)->voxel_num[1] + (_y)) * (_gcode)->voxel_num[0] + (_x)))
+
+
 void gcode_internal_init (gcode_block_t *block, gcode_block_t *parent, gcode_t *gcode, uint8_t type, uint8_t flags);
+void gcode_internal_free (gcode_block_t *block);
+gcode_block_t *gcode_internal_lookup (uint32_t name);
+void gcode_internal_draw_name (uint32_t name);
+void gcode_internal_draw_pick (uint8_t pick);
+uint8_t gcode_internal_draw_picking (void);
+uint32_t gcode_internal_tess (gcode_t *gcode, gfloat_t radius, gfloat_t sweep, uint32_t fixed);
 void format_z (char *format, char **format2, unsigned int num);
 
 #define gsprintf(_string, _num, _format, args...) { \
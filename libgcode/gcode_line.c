@@ -58,6 +58,7 @@ gcode_line_free (gcode_block_t **block)
 {
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -234,7 +235,7 @@ gcode_line_draw (gcode_block_t *block, gcode_block_t *selected)
 
 //  sind = (block == selected || !block) ? 1 : 0;
 
-  glLoadName ((GLuint) block->name); /* Set Name to block pointer value */
+  gcode_internal_draw_name (block->name);
   glLineWidth (1);
 
   glBegin (GL_LINES);
@@ -0,0 +1,649 @@
+/*
+*  gcode_mesh.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_mesh.h"
+#include "gcode_voxel.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <pthread.h>
+#endif
+
+/*
+* The surface is extracted on the dual grid: every cell spans the centers
+* of 2x2x2 voxels and carries at most one vertex, placed at the average of
+* the crossings on its edges.  Each pair of neighboring voxels that differ
+* yields a quad joining the four cells around them, so vertices are shared
+* and the mesh comes out indexed.  Voxels outside the stock read as empty,
+* which closes the surface along the material boundary.
+*/
+
+#define GCODE_MESH_NONE		0xFFFFFFFF
+
+/* Corner pairs of the twelve cell edges, corners are numbered x | y << 1 | z << 2 */
+static const uint8_t gcode_mesh_edge[12][2] = {
+  {0, 1}, {2, 3}, {4, 5}, {6, 7},
+  {0, 2}, {1, 3}, {4, 6}, {5, 7},
+  {0, 4}, {1, 5}, {2, 6}, {3, 7} };
+
+typedef struct gcode_mesh_local_s
+{
+  gcode_t *gcode;
+  gcode_mesh_tile_t *tile;
+  int c0[3];		/* first cell owned by the tile */
+  int v0[3];		/* stock voxel at local voxel 0 */
+  int w[3];		/* local voxels per axis */
+  int m[3];		/* local cells per axis, including the apron */
+  uint8_t *occ;
+  uint32_t *vind;
+} gcode_mesh_local_t;
+
+#define GCODE_MESH_OCC(_l, _x, _y, _z) \
+	((_l)->occ[((size_t) (_z) * (_l)->w[1] + (_y)) * (_l)->w[0] + (_x)])
+
+
+void
+gcode_mesh_init (gcode_mesh_t *mesh)
+{
+  mesh->tile_num[0] = 0;
+  mesh->tile_num[1] = 0;
+  mesh->tile_num[2] = 0;
+  mesh->tile = NULL;
+}
+
+
+void
+gcode_mesh_free (gcode_mesh_t *mesh)
+{
+  uint32_t i, num;
+
+  num = mesh->tile_num[0] * mesh->tile_num[1] * mesh->tile_num[2];
+  if (mesh->tile)
+  {
+    for (i = 0; i < num; i++)
+    {
+      free (mesh->tile[i].vert);
+      free (mesh->tile[i].index);
+    }
+  }
+
+  free (mesh->tile);
+  gcode_mesh_init (mesh);
+}
+
+
+uint32_t
+gcode_mesh_triangles (gcode_mesh_t *mesh)
+{
+  uint32_t i, num, sum;
+
+  sum = 0;
+  num = mesh->tile_num[0] * mesh->tile_num[1] * mesh->tile_num[2];
+  for (i = 0; i < num; i++)
+    sum += mesh->tile[i].index_num / 3;
+
+  return (sum);
+}
+
+
+/*
+* Returns the index of the vertex belonging to local cell (x,y,z),
+* creating it on first use.  Cell (x,y,z) has local voxel (x,y,z)+1 as
+* its lowest corner.
+*/
+static uint32_t
+gcode_mesh_vertex (gcode_mesh_local_t *local, int x, int y, int z)
+{
+  gcode_t *gcode;
+  gcode_mesh_tile_t *tile;
+  uint32_t *vind;
+  float *vert;
+  gfloat_t pos[3], nor[3], mag;
+  uint8_t corner[8];
+  int c, e, a, n, cx, cy, cz, p[3];
+
+  vind = &local->vind[((size_t) z * local->m[1] + y) * local->m[0] + x];
+  if (*vind != GCODE_MESH_NONE)
+    return (*vind);
+
+  gcode = local->gcode;
+  tile = local->tile;
+
+  for (c = 0; c < 8; c++)
+    corner[c] = GCODE_MESH_OCC (local, x + 1 + (c & 1), y + 1 + ((c >> 1) & 1), z + 1 + (c >> 2));
+
+  /* Average of the crossing midpoints, in cell units */
+  pos[0] = pos[1] = pos[2] = 0.0;
+  n = 0;
+  for (e = 0; e < 12; e++)
+  {
+    if (corner[gcode_mesh_edge[e][0]] == corner[gcode_mesh_edge[e][1]])
+      continue;
+    for (a = 0; a < 3; a++)
+      pos[a] += 0.5 * (((gcode_mesh_edge[e][0] >> a) & 1) + ((gcode_mesh_edge[e][1] >> a) & 1));
+    n++;
+  }
+  for (a = 0; a < 3; a++)
+    pos[a] /= (gfloat_t) n;
+
+  /*
+  * Central differences at all eight corners are averaged, which spreads
+  * the gradient over a 4x4x4 neighborhood and keeps the shading smooth
+  * across the voxel steps.
+  */
+  nor[0] = nor[1] = nor[2] = 0.0;
+  for (c = 0; c < 8; c++)
+  {
+    cx = x + 1 + (c & 1);
+    cy = y + 1 + ((c >> 1) & 1);
+    cz = z + 1 + (c >> 2);
+    nor[0] += GCODE_MESH_OCC (local, cx-1, cy, cz) - GCODE_MESH_OCC (local, cx+1, cy, cz);
+    nor[1] += GCODE_MESH_OCC (local, cx, cy-1, cz) - GCODE_MESH_OCC (local, cx, cy+1, cz);
+    nor[2] += GCODE_MESH_OCC (local, cx, cy, cz-1) - GCODE_MESH_OCC (local, cx, cy, cz+1);
+  }
+
+  /* Thin walls cancel out, fall back on the corners of the cell itself */
+  if (fabs (nor[0]) + fabs (nor[1]) + fabs (nor[2]) == 0.0)
+    for (c = 0; c < 8; c++)
+      if (corner[c])
+        for (a = 0; a < 3; a++)
+          nor[a] -= ((c >> a) & 1) - 0.5;
+
+  for (a = 0; a < 3; a++)
+    nor[a] *= (gfloat_t) gcode->voxel_num[a] / gcode->voxel_span[a];
+
+  mag = sqrt (nor[0]*nor[0] + nor[1]*nor[1] + nor[2]*nor[2]);
+  if (mag > 0.0)
+    for (a = 0; a < 3; a++)
+      nor[a] /= mag;
+
+  if (tile->vert_num == tile->vert_max)
+  {
+    tile->vert_max = tile->vert_max ? 2 * tile->vert_max : 1024;
+    vert = (float *) realloc (tile->vert, (size_t) tile->vert_max * GCODE_MESH_VERTEX_SIZE * sizeof (float));
+    if (!vert)
+      return (GCODE_MESH_NONE);
+    tile->vert = vert;
+  }
+
+  /* Voxel centers sit half a voxel in from the material faces */
+  p[0] = local->v0[0] + x + 1;
+  p[1] = local->v0[1] + y + 1;
+  p[2] = local->v0[2] + z + 1;
+
+  vert = &tile->vert[(size_t) tile->vert_num * GCODE_MESH_VERTEX_SIZE];
+  vert[0] = (float) (-gcode->material_size[0]*0.5 + gcode->voxel_min[0] + ((p[0] + pos[0] + 0.5) / (gfloat_t) gcode->voxel_num[0]) * gcode->voxel_span[0]);
+  vert[1] = (float) (-gcode->material_size[1]*0.5 + gcode->voxel_min[1] + ((p[1] + pos[1] + 0.5) / (gfloat_t) gcode->voxel_num[1]) * gcode->voxel_span[1]);
+  vert[2] = (float) (gcode->voxel_min[2] + ((p[2] + pos[2] + 0.5) / (gfloat_t) gcode->voxel_num[2]) * gcode->voxel_span[2] - gcode->material_size[2]);
+  vert[3] = (float) nor[0];
+  vert[4] = (float) nor[1];
+  vert[5] = (float) nor[2];
+
+  *vind = tile->vert_num++;
+  return (*vind);
+}
+
+
+static int
+gcode_mesh_quad (gcode_mesh_local_t *local, uint32_t q[4])
+{
+  gcode_mesh_tile_t *tile;
+  uint32_t *index;
+
+  tile = local->tile;
+
+  if (q[0] == GCODE_MESH_NONE || q[1] == GCODE_MESH_NONE || q[2] == GCODE_MESH_NONE || q[3] == GCODE_MESH_NONE)
+    return (1);
+
+  if (tile->index_num + 6 > tile->index_max)
+  {
+    tile->index_max = tile->index_max ? 2 * tile->index_max : 4096;
+    index = (uint32_t *) realloc (tile->index, (size_t) tile->index_max * sizeof (uint32_t));
+    if (!index)
+      return (1);
+    tile->index = index;
+  }
+
+  index = &tile->index[tile->index_num];
+  index[0] = q[0];
+  index[1] = q[1];
+  index[2] = q[2];
+  index[3] = q[0];
+  index[4] = q[2];
+  index[5] = q[3];
+  tile->index_num += 6;
+
+  return (0);
+}
+
+
+/*
+* Extract the surface of a single tile.  The tile owns the cells from c0
+* up to the next tile and reads one extra ring of cells below them, plus the
+* voxels needed for the gradients, into a private copy of the stock.
+*/
+static int
+gcode_mesh_tile_extract (gcode_mesh_t *mesh, gcode_t *gcode, uint32_t ind)
+{
+  gcode_mesh_local_t local;
+  size_t num;
+  uint32_t q[4];
+  int t[3], c1, a, b, d, x, y, z, gx, gy, gz, o[3], s0, s1, error;
+
+  t[0] = ind % mesh->tile_num[0];
+  t[1] = (ind / mesh->tile_num[0]) % mesh->tile_num[1];
+  t[2] = ind / (mesh->tile_num[0] * mesh->tile_num[1]);
+
+  local.gcode = gcode;
+  local.tile = &mesh->tile[ind];
+  local.tile->vert_num = 0;
+  local.tile->index_num = 0;
+  local.tile->updated = 1;
+
+  /* Cells run from -1 to voxel_num-1 so the outer faces of the stock are included */
+  for (a = 0; a < 3; a++)
+  {
+    local.c0[a] = -1 + t[a] * GCODE_MESH_TILE;
+    c1 = local.c0[a] + GCODE_MESH_TILE;
+    if (c1 > (int) gcode->voxel_num[a])
+      c1 = (int) gcode->voxel_num[a];
+
+    local.v0[a] = local.c0[a] - 2;
+    local.w[a] = c1 - local.c0[a] + 4;
+    local.m[a] = c1 - local.c0[a] + 1;
+  }
+
+  num = (size_t) local.w[0] * local.w[1] * local.w[2];
+  local.occ = (uint8_t *) malloc (num);
+  num = (size_t) local.m[0] * local.m[1] * local.m[2];
+  local.vind = (uint32_t *) malloc (num * sizeof (uint32_t));
+  if (!local.occ || !local.vind)
+  {
+    free (local.occ);
+    free (local.vind);
+    return (1);
+  }
+
+  memset (local.vind, 0xFF, num * sizeof (uint32_t));
+
+  for (y = 0; y < local.w[1]; y++)
+  {
+    gy = local.v0[1] + y;
+    for (x = 0; x < local.w[0]; x++)
+    {
+      gx = local.v0[0] + x;
+      for (z = 0; z < local.w[2]; z++)
+      {
+        gz = local.v0[2] + z;
+        if (gx < 0 || gy < 0 || gz < 0 || gx >= (int) gcode->voxel_num[0] || gy >= (int) gcode->voxel_num[1] || gz >= (int) gcode->voxel_num[2])
+        {
+          GCODE_MESH_OCC (&local, x, y, z) = 0;
+        }
+        else
+        {
+          GCODE_MESH_OCC (&local, x, y, z) = gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, gx, gy, gz)] ? 1 : 0;
+        }
+      }
+    }
+  }
+
+  /*
+  * Every owned cell looks at the edges leaving its lowest corner voxel
+  * along +x, +y and +z.  A sign change there produces a quad joining this
+  * cell with its three neighbors below it in the other two axes.
+  */
+  error = 0;
+  for (z = 1; z < local.m[2]; z++)
+    for (y = 1; y < local.m[1]; y++)
+      for (x = 1; x < local.m[0]; x++)
+      {
+        o[0] = x + 1;
+        o[1] = y + 1;
+        o[2] = z + 1;
+        s0 = GCODE_MESH_OCC (&local, o[0], o[1], o[2]);
+
+        for (a = 0; a < 3; a++)
+        {
+          int p[3];
+
+          b = (a + 1) % 3;
+          d = (a + 2) % 3;
+
+          p[0] = o[0];
+          p[1] = o[1];
+          p[2] = o[2];
+          p[a]++;
+          s1 = GCODE_MESH_OCC (&local, p[0], p[1], p[2]);
+          if (s0 == s1)
+            continue;
+
+          /* Counter clockwise around +a when the solid side is below */
+          p[0] = x;
+          p[1] = y;
+          p[2] = z;
+          p[b]--;
+          p[d]--;
+          q[0] = gcode_mesh_vertex (&local, p[0], p[1], p[2]);
+          p[b]++;
+          q[1] = gcode_mesh_vertex (&local, p[0], p[1], p[2]);
+          p[d]++;
+          q[2] = gcode_mesh_vertex (&local, p[0], p[1], p[2]);
+          p[b]--;
+          q[3] = gcode_mesh_vertex (&local, p[0], p[1], p[2]);
+
+          if (!s0)
+          {
+            uint32_t swap;
+
+            swap = q[1];
+            q[1] = q[3];
+            q[3] = swap;
+          }
+
+          error |= gcode_mesh_quad (&local, q);
+        }
+      }
+
+  free (local.occ);
+  free (local.vind);
+
+  return (error);
+}
+
+
+typedef struct gcode_mesh_job_s
+{
+  gcode_mesh_t *mesh;
+  gcode_t *gcode;
+  uint32_t *list;		/* tiles to extract, NULL for all of them */
+  uint32_t num;
+  uint32_t next;
+  uint32_t done;
+  int error;
+#ifndef _WIN32
+  pthread_mutex_t lock;
+#endif
+} gcode_mesh_job_t;
+
+
+/*
+* Touch the voxels tile ind read, apron included, as gcode_mesh_tile_extract
+* lays them out.
+*/
+static void
+gcode_mesh_tile_touch (gcode_mesh_t *mesh, gcode_t *gcode, uint32_t ind)
+{
+  int t[3], lo[3], hi[3], a;
+
+  t[0] = ind % mesh->tile_num[0];
+  t[1] = (ind / mesh->tile_num[0]) % mesh->tile_num[1];
+  t[2] = ind / (mesh->tile_num[0] * mesh->tile_num[1]);
+
+  for (a = 0; a < 3; a++)
+  {
+    lo[a] = t[a] * GCODE_MESH_TILE - 3;
+    hi[a] = t[a] * GCODE_MESH_TILE + GCODE_MESH_TILE;
+    if (lo[a] < 0)
+      lo[a] = 0;
+    if (hi[a] > (int) gcode->voxel_num[a] - 1)
+      hi[a] = (int) gcode->voxel_num[a] - 1;
+  }
+
+  gcode_voxel_touch_box (gcode, lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+}
+
+
+/*
+* Hand out the next tile.  Page accounting for a mapped stock is done
+* here so that gcode_voxel_touch is only ever called under the lock.
+*/
+static int
+gcode_mesh_job_next (gcode_mesh_job_t *job, uint32_t *ind, int finished)
+{
+  int more;
+
+#ifndef _WIN32
+  pthread_mutex_lock (&job->lock);
+#endif
+
+  if (finished)
+  {
+    job->done++;
+    gcode_mesh_tile_touch (job->mesh, job->gcode, *ind);
+  }
+
+  more = job->next < job->num && !job->error;
+  if (more)
+  {
+    *ind = job->list ? job->list[job->next] : job->next;
+    job->next++;
+  }
+
+#ifndef _WIN32
+  pthread_mutex_unlock (&job->lock);
+#endif
+
+  return (more);
+}
+
+
+static void
+gcode_mesh_job_error (gcode_mesh_job_t *job)
+{
+#ifndef _WIN32
+  pthread_mutex_lock (&job->lock);
+  job->error = 1;
+  pthread_mutex_unlock (&job->lock);
+#else
+  job->error = 1;
+#endif
+}
+
+
+#ifndef _WIN32
+static void *
+gcode_mesh_worker (void *data)
+{
+  gcode_mesh_job_t *job;
+  uint32_t ind;
+  int finished;
+
+  job = (gcode_mesh_job_t *) data;
+
+  finished = 0;
+  while (gcode_mesh_job_next (job, &ind, finished))
+  {
+    if (gcode_mesh_tile_extract (job->mesh, job->gcode, ind))
+      gcode_mesh_job_error (job);
+    finished = 1;
+  }
+
+  return (NULL);
+}
+#endif
+
+
+/*
+* Extract the listed tiles.  They are spread over one worker per processor,
+* the calling thread takes tiles as well and is the only one reporting
+* progress.
+*/
+static int
+gcode_mesh_run (gcode_mesh_t *mesh, gcode_t *gcode, uint32_t *list, uint32_t num, int progress)
+{
+  gcode_mesh_job_t job;
+  uint32_t ind;
+  int i, finished, thread_num;
+#ifndef _WIN32
+  pthread_t thread[GCODE_MESH_THREADS_MAX];
+  long cpu_num;
+#endif
+
+  job.mesh = mesh;
+  job.gcode = gcode;
+  job.list = list;
+  job.num = num;
+  job.next = 0;
+  job.done = 0;
+  job.error = 0;
+
+  thread_num = 0;
+#ifndef _WIN32
+  pthread_mutex_init (&job.lock, NULL);
+
+  cpu_num = sysconf (_SC_NPROCESSORS_ONLN);
+  if (cpu_num > GCODE_MESH_THREADS_MAX)
+    cpu_num = GCODE_MESH_THREADS_MAX;
+  if (cpu_num > (long) num)
+    cpu_num = num;
+
+  for (i = 0; i < cpu_num - 1; i++)
+  {
+    if (pthread_create (&thread[thread_num], NULL, gcode_mesh_worker, &job))
+      break;
+    thread_num++;
+  }
+#endif
+
+  finished = 0;
+  while (gcode_mesh_job_next (&job, &ind, finished))
+  {
+    if (gcode_mesh_tile_extract (mesh, gcode, ind))
+      gcode_mesh_job_error (&job);
+    finished = 1;
+
+    if (progress && gcode->progress_callback)
+      gcode->progress_callback (gcode->gui, (gfloat_t) job.done / (gfloat_t) job.num);
+  }
+
+#ifndef _WIN32
+  for (i = 0; i < thread_num; i++)
+    pthread_join (thread[i], NULL);
+
+  pthread_mutex_destroy (&job.lock);
+#endif
+
+  if (progress && gcode->progress_callback)
+    gcode->progress_callback (gcode->gui, 1.0);
+
+  return (job.error);
+}
+
+
+/*
+* Build the surface mesh of the whole simulated stock.
+*/
+int
+gcode_mesh_build (gcode_mesh_t *mesh, gcode_t *gcode)
+{
+  uint32_t num;
+  int a;
+
+  gcode_mesh_free (mesh);
+
+  if (!gcode->voxel_map)
+    return (1);
+
+  for (a = 0; a < 3; a++)
+    mesh->tile_num[a] = (gcode->voxel_num[a] + GCODE_MESH_TILE) / GCODE_MESH_TILE;
+
+  num = mesh->tile_num[0] * mesh->tile_num[1] * mesh->tile_num[2];
+  mesh->tile = (gcode_mesh_tile_t *) calloc (num, sizeof (gcode_mesh_tile_t));
+  if (!mesh->tile)
+  {
+    gcode_mesh_init (mesh);
+    return (1);
+  }
+
+  gcode_voxel_dirty_fill (gcode, 0);
+
+  if (gcode_mesh_run (mesh, gcode, NULL, num, 1))
+  {
+    gcode_mesh_free (mesh);
+    return (1);
+  }
+
+  return (0);
+}
+
+
+/*
+* Extract again only the tiles that read voxels the simulator has written
+* since the last build or update.  A tile reads the voxel tiles on either
+* side of its own through its apron.  Updated tiles are flagged for the
+* caller, which clears the flags once it has consumed them.
+*/
+int
+gcode_mesh_update (gcode_mesh_t *mesh, gcode_t *gcode)
+{
+  uint32_t *list, num, tnum[3], ind;
+  int a, t[3], v[3], lo[3], hi[3], dirty;
+
+  if (!gcode->voxel_map || !gcode->voxel_dirty)
+    return (1);
+
+  for (a = 0; a < 3; a++)
+    tnum[a] = (gcode->voxel_num[a] + GCODE_MESH_TILE) / GCODE_MESH_TILE;
+
+  /* A different stock means starting over */
+  if (!mesh->tile || tnum[0] != mesh->tile_num[0] || tnum[1] != mesh->tile_num[1] || tnum[2] != mesh->tile_num[2])
+    return (gcode_mesh_build (mesh, gcode));
+
+  num = tnum[0] * tnum[1] * tnum[2];
+  list = (uint32_t *) malloc (num * sizeof (uint32_t));
+  if (!list)
+    return (1);
+
+  num = 0;
+  for (t[2] = 0; t[2] < (int) tnum[2]; t[2]++)
+    for (t[1] = 0; t[1] < (int) tnum[1]; t[1]++)
+      for (t[0] = 0; t[0] < (int) tnum[0]; t[0]++)
+      {
+        for (a = 0; a < 3; a++)
+        {
+          lo[a] = t[a] > 0 ? t[a] - 1 : 0;
+          hi[a] = t[a] + 1 < (int) gcode->voxel_tile_num[a] ? t[a] + 1 : (int) gcode->voxel_tile_num[a] - 1;
+        }
+
+        dirty = 0;
+        for (v[2] = lo[2]; v[2] <= hi[2] && !dirty; v[2]++)
+          for (v[1] = lo[1]; v[1] <= hi[1] && !dirty; v[1]++)
+            for (v[0] = lo[0]; v[0] <= hi[0] && !dirty; v[0]++)
+              dirty = gcode->voxel_dirty[((size_t) v[2] * gcode->voxel_tile_num[1] + v[1]) * gcode->voxel_tile_num[0] + v[0]];
+
+        if (dirty)
+        {
+          ind = ((uint32_t) t[2] * tnum[1] + t[1]) * tnum[0] + t[0];
+          list[num++] = ind;
+        }
+      }
+
+  gcode_voxel_dirty_fill (gcode, 0);
+
+  a = num ? gcode_mesh_run (mesh, gcode, list, num, 0) : 0;
+  free (list);
+
+  if (a)
+  {
+    gcode_mesh_free (mesh);
+    return (1);
+  }
+
+  return (0);
+}
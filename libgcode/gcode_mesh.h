@@ -0,0 +1,55 @@
+/*
+*  gcode_mesh.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_MESH_H
+#define _GCODE_MESH_H
+
+#include "gcode_internal.h"
+#include "gcode_voxel.h"
+
+/* Cells per tile along each axis, tiles are extracted independently */
+#define GCODE_MESH_TILE			GCODE_VOXEL_TILE
+#define GCODE_MESH_THREADS_MAX		16
+
+/* Floats per vertex: position followed by unit normal */
+#define GCODE_MESH_VERTEX_SIZE		6
+
+typedef struct gcode_mesh_tile_s
+{
+  uint32_t vert_num;
+  uint32_t vert_max;
+  float *vert;
+  uint32_t index_num;
+  uint32_t index_max;
+  uint32_t *index;
+  uint8_t updated;		/* extracted again since the consumer last looked */
+} gcode_mesh_tile_t;
+
+typedef struct gcode_mesh_s
+{
+  uint32_t tile_num[3];
+  gcode_mesh_tile_t *tile;
+} gcode_mesh_t;
+
+void gcode_mesh_init (gcode_mesh_t *mesh);
+void gcode_mesh_free (gcode_mesh_t *mesh);
+int gcode_mesh_build (gcode_mesh_t *mesh, gcode_t *gcode);
+int gcode_mesh_update (gcode_mesh_t *mesh, gcode_t *gcode);
+uint32_t gcode_mesh_triangles (gcode_mesh_t *mesh);
+
+#endif
@@ -19,10 +19,21 @@
 #include "gcode_pocket.h"
 #include <stdlib.h>
 #include <string.h>
+#include "gcode_contour.h"
 #include "gcode_util.h"
 #include "gcode_tool.h"
 
 
+/* A loop of one ring and where it sits among the others */
+typedef struct gcode_pocket_loop_s
+{
+  gcode_contour_t *contour;
+  gfloat_t distance;		/* from the outline, always positive */
+  int child;			/* first loop inside it on the next ring, -1 for none */
+  int sibling;			/* next loop inside the same one, -1 for none */
+} gcode_pocket_loop_t;
+
+
 void
 gcode_pocket_init (gcode_pocket_t *pocket, gfloat_t resolution)
 {
@@ -46,13 +57,30 @@ gcode_pocket_free (gcode_pocket_t *pocket)
 }
 
 
+/* Add a line to the end of the row, making room as it goes */
+static void
+gcode_pocket_row_add (gcode_pocket_row_t *row, gfloat_t x0, gfloat_t x1)
+{
+  if (row->line_num == row->line_max)
+  {
+    row->line_max = row->line_max ? 2 * row->line_max : 8;
+    row->line_array = (gcode_vec2d_t *) realloc (row->line_array, row->line_max * sizeof (gcode_vec2d_t));
+  }
+
+  row->line_array[row->line_num][0] = x0;
+  row->line_array[row->line_num][1] = x1;
+  row->line_num++;
+}
+
+
 void
 gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *start_block, gcode_block_t *end_block)
 {
   gcode_block_t *index_block;
   gcode_tool_t *tool;
-  gfloat_t x_array[64], y;
-  uint32_t xind, i;
+  gcode_pocket_row_t *row;
+  gfloat_t *x_array, y;
+  uint32_t xind, x_max, i;
 
   tool = gcode_tool_find (start_block);
 
@@ -67,14 +95,27 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *start_block, gcode_blo
 
   pocket->row_num = 0;
 
+  x_max = 64;
+  x_array = (gfloat_t *) malloc (x_max * sizeof (gfloat_t));
+
   for (y = -start_block->gcode->material_origin[1]; y <= start_block->gcode->material_size[1] - start_block->gcode->material_origin[1]; y += pocket->resolution)
   {
-    pocket->row_array[pocket->row_num].line_array = (gcode_vec2d_t *) malloc (64 * sizeof (gcode_vec2d_t));
+    row = &pocket->row_array[pocket->row_num];
+    row->line_num = 0;
+    row->line_max = 0;
+    row->line_array = NULL;
 
     xind = 0;
     index_block = start_block;
     while (index_block != end_block)
     {
+      /* No block crosses a row more than twice */
+      if (xind + 2 > x_max)
+      {
+        x_max *= 2;
+        x_array = (gfloat_t *) realloc (x_array, x_max * sizeof (gfloat_t));
+      }
+
       index_block->eval (index_block, y, x_array, &xind);
       index_block = index_block->next;
     }
@@ -82,7 +123,6 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *start_block, gcode_blo
     qsort (x_array, xind, sizeof (gfloat_t), gcode_util_qsort_compare_asc);
     gcode_util_remove_duplicate_scalars (x_array, &xind);
 
-    pocket->row_array[pocket->row_num].line_num = 0;
     /* Generate the Lines */
     if (xind >= 2)
     {
@@ -105,25 +145,96 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *start_block, gcode_blo
           * Nudge the pocket lines in by 10% of the tool diameter so that
           * the final pass that does the perimeter leaves a better finish
           */
-          pocket->row_array[pocket->row_num].line_array[pocket->row_array[pocket->row_num].line_num][0] = x_array[i] + 0.1 * tool->diam;
-          pocket->row_array[pocket->row_num].line_array[pocket->row_array[pocket->row_num].line_num][1] = x_array[i+1] - 0.1 * tool->diam;
+          gcode_pocket_row_add (row, x_array[i] + 0.1 * tool->diam, x_array[i+1] - 0.1 * tool->diam);
 /*  printf ("line_eval: %f to %f @ %f\n", x_array[i], x_array[i+1], y); */
-          pocket->row_array[pocket->row_num].line_num++;
           pocket->seg_num++;
         }
       }
     }
-    pocket->row_array[pocket->row_num].y = y;
+    row->y = y;
 
     pocket->row_num++;
   }
+
+  free (x_array);
+}
+
+
+/* Whether one line of the row runs from x0 to x1 */
+static int
+gcode_pocket_covered (gcode_pocket_row_t *row, gfloat_t x0, gfloat_t x1)
+{
+  int j;
+
+  for (j = 0; j < row->line_num; j++)
+    if (row->line_array[j][0] <= (x0 < x1 ? x0 : x1) + GCODE_PRECISION && row->line_array[j][1] >= (x0 < x1 ? x1 : x0) - GCODE_PRECISION)
+      return (1);
+
+  return (0);
+}
+
+
+/*
+* Move from the end of the line last cut, on row row0 at x0, to x1 on row
+* i.  Outside the pocket is made of circles the size of the end mill, and
+* none fits between two rows without cutting into one of them by more than
+* the lines are nudged in.  So a move straight across from a line on one
+* row to a line on the next is inside, and so is one along a line.  The
+* end mill stays down going along whichever row runs under the whole move
+* and then across, or straight over when both do.  Otherwise nothing says
+* the move stays inside, at this depth or the one above, since a gap on a
+* row is the wall itself, so the end mill comes all the way up.
+*/
+static void
+gcode_pocket_link (gcode_pocket_t *pocket, gcode_block_t *code_block, int row0, gfloat_t x0, int i, gfloat_t x1, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  char string[256];
+  gfloat_t y0, y1;
+  int covered0, covered1;
+
+  if (row0 >= 0)
+  {
+    y0 = pocket->row_array[row0].y;
+    y1 = pocket->row_array[i].y;
+
+    covered0 = i - row0 <= 1 && gcode_pocket_covered (&pocket->row_array[row0], x0, x1);
+    covered1 = i - row0 <= 1 && gcode_pocket_covered (&pocket->row_array[i], x0, x1);
+
+    if (covered0 && !covered1)
+    {
+      gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", x1, y0);
+      GCODE_APPEND(code_block, string);
+    }
+    else if (covered1 && !covered0)
+    {
+      gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", x0, y1);
+      GCODE_APPEND(code_block, string);
+    }
+
+    if (covered0 || covered1)
+    {
+      gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", x1, y1);
+      GCODE_APPEND(code_block, string);
+      return;
+    }
+  }
+
+  GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+  gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", x1, pocket->row_array[i].y);
+  GCODE_APPEND(code_block, string);
+
+  /* Only rapid plunge if depth is lower than rapid_depth */
+  if (rapid_depth >= depth-GCODE_PRECISION)
+    GCODE_PLUNGE_RAPID(code_block, rapid_depth);
+  GCODE_PLUNGE(code_block, depth, tool);
 }
 
 
 void
 gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
 {
-  int i, j, row, first_cut;
+  int i, j, row;
+  gfloat_t x;
   char string[256];
 
 
@@ -131,11 +242,11 @@ gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t d
   if (pocket->seg_num == 0)
     return;
 
-  first_cut = 1;
-
   GCODE_COMMENT (code_block, "POCKETING");
 
-  row = 0;
+  /* Row of the last line cut, -1 while up at the start */
+  row = -1;
+  x = 0.0;
   for (i = 0; i < pocket->row_num; i++)
   {
     /* Zig Zag */
@@ -148,7 +259,7 @@ gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t d
           continue;
 
         /*
-        * This retract exists because it is not guaranteed that the next pass of the zig-zag will remove material that should remain, e.g.
+        * The link used to retract every time because it is not guaranteed that the next pass of the zig-zag will remove material that should remain, e.g.
         * +---------------+
         * +---*********---+
         * +------***------+
@@ -156,17 +267,13 @@ gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t d
         * +---------------+
         * where "*" is the path of the end-mill.
         */
-        GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
-        gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", pocket->row_array[i].line_array[j][1], pocket->row_array[i].y);
-        GCODE_APPEND(code_block, string);
-
-        /* Only rapid plunge if depth is lower than rapid_depth */
-        if (rapid_depth >= depth-GCODE_PRECISION)
-          GCODE_PLUNGE_RAPID(code_block, rapid_depth);
-        GCODE_PLUNGE(code_block, depth, tool);
+        gcode_pocket_link (pocket, code_block, row, x, i, pocket->row_array[i].line_array[j][1], depth, rapid_depth, tool);
 
         gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", pocket->row_array[i].line_array[j][0], pocket->row_array[i].y);
         GCODE_APPEND(code_block, string);
+
+        row = i;
+        x = pocket->row_array[i].line_array[j][0];
       }
     }
     else
@@ -177,103 +284,785 @@ gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t d
         if (fabs (pocket->row_array[i].line_array[j][0] - pocket->row_array[i].line_array[j][1]) < tool->diam)
           continue;
 
-        /* This retract exists because it is not guaranteed that the next pass of the zig-zag will remove material that should remain. */
-        GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
-
-        gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", pocket->row_array[i].line_array[j][0], pocket->row_array[i].y);
-        GCODE_APPEND(code_block, string);
-
-        if (rapid_depth >= depth-GCODE_PRECISION)
-          GCODE_PLUNGE_RAPID(code_block, rapid_depth);
-        GCODE_PLUNGE(code_block, depth, tool);
+        gcode_pocket_link (pocket, code_block, row, x, i, pocket->row_array[i].line_array[j][0], depth, rapid_depth, tool);
 
         gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", pocket->row_array[i].line_array[j][1], pocket->row_array[i].y);
         GCODE_APPEND(code_block, string);
+
+        row = i;
+        x = pocket->row_array[i].line_array[j][1];
       }
     }
-/*    row ^= 1; */
   }
 
   GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
 }
 
 
+/*
+* Replace row a with what op keeps of a and b, both sorted lines that do
+* not overlap, as is the result.  Ends of either row are taken in order in
+* one pass, so the time is that of the two rows together, and no more
+* lines can come of it than the two have.  Lines left shorter than the
+* precision are dropped.
+*/
+static void
+gcode_pocket_row_merge (gcode_pocket_row_t *row_a, gcode_pocket_row_t *row_b, int op)
+{
+  gcode_pocket_row_t out;
+  gfloat_t x, xa, xb, start;
+  int i, j, in_a, in_b, keep, kept;
+
+  out.line_num = 0;
+  out.line_max = row_a->line_num + row_b->line_num;
+  out.line_array = (gcode_vec2d_t *) malloc ((out.line_max ? out.line_max : 1) * sizeof (gcode_vec2d_t));
+  out.y = row_a->y;
+
+  /* i and j count ends, even ones start a line */
+  i = 0;
+  j = 0;
+  in_a = 0;
+  in_b = 0;
+  kept = 0;
+  start = 0.0;
+  while (i < 2 * row_a->line_num || j < 2 * row_b->line_num)
+  {
+    xa = i < 2 * row_a->line_num ? row_a->line_array[i/2][i%2] : 0.0;
+    xb = j < 2 * row_b->line_num ? row_b->line_array[j/2][j%2] : 0.0;
+    if (i >= 2 * row_a->line_num)
+      x = xb;
+    else if (j >= 2 * row_b->line_num)
+      x = xa;
+    else
+      x = xa < xb ? xa : xb;
+
+    /* Ends that meet are passed together, so lines that touch join up */
+    while (i < 2 * row_a->line_num && row_a->line_array[i/2][i%2] <= x + GCODE_PRECISION)
+      in_a = !(i++ % 2);
+    while (j < 2 * row_b->line_num && row_b->line_array[j/2][j%2] <= x + GCODE_PRECISION)
+      in_b = !(j++ % 2);
+
+    switch (op)
+    {
+      case GCODE_POCKET_UNION:
+        keep = in_a || in_b;
+        break;
+
+      case GCODE_POCKET_SUBTRACT:
+        keep = in_a && !in_b;
+        break;
+
+      default:
+        keep = in_a && in_b;
+        break;
+    }
+
+    if (keep && !kept)
+    {
+      start = x;
+    }
+    else if (kept && !keep && x - start > GCODE_PRECISION)
+    {
+      out.line_array[out.line_num][0] = start;
+      out.line_array[out.line_num][1] = x;
+      out.line_num++;
+    }
+    kept = keep;
+  }
+
+  free (row_a->line_array);
+  *row_a = out;
+}
+
+
+/*
+* Apply op to each row of pocket_a and the same row of pocket_b, prepared
+* alike: GCODE_POCKET_UNION adds the lines of pocket_b to pocket_a,
+* GCODE_POCKET_SUBTRACT takes them out and GCODE_POCKET_INTERSECT keeps
+* only what both have.
+*/
 void
-gcode_pocket_subtract (gcode_pocket_t *pocket_a, gcode_pocket_t *pocket_b)
+gcode_pocket_merge (gcode_pocket_t *pocket_a, gcode_pocket_t *pocket_b, int op)
 {
-  int i, j, k, l;
+  gcode_pocket_row_t empty;
+  int i;
+
+  empty.line_num = 0;
+  empty.line_max = 0;
+  empty.line_array = NULL;
 
+  pocket_a->seg_num = 0;
   for (i = 0; i < pocket_a->row_num; i++)
   {
-    for (j = 0; j < pocket_a->row_array[i].line_num; j++)
+    gcode_pocket_row_merge (&pocket_a->row_array[i], i < pocket_b->row_num ? &pocket_b->row_array[i] : &empty, op);
+    pocket_a->seg_num += pocket_a->row_array[i].line_num;
+  }
+}
+
+
+static void
+gcode_pocket_ring_seg (gcode_block_t *code_block, gcode_contour_seg_t *seg)
+{
+  char string[256];
+
+  if (seg->type == GCODE_CONTOUR_ARC)
+  {
+    gsprintf (string, code_block->gcode->decimal, "%s X%z Y%z I%z J%z\n", seg->sweep < 0.0 ? "G02" : "G03", seg->p1[0], seg->p1[1], seg->center[0]-seg->p0[0], seg->center[1]-seg->p0[1]);
+  }
+  else
+  {
+    gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", seg->p1[0], seg->p1[1]);
+  }
+  GCODE_APPEND(code_block, string);
+}
+
+
+static void
+gcode_pocket_ring_loop (gcode_block_t *code_block, gcode_contour_t *contour)
+{
+  int i;
+
+  for (i = 0; i < contour->seg_num; i++)
+    gcode_pocket_ring_seg (code_block, &contour->seg[i]);
+}
+
+
+/* Back along the chain from the end of its last segment to the start of its first */
+static void
+gcode_pocket_ring_back (gcode_block_t *code_block, gcode_contour_t *contour)
+{
+  gcode_contour_seg_t *seg;
+  char string[256];
+  int i;
+
+  for (i = contour->seg_num - 1; i >= 0; i--)
+  {
+    seg = &contour->seg[i];
+    if (seg->type == GCODE_CONTOUR_ARC)
+    {
+      gsprintf (string, code_block->gcode->decimal, "%s X%z Y%z I%z J%z\n", seg->sweep < 0.0 ? "G03" : "G02", seg->p0[0], seg->p0[1], seg->center[0]-seg->p1[0], seg->center[1]-seg->p1[1]);
+    }
+    else
+    {
+      gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", seg->p0[0], seg->p0[1]);
+    }
+    GCODE_APPEND(code_block, string);
+  }
+}
+
+
+/*
+* Offset the contour in every step until nothing is left of it, and hang
+* each loop under the loop of the ring before that it is inside of.  With
+* outline set the contour itself heads the tree as the first loop.  Loops
+* of a ring are well clear of those of the ring before, so testing any one
+* point of them will do.  Returns how many loops head trees, which come
+* first in loop.
+*/
+static int
+gcode_pocket_loops (gcode_contour_t *contour, gfloat_t step, int outline, gcode_contour_ring_t **ring, int *ring_num, gcode_pocket_loop_t **loop)
+{
+  gfloat_t *distance, side;
+  int loop_num, i, j, k, l, first, next_first;
+
+  /* No loop lies deeper in than the radius of a circle as big as the whole */
+  *ring_num = (int) (sqrt (fabs (gcode_contour_area (contour)) / GCODE_PI) / step) + 1;
+
+  /* Inside is to the left of counter clockwise travel, where distances are negative */
+  side = gcode_contour_area (contour) > 0.0 ? -1.0 : 1.0;
+
+  distance = (gfloat_t *) malloc (*ring_num * sizeof (gfloat_t));
+  *ring = (gcode_contour_ring_t *) malloc (*ring_num * sizeof (gcode_contour_ring_t));
+  for (i = 0; i < *ring_num; i++)
+    distance[i] = side * (i + 1) * step;
+  gcode_contour_offset (contour, distance, *ring_num, *ring);
+  free (distance);
+
+  loop_num = outline;
+  for (i = 0; i < *ring_num; i++)
+    loop_num += (*ring)[i].loop_num;
+  *loop = (gcode_pocket_loop_t *) malloc ((loop_num ? loop_num : 1) * sizeof (gcode_pocket_loop_t));
+
+  k = 0;
+  if (outline)
+  {
+    (*loop)[0].contour = contour;
+    (*loop)[0].distance = 0.0;
+    (*loop)[0].child = -1;
+    (*loop)[0].sibling = -1;
+    k = 1;
+  }
+
+  first = 0;
+  for (i = 0; i < *ring_num; i++)
+  {
+    next_first = k;
+    for (j = 0; j < (*ring)[i].loop_num; j++, k++)
     {
-      /*
-      * Compare each line in pocket_a with each line in pocket_b.
-      * If there is an overlap of a line from pocket_b with a line in pocket_a
-      * then subtract it from pocket_a.
-      */
+      (*loop)[k].contour = &(*ring)[i].loop[j];
+      (*loop)[k].distance = (i + 1) * step;
+      (*loop)[k].child = -1;
+      (*loop)[k].sibling = -1;
 
-      for (k = 0; k < pocket_b->row_array[i].line_num; k++)
+      for (l = first; l < next_first; l++)
       {
-        /*
-        * CASE 1: *---+---+---*   contained within (or complete overlap)
-        * CASE 2: *---+---*---+   overlap right
-        * CASE 3: +---*---+---*   overlap left
-        * Where '*' is pocket_a and '+' is pocket_b.
-        */
-#if 0
-printf ("%.12f > %.12f && %.12f < %.12f && %.12f > %.12f && %.12f < %.12f\n",
-pocket_b->row_array[i].line_array[k][0],
-pocket_a->row_array[i].line_array[j][0],
-pocket_b->row_array[i].line_array[k][0],
-pocket_a->row_array[i].line_array[j][1],
-pocket_b->row_array[i].line_array[k][1],
-pocket_a->row_array[i].line_array[j][0],
-pocket_b->row_array[i].line_array[k][1],
-pocket_a->row_array[i].line_array[j][1]);
-#endif
-
-        if (pocket_b->row_array[i].line_array[k][0]+GCODE_PRECISION >= pocket_a->row_array[i].line_array[j][0] &&
-            pocket_b->row_array[i].line_array[k][0]-GCODE_PRECISION <= pocket_a->row_array[i].line_array[j][1] &&
-            pocket_b->row_array[i].line_array[k][1]+GCODE_PRECISION >= pocket_a->row_array[i].line_array[j][0] &&
-            pocket_b->row_array[i].line_array[k][1]-GCODE_PRECISION <= pocket_a->row_array[i].line_array[j][1])
-        {
-          /* CASE 1: split into 2 lines, shift all lines up one, insert new line into free slot */
-          for (l = pocket_a->row_array[i].line_num-1; l > j; l--)
-          {
-            pocket_a->row_array[i].line_array[l+1][0] = pocket_a->row_array[i].line_array[l][0];
-            pocket_a->row_array[i].line_array[l+1][1] = pocket_a->row_array[i].line_array[l][1];
-          }
-
-          /* Line j is now a free slot, everything has been shifted up 1 slot */
-          pocket_a->row_array[i].line_array[j+1][0] = pocket_b->row_array[i].line_array[k][1];
-          pocket_a->row_array[i].line_array[j+1][1] = pocket_a->row_array[i].line_array[j][1];
-
-          /* trim existing line to beginning of overlapping line */
-          pocket_a->row_array[i].line_array[j][1] = pocket_b->row_array[i].line_array[k][0];
-
-          /* Increment the number of lines */
-          pocket_a->row_array[i].line_num++;
-#if 0
-if (pocket_a->row_array[i].line_num == 2)
-  printf ("lines: %d, %f to %f and %f to %f  at  %f\n", pocket_a->row_array[i].line_num, pocket_a->row_array[i].line_array[0][0], pocket_a->row_array[i].line_array[0][1], pocket_a->row_array[i].line_array[1][0], pocket_a->row_array[i].line_array[1][1], ((gfloat_t) i) * pocket_a->resolution);
-#endif
-          /* Increment to newly created line */
-          j++;
-        }
-        else if (pocket_b->row_array[i].line_array[k][0] > pocket_a->row_array[i].line_array[j][0] &&
-                 pocket_b->row_array[i].line_array[k][0] < pocket_a->row_array[i].line_array[j][1])
+        if (gcode_contour_inside ((*loop)[l].contour, (*loop)[k].contour->seg[0].p0))
         {
-          /* CASE 2 */
-          pocket_a->row_array[i].line_array[j][1] = pocket_b->row_array[i].line_array[k][0];
-        }
-        else if (pocket_b->row_array[i].line_array[k][1] > pocket_a->row_array[i].line_array[j][0] &&
-                 pocket_b->row_array[i].line_array[k][1] < pocket_a->row_array[i].line_array[j][1])
-        {
-          /* CASE 3 */
-          pocket_a->row_array[i].line_array[j][0] = pocket_b->row_array[i].line_array[k][1];
+          (*loop)[k].sibling = (*loop)[l].child;
+          (*loop)[l].child = k;
+          break;
         }
       }
     }
+    first = next_first;
+  }
+
+  return (outline ? 1 : (*ring)[0].loop_num);
+}
+
+
+/*
+* Step over from pos to p at depth when the straight move is shorter than
+* pos_distance, how far the end mill is from the outline, as then it
+* cannot reach the outline on the way.  Returns 1 when it is too far and
+* the end mill has to come up instead.
+*/
+static int
+gcode_pocket_ring_link (gcode_block_t *code_block, gfloat_t *pos, gfloat_t pos_distance, gcode_vec2d_t p)
+{
+  char string[256];
+
+  if (pos_distance <= 0.0 || sqrt ((p[0]-pos[0])*(p[0]-pos[0]) + (p[1]-pos[1])*(p[1]-pos[1])) >= pos_distance)
+    return (1);
+
+  gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", p[0], p[1]);
+  GCODE_APPEND(code_block, string);
+
+  return (0);
+}
+
+
+/*
+* Cut the loops inside loop n, innermost first, then loop n itself.  Only
+* moving off to the next island of a ring split in two is usually too far
+* to stay down.
+*/
+static void
+gcode_pocket_ring_cut (gcode_block_t *code_block, gcode_pocket_loop_t *loop, int n, gfloat_t *pos, gfloat_t *pos_distance, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_contour_t *contour;
+  char string[256];
+  int i;
+
+  for (i = loop[n].child; i >= 0; i = loop[i].sibling)
+    gcode_pocket_ring_cut (code_block, loop, i, pos, pos_distance, depth, rapid_depth, tool);
+
+  contour = loop[n].contour;
+  if (*pos_distance > 0.0)
+    gcode_contour_start_at (contour, pos);
+
+  if (gcode_pocket_ring_link (code_block, pos, *pos_distance, contour->seg[0].p0))
+  {
+    GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+    gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", contour->seg[0].p0[0], contour->seg[0].p0[1]);
+    GCODE_APPEND(code_block, string);
+
+    if (rapid_depth >= depth-GCODE_PRECISION)
+      GCODE_PLUNGE_RAPID(code_block, rapid_depth);
+    GCODE_PLUNGE(code_block, depth, tool);
   }
+
+  gcode_pocket_ring_loop (code_block, contour);
+
+  pos[0] = contour->seg[0].p0[0];
+  pos[1] = contour->seg[0].p0[1];
+  *pos_distance = loop[n].distance;
+}
+
+
+/*
+* Clear the inside of the closed list from start_block with loops offset
+* in from it every resolution, rather than in rows.  Each ring is linked
+* to the one around it at depth, so the end mill comes up only between
+* islands.  Returns 1 when the list is not a closed chain of lines and
+* arcs, leaving rows to do the pocket.
+*/
+int
+gcode_pocket_rings (gcode_block_t *code_block, gcode_block_t *start_block, gcode_block_t *end_block, gfloat_t resolution, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_contour_t contour;
+  gcode_contour_ring_t *ring;
+  gcode_pocket_loop_t *loop;
+  gfloat_t pos[2], pos_distance;
+  int ring_num, root_num, i;
+
+  gcode_contour_init (&contour);
+  if (gcode_contour_from_list (&contour, start_block, end_block) || resolution < GCODE_PRECISION)
+  {
+    gcode_contour_free (&contour);
+    return (1);
+  }
+
+  root_num = gcode_pocket_loops (&contour, resolution, 0, &ring, &ring_num, &loop);
+
+  if (root_num)
+    GCODE_COMMENT (code_block, "POCKETING");
+
+  /* Each loop of the first ring heads a spiral of its own */
+  pos_distance = 0.0;
+  for (i = 0; i < root_num; i++)
+    gcode_pocket_ring_cut (code_block, loop, i, pos, &pos_distance, depth, rapid_depth, tool);
+
+  if (root_num)
+    GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+
+  for (i = 0; i < ring_num; i++)
+    gcode_contour_ring_free (&ring[i]);
+  free (loop);
+  free (ring);
+  gcode_contour_free (&contour);
+
+  return (0);
+}
+
+
+/* One whole turn about center starting and ending at p, Z going down to depth on the way */
+static void
+gcode_pocket_adaptive_circle (gcode_block_t *code_block, gcode_vec2d_t p, gcode_vec2d_t center, gfloat_t dir, gfloat_t *depth)
+{
+  char string[256];
+
+  if (depth)
+  {
+    gsprintf (string, code_block->gcode->decimal, "%s X%z Y%z Z%z I%z J%z\n", dir < 0.0 ? "G02" : "G03", p[0], p[1], code_block->gcode->material_origin[2] + *depth, center[0]-p[0], center[1]-p[1]);
+  }
+  else
+  {
+    gsprintf (string, code_block->gcode->decimal, "%s X%z Y%z I%z J%z\n", dir < 0.0 ? "G02" : "G03", p[0], p[1], center[0]-p[0], center[1]-p[1]);
+  }
+  GCODE_APPEND(code_block, string);
+}
+
+
+/*
+* Come down to depth at p.  Where there is room for a circle of radius
+* about center the end mill goes down it in a helix no steeper than step
+* a turn, so it never has to cut with the end alone.
+*/
+static void
+gcode_pocket_adaptive_enter (gcode_block_t *code_block, gcode_vec2d_t p, gcode_vec2d_t center, gfloat_t radius, gfloat_t dir, gfloat_t step, gfloat_t feed, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  char string[256];
+  gfloat_t z;
+  int i, turn_num;
+
+  GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+  gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", p[0], p[1]);
+  GCODE_APPEND(code_block, string);
+
+  if (rapid_depth >= depth-GCODE_PRECISION)
+    GCODE_PLUNGE_RAPID(code_block, rapid_depth);
+
+  if (radius < step || rapid_depth < depth+GCODE_PRECISION)
+  {
+    GCODE_PLUNGE(code_block, depth, tool);
+  }
+  else
+  {
+    sprintf (string, "F%.3f ", tool->feed);
+    GCODE_APPEND(code_block, string);
+    GCODE_COMMENT(code_block, "ramp feed rate");
+
+    turn_num = (int) ceil ((rapid_depth - depth) / step);
+    for (i = 1; i <= turn_num; i++)
+    {
+      z = rapid_depth - (rapid_depth - depth) * i / turn_num;
+      gcode_pocket_adaptive_circle (code_block, p, center, dir, &z);
+    }
+  }
+
+  sprintf (string, "F%.3f ", feed);
+  GCODE_APPEND(code_block, string);
+  GCODE_COMMENT(code_block, "adaptive feed rate");
+}
+
+
+/* Equal layers from rapid_depth down to depth, none deeper than layer */
+static int
+gcode_pocket_adaptive_layer_num (gfloat_t layer, gfloat_t depth, gfloat_t rapid_depth)
+{
+  int layer_num;
+
+  layer_num = layer > GCODE_PRECISION ? (int) ceil ((rapid_depth - depth) / layer - GCODE_PRECISION) : 1;
+
+  return (layer_num < 1 ? 1 : layer_num);
+}
+
+
+/*
+* Cut a loop with no room inside it for circles, where the end mill takes
+* its whole width, around once a layer at the normal feed.
+*/
+static void
+gcode_pocket_adaptive_full (gcode_block_t *code_block, gcode_contour_t *contour, gfloat_t feed, gfloat_t layer, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  char string[256];
+  int i, layer_num;
+
+  GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+  gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", contour->seg[0].p0[0], contour->seg[0].p0[1]);
+  GCODE_APPEND(code_block, string);
+
+  if (rapid_depth >= depth-GCODE_PRECISION)
+    GCODE_PLUNGE_RAPID(code_block, rapid_depth);
+
+  layer_num = gcode_pocket_adaptive_layer_num (layer, depth, rapid_depth);
+  for (i = 1; i <= layer_num; i++)
+  {
+    GCODE_PLUNGE(code_block, rapid_depth - (rapid_depth - depth) * i / layer_num, tool);
+    gcode_pocket_ring_loop (code_block, contour);
+  }
+
+  sprintf (string, "F%.3f ", feed);
+  GCODE_APPEND(code_block, string);
+  GCODE_COMMENT(code_block, "adaptive feed rate");
+}
+
+
+/*
+* Cut the stretches of loop n that are more than GCODE_POCKET_ADAPTIVE_REACH
+* steps from every loop inside it, necks and arms too narrow for the ring
+* inside to reach into.  Going round the loop the end mill would take its
+* whole width there, so each stretch is first slotted along the loop, back
+* and forth a layer at a time at the normal feed.  Returns 1 when anything
+* was cut, with the end mill left down at pos, on the loop.
+*/
+static int
+gcode_pocket_adaptive_reach (gcode_block_t *code_block, gcode_pocket_loop_t *loop, int n, gfloat_t step, gfloat_t feed, gfloat_t layer, gfloat_t *pos, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_vec2d_t *point, *tangent;
+  gcode_contour_t part;
+  char string[256];
+  gfloat_t dist, best;
+  uint8_t *far;
+  int i, j, k, l, a, b, point_num, layer_num, cut;
+
+  point_num = gcode_contour_sample (loop[n].contour, step, &point, &tangent);
+  far = (uint8_t *) malloc (point_num);
+
+  k = -1;
+  for (i = 0; i < point_num; i++)
+  {
+    best = -1.0;
+    for (j = loop[n].child; j >= 0; j = loop[j].sibling)
+    {
+      dist = gcode_contour_distance (loop[j].contour, point[i]);
+      if (best < 0.0 || dist < best)
+        best = dist;
+    }
+
+    far[i] = best < 0.0 || best > GCODE_POCKET_ADAPTIVE_REACH * step;
+    if (!far[i])
+      k = i;
+  }
+
+  cut = 0;
+  layer_num = gcode_pocket_adaptive_layer_num (layer, depth, rapid_depth);
+
+  /* Stretches run from the point before the first far one to the point after the last, both within reach */
+  for (i = 1; k >= 0 && i <= point_num; i++)
+  {
+    a = (k + i) % point_num;
+    if (!far[a] || far[(a + point_num - 1) % point_num])
+      continue;
+
+    for (b = a; far[b]; b = (b + 1) % point_num);
+    a = (a + point_num - 1) % point_num;
+
+    /* Points are step apart from the start of the loop */
+    gcode_contour_part (loop[n].contour, a * step, b * step, &part);
+    if (!part.seg_num)
+    {
+      gcode_contour_free (&part);
+      continue;
+    }
+
+    GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+    gsprintf (string, code_block->gcode->decimal, "G00 X%z Y%z\n", part.seg[0].p0[0], part.seg[0].p0[1]);
+    GCODE_APPEND(code_block, string);
+
+    if (rapid_depth >= depth-GCODE_PRECISION)
+      GCODE_PLUNGE_RAPID(code_block, rapid_depth);
+
+    /* Odd layers go along the loop, even ones back */
+    for (l = 1; l <= layer_num; l++)
+    {
+      GCODE_PLUNGE(code_block, rapid_depth - (rapid_depth - depth) * l / layer_num, tool);
+      if (l & 1)
+      {
+        gcode_pocket_ring_loop (code_block, &part);
+      }
+      else
+      {
+        gcode_pocket_ring_back (code_block, &part);
+      }
+    }
+
+    if (layer_num & 1)
+    {
+      pos[0] = part.seg[part.seg_num-1].p1[0];
+      pos[1] = part.seg[part.seg_num-1].p1[1];
+    }
+    else
+    {
+      pos[0] = part.seg[0].p0[0];
+      pos[1] = part.seg[0].p0[1];
+    }
+    cut = 1;
+
+    gcode_contour_free (&part);
+  }
+
+  if (cut)
+  {
+    sprintf (string, "F%.3f ", feed);
+    GCODE_APPEND(code_block, string);
+    GCODE_COMMENT(code_block, "adaptive feed rate");
+  }
+
+  free (far);
+  free (point);
+  free (tangent);
+
+  return (cut);
+}
+
+
+/*
+* Cut an innermost loop as a slot of circles step apart along it, each
+* wider than the loop by radius either side, rather than in one pass
+* with the whole end mill in the work.  The circles stay within distance
+* of the loop, how far it is from the outline.  Without room for them the
+* loop is cut whole width a layer at a time.
+*/
+static void
+gcode_pocket_adaptive_slot (gcode_block_t *code_block, gcode_contour_t *contour, gfloat_t distance, gfloat_t dir, gfloat_t step, gfloat_t feed, gfloat_t layer, gfloat_t *pos, gfloat_t *pos_distance, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_vec2d_t *point, *tangent, p;
+  char string[256];
+  gfloat_t radius;
+  int i, point_num;
+
+  /* Room is left for the moves between circles bowing out past a curved loop */
+  radius = 0.8 * distance;
+  if (radius > 0.5 * tool->diam)
+    radius = 0.5 * tool->diam;
+
+  if (radius < 0.25 * step)
+  {
+    gcode_pocket_adaptive_full (code_block, contour, feed, layer, depth, rapid_depth, tool);
+
+    pos[0] = contour->seg[0].p0[0];
+    pos[1] = contour->seg[0].p0[1];
+    *pos_distance = distance;
+    return;
+  }
+
+  point_num = gcode_contour_sample (contour, step, &point, &tangent);
+
+  /* There is always a point, but without one the end mill stays put */
+  p[0] = pos[0];
+  p[1] = pos[1];
+
+  for (i = 0; i < point_num; i++)
+  {
+    /* Each circle starts ahead of its center, heading the way the slot goes */
+    p[0] = point[i][0] + radius * tangent[i][0];
+    p[1] = point[i][1] + radius * tangent[i][1];
+
+    if (i)
+    {
+      gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", p[0], p[1]);
+      GCODE_APPEND(code_block, string);
+    }
+    else if (gcode_pocket_ring_link (code_block, pos, *pos_distance, p))
+    {
+      gcode_pocket_adaptive_enter (code_block, p, point[i], radius, dir, step, feed, depth, rapid_depth, tool);
+    }
+
+    gcode_pocket_adaptive_circle (code_block, p, point[i], dir, NULL);
+  }
+
+  pos[0] = p[0];
+  pos[1] = p[1];
+  *pos_distance = distance - radius;
+
+  free (point);
+  free (tangent);
+}
+
+
+/*
+* Cut a loop around one already cut a step in from it.  Along the sides
+* the end mill takes step, but at a corner turning in the last loop is
+* step over the sine of half the corner from it, so before reaching each
+* such corner between lines the end mill goes round circles that fit the
+* corner, each a step further into it than the one before.
+*/
+static void
+gcode_pocket_adaptive_loop (gcode_block_t *code_block, gcode_contour_t *contour, gfloat_t dir, gfloat_t step)
+{
+  gcode_contour_seg_t *seg, *next;
+  gcode_vec2d_t u0, u1, bisect, a, center;
+  char string[256];
+  gfloat_t half, corner, e, t, along, len0, len1;
+  int i, j;
+
+  for (i = 0; i < contour->seg_num; i++)
+  {
+    seg = &contour->seg[i];
+    next = &contour->seg[(i + 1) % contour->seg_num];
+
+    if (seg->type != GCODE_CONTOUR_LINE || next->type != GCODE_CONTOUR_LINE || contour->seg_num < 3)
+    {
+      gcode_pocket_ring_seg (code_block, seg);
+      continue;
+    }
+
+    GCODE_MATH_VEC2D_SUB (u0, seg->p1, seg->p0);
+    GCODE_MATH_VEC2D_SUB (u1, next->p1, next->p0);
+    GCODE_MATH_VEC2D_MAG (len0, u0);
+    GCODE_MATH_VEC2D_MAG (len1, u1);
+
+    if (len0 > GCODE_PRECISION && len1 > GCODE_PRECISION && dir * (u0[0]*u1[1] - u0[1]*u1[0]) > 0.0)
+    {
+      GCODE_MATH_VEC2D_SCALE (u0, 1.0 / len0);
+      GCODE_MATH_VEC2D_SCALE (u1, 1.0 / len1);
+
+      /* Sine of half the corner, from the cosine of the whole turn */
+      half = sqrt (0.5 * (1.0 + u0[0]*u1[0] + u0[1]*u1[1]));
+      corner = half > GCODE_PRECISION ? step / half : 0.0;
+
+      GCODE_MATH_VEC2D_SUB (bisect, u1, u0);
+      GCODE_MATH_VEC2D_UNITIZE (bisect);
+
+      /* Circle j touches both lines and comes e short of the corner */
+      for (j = 0; corner > GCODE_POCKET_ADAPTIVE_CORNER * step && half < 1.0 - GCODE_PRECISION; j++)
+      {
+        e = corner - (j + 1) * step;
+        if (e < GCODE_PRECISION)
+          break;
+
+        t = e / (1.0 - half);
+        along = t * sqrt (1.0 - half*half);
+        if (along > len0 || along > len1)
+          continue;
+
+        a[0] = seg->p1[0] - along * u0[0];
+        a[1] = seg->p1[1] - along * u0[1];
+        center[0] = seg->p1[0] + t * bisect[0];
+        center[1] = seg->p1[1] + t * bisect[1];
+
+        gsprintf (string, code_block->gcode->decimal, "G01 X%z Y%z\n", a[0], a[1]);
+        GCODE_APPEND(code_block, string);
+        gcode_pocket_adaptive_circle (code_block, a, center, dir, NULL);
+      }
+    }
+
+    gcode_pocket_ring_seg (code_block, seg);
+  }
+}
+
+
+/* Cut the loops inside loop n, innermost first as slots, then loop n itself */
+static void
+gcode_pocket_adaptive_cut (gcode_block_t *code_block, gcode_pocket_loop_t *loop, int n, gfloat_t step, gfloat_t feed, gfloat_t layer, gfloat_t *pos, gfloat_t *pos_distance, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_contour_t *contour;
+  gfloat_t dir;
+  int i;
+
+  for (i = loop[n].child; i >= 0; i = loop[i].sibling)
+    gcode_pocket_adaptive_cut (code_block, loop, i, step, feed, layer, pos, pos_distance, depth, rapid_depth, tool);
+
+  contour = loop[n].contour;
+  if (*pos_distance > 0.0)
+    gcode_contour_start_at (contour, pos);
+  dir = gcode_contour_area (contour) > 0.0 ? 1.0 : -1.0;
+
+  if (loop[n].child < 0)
+  {
+    gcode_pocket_adaptive_slot (code_block, contour, loop[n].distance, dir, step, feed, layer, pos, pos_distance, depth, rapid_depth, tool);
+    return;
+  }
+
+  if (gcode_pocket_adaptive_reach (code_block, loop, n, step, feed, layer, pos, depth, rapid_depth, tool))
+    gcode_contour_start_at (contour, pos);
+  else if (gcode_pocket_ring_link (code_block, pos, *pos_distance, contour->seg[0].p0))
+    gcode_pocket_adaptive_enter (code_block, contour->seg[0].p0, contour->seg[0].p0, 0.0, dir, step, feed, depth, rapid_depth, tool);
+
+  gcode_pocket_adaptive_loop (code_block, contour, dir, step);
+
+  pos[0] = contour->seg[0].p0[0];
+  pos[1] = contour->seg[0].p0[1];
+  *pos_distance = loop[n].distance;
+}
+
+
+/*
+* Clear the inside of the closed list from start_block in rings step
+* apart out to the outline itself, so the end mill never cuts more than
+* step into the wall.  Innermost loops are cut in circles and corners are
+* eased into with circles, where the end mill would otherwise take more.
+* With so little of the end mill in the work the feed is raised by how
+* much thinner that makes the chips, and depth may be taken in one pass
+* that rows would take in many.  Wherever there is no such room and the
+* end mill would take its whole width it goes down no more than layer at
+* a time, at the normal feed.  Returns 1 when the list is not a closed
+* chain of lines and arcs, leaving rows to do the pocket.
+*/
+int
+gcode_pocket_adaptive (gcode_block_t *code_block, gcode_block_t *start_block, gcode_block_t *end_block, gfloat_t step, gfloat_t layer, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool)
+{
+  gcode_contour_t contour;
+  gcode_contour_ring_t *ring;
+  gcode_pocket_loop_t *loop;
+  char string[256];
+  gfloat_t pos[2], pos_distance, feed, k;
+  int ring_num, i;
+
+  gcode_contour_init (&contour);
+  if (gcode_contour_from_list (&contour, start_block, end_block) || step < GCODE_PRECISION)
+  {
+    gcode_contour_free (&contour);
+    return (1);
+  }
+
+  gcode_pocket_loops (&contour, step, 1, &ring, &ring_num, &loop);
+
+  /* Chip thinning, the chip is as thick as at full width where the end mill leaves the wall */
+  feed = tool->feed;
+  if (step < 0.5 * tool->diam)
+  {
+    k = 1.0 - 2.0 * step / tool->diam;
+    feed = tool->feed / sqrt (1.0 - k*k);
+  }
+
+  GCODE_COMMENT (code_block, "POCKETING");
+
+  pos_distance = 0.0;
+  gcode_pocket_adaptive_cut (code_block, loop, 0, step, feed, layer, pos, &pos_distance, depth, rapid_depth, tool);
+
+  GCODE_RETRACT(code_block, code_block->gcode->ztraverse);
+  sprintf (string, "F%.3f ", tool->feed);
+  GCODE_APPEND(code_block, string);
+  GCODE_COMMENT(code_block, "normal feed rate");
+
+  for (i = 0; i < ring_num; i++)
+    gcode_contour_ring_free (&ring[i]);
+  free (loop);
+  free (ring);
+  gcode_contour_free (&contour);
+
+  return (0);
 }
@@ -22,9 +22,20 @@
 #include "gcode_internal.h"
 #include "gcode_tool.h"
 
+#define GCODE_POCKET_UNION	0x0
+#define GCODE_POCKET_SUBTRACT	0x1
+#define GCODE_POCKET_INTERSECT	0x2
+
+#define GCODE_POCKET_ADAPTIVE_STEP	0.1	/* of the diameter, most taken into the wall by adaptive clearing */
+#define GCODE_POCKET_ADAPTIVE_DEPTH	2.0	/* of the diameter, most taken down in one adaptive pass */
+#define GCODE_POCKET_ADAPTIVE_CORNER	1.2	/* of the step, most taken into a corner without easing in */
+#define GCODE_POCKET_ADAPTIVE_REACH	2.0	/* of the step, farthest a loop goes from the one inside it before being slotted */
+
+/* Lines along one row, sorted and apart */
 typedef struct gcode_pocket_row_s
 {
   int line_num;
+  int line_max;
   gcode_vec2d_t *line_array;
   gfloat_t y;
 } gcode_pocket_row_t;
@@ -41,6 +52,8 @@ void gcode_pocket_init (gcode_pocket_t *pocket, gfloat_t resolution);
 void gcode_pocket_free (gcode_pocket_t *pocket);
 void gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *start_block, gcode_block_t *end_block);
 void gcode_pocket_make (gcode_pocket_t *pocket, gcode_block_t *code_block, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool);
-void gcode_pocket_subtract (gcode_pocket_t *pocket_a, gcode_pocket_t *pocket_b);
+void gcode_pocket_merge (gcode_pocket_t *pocket_a, gcode_pocket_t *pocket_b, int op);
+int gcode_pocket_rings (gcode_block_t *code_block, gcode_block_t *start_block, gcode_block_t *end_block, gfloat_t resolution, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool);
+int gcode_pocket_adaptive (gcode_block_t *code_block, gcode_block_t *start_block, gcode_block_t *end_block, gfloat_t step, gfloat_t layer, gfloat_t depth, gfloat_t rapid_depth, gcode_tool_t *tool);
 
 #endif
@@ -52,6 +52,7 @@ gcode_point_free (gcode_block_t **block)
 {
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
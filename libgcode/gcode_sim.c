@@ -17,34 +17,401 @@
 *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "gcode_sim.h"
+#include "gcode_voxel.h"
+#include "gcode_template.h"
 #include <string.h>
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+  #define GCODE_SIM_X86 1
+  #include <immintrin.h>
+#endif
+
+
+/*
+* Clears a run of voxels.  The widest store the processor supports
+* is selected once at runtime by gcode_sim_init.
+*/
+typedef void (*gcode_sim_clear_t) (uint8_t *run, int len);
+
+static void
+gcode_sim_clear_scalar (uint8_t *run, int len)
+{
+  memset (run, 0, len);
+}
+
+#if GCODE_SIM_X86
+__attribute__ ((target ("sse2")))
+static void
+gcode_sim_clear_sse2 (uint8_t *run, int len)
+{
+  __m128i zero;
+  int i;
+
+  zero = _mm_setzero_si128 ();
+  for (i = 0; i + 16 <= len; i += 16)
+    _mm_storeu_si128 ((__m128i *) &run[i], zero);
+  for (; i < len; i++)
+    run[i] = 0;
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+gcode_sim_clear_avx2 (uint8_t *run, int len)
+{
+  __m256i zero;
+  int i;
+
+  zero = _mm256_setzero_si256 ();
+  for (i = 0; i + 32 <= len; i += 32)
+    _mm256_storeu_si256 ((__m256i *) &run[i], zero);
+  if (i + 16 <= len)
+  {
+    _mm_storeu_si128 ((__m128i *) &run[i], _mm256_castsi256_si128 (zero));
+    i += 16;
+  }
+  for (; i < len; i++)
+    run[i] = 0;
+}
+#endif
+
+static gcode_sim_clear_t gcode_sim_clear = gcode_sim_clear_scalar;
+
+
+/*
+* Number of solid voxels among x0..x1 of row y for every z in z0..z1.
+*/
+static size_t
+gcode_sim_count_span (gcode_t *gcode, int yind, int x0, int x1, int z0, int z1)
+{
+  size_t count;
+  int i, xind, zind;
+  uint8_t *run;
+
+  count = 0;
+  switch (gcode->voxel_layout)
+  {
+    case GCODE_VOXEL_LAYOUT_COLUMN:
+      for (xind = x0; xind <= x1; xind++)
+      {
+        run = &gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, xind, yind, z0)];
+        for (i = 0; i <= z1 - z0; i++)
+          count += run[i];
+      }
+      break;
+
+    case GCODE_VOXEL_LAYOUT_BRICK:
+      for (zind = z0; zind <= z1; zind++)
+        for (xind = x0; xind <= x1; xind++)
+          count += gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, xind, yind, zind)];
+      break;
+
+    default:
+      for (zind = z0; zind <= z1; zind++)
+      {
+        run = &gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, x0, yind, zind)];
+        for (i = 0; i <= x1 - x0; i++)
+          count += run[i];
+      }
+      break;
+  }
+
+  return (count);
+}
+
+
+/*
+* Clears voxels x0..x1 of row y for every z in z0..z1, issuing the
+* longest runs that are contiguous in the current voxel layout.
+*/
+static void
+gcode_sim_clear_span (gcode_t *gcode, gcode_sim_t *sim, int yind, int x0, int x1, int z0, int z1)
+{
+  int i, xind, zind, xend;
+  uint8_t *run;
+
+  gcode_voxel_touch_box (gcode, x0, x1, yind, yind, z0, z1);
+
+  if (sim->measure)
+    sim->measure_voxels += gcode_sim_count_span (gcode, yind, x0, x1, z0, z1);
+
+  gcode_voxel_dirty (gcode, x0, x1, yind, yind, z0, z1);
+
+  switch (gcode->voxel_layout)
+  {
+    case GCODE_VOXEL_LAYOUT_COLUMN:
+      /* Each X under the cutter is a single run through Z */
+      for (xind = x0; xind <= x1; xind++)
+        gcode_sim_clear (&gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, xind, yind, z0)], z1 - z0 + 1);
+      break;
+
+    case GCODE_VOXEL_LAYOUT_BRICK:
+      /* X runs end at the edge of each brick, too short to be worth a call */
+      for (xind = x0; xind <= x1; xind = xend + 1)
+      {
+        xend = xind | 7;
+        if (xend > x1)
+          xend = x1;
+
+        run = &gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, xind, yind, z0)];
+        for (zind = z0; zind <= z1; zind++)
+        {
+          /* Next Z within a brick is 64 bytes on, otherwise start a new brick */
+          if (zind != z0)
+            run = (zind & 7) ? run + 64 : &gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, xind, yind, zind)];
+          if (xend - xind == 7)
+          {
+            memset (run, 0, 8);
+          }
+          else
+          {
+            for (i = 0; i <= xend - xind; i++)
+              run[i] = 0;
+          }
+        }
+      }
+      break;
+
+    default:
+      for (zind = z0; zind <= z1; zind++)
+        gcode_sim_clear (&gcode->voxel_map[GCODE_VOXEL_INDEX (gcode, x0, yind, zind)], x1 - x0 + 1);
+      break;
+  }
+}
+
+
+/*
+* Tabulate how far above the tip the tool cuts at each voxel offset (dx, dy)
+* from its center.  Rebuilt only when the tool geometry changes.
+*/
+static void
+gcode_sim_footprint (gcode_t *gcode, gcode_sim_t *sim)
+{
+  gfloat_t cell[3], rad, corner, flat, tan_half, r, h, d;
+  int i, j, w, v;
+
+  cell[0] = sim->vn_inv[0] * gcode->voxel_span[0];
+  cell[1] = sim->vn_inv[1] * gcode->voxel_span[1];
+  cell[2] = sim->vn_inv[2] * gcode->voxel_span[2];
+
+  rad = 0.5 * sim->tool_diameter + 100.0*GCODE_PRECISION;
+  sim->footprint_rad[0] = (int) ceil (rad / cell[0]);
+  sim->footprint_rad[1] = (int) ceil (rad / cell[1]);
+  w = 2 * sim->footprint_rad[0] + 1;
+
+  sim->footprint = (int16_t *) realloc (sim->footprint, sizeof (int16_t) * w * (2 * sim->footprint_rad[1] + 1));
+
+  corner = sim->tool_corner;
+  if (corner < 0.0)
+    corner = 0.0;
+  if (corner > 0.5 * sim->tool_diameter)
+    corner = 0.5 * sim->tool_diameter;
+  flat = 0.5 * sim->tool_diameter - corner;
+
+  tan_half = tan (0.5 * sim->tool_angle * GCODE_PI / 180.0);
+
+  for (j = -sim->footprint_rad[1]; j <= sim->footprint_rad[1]; j++)
+  {
+    for (i = -sim->footprint_rad[0]; i <= sim->footprint_rad[0]; i++)
+    {
+      r = sqrt ((i * cell[0]) * (i * cell[0]) + (j * cell[1]) * (j * cell[1]));
+
+      if (r > rad)
+      {
+        sim->footprint[(j + sim->footprint_rad[1]) * w + i + sim->footprint_rad[0]] = -1;
+        continue;
+      }
+
+      switch (sim->tool_shape)
+      {
+        case GCODE_TOOL_SHAPE_BALL:
+          d = 0.5 * sim->tool_diameter;
+          h = r < d ? d - sqrt (d*d - r*r) : d;
+          break;
+
+        case GCODE_TOOL_SHAPE_VBIT:
+          h = tan_half > GCODE_PRECISION ? r / tan_half : 0.0;
+          break;
+
+        case GCODE_TOOL_SHAPE_BULL:
+          d = r - flat;
+          h = d <= 0.0 ? 0.0 : (d < corner ? corner - sqrt (corner*corner - d*d) : corner);
+          break;
+
+        default:
+          h = 0.0;
+          break;
+      }
+
+      v = (int) ceil (h / cell[2] - GCODE_PRECISION);
+      if (v > 0x7fff)
+        v = 0x7fff;
+      sim->footprint[(j + sim->footprint_rad[1]) * w + i + sim->footprint_rad[0]] = (int16_t) v;
+    }
+  }
+
+  sim->footprint_key[0] = sim->tool_diameter;
+  sim->footprint_key[1] = (gfloat_t) sim->tool_shape;
+  sim->footprint_key[2] = sim->tool_angle;
+  sim->footprint_key[3] = sim->tool_corner;
+}
+
+
+/*
+* Shaped tools: clear from the depth the footprint gives for each cell
+* under the tool up to the top of the cutter.  The tool center is
+* snapped to the nearest voxel so the table lines up with the grid.
+*/
+static void
+gcode_sim_intersect_footprint (gcode_t *gcode, gcode_sim_t *sim, gfloat_t *pos, int tip, int top)
+{
+  int i, j, w, xind, yind, zind, center[2];
+  int16_t *row;
+
+  if (sim->footprint == NULL ||
+      sim->footprint_key[0] != sim->tool_diameter ||
+      sim->footprint_key[1] != (gfloat_t) sim->tool_shape ||
+      sim->footprint_key[2] != sim->tool_angle ||
+      sim->footprint_key[3] != sim->tool_corner)
+    gcode_sim_footprint (gcode, sim);
+
+  center[0] = (int) floor (pos[0] / (sim->vn_inv[0] * gcode->voxel_span[0]) + 0.5);
+  center[1] = (int) floor (pos[1] / (sim->vn_inv[1] * gcode->voxel_span[1]) + 0.5);
+  w = 2 * sim->footprint_rad[0] + 1;
+
+  for (j = -sim->footprint_rad[1]; j <= sim->footprint_rad[1]; j++)
+  {
+    yind = center[1] + j;
+    if (yind < 0 || yind >= gcode->voxel_num[1])
+      continue;
+
+    row = &sim->footprint[(j + sim->footprint_rad[1]) * w + sim->footprint_rad[0]];
+    for (i = -sim->footprint_rad[0]; i <= sim->footprint_rad[0]; i++)
+    {
+      xind = center[0] + i;
+      if (xind < 0 || xind >= gcode->voxel_num[0] || row[i] < 0)
+        continue;
+
+      zind = tip + row[i];
+      if (zind < 0)
+        zind = 0;
+      if (zind <= top)
+        gcode_sim_clear_span (gcode, sim, yind, xind, xind, zind, top);
+    }
+  }
+}
+
+
+/*
+* Whether the cutter swept over the box lo..hi (simulator coordinates)
+* stays clear of the simulated voxels, with a voxel to spare.
+*/
+static int
+gcode_sim_outside (gcode_t *gcode, gcode_sim_t *sim, gfloat_t *lo, gfloat_t *hi)
+{
+  gfloat_t rad, cell[3], bot, top;
+  int i;
+
+  rad = 0.5 * sim->tool_diameter + 100.0*GCODE_PRECISION;
+
+  for (i = 0; i < 3; i++)
+    cell[i] = sim->vn_inv[i] * gcode->voxel_span[i];
+
+  for (i = 0; i < 2; i++)
+  {
+    if (lo[i] + sim->origin[i] - gcode->voxel_min[i] - rad > gcode->voxel_span[i] + cell[i])
+      return (1);
+    if (hi[i] + sim->origin[i] - gcode->voxel_min[i] + rad < -cell[i])
+      return (1);
+  }
+
+  /* The cutter reaches from its tip to 10x its radius above, as in gcode_sim_intersect */
+  bot = gcode->material_size[2] + (lo[2] - sim->origin[2]) - gcode->voxel_min[2];
+  top = gcode->material_size[2] + (hi[2] - sim->origin[2]) - gcode->voxel_min[2] + 10.0 * rad;
+
+  return (bot > gcode->voxel_span[2] + cell[2] || top < -cell[2]);
+}
+
+
+/*
+* Cull a straight move from orig to xyz that cannot cut anything.  The
+* tool is moved to the end and the distance still counts towards time.
+*/
+static int
+gcode_sim_cull_line (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t orig, gcode_vec3d_t xyz, gfloat_t dist)
+{
+  gcode_vec3d_t lo, hi;
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    lo[i] = orig[i] < xyz[i] ? orig[i] : xyz[i];
+    hi[i] = orig[i] < xyz[i] ? xyz[i] : orig[i];
+  }
+
+  if (!gcode_sim_outside (gcode, sim, lo, hi))
+    return (0);
+
+  sim->time_elapsed += dist;
+  GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
+  return (1);
+}
+
+
+/*
+* As gcode_sim_cull_line for an arc about orig, bounded by the whole circle.
+*/
+static int
+gcode_sim_cull_arc (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t orig, gcode_vec3d_t xyz, gfloat_t rad, gfloat_t dist)
+{
+  gcode_vec3d_t lo, hi;
+
+  GCODE_MATH_VEC3D_SET (lo, orig[0] - rad, orig[1] - rad, orig[2]);
+  GCODE_MATH_VEC3D_SET (hi, orig[0] + rad, orig[1] + rad, orig[2]);
+
+  if (!gcode_sim_outside (gcode, sim, lo, hi))
+    return (0);
+
+  sim->time_elapsed += dist;
+  GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
+  return (1);
+}
 
 
 static void
 gcode_sim_intersect (gcode_t *gcode, gcode_sim_t *sim)
 {
-  int xind, yind, zind, min[3], max[3];
-  gfloat_t pos[3], xt, yt, xd, yd, rad;
+  int yind, tip, min[3], max[3], span[2];
+  gfloat_t pos[3], cell[2], inv_cell[2], yd, rad, rad_sq, half;
 
   rad = 0.5 * sim->tool_diameter + 100.0*GCODE_PRECISION;
+  rad_sq = rad * rad;
 
   /* Increment total movement */
   sim->time_elapsed += sim->step_res;
 
-  pos[0] = sim->pos[0] + sim->origin[0];
-  pos[1] = sim->pos[1] + sim->origin[1];
-  pos[2] = sim->pos[2] - sim->origin[2];
+  if (sim->measure)
+  {
+    sim->measure_len += sim->step_res;
+    if (sim->measure_len >= sim->measure_window)
+      gcode_sim_measure_close (gcode, sim);
+  }
+
+  /* Position relative to the corner of the simulated box, Z as height above its bottom */
+  pos[0] = sim->pos[0] + sim->origin[0] - gcode->voxel_min[0];
+  pos[1] = sim->pos[1] + sim->origin[1] - gcode->voxel_min[1];
+  pos[2] = gcode->material_size[2] + (sim->pos[2] - sim->origin[2]) - gcode->voxel_min[2];
 
   /* Take into account the origin of the cutter relative to the position of the cutter */
-  min[0] = (int) ((gfloat_t) gcode->voxel_num[0]) * (pos[0]-rad) / gcode->material_size[0];
-  min[1] = (int) ((gfloat_t) gcode->voxel_num[1]) * (pos[1]-rad) / gcode->material_size[1];
-  min[2] = (int) ((gfloat_t) gcode->voxel_num[2]) * (gcode->material_size[2]+pos[2]) / gcode->material_size[2];
+  min[0] = (int) ((gfloat_t) gcode->voxel_num[0]) * (pos[0]-rad) / gcode->voxel_span[0];
+  min[1] = (int) ((gfloat_t) gcode->voxel_num[1]) * (pos[1]-rad) / gcode->voxel_span[1];
+  min[2] = (int) ((gfloat_t) gcode->voxel_num[2]) * pos[2] / gcode->voxel_span[2];
+  tip = min[2];
 
   /* Set the cutter to be 0.5" high */
-  max[0] = (int) ((gfloat_t) gcode->voxel_num[0]) * (pos[0]+rad) / gcode->material_size[0];
-  max[1] = (int) ((gfloat_t) gcode->voxel_num[1]) * (pos[1]+rad) / gcode->material_size[1];
+  max[0] = (int) ((gfloat_t) gcode->voxel_num[0]) * (pos[0]+rad) / gcode->voxel_span[0];
+  max[1] = (int) ((gfloat_t) gcode->voxel_num[1]) * (pos[1]+rad) / gcode->voxel_span[1];
   /* Because tool cutting length isn't used yet, use 10x the tool radius */
-  max[2] = (int) ((gfloat_t) gcode->voxel_num[2]) * (gcode->material_size[2]+pos[2]+(10.0 * rad)) / gcode->material_size[2];
+  max[2] = (int) ((gfloat_t) gcode->voxel_num[2]) * (pos[2]+(10.0 * rad)) / gcode->voxel_span[2];
 
   if (min[0] < 0) min[0] = 0;
   if (min[1] < 0) min[1] = 0;
@@ -54,29 +421,46 @@ gcode_sim_intersect (gcode_t *gcode, gcode_sim_t *sim)
   if (max[1] < 0) max[1] = min[1]-1;
   if (max[2] < 0) max[2] = min[2]-1;
 
-  if (max[0] >= gcode->voxel_num[0]) max[0] = gcode->voxel_num[0]-1;
-  if (max[1] >= gcode->voxel_num[1]) max[1] = gcode->voxel_num[1]-1;
-  if (max[2] >= gcode->voxel_num[2]) max[2] = gcode->voxel_num[2]-1;
+  if (max[0] >= (int) gcode->voxel_num[0]) max[0] = (int) gcode->voxel_num[0]-1;
+  if (max[1] >= (int) gcode->voxel_num[1]) max[1] = (int) gcode->voxel_num[1]-1;
+  if (max[2] >= (int) gcode->voxel_num[2]) max[2] = (int) gcode->voxel_num[2]-1;
 
-  if (min[0] >= gcode->voxel_num[0]) min[0] = max[0]+1;
-  if (min[1] >= gcode->voxel_num[1]) min[1] = max[1]+1;
-  if (min[2] >= gcode->voxel_num[2]) min[2] = max[2]+1;
+  if (min[0] >= (int) gcode->voxel_num[0]) min[0] = max[0]+1;
+  if (min[1] >= (int) gcode->voxel_num[1]) min[1] = max[1]+1;
+  if (min[2] >= (int) gcode->voxel_num[2]) min[2] = max[2]+1;
 
-/* printf ("%d %d %d -> %d %d %d\n", min[0], min[1], min[2], max[0], max[1], max[2]); */
-  for (yind = min[1]; yind <= max[1]; yind++)
+  if (min[0] > max[0] || min[2] > max[2])
+    return;
+
+  if (sim->tool_shape != GCODE_TOOL_SHAPE_FLAT)
   {
-    yt = ((gfloat_t) yind * sim->vn_inv[1]) * gcode->material_size[1];
-    yd = yt-pos[1];
+    gcode_sim_intersect_footprint (gcode, sim, pos, tip, max[2]);
+    return;
+  }
 
-    for (xind = min[0]; xind <= max[0]; xind++)
-    {
-      xt = ((gfloat_t) xind * sim->vn_inv[0]) * gcode->material_size[0];
-      xd = xt-pos[0];
+  /* Voxel centers sit at ind * cell, all of this is invariant across rows. */
+  cell[0] = sim->vn_inv[0] * gcode->voxel_span[0];
+  cell[1] = sim->vn_inv[1] * gcode->voxel_span[1];
+  inv_cell[0] = 1.0 / cell[0];
+  inv_cell[1] = 1.0 / cell[1];
 
-      if ((xd*xd + yd*yd) <= rad*rad)
-        for (zind = min[2]; zind <= max[2]; zind++)
-          gcode->voxel_map[(zind * gcode->voxel_num[1] + yind) * gcode->voxel_num[0] + xind] = 0;
-    }
+/* printf ("%d %d %d -> %d %d %d\n", min[0], min[1], min[2], max[0], max[1], max[2]); */
+  for (yind = min[1]; yind <= max[1]; yind++)
+  {
+    yd = (gfloat_t) yind * cell[1] - pos[1];
+    if (yd*yd > rad_sq)
+      continue;
+
+    /* The cutter covers the X-span |xd| <= sqrt(rad^2 - yd^2) of this row */
+    half = sqrt (rad_sq - yd*yd);
+    span[0] = (int) ceil ((pos[0] - half) * inv_cell[0]);
+    span[1] = (int) floor ((pos[0] + half) * inv_cell[0]);
+    if (span[0] < min[0]) span[0] = min[0];
+    if (span[1] > max[0]) span[1] = max[0];
+    if (span[0] > span[1])
+      continue;
+
+    gcode_sim_clear_span (gcode, sim, yind, span[0], span[1], min[2], max[2]);
   }
 }
 
@@ -166,10 +550,30 @@ gcode_sim_parse_args (gcode_sim_t *sim, char *args, gcode_vec3d_t xyz, gcode_vec
 void
 gcode_sim_init (gcode_t *gcode, gcode_sim_t *sim)
 {
+#if GCODE_SIM_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+  {
+    gcode_sim_clear = gcode_sim_clear_avx2;
+  }
+  else if (__builtin_cpu_supports ("sse2"))
+  {
+    gcode_sim_clear = gcode_sim_clear_sse2;
+  }
+  else
+#endif
+  {
+    gcode_sim_clear = gcode_sim_clear_scalar;
+  }
+
   sim->absolute = 1;
 
   sim->feed = 10;
   sim->tool_diameter = 1.0;
+  sim->tool_shape = GCODE_TOOL_SHAPE_FLAT;
+  sim->tool_angle = 90.0;
+  sim->tool_corner = 0.0;
+  sim->footprint = NULL;
   if (gcode->units == GCODE_UNITS_MILLIMETER)
     sim->feed *= GCODE_INCH2MM;
 
@@ -185,12 +589,365 @@ gcode_sim_init (gcode_t *gcode, gcode_sim_t *sim)
   * Quadrant-I of a 2d cartesian map.
   */
   GCODE_MATH_VEC3D_SET (sim->pos, 0.0, 0.0, GCODE_PRECISION);
+  GCODE_MATH_VEC3D_SET (sim->origin, 0.0, 0.0, 0.0);
+
+  sim->measure = 0;
+  sim->measure_voxels = 0;
+  sim->measure_len = 0.0;
+  sim->measure_window = 0.0;
+  sim->measure_peak = 0.0;
 }
 
 
 void
 gcode_sim_free (gcode_sim_t *sim)
 {
+  free (sim->footprint);
+  sim->footprint = NULL;
+}
+
+
+/*
+* Turn the voxels removed since the window opened into a cross section
+* (volume per unit of travel) and keep the largest seen.
+*/
+void
+gcode_sim_measure_close (gcode_t *gcode, gcode_sim_t *sim)
+{
+  gfloat_t volume, area;
+
+  if (sim->measure_len > GCODE_PRECISION)
+  {
+    volume = (gcode->voxel_span[0] / (gfloat_t) gcode->voxel_num[0]) *
+             (gcode->voxel_span[1] / (gfloat_t) gcode->voxel_num[1]) *
+             (gcode->voxel_span[2] / (gfloat_t) gcode->voxel_num[2]);
+    area = (gfloat_t) sim->measure_voxels * volume / sim->measure_len;
+    if (area > sim->measure_peak)
+      sim->measure_peak = area;
+  }
+
+  sim->measure_voxels = 0;
+  sim->measure_len = 0.0;
+}
+
+
+static void
+gcode_sim_rle_append (gcode_sim_snapshot_t *snapshot, size_t *alloc, size_t run)
+{
+  /* LEB128: 7 bits per byte, high bit set on all but the last byte */
+  do
+  {
+    if (snapshot->rle_len == *alloc)
+    {
+      *alloc = 2 * *alloc + 64;
+      snapshot->rle = (uint8_t *) realloc (snapshot->rle, *alloc);
+    }
+
+    snapshot->rle[snapshot->rle_len++] = (run & 0x7f) | (run > 0x7f ? 0x80 : 0x00);
+    run >>= 7;
+  } while (run);
+}
+
+
+void
+gcode_sim_snapshot_save (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, gcode_sim_t *sim)
+{
+  size_t i, run, alloc;
+  uint8_t value;
+
+  snapshot->sim = *sim;
+  snapshot->sim.footprint = NULL;
+
+  snapshot->rle_len = 0;
+  alloc = 0;
+
+  /* Runs alternate starting with solid, so a leading cut run has a zero length solid run before it */
+  value = 1;
+  run = 0;
+  for (i = 0; i < gcode->voxel_size; i++)
+  {
+    if ((i & (GCODE_VOXEL_RESIDENT_LIMIT - 1)) == 0)
+      gcode_voxel_touch (gcode, i, gcode->voxel_size - i < GCODE_VOXEL_RESIDENT_LIMIT ? gcode->voxel_size - i : GCODE_VOXEL_RESIDENT_LIMIT);
+
+    if ((gcode->voxel_map[i] != 0) == value)
+    {
+      run++;
+    }
+    else
+    {
+      gcode_sim_rle_append (snapshot, &alloc, run);
+      value = !value;
+      run = 1;
+    }
+  }
+  gcode_sim_rle_append (snapshot, &alloc, run);
+
+  snapshot->rle = (uint8_t *) realloc (snapshot->rle, snapshot->rle_len);
+}
+
+
+void
+gcode_sim_snapshot_load (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, gcode_sim_t *sim)
+{
+  size_t i, ind, run;
+  uint8_t value, shift;
+
+  free (sim->footprint);
+  *sim = snapshot->sim;
+  sim->footprint = NULL;
+
+  value = 1;
+  ind = 0;
+  i = 0;
+  while (i < snapshot->rle_len)
+  {
+    run = 0;
+    shift = 0;
+    do
+    {
+      run |= (size_t) (snapshot->rle[i] & 0x7f) << shift;
+      shift += 7;
+    } while (snapshot->rle[i++] & 0x80);
+
+    if (ind + run > gcode->voxel_size)
+      run = gcode->voxel_size - ind;
+    gcode_voxel_touch (gcode, ind, run);
+    gcode_voxel_set (gcode, ind, run, value);
+    ind += run;
+    value = !value;
+  }
+}
+
+
+void
+gcode_sim_snapshot_free (gcode_t *gcode)
+{
+  int i;
+
+  for (i = 0; i < gcode->sim_snapshot_num; i++)
+    free (gcode->sim_snapshot[i].rle);
+  free (gcode->sim_snapshot);
+
+  gcode->sim_snapshot = NULL;
+  gcode->sim_snapshot_num = 0;
+}
+
+
+/*
+* Gather what every tool in the list and its templates cuts with, in block
+* order, so a cache made with other tools is never taken for the same part.
+*/
+static void
+gcode_sim_cache_tools (gcode_block_t *list, gfloat_t **table, uint32_t *num)
+{
+  gcode_block_t *block;
+  gcode_tool_t *tool;
+  gfloat_t *entry;
+
+  for (block = list; block; block = block->next)
+  {
+    if (block->type == GCODE_TYPE_TEMPLATE)
+    {
+      gcode_sim_cache_tools (((gcode_template_t *) block->pdata)->list, table, num);
+      continue;
+    }
+
+    if (block->type != GCODE_TYPE_TOOL)
+      continue;
+
+    tool = (gcode_tool_t *) block->pdata;
+    *table = (gfloat_t *) realloc (*table, (*num + 1) * GCODE_SIM_CACHE_TOOL * sizeof (gfloat_t));
+    entry = &(*table)[*num * GCODE_SIM_CACHE_TOOL];
+    entry[0] = tool->diam;
+    entry[1] = tool->len;
+    entry[2] = tool->feed;
+    entry[3] = tool->plunge_ratio;
+    entry[4] = (gfloat_t) tool->shape;
+    entry[5] = tool->angle;
+    entry[6] = tool->corner;
+    (*num)++;
+  }
+}
+
+
+/*
+* Keep the stock of a snapshot on disk so a later session can pick it up
+* without simulating.  Written to a temporary file first so a crash never
+* leaves a partial cache behind.
+*/
+int
+gcode_sim_cache_save (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, const char *filename)
+{
+  FILE *fh;
+  char *tmp;
+  gfloat_t *tools;
+  uint32_t header[2], tool_num;
+  uint64_t size;
+  int error;
+
+  tmp = (char *) malloc (strlen (filename) + 5);
+  sprintf (tmp, "%s.tmp", filename);
+
+  fh = fopen (tmp, "wb");
+  if (!fh)
+  {
+    free (tmp);
+    return (1);
+  }
+
+  header[0] = GCODE_SIM_CACHE_HEADER;
+  header[1] = GCODE_SIM_CACHE_VERSION;
+  fwrite (header, sizeof (uint32_t), 2, fh);
+  fwrite (&snapshot->hash, sizeof (uint64_t), 1, fh);
+  fwrite (&snapshot->code_len, sizeof (uint64_t), 1, fh);
+  fwrite (&gcode->voxel_res, sizeof (uint32_t), 1, fh);
+  fwrite (gcode->voxel_num, sizeof (uint32_t), 3, fh);
+  fwrite (&gcode->voxel_layout, sizeof (uint8_t), 1, fh);
+  size = gcode->voxel_size;
+  fwrite (&size, sizeof (uint64_t), 1, fh);
+
+  tools = NULL;
+  tool_num = 0;
+  gcode_sim_cache_tools (gcode->list, &tools, &tool_num);
+  fwrite (&tool_num, sizeof (uint32_t), 1, fh);
+  fwrite (tools, sizeof (gfloat_t), tool_num * GCODE_SIM_CACHE_TOOL, fh);
+  free (tools);
+
+  fwrite (&snapshot->mode, sizeof (uint32_t), 1, fh);
+  fwrite (&snapshot->G83_depth, sizeof (gfloat_t), 1, fh);
+  fwrite (&snapshot->G83_retract, sizeof (gfloat_t), 1, fh);
+
+  fwrite (snapshot->sim.pos, sizeof (gfloat_t), 3, fh);
+  fwrite (snapshot->sim.origin, sizeof (gfloat_t), 3, fh);
+  fwrite (&snapshot->sim.feed, sizeof (gfloat_t), 1, fh);
+  fwrite (&snapshot->sim.absolute, sizeof (uint8_t), 1, fh);
+  fwrite (&snapshot->sim.time_elapsed, sizeof (gfloat_t), 1, fh);
+  fwrite (&snapshot->sim.tool_diameter, sizeof (gfloat_t), 1, fh);
+  fwrite (&snapshot->sim.tool_shape, sizeof (uint8_t), 1, fh);
+  fwrite (&snapshot->sim.tool_angle, sizeof (gfloat_t), 1, fh);
+  fwrite (&snapshot->sim.tool_corner, sizeof (gfloat_t), 1, fh);
+
+  size = snapshot->rle_len;
+  fwrite (&size, sizeof (uint64_t), 1, fh);
+  fwrite (snapshot->rle, 1, snapshot->rle_len, fh);
+
+  error = ferror (fh);
+  fclose (fh);
+
+  if (!error)
+  {
+#ifdef _WIN32
+    remove (filename);
+#endif
+    error = rename (tmp, filename);
+  }
+  if (error)
+    remove (tmp);
+
+  free (tmp);
+  return (error ? 1 : 0);
+}
+
+
+/*
+* Read back a snapshot written by gcode_sim_cache_save, provided it was
+* made from the code identified by hash and code_len, with the same tools,
+* on a stock of the same layout.  The hash alone is not trusted.
+*/
+int
+gcode_sim_cache_load (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, const char *filename, uint64_t hash, uint64_t code_len)
+{
+  FILE *fh;
+  gfloat_t *tools, *cached_tools;
+  uint32_t header[2], value, num[3], tool_num, cached_tool_num;
+  uint64_t key[2], size;
+  uint8_t layout;
+  int n;
+
+  fh = fopen (filename, "rb");
+  if (!fh)
+    return (1);
+
+  n = fread (header, sizeof (uint32_t), 2, fh);
+  n += fread (key, sizeof (uint64_t), 2, fh);
+  if (n != 4 || header[0] != GCODE_SIM_CACHE_HEADER || header[1] != GCODE_SIM_CACHE_VERSION || key[0] != hash || key[1] != code_len)
+  {
+    fclose (fh);
+    return (1);
+  }
+
+  n = fread (&value, sizeof (uint32_t), 1, fh);
+  n += fread (num, sizeof (uint32_t), 3, fh);
+  n += fread (&layout, sizeof (uint8_t), 1, fh);
+  n += fread (&size, sizeof (uint64_t), 1, fh);
+  if (n != 6 || value != gcode->voxel_res || layout != gcode->voxel_layout || size != gcode->voxel_size ||
+      num[0] != gcode->voxel_num[0] || num[1] != gcode->voxel_num[1] || num[2] != gcode->voxel_num[2])
+  {
+    fclose (fh);
+    return (1);
+  }
+
+  tools = NULL;
+  tool_num = 0;
+  gcode_sim_cache_tools (gcode->list, &tools, &tool_num);
+  cached_tools = NULL;
+  n = fread (&cached_tool_num, sizeof (uint32_t), 1, fh);
+  if (n == 1 && cached_tool_num == tool_num)
+  {
+    cached_tools = (gfloat_t *) malloc ((tool_num + 1) * GCODE_SIM_CACHE_TOOL * sizeof (gfloat_t));
+    n += fread (cached_tools, sizeof (gfloat_t), tool_num * GCODE_SIM_CACHE_TOOL, fh);
+  }
+  if (n != 1 + (int) (tool_num * GCODE_SIM_CACHE_TOOL) || cached_tool_num != tool_num ||
+      (tool_num && memcmp (cached_tools, tools, tool_num * GCODE_SIM_CACHE_TOOL * sizeof (gfloat_t))))
+  {
+    free (tools);
+    free (cached_tools);
+    fclose (fh);
+    return (1);
+  }
+  free (tools);
+  free (cached_tools);
+
+  /* Whatever was not saved is as a fresh simulator would have it */
+  gcode_sim_init (gcode, &snapshot->sim);
+  GCODE_MATH_VEC3D_SET (snapshot->sim.vn_inv, 1.0 / (gfloat_t) gcode->voxel_num[0], 1.0 / (gfloat_t) gcode->voxel_num[1], 1.0 / (gfloat_t) gcode->voxel_num[2]);
+  snapshot->hash = hash;
+  snapshot->code_len = code_len;
+
+  n = fread (&snapshot->mode, sizeof (uint32_t), 1, fh);
+  n += fread (&snapshot->G83_depth, sizeof (gfloat_t), 1, fh);
+  n += fread (&snapshot->G83_retract, sizeof (gfloat_t), 1, fh);
+
+  n += fread (snapshot->sim.pos, sizeof (gfloat_t), 3, fh);
+  n += fread (snapshot->sim.origin, sizeof (gfloat_t), 3, fh);
+  n += fread (&snapshot->sim.feed, sizeof (gfloat_t), 1, fh);
+  n += fread (&snapshot->sim.absolute, sizeof (uint8_t), 1, fh);
+  n += fread (&snapshot->sim.time_elapsed, sizeof (gfloat_t), 1, fh);
+  n += fread (&snapshot->sim.tool_diameter, sizeof (gfloat_t), 1, fh);
+  n += fread (&snapshot->sim.tool_shape, sizeof (uint8_t), 1, fh);
+  n += fread (&snapshot->sim.tool_angle, sizeof (gfloat_t), 1, fh);
+  n += fread (&snapshot->sim.tool_corner, sizeof (gfloat_t), 1, fh);
+
+  n += fread (&size, sizeof (uint64_t), 1, fh);
+  if (n != 17)
+  {
+    fclose (fh);
+    return (1);
+  }
+
+  snapshot->rle_len = (size_t) size;
+  snapshot->rle = (uint8_t *) malloc (snapshot->rle_len);
+  if (!snapshot->rle || fread (snapshot->rle, 1, snapshot->rle_len, fh) != snapshot->rle_len)
+  {
+    free (snapshot->rle);
+    snapshot->rle = NULL;
+    snapshot->rle_len = 0;
+    fclose (fh);
+    return (1);
+  }
+
+  fclose (fh);
+  return (0);
 }
 
 
@@ -217,6 +974,9 @@ gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args)
   if (mag < GCODE_PRECISION)
     return;
 
+  if (gcode_sim_cull_line (gcode, sim, orig, xyz, tot_dist))
+    return;
+
   GCODE_MATH_VEC3D_UNITIZE (dvec);
   GCODE_MATH_VEC3D_MUL_SCALAR (dvec, dvec, sim->step_res);
   GCODE_MATH_VEC3D_MAG (mag, dvec);
@@ -299,6 +1059,9 @@ gcode_sim_G02 (gcode_t *gcode, gcode_sim_t *sim, char *args)
     if (src_angle-GCODE_PRECISION <= dst_angle)
       src_angle += GCODE_2PI;
 
+    if (gcode_sim_cull_arc (gcode, sim, orig, xyz, rad, rad * (src_angle - dst_angle)))
+      return;
+
     /* Go from src_angle to dst_angle by step_angle increments */
     while (src_angle - step_angle > dst_angle)
     {
@@ -361,6 +1124,9 @@ gcode_sim_G03 (gcode_t *gcode, gcode_sim_t *sim, char *args)
     if (src_angle+GCODE_PRECISION >= dst_angle)
       dst_angle += GCODE_2PI;
 
+    if (gcode_sim_cull_arc (gcode, sim, orig, xyz, rad, rad * (dst_angle - src_angle)))
+      return;
+
     /* Go from src_angle to dst_angle by step_angle increments */
     while (src_angle + step_angle < dst_angle)
     {
@@ -407,6 +1173,9 @@ gcode_sim_G83 (gcode_t *gcode, gcode_sim_t *sim, char *args, gfloat_t *G83_depth
   if (mag < GCODE_PRECISION)
     return;
 
+  if (gcode_sim_cull_line (gcode, sim, orig, xyz, tot_dist))
+    return;
+
   GCODE_MATH_VEC3D_UNITIZE (dvec);
   GCODE_MATH_VEC3D_MUL_SCALAR (dvec, dvec, sim->step_res);
   GCODE_MATH_VEC3D_MAG (mag, dvec);
@@ -20,6 +20,20 @@
 #define _GCODE_SIM_H
 
 #include "gcode_internal.h"
+#include "gcode_tool.h"
+
+#define GCODE_SIM_CACHE_HEADER		0x4753494d
+#define GCODE_SIM_CACHE_VERSION		0x20101002
+#define GCODE_SIM_CACHE_TOOL		7	/* values kept per tool: diameter, length, feed, plunge ratio, shape, angle, corner */
+
+/* Moves cutting less than this fraction of the heaviest cut of their tool run at the feed limit */
+#define GCODE_SIM_FEED_AIR		0.05
+
+/* The programmed feed is taken to be safe for a full width slot this many tool diameters deep */
+#define GCODE_SIM_FEED_SLOT		0.5
+
+/* Heavier cuts are slowed to keep the rate of removal, but to no less than this fraction of the programmed feed */
+#define GCODE_SIM_FEED_MIN		0.25
 
 typedef struct gcode_sim_s
 {
@@ -31,10 +45,45 @@ typedef struct gcode_sim_s
   gfloat_t time_elapsed;	/* time elapsed */
   gfloat_t step_res;		/* step resolution*/
   gcode_vec3d_t vn_inv;		/* voxel number inverse */
+  uint8_t tool_shape;		/* GCODE_TOOL_SHAPE_XXX */
+  gfloat_t tool_angle;		/* v-bit included angle in degrees */
+  gfloat_t tool_corner;		/* bull-nose corner radius */
+  int16_t *footprint;		/* voxels above the tip cut at each (dx, dy) cell, -1 outside the tool */
+  int footprint_rad[2];		/* footprint half width in cells */
+  gfloat_t footprint_key[4];	/* tool geometry the footprint was built for */
+  uint8_t measure;		/* count the material each step removes, see gcode_optimize_feed */
+  size_t measure_voxels;	/* voxels removed since the current window opened */
+  gfloat_t measure_len;		/* distance travelled since the current window opened */
+  gfloat_t measure_window;	/* distance removal is averaged over */
+  gfloat_t measure_peak;	/* largest cross section cut over any window, units squared */
 } gcode_sim_t;
 
+/*
+* Simulator state and run-length encoded stock captured after a top-level
+* block, used by gcode_render_final to resume after the last unchanged block.
+*/
+typedef struct gcode_sim_snapshot_s
+{
+  uint64_t hash;		/* hash of the code of every block simulated before this snapshot */
+  uint64_t code_len;		/* bytes of code that went into the hash */
+  gcode_sim_t sim;
+  uint32_t mode;		/* canned cycle in effect */
+  gfloat_t G83_depth;
+  gfloat_t G83_retract;
+  size_t rle_len;
+  uint8_t *rle;			/* alternating run lengths of solid and cut voxels, LEB128 encoded */
+} gcode_sim_snapshot_t;
+
 void gcode_sim_init (gcode_t *gcode, gcode_sim_t *sim);
 void gcode_sim_free (gcode_sim_t *sim);
+void gcode_sim_measure_close (gcode_t *gcode, gcode_sim_t *sim);
+
+void gcode_sim_snapshot_save (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, gcode_sim_t *sim);
+void gcode_sim_snapshot_load (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, gcode_sim_t *sim);
+void gcode_sim_snapshot_free (gcode_t *gcode);
+
+int gcode_sim_cache_save (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, const char *filename);
+int gcode_sim_cache_load (gcode_t *gcode, gcode_sim_snapshot_t *snapshot, const char *filename, uint64_t hash, uint64_t code_len);
 
 void gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args);
 void gcode_sim_G01 (gcode_t *gcode, gcode_sim_t *sim, char *args);
@@ -63,6 +63,7 @@ gcode_sketch_init (GCODE_INIT_PARAMETERS)
   sketch->taper_offset[0] = 0.0;
   sketch->taper_offset[1] = 0.0;
   sketch->pocket = 0;
+  sketch->pocket_style = GCODE_SKETCH_POCKET_ZIGZAG;
   sketch->zero_pass = 0;
   sketch->helical = 0;
 
@@ -102,6 +103,7 @@ gcode_sketch_free (gcode_block_t **block)
 
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -331,8 +333,8 @@ gcode_sketch_make (gcode_block_t *block)
   gcode_tool_t *tool;
   gcode_block_t *child_block, *start_block, *index_block;
   gcode_vec2d_t p0, p1, e0, e1, t;
-  gfloat_t z, last_z, inside, tool_rad, block_length, path_length, accum_length, length_coef;
-  int closed, taper_exists, path_num;
+  gfloat_t z, last_z, adaptive_z, clear_z, inside, tool_rad, block_length, path_length, accum_length, length_coef;
+  int closed, taper_exists, path_num, rows;
   char string[256];
 
   GCODE_CLEAR(block);
@@ -457,6 +459,9 @@ gcode_sketch_make (gcode_block_t *block)
     if (z-GCODE_PRECISION > p1[1] && (z - extrusion->resolution) < p1[1])
       z = p1[1];
 
+    /* Depth adaptive clearing has reached, ahead of the layers */
+    adaptive_z = p0[1];
+
 
     while (z >= p1[1])
     {
@@ -477,7 +482,7 @@ gcode_sketch_make (gcode_block_t *block)
 
       /* For now, generate duplicate list regardless if it will be used or not */
       gcode_util_duplicate_list (start_block, index_block->next, &evaluated_offset_list);
-      gcode_util_push_offset (evaluated_offset_list);
+      gcode_util_push_offset (&evaluated_offset_list);
 
       /*
       * POCKETING:
@@ -494,12 +499,50 @@ gcode_sketch_make (gcode_block_t *block)
 
           /*
           * Inward Taper:
-          *  Pocketing applied automatically.
+          *  Pocketing applied automatically, in rings or adaptively if the
+          *  sketch asks for them and rows otherwise.
           */
-          gcode_pocket_init (&pocket, tool_rad);
-          gcode_pocket_prep (&pocket, evaluated_offset_list, NULL);
-          gcode_pocket_make (&pocket, block, z, last_z, tool);
-          gcode_pocket_free (&pocket);
+          rows = 1;
+          if (sketch->pocket_style == GCODE_SKETCH_POCKET_RINGS)
+          {
+            rows = gcode_pocket_rings (block, evaluated_offset_list, NULL, tool_rad, z, last_z, tool);
+          }
+          else if (sketch->pocket_style == GCODE_SKETCH_POCKET_ADAPTIVE)
+          {
+            /*
+            * Taking little of the wall, adaptive clearing goes as deep as the
+            * end mill allows in one pass and the layers until then only cut
+            * the outline.  The outline has to stay put for that, so a taper
+            * is still cleared a layer at a time.
+            */
+            rows = 0;
+            if (z < adaptive_z - GCODE_PRECISION)
+            {
+              clear_z = z;
+              if (!taper_exists && fabs (sketch->taper_offset[0]) < GCODE_PRECISION && fabs (sketch->taper_offset[1]) < GCODE_PRECISION)
+              {
+                clear_z = adaptive_z - GCODE_POCKET_ADAPTIVE_DEPTH * tool->diam;
+                if (tool->len > GCODE_PRECISION && clear_z < adaptive_z - tool->len)
+                  clear_z = adaptive_z - tool->len;
+                if (clear_z > z)
+                  clear_z = z;
+                if (clear_z < p1[1])
+                  clear_z = p1[1];
+              }
+
+              rows = gcode_pocket_adaptive (block, evaluated_offset_list, NULL, GCODE_POCKET_ADAPTIVE_STEP * tool->diam, extrusion->resolution, clear_z, adaptive_z, tool);
+              if (!rows)
+                adaptive_z = clear_z;
+            }
+          }
+
+          if (rows)
+          {
+            gcode_pocket_init (&pocket, tool_rad);
+            gcode_pocket_prep (&pocket, evaluated_offset_list, NULL);
+            gcode_pocket_make (&pocket, block, z, last_z, tool);
+            gcode_pocket_free (&pocket);
+          }
         }
         else if (extrusion->cut_side == GCODE_EXTRUSION_OUTSIDE)
         {
@@ -534,14 +577,14 @@ gcode_sketch_make (gcode_block_t *block)
 
           /* Generate the evaluated outside offset list */
           gcode_util_duplicate_list (start_block, index_block->next, &evaluated_outside_offset_list);
-          gcode_util_push_offset (evaluated_outside_offset_list);
+          gcode_util_push_offset (&evaluated_outside_offset_list);
 
           gcode_pocket_prep (&outside_pocket, evaluated_outside_offset_list, NULL);
 
           /* Return extrusion to existing state */
 /*          gcode_extrusion_evaluate_offset (sketch->extrusion, z, &sketch->offset.eval); */
 
-          gcode_pocket_subtract (&outside_pocket, &inside_pocket);
+          gcode_pocket_merge (&outside_pocket, &inside_pocket, GCODE_POCKET_SUBTRACT);
           gcode_pocket_make (&outside_pocket, block, z, last_z, tool);
 
           gcode_pocket_free (&inside_pocket);
@@ -764,6 +807,12 @@ gcode_sketch_save (gcode_block_t *block, FILE *fh)
   fwrite (&size, sizeof (uint32_t), 1, fh);
   fwrite (&sketch->pocket, size, 1, fh);
 
+  data = GCODE_DATA_SKETCH_POCKET_STYLE;
+  size = sizeof (uint8_t);
+  fwrite (&data, sizeof (uint8_t), 1, fh);
+  fwrite (&size, sizeof (uint32_t), 1, fh);
+  fwrite (&sketch->pocket_style, size, 1, fh);
+
   data = GCODE_DATA_SKETCH_ZERO_PASS;
   size = sizeof (uint8_t);
   fwrite (&data, sizeof (uint8_t), 1, fh);
@@ -859,6 +908,10 @@ gcode_sketch_load (gcode_block_t *block, FILE *fh)
         fread (&sketch->pocket, dsize, 1, fh);
         break;
 
+      case GCODE_DATA_SKETCH_POCKET_STYLE:
+        fread (&sketch->pocket_style, dsize, 1, fh);
+        break;
+
       case GCODE_DATA_SKETCH_ZERO_PASS:
         fread (&sketch->zero_pass, dsize, 1, fh);
         break;
@@ -1026,7 +1079,7 @@ gcode_sketch_draw (gcode_block_t *block, gcode_block_t *selected)
         * Duplicate List, apply offsets, set eval and tool to 0 (zero offsets), make/draw, free
         */
         gcode_util_duplicate_list (start_block, index_block->next, &evaluated_offset_list);
-        gcode_util_push_offset (evaluated_offset_list);
+        gcode_util_push_offset (&evaluated_offset_list);
 
         /* Draw the blocks */
         child_block = closed ? evaluated_offset_list : start_block;
@@ -1130,6 +1183,7 @@ gcode_sketch_duplicate (gcode_block_t *block, gcode_block_t **duplicate)
   duplicate_sketch->taper_offset[1] = sketch->taper_offset[1];
   duplicate_sketch->offset = sketch->offset;
   duplicate_sketch->pocket = sketch->pocket;
+  duplicate_sketch->pocket_style = sketch->pocket_style;
   duplicate_sketch->zero_pass = sketch->zero_pass;
 
   sketch->extrusion->duplicate (sketch->extrusion, &duplicate_sketch->extrusion);
@@ -1197,11 +1251,11 @@ gcode_sketch_aabb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max)
     if (tmin[0] < min[0])
       min[0] = tmin[0];
 
-    if (tmin[0] > max[0])
-      max[0] = tmin[0];
+    if (tmax[0] > max[0])
+      max[0] = tmax[0];
 
-    if (tmax[1] < min[1])
-      min[1] = tmax[1];
+    if (tmin[1] < min[1])
+      min[1] = tmin[1];
 
     if (tmax[1] > max[1])
       max[1] = tmax[1];
@@ -1209,11 +1263,11 @@ gcode_sketch_aabb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max)
 }
 
 
-void
+gcode_block_t *
 gcode_sketch_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation)
 {
   gcode_sketch_t *sketch;
-  gcode_block_t *child_block, *pattern_block, **pattern_list, *last_block;
+  gcode_block_t *child_block, *pattern_block, **pattern_list, *last_block, *old_list;
   gfloat_t inc_rotation, inc_translate_x, inc_translate_y;
   int i;
 
@@ -1299,8 +1353,15 @@ gcode_sketch_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x
     }
   }
 
-  gcode_list_free (&sketch->list);
+  /* The list is handed back rather than freed so the edit can be undone */
+  old_list = sketch->list;
   sketch->list = *pattern_list;
+  free (pattern_list);
+
+  for (child_block = sketch->list; child_block; child_block = child_block->next)
+    child_block->parent_list = &sketch->list;
+
+  return (old_list);
 }
 
 
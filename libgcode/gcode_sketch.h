@@ -27,6 +27,11 @@
 #define GCODE_DATA_SKETCH_POCKET	0x05
 #define	GCODE_DATA_SKETCH_ZERO_PASS	0x06
 #define GCODE_DATA_SKETCH_HELICAL	0x07
+#define GCODE_DATA_SKETCH_POCKET_STYLE	0x08
+
+#define GCODE_SKETCH_POCKET_ZIGZAG	0x0
+#define GCODE_SKETCH_POCKET_RINGS	0x1	/* loops offset in from the outline */
+#define GCODE_SKETCH_POCKET_ADAPTIVE	0x2	/* rings a small step apart, looping into slots and corners */
 
 typedef struct gcode_sketch_s
 {
@@ -34,6 +39,7 @@ typedef struct gcode_sketch_s
   gcode_block_t *list;
   gcode_vec2d_t taper_offset;
   uint8_t pocket;
+  uint8_t pocket_style;
   uint8_t zero_pass;
   uint8_t helical;
   gcode_offset_t offset;
@@ -48,7 +54,7 @@ void gcode_sketch_draw (gcode_block_t *block, gcode_block_t *selected);
 void gcode_sketch_duplicate (gcode_block_t *block, gcode_block_t **duplicate);
 void gcode_sketch_scale (gcode_block_t *block, gfloat_t scale);
 void gcode_sketch_aabb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max);
-void gcode_sketch_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation);
+gcode_block_t *gcode_sketch_pattern (gcode_block_t *block, int iterations, gfloat_t translate_x, gfloat_t translate_y, gfloat_t rotate_about_x, gfloat_t rotate_about_y, gfloat_t rotation);
 int gcode_sketch_is_closed (gcode_block_t *block);
 gcode_block_t* gcode_sketch_prev_connected (gcode_block_t *block);
 gcode_block_t* gcode_sketch_next_connected (gcode_block_t *block);
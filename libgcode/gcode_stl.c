@@ -74,6 +74,7 @@ gcode_stl_free (gcode_block_t **block)
 
   free ((*block)->code);
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -379,7 +380,8 @@ gcode_stl_draw (gcode_block_t *block, gcode_block_t *selected)
   gcode_stl_t *stl;
   gcode_block_t *index_block;
   gfloat_t z;
-  float mat_diffuse[4];
+  float mat_diffuse[4], mat_emission[4] = { 0.0, 0.0, 0.0, 1.0 };
+  uint8_t picking;
   int i;
 
 
@@ -388,17 +390,27 @@ gcode_stl_draw (gcode_block_t *block, gcode_block_t *selected)
 
   stl = (gcode_stl_t *) block->pdata;
 
-//#if 0
-  glEnable (GL_LIGHTING);
-  glEnable (GL_LIGHT0);
-/*  glEnable (GL_DEPTH_TEST); */
+  /* Whatever is changed here is put back for the blocks drawn after this one */
+  glPushAttrib (GL_ENABLE_BIT | GL_LIGHTING_BIT | GL_CURRENT_BIT);
 
-  mat_diffuse[0] = 0.6;
-  mat_diffuse[1] = 0.6;
-  mat_diffuse[2] = 0.6;
-  mat_diffuse[3] = 1.0;
-  glLightModeli (GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-  glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
+  /* The view lights only the name while picking */
+  picking = gcode_internal_draw_picking ();
+
+//#if 0
+  if (!picking)
+  {
+    glEnable (GL_LIGHTING);
+    glEnable (GL_LIGHT0);
+/*    glEnable (GL_DEPTH_TEST); */
+
+    mat_diffuse[0] = 0.6;
+    mat_diffuse[1] = 0.6;
+    mat_diffuse[2] = 0.6;
+    mat_diffuse[3] = 1.0;
+    glLightModeli (GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
+    glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, mat_emission);
+  }
 
   glBegin (GL_TRIANGLES);
   for (i = 0; i < stl->tri_num; i++)
@@ -410,11 +422,14 @@ gcode_stl_draw (gcode_block_t *block, gcode_block_t *selected)
   }
   glEnd ();
 //#else
-  glDisable (GL_LIGHTING);
-  glDisable (GL_LIGHT0);
-  glDisable (GL_DEPTH_TEST);
+  if (!picking)
+  {
+    glDisable (GL_LIGHTING);
+    glDisable (GL_LIGHT0);
+    glDisable (GL_DEPTH_TEST);
 
-  glColor3f (0.3, 0.9, 0.3);
+    glColor3f (0.3, 0.9, 0.3);
+  }
   glBegin (GL_LINES);
   for (i = 0; i < stl->slices; i++)
   {
@@ -437,6 +452,7 @@ gcode_stl_draw (gcode_block_t *block, gcode_block_t *selected)
   glEnd ();
 //#endif
 
+  glPopAttrib ();
 #endif
 }
 
@@ -61,6 +61,7 @@ gcode_template_init (GCODE_INIT_PARAMETERS)
 void
 gcode_template_free (gcode_block_t **block)
 {
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
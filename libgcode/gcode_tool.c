@@ -48,6 +48,9 @@ gcode_tool_init (GCODE_INIT_PARAMETERS)
   tool->number = 1;
   tool->plunge_ratio = 0.2; /* 20% */
   tool->spindle_rpm = 2000; /* 2,000 RPM */
+  tool->shape = GCODE_TOOL_SHAPE_FLAT;
+  tool->angle = 90.0;
+  tool->corner = 0.0;
 
   tool->coolant = ((*block)->gcode->machine_options & GCODE_MACHINE_OPTION_COOLANT) == 0 ? 0 : 1;
 }
@@ -57,6 +60,7 @@ void
 gcode_tool_free (gcode_block_t **block)
 {
   free ((*block)->pdata);
+  gcode_internal_free (*block);
   free (*block);
   *block = NULL;
 }
@@ -156,6 +160,11 @@ gcode_tool_make (gcode_block_t *block)
   GCODE_COMMENT (block, "Feed Rate");
   sprintf (string, "GCAM:TOOL_DIAMETER:%f", tool->diam);
   GCODE_COMMENT (block, string);
+  if (tool->shape != GCODE_TOOL_SHAPE_FLAT)
+  {
+    sprintf (string, "GCAM:TOOL_SHAPE:%d:%f:%f", tool->shape, tool->angle, tool->corner);
+    GCODE_COMMENT (block, string);
+  }
 
   if (block->gcode->machine_options & GCODE_MACHINE_OPTION_SPINDLE_CONTROL)
   {
@@ -205,6 +214,9 @@ gcode_tool_save (gcode_block_t *block, FILE *fh)
   GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_PLUNGE_RATIO, sizeof (gfloat_t), &tool->plunge_ratio);
   GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_SPINDLE_RPM, sizeof (uint32_t), &tool->spindle_rpm);
   GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_COOLANT, sizeof (uint8_t), &tool->coolant);
+  GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_SHAPE, sizeof (uint8_t), &tool->shape);
+  GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_ANGLE, sizeof (gfloat_t), &tool->angle);
+  GCODE_WRITE_DATA (fh, GCODE_DATA_TOOL_CORNER, sizeof (gfloat_t), &tool->corner);
 }
 
 
@@ -275,6 +287,18 @@ gcode_tool_load (gcode_block_t *block, FILE *fh)
         fread (&tool->coolant, dsize, 1, fh);
         break;
 
+      case GCODE_DATA_TOOL_SHAPE:
+        fread (&tool->shape, dsize, 1, fh);
+        break;
+
+      case GCODE_DATA_TOOL_ANGLE:
+        fread (&tool->angle, dsize, 1, fh);
+        break;
+
+      case GCODE_DATA_TOOL_CORNER:
+        fread (&tool->corner, dsize, 1, fh);
+        break;
+
       default:
         fseek (fh, dsize, SEEK_CUR);
         break;
@@ -309,6 +333,9 @@ gcode_tool_duplicate (gcode_block_t *block, gcode_block_t **duplicate)
   duplicate_tool->change[1] = tool->change[1];
   duplicate_tool->change[2] = tool->change[2];
   duplicate_tool->plunge_ratio = tool->plunge_ratio;
+  duplicate_tool->shape = tool->shape;
+  duplicate_tool->angle = tool->angle;
+  duplicate_tool->corner = tool->corner;
 }
 
 
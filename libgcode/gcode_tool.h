@@ -31,6 +31,14 @@
 #define GCODE_DATA_TOOL_PLUNGE_RATIO		0x07
 #define GCODE_DATA_TOOL_SPINDLE_RPM		0x08
 #define GCODE_DATA_TOOL_COOLANT			0x09
+#define GCODE_DATA_TOOL_SHAPE			0x0A
+#define GCODE_DATA_TOOL_ANGLE			0x0B
+#define GCODE_DATA_TOOL_CORNER			0x0C
+
+#define GCODE_TOOL_SHAPE_FLAT			0x00
+#define GCODE_TOOL_SHAPE_BALL			0x01
+#define GCODE_TOOL_SHAPE_VBIT			0x02
+#define GCODE_TOOL_SHAPE_BULL			0x03
 
 typedef struct gcode_tool_s
 {
@@ -46,6 +54,9 @@ typedef struct gcode_tool_s
   gfloat_t plunge_ratio;
   uint32_t spindle_rpm;
   uint8_t coolant;
+  uint8_t shape;
+  gfloat_t angle;	/* included angle of a v-bit in degrees */
+  gfloat_t corner;	/* corner radius of a bull-nose */
 } gcode_tool_t;
 
 void gcode_tool_init (GCODE_INIT_PARAMETERS);
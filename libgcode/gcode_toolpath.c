@@ -0,0 +1,441 @@
+/*
+*  gcode_toolpath.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_toolpath.h"
+#include "gcode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+* The toolpath is read back from the generated code in one pass and
+* written straight into the layout the card draws from: a single line
+* strip through every position the tool visits, arcs broken into chords,
+* with each vertex carrying the color of the move that ends on it.  Drawn
+* with flat shading every segment takes the color of its move, and the
+* first n moves are the first move[n-1]+1 vertices of the strip.
+*/
+
+typedef struct gcode_toolpath_state_s
+{
+  gcode_toolpath_t *toolpath;
+  gcode_t *gcode;
+
+  gfloat_t pos[3];
+  uint8_t known[3];		/* axes given a position so far */
+  uint8_t started;		/* the strip has its first vertex */
+  uint8_t absolute;
+  int motion;			/* G00 through G03 */
+  int cycle;			/* 81 or 83 while a canned cycle is active */
+  gfloat_t cycle_z;
+  gfloat_t cycle_r;
+  gfloat_t cycle_q;
+  int error;
+} gcode_toolpath_state_t;
+
+
+void
+gcode_toolpath_init (gcode_toolpath_t *toolpath)
+{
+  uint8_t color[GCODE_TOOLPATH_KIND_NUM][4] = { { 255, 64, 64, 255 }, { 64, 192, 255, 255 }, { 255, 224, 64, 255 } };
+
+  memcpy (toolpath->color, color, sizeof (color));
+
+  toolpath->vertex_num = 0;
+  toolpath->vertex_max = 0;
+  toolpath->vertex = NULL;
+  toolpath->move_num = 0;
+  toolpath->move_max = 0;
+  toolpath->move = NULL;
+  memset (toolpath->kind_num, 0, sizeof (toolpath->kind_num));
+}
+
+
+void
+gcode_toolpath_free (gcode_toolpath_t *toolpath)
+{
+  free (toolpath->vertex);
+  free (toolpath->move);
+
+  toolpath->vertex_num = 0;
+  toolpath->vertex_max = 0;
+  toolpath->vertex = NULL;
+  toolpath->move_num = 0;
+  toolpath->move_max = 0;
+  toolpath->move = NULL;
+  memset (toolpath->kind_num, 0, sizeof (toolpath->kind_num));
+}
+
+
+static void
+gcode_toolpath_vertex (gcode_toolpath_state_t *state, gfloat_t pos[3], int kind)
+{
+  gcode_toolpath_t *toolpath;
+  gcode_toolpath_vertex_t *vertex;
+  uint32_t max;
+
+  toolpath = state->toolpath;
+
+  if (toolpath->vertex_num == toolpath->vertex_max)
+  {
+    max = toolpath->vertex_max ? 2 * toolpath->vertex_max : 4096;
+    vertex = (gcode_toolpath_vertex_t *) realloc (toolpath->vertex, max * sizeof (gcode_toolpath_vertex_t));
+    if (!vertex)
+    {
+      state->error = 1;
+      return;
+    }
+    toolpath->vertex = vertex;
+    toolpath->vertex_max = max;
+  }
+
+  vertex = &toolpath->vertex[toolpath->vertex_num++];
+  memcpy (vertex->color, toolpath->color[kind], 4);
+  vertex->pos[0] = (float) pos[0];
+  vertex->pos[1] = (float) pos[1];
+  vertex->pos[2] = (float) pos[2];
+}
+
+
+static void
+gcode_toolpath_move (gcode_toolpath_state_t *state, int kind)
+{
+  gcode_toolpath_t *toolpath;
+  uint32_t *move, max;
+
+  toolpath = state->toolpath;
+
+  if (toolpath->move_num == toolpath->move_max)
+  {
+    max = toolpath->move_max ? 2 * toolpath->move_max : 4096;
+    move = (uint32_t *) realloc (toolpath->move, max * sizeof (uint32_t));
+    if (!move)
+    {
+      state->error = 1;
+      return;
+    }
+    toolpath->move = move;
+    toolpath->move_max = max;
+  }
+
+  toolpath->move[toolpath->move_num++] = toolpath->vertex_num - 1;
+  toolpath->kind_num[kind]++;
+}
+
+
+/*
+* Until every axis has been given a position there is nowhere to draw
+* from, moves only update what is known.
+*/
+static int
+gcode_toolpath_start (gcode_toolpath_state_t *state, gfloat_t target[3], uint8_t has[3])
+{
+  if (state->started)
+    return (1);
+
+  state->known[0] |= has[0];
+  state->known[1] |= has[1];
+  state->known[2] |= has[2];
+  GCODE_MATH_VEC3D_COPY (state->pos, target);
+
+  if (state->known[0] && state->known[1] && state->known[2])
+  {
+    gcode_toolpath_vertex (state, state->pos, GCODE_TOOLPATH_RAPID);
+    state->started = 1;
+  }
+
+  return (0);
+}
+
+
+static void
+gcode_toolpath_line (gcode_toolpath_state_t *state, gfloat_t target[3], int rapid)
+{
+  gfloat_t d[3], len;
+  int kind;
+
+  GCODE_MATH_VEC3D_SUB (d, target, state->pos);
+  GCODE_MATH_VEC3D_MAG (len, d);
+  if (len < GCODE_PRECISION)
+    return;
+
+  if (rapid)
+  {
+    kind = GCODE_TOOLPATH_RAPID;
+  }
+  else if (d[2] < 0.0 && fabs (d[0]) < GCODE_PRECISION && fabs (d[1]) < GCODE_PRECISION)
+  {
+    kind = GCODE_TOOLPATH_PLUNGE;
+  }
+  else
+  {
+    kind = GCODE_TOOLPATH_FEED;
+  }
+
+  gcode_toolpath_vertex (state, target, kind);
+  gcode_toolpath_move (state, kind);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, target);
+}
+
+
+/* Chords within the drawing tolerance, the helix climbs linearly along them */
+static void
+gcode_toolpath_arc (gcode_toolpath_state_t *state, gfloat_t target[3], gfloat_t ijk[3], int cw)
+{
+  gfloat_t center[2], rad, a0, a1, sweep, angle, pos[3];
+  uint32_t i, num;
+
+  center[0] = state->pos[0] + ijk[0];
+  center[1] = state->pos[1] + ijk[1];
+  rad = sqrt ((state->pos[0] - center[0]) * (state->pos[0] - center[0]) + (state->pos[1] - center[1]) * (state->pos[1] - center[1]));
+  if (rad < GCODE_PRECISION)
+  {
+    gcode_toolpath_line (state, target, 0);
+    return;
+  }
+
+  a0 = atan2 (state->pos[1] - center[1], state->pos[0] - center[0]);
+  a1 = atan2 (target[1] - center[1], target[0] - center[0]);
+  sweep = cw ? a0 - a1 : a1 - a0;
+  if (sweep < 0.0)
+    sweep += 2.0 * GCODE_PI;
+
+  /* Coincident end points describe a full circle */
+  if (sweep * rad < GCODE_PRECISION)
+    sweep = 2.0 * GCODE_PI;
+
+  num = gcode_internal_tess (state->gcode, rad, sweep * GCODE_RAD2DEG, 32);
+  if (num < 2)
+    num = 2;
+
+  for (i = 1; i < num - 1; i++)
+  {
+    angle = a0 + (cw ? -sweep : sweep) * (gfloat_t) i / (gfloat_t) (num - 1);
+    pos[0] = center[0] + rad * cos (angle);
+    pos[1] = center[1] + rad * sin (angle);
+    pos[2] = state->pos[2] + (target[2] - state->pos[2]) * (gfloat_t) i / (gfloat_t) (num - 1);
+    gcode_toolpath_vertex (state, pos, GCODE_TOOLPATH_FEED);
+  }
+
+  gcode_toolpath_vertex (state, target, GCODE_TOOLPATH_FEED);
+  gcode_toolpath_move (state, GCODE_TOOLPATH_FEED);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, target);
+}
+
+
+/* One hole of a G81/G83 cycle, the same moves gcode_estimate times */
+static void
+gcode_toolpath_hole (gcode_toolpath_state_t *state, gfloat_t x, gfloat_t y)
+{
+  gfloat_t target[3], bottom, next;
+
+  GCODE_MATH_VEC3D_SET (target, x, y, state->pos[2]);
+  gcode_toolpath_line (state, target, 1);
+  target[2] = state->cycle_r;
+  gcode_toolpath_line (state, target, 1);
+
+  bottom = state->cycle_r;
+  while (bottom > state->cycle_z + GCODE_PRECISION)
+  {
+    next = state->cycle == 83 && state->cycle_q > GCODE_PRECISION ? bottom - state->cycle_q : state->cycle_z;
+    if (next < state->cycle_z)
+      next = state->cycle_z;
+
+    if (bottom < state->cycle_r)
+    {
+      target[2] = bottom;
+      gcode_toolpath_line (state, target, 1);
+    }
+
+    target[2] = next;
+    gcode_toolpath_line (state, target, 0);
+    target[2] = state->cycle_r;
+    gcode_toolpath_line (state, target, 1);
+
+    bottom = next;
+  }
+}
+
+
+static void
+gcode_toolpath_line_parse (gcode_toolpath_state_t *state, char *code)
+{
+  gfloat_t word[3], target[3], ijk[3], value, r, q;
+  uint8_t has[3];
+  int i, g, motion, cycle, depth;
+  char line[256], *sp, *end, letter;
+
+  /* Copy the line without comments or spaces */
+  i = 0;
+  depth = 0;
+  for (sp = code; *sp && *sp != '\n' && *sp != ';' && i < 255; sp++)
+  {
+    if (*sp == '(')
+      depth++;
+    else if (*sp == ')')
+      depth--;
+    else if (!depth && *sp != ' ' && *sp != '\t')
+      line[i++] = *sp;
+  }
+  line[i] = 0;
+
+  if (!line[0])
+    return;
+
+  has[0] = has[1] = has[2] = 0;
+  GCODE_MATH_VEC3D_SET (word, 0.0, 0.0, 0.0);
+  GCODE_MATH_VEC3D_SET (ijk, 0.0, 0.0, 0.0);
+  motion = -1;
+  cycle = -1;
+  r = q = 0.0;
+
+  for (sp = line; *sp;)
+  {
+    letter = toupper (*sp++);
+    value = strtod (sp, &end);
+    if (end == sp)
+      continue;
+    sp = end;
+
+    switch (letter)
+    {
+      case 'G':
+        g = (int) floor (value + 0.5);
+        if (g >= 0 && g <= 3)
+          motion = g;
+        else if (g == 80)
+          state->cycle = 0;
+        else if (g == 81 || g == 83)
+          cycle = g;
+        else if (g == 90)
+          state->absolute = 1;
+        else if (g == 91)
+          state->absolute = 0;
+        break;
+
+      case 'X':
+      case 'Y':
+      case 'Z':
+        word[letter - 'X'] = value;
+        has[letter - 'X'] = 1;
+        break;
+
+      case 'I':
+      case 'J':
+      case 'K':
+        ijk[letter - 'I'] = value;
+        break;
+
+      case 'Q':
+        q = value;
+        break;
+
+      case 'R':
+        r = value;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  for (i = 0; i < 3; i++)
+    target[i] = has[i] ? (state->absolute ? word[i] : state->pos[i] + word[i]) : state->pos[i];
+
+  if (!gcode_toolpath_start (state, target, has))
+  {
+    if (motion >= 0)
+      state->motion = motion;
+    return;
+  }
+
+  if (cycle > 0)
+  {
+    state->cycle = cycle;
+    if (has[2])
+      state->cycle_z = word[2];
+    state->cycle_r = r;
+    state->cycle_q = q;
+    if (has[0] || has[1])
+      gcode_toolpath_hole (state, target[0], target[1]);
+    return;
+  }
+
+  if (motion >= 0)
+    state->motion = motion;
+  else if (state->cycle && (has[0] || has[1]))
+  {
+    gcode_toolpath_hole (state, target[0], target[1]);
+    return;
+  }
+
+  if (!has[0] && !has[1] && !has[2])
+    return;
+
+  switch (state->motion)
+  {
+    case 0:
+      gcode_toolpath_line (state, target, 1);
+      break;
+
+    case 1:
+      gcode_toolpath_line (state, target, 0);
+      break;
+
+    case 2:
+    case 3:
+      gcode_toolpath_arc (state, target, ijk, state->motion == 2);
+      break;
+  }
+}
+
+
+/*
+* Make the code and read the toolpath back from it.  Arcs are broken
+* into chords within gcode->draw_tol.  Returns 1 when out of memory, with
+* the moves read so far kept.
+*/
+int
+gcode_toolpath_build (gcode_toolpath_t *toolpath, gcode_t *gcode)
+{
+  gcode_toolpath_state_t state;
+  gcode_block_t *block;
+  char *sp, *tsp;
+
+  gcode_toolpath_free (toolpath);
+
+  gcode_list_make (gcode);
+
+  memset (&state, 0, sizeof (gcode_toolpath_state_t));
+  state.toolpath = toolpath;
+  state.gcode = gcode;
+  state.absolute = 1;
+
+  for (block = gcode->list; block && !state.error; block = block->next)
+  {
+    if (!block->code)
+      continue;
+
+    for (sp = block->code; !state.error && (tsp = strchr (sp, '\n')); sp = tsp + 1)
+      gcode_toolpath_line_parse (&state, sp);
+  }
+
+  return (state.error);
+}
@@ -0,0 +1,55 @@
+/*
+*  gcode_toolpath.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_TOOLPATH_H
+#define _GCODE_TOOLPATH_H
+
+#include "gcode_internal.h"
+
+#define GCODE_TOOLPATH_RAPID		0x0
+#define GCODE_TOOLPATH_FEED		0x1
+#define GCODE_TOOLPATH_PLUNGE		0x2
+#define GCODE_TOOLPATH_KIND_NUM		3
+
+/* Laid out as GL_C4UB_V3F, the color of a vertex is the color of the move ending there */
+typedef struct gcode_toolpath_vertex_s
+{
+  uint8_t color[4];
+  float pos[3];
+} gcode_toolpath_vertex_t;
+
+typedef struct gcode_toolpath_s
+{
+  uint8_t color[GCODE_TOOLPATH_KIND_NUM][4];	/* rgba of each kind of move */
+
+  uint32_t vertex_num;
+  uint32_t vertex_max;
+  gcode_toolpath_vertex_t *vertex;	/* one line strip through every move */
+
+  uint32_t move_num;
+  uint32_t move_max;
+  uint32_t *move;		/* last vertex of each move */
+
+  uint32_t kind_num[GCODE_TOOLPATH_KIND_NUM];	/* moves of each kind */
+} gcode_toolpath_t;
+
+void gcode_toolpath_init (gcode_toolpath_t *toolpath);
+void gcode_toolpath_free (gcode_toolpath_t *toolpath);
+int gcode_toolpath_build (gcode_toolpath_t *toolpath, gcode_t *gcode);
+
+#endif
@@ -20,6 +20,7 @@
 #include <inttypes.h>
 #include "gcode.h"
 #include "gcode_arc.h"
+#include "gcode_contour.h"
 #include "gcode_line.h"
 
 
@@ -473,11 +474,64 @@ gcode_util_intersect (gcode_block_t *block_a, gcode_block_t *block_b, gcode_vec2
 }
 
 
+/*
+* Replace a closed list with the largest loop of its offset, made by the
+* offset engine, which removes self intersections anywhere along the list
+* rather than only between neighbors.  Returns 0 to leave the list alone.
+*/
+static int
+push_contour (gcode_block_t **list, gcode_offset_t *zero_offset)
+{
+  gcode_contour_t contour;
+  gcode_contour_ring_t ring;
+  gcode_block_t *offset_list;
+  gfloat_t distance, area, best_area;
+  int i, best;
+
+  distance = (*list)->offset->side * ((*list)->offset->tool + (*list)->offset->eval);
+  if (fabs (distance) < GCODE_CONTOUR_TOL)
+    return (0);
+
+  gcode_contour_init (&contour);
+  if (gcode_contour_from_list (&contour, *list, NULL))
+  {
+    gcode_contour_free (&contour);
+    return (0);
+  }
+
+  gcode_contour_offset (&contour, &distance, 1, &ring);
+
+  best = -1;
+  best_area = 0.0;
+  for (i = 0; i < ring.loop_num; i++)
+  {
+    area = fabs (gcode_contour_area (&ring.loop[i]));
+    if (area > best_area)
+    {
+      best = i;
+      best_area = area;
+    }
+  }
+
+  if (best >= 0)
+  {
+    gcode_contour_to_list (&ring.loop[best], (*list)->gcode, (*list)->parent, zero_offset, &offset_list);
+    gcode_list_free (list);
+    *list = offset_list;
+  }
+
+  gcode_contour_ring_free (&ring);
+  gcode_contour_free (&contour);
+
+  return (best >= 0);
+}
+
+
 void
-gcode_util_push_offset (gcode_block_t *list)
+gcode_util_push_offset (gcode_block_t **offset_list)
 {
   gcode_block_t *working_index_block, *next_block, *next_next_block, *prev_block, *prev_prev_block, *last_block;
-  gcode_block_t *duplicate_list, *index_block;
+  gcode_block_t *duplicate_list, *index_block, *list;
   gcode_vec2d_t ip_array[2];
   int miss, ip_num, ip_ind;
   gcode_offset_t *zero_offset;
@@ -488,6 +542,7 @@ gcode_util_push_offset (gcode_block_t *list)
   * Walk through each block and intersect / truncate etc.
   */
 
+  list = *offset_list;
   zero_offset = (gcode_offset_t *) malloc (sizeof (gcode_offset_t));
   zero_offset->side = list->offset->side;
   zero_offset->tool = 0.0;
@@ -496,6 +551,13 @@ gcode_util_push_offset (gcode_block_t *list)
   zero_offset->origin[1] = 0.0;
   zero_offset->rotation = 0.0;
 
+  /*
+  * Closed lists go through the offset engine, which may hand back new
+  * blocks.  Open lists and single blocks are pushed and trimmed below.
+  */
+  if (list->next && push_contour (offset_list, zero_offset))
+    return;
+
   /*
   * Push Offset
   */
@@ -0,0 +1,386 @@
+/*
+*  gcode_voxel.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gcode_voxel.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <sys/mman.h>
+#endif
+
+
+/*
+* Create an unlinked scratch file of the requested size and map it.
+* The file goes away on its own when the mapping and descriptor are closed.
+*/
+static int
+gcode_voxel_map_scratch (gcode_t *gcode)
+{
+#ifndef _WIN32
+  char filename[256];
+  const char *dir;
+  int fd;
+  void *map;
+
+  dir = getenv ("TMPDIR");
+  if (!dir)
+    dir = "/tmp";
+
+  snprintf (filename, 256, "%s/gcam-stock-XXXXXX", dir);
+  fd = mkstemp (filename);
+  if (fd < 0)
+    return (1);
+  unlink (filename);
+
+  if (ftruncate (fd, (off_t) gcode->voxel_size))
+  {
+    close (fd);
+    return (1);
+  }
+
+  gcode->voxel_resident = (uint8_t *) calloc ((gcode->voxel_size + GCODE_VOXEL_CHUNK - 1) / GCODE_VOXEL_CHUNK, 1);
+  if (!gcode->voxel_resident)
+  {
+    close (fd);
+    return (1);
+  }
+
+  map = mmap (NULL, gcode->voxel_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    free (gcode->voxel_resident);
+    gcode->voxel_resident = NULL;
+    close (fd);
+    return (1);
+  }
+
+  /* No read ahead, or faults would map in far more than the chunks accounted for */
+  madvise (map, gcode->voxel_size, MADV_RANDOM);
+
+  gcode->voxel_map = (uint8_t *) map;
+  gcode->voxel_fd = fd;
+  gcode->voxel_mapped = gcode->voxel_size;
+  gcode->voxel_touched = 0;
+
+  return (0);
+#else
+  return (1);
+#endif
+}
+
+
+/*
+* Allocate voxel_map for voxel_size bytes.  Small stocks live on the heap,
+* large ones in a scratch file so that only the pages near the cutter are
+* resident at any one time.
+*/
+int
+gcode_voxel_alloc (gcode_t *gcode)
+{
+  size_t tile_num;
+  int i;
+
+  gcode_voxel_free (gcode);
+
+  for (i = 0; i < 3; i++)
+    gcode->voxel_tile_num[i] = (gcode->voxel_num[i] + GCODE_VOXEL_TILE - 1) / GCODE_VOXEL_TILE;
+  tile_num = (size_t) gcode->voxel_tile_num[0] * gcode->voxel_tile_num[1] * gcode->voxel_tile_num[2];
+
+  /* A fresh stock has never been seen by anyone */
+  gcode->voxel_dirty = (uint8_t *) malloc (tile_num);
+  if (!gcode->voxel_dirty)
+    return (1);
+  memset (gcode->voxel_dirty, 1, tile_num);
+
+  if (gcode->voxel_size > GCODE_VOXEL_CORE_LIMIT)
+    if (!gcode_voxel_map_scratch (gcode))
+      return (0);
+
+  /*
+  * gcode_voxel_set compares before it writes, so start from a defined
+  * (empty) stock just as a freshly truncated scratch file does.
+  */
+  gcode->voxel_map = (uint8_t *) calloc (gcode->voxel_size, 1);
+
+  return (gcode->voxel_map ? 0 : 1);
+}
+
+
+void
+gcode_voxel_free (gcode_t *gcode)
+{
+#ifndef _WIN32
+  if (gcode->voxel_fd >= 0)
+  {
+    /* gcode_prep has already worked out the size of the next stock */
+    munmap (gcode->voxel_map, gcode->voxel_mapped);
+    close (gcode->voxel_fd);
+    gcode->voxel_fd = -1;
+    gcode->voxel_mapped = 0;
+    gcode->voxel_map = NULL;
+    free (gcode->voxel_resident);
+    gcode->voxel_resident = NULL;
+  }
+#endif
+
+  free (gcode->voxel_map);
+  gcode->voxel_map = NULL;
+
+  free (gcode->voxel_dirty);
+  gcode->voxel_dirty = NULL;
+}
+
+
+/*
+* Set len bytes of voxel_map from ind on to value, flagging only the tiles
+* where a voxel actually changes so a redraw can skip the rest.
+*/
+void
+gcode_voxel_set (gcode_t *gcode, size_t ind, size_t len, uint8_t value)
+{
+  size_t i, end;
+
+  end = ind + len;
+  for (i = ind; i < end;)
+  {
+    if (gcode->voxel_map[i] != value)
+    {
+      i = gcode_voxel_dirty_index (gcode, i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  memset (&gcode->voxel_map[ind], value, len);
+}
+
+
+void
+gcode_voxel_fill (gcode_t *gcode, uint8_t value)
+{
+  size_t ind, len;
+
+  for (ind = 0; ind < gcode->voxel_size; ind += len)
+  {
+    len = gcode->voxel_size - ind;
+    if (len > GCODE_VOXEL_RESIDENT_LIMIT)
+      len = GCODE_VOXEL_RESIDENT_LIMIT;
+
+    gcode_voxel_touch (gcode, ind, len);
+    gcode_voxel_set (gcode, ind, len, value);
+  }
+}
+
+
+/*
+* Record that bytes ind..ind+len of a mapped stock are about to be
+* accessed, flagging the chunks they lie in.  Once the chunks flagged would
+* pass the resident limit their pages are dropped from the mapping, the
+* data stays in the file and is faulted back in as the cutter returns.
+*/
+void
+gcode_voxel_touch (gcode_t *gcode, size_t ind, size_t len)
+{
+  size_t chunk, first, last, bytes;
+
+  if (gcode->voxel_fd < 0 || len == 0)
+    return;
+
+  first = ind / GCODE_VOXEL_CHUNK;
+  last = (ind + len - 1) / GCODE_VOXEL_CHUNK;
+
+  bytes = 0;
+  for (chunk = first; chunk <= last; chunk++)
+    if (!gcode->voxel_resident[chunk])
+      bytes += GCODE_VOXEL_CHUNK;
+
+  /* Release before flagging, all of these chunks are still to be used */
+  if (bytes && gcode->voxel_touched + bytes > GCODE_VOXEL_RESIDENT_LIMIT)
+    gcode_voxel_release (gcode);
+
+  for (chunk = first; chunk <= last; chunk++)
+  {
+    if (!gcode->voxel_resident[chunk])
+    {
+      gcode->voxel_resident[chunk] = 1;
+      gcode->voxel_touched += GCODE_VOXEL_CHUNK;
+    }
+  }
+}
+
+
+/*
+* Touch voxels (x0..x1, y0..y1, z0..z1) a run at a time in the current
+* layout, so only the chunks the box lies in are flagged.
+*/
+void
+gcode_voxel_touch_box (gcode_t *gcode, int x0, int x1, int y0, int y1, int z0, int z1)
+{
+  int x, y, z;
+
+  if (gcode->voxel_fd < 0)
+    return;
+
+  switch (gcode->voxel_layout)
+  {
+    case GCODE_VOXEL_LAYOUT_COLUMN:
+      /* Columns of a row follow each other, the gaps between runs are too short to skip a page */
+      for (y = y0; y <= y1; y++)
+        gcode_voxel_touch (gcode, GCODE_VOXEL_INDEX (gcode, x0, y, z0), GCODE_VOXEL_INDEX (gcode, x1, y, z1) - GCODE_VOXEL_INDEX (gcode, x0, y, z0) + 1);
+      break;
+
+    case GCODE_VOXEL_LAYOUT_BRICK:
+      /* A brick is 512 bytes in a row */
+      for (z = z0 & ~7; z <= z1; z += 8)
+        for (y = y0 & ~7; y <= y1; y += 8)
+          for (x = x0 & ~7; x <= x1; x += 8)
+            gcode_voxel_touch (gcode, GCODE_VOXEL_INDEX (gcode, x, y, z), 512);
+      break;
+
+    default:
+      for (z = z0; z <= z1; z++)
+        for (y = y0; y <= y1; y++)
+          gcode_voxel_touch (gcode, GCODE_VOXEL_INDEX (gcode, x0, y, z), x1 - x0 + 1);
+      break;
+  }
+}
+
+
+void
+gcode_voxel_release (gcode_t *gcode)
+{
+#ifndef _WIN32
+  size_t chunk, first, chunk_num, end;
+
+  if (gcode->voxel_fd < 0)
+    return;
+
+  /* Hand back each run of accessed chunks in one call */
+  chunk_num = (gcode->voxel_mapped + GCODE_VOXEL_CHUNK - 1) / GCODE_VOXEL_CHUNK;
+  for (chunk = 0; chunk < chunk_num; chunk++)
+  {
+    if (!gcode->voxel_resident[chunk])
+      continue;
+
+    for (first = chunk; chunk < chunk_num && gcode->voxel_resident[chunk]; chunk++)
+      gcode->voxel_resident[chunk] = 0;
+
+    end = chunk * GCODE_VOXEL_CHUNK;
+    if (end > gcode->voxel_mapped)
+      end = gcode->voxel_mapped;
+    madvise (gcode->voxel_map + first * GCODE_VOXEL_CHUNK, end - first * GCODE_VOXEL_CHUNK, MADV_DONTNEED);
+  }
+  gcode->voxel_touched = 0;
+#endif
+}
+
+
+/*
+* Flag the tiles overlapping voxels (x0..x1, y0..y1, z0..z1) as written.
+* Readers such as the stock mesh clear the flags once they have caught up.
+*/
+void
+gcode_voxel_dirty (gcode_t *gcode, int x0, int x1, int y0, int y1, int z0, int z1)
+{
+  int i, j, k;
+  size_t row;
+
+  if (!gcode->voxel_dirty)
+    return;
+
+  x0 /= GCODE_VOXEL_TILE;
+  x1 /= GCODE_VOXEL_TILE;
+  y0 /= GCODE_VOXEL_TILE;
+  y1 /= GCODE_VOXEL_TILE;
+  z0 /= GCODE_VOXEL_TILE;
+  z1 /= GCODE_VOXEL_TILE;
+
+  for (k = z0; k <= z1; k++)
+    for (j = y0; j <= y1; j++)
+    {
+      row = ((size_t) k * gcode->voxel_tile_num[1] + j) * gcode->voxel_tile_num[0];
+      for (i = x0; i <= x1; i++)
+        gcode->voxel_dirty[row + i] = 1;
+    }
+}
+
+
+/*
+* Flag the tile holding byte ind of voxel_map and return the offset just
+* past the run of bytes that follows it in memory within the same tile.
+*/
+size_t
+gcode_voxel_dirty_index (gcode_t *gcode, size_t ind)
+{
+  size_t rest, end, brick;
+  int xyz[3], i;
+
+  switch (gcode->voxel_layout)
+  {
+    case GCODE_VOXEL_LAYOUT_COLUMN:
+      xyz[2] = ind % gcode->voxel_num[2];
+      rest = ind / gcode->voxel_num[2];
+      xyz[0] = rest % gcode->voxel_num[0];
+      xyz[1] = rest / gcode->voxel_num[0];
+      end = ind + GCODE_VOXEL_TILE - xyz[2] % GCODE_VOXEL_TILE;
+      if (end > ind - xyz[2] + gcode->voxel_num[2])
+        end = ind - xyz[2] + gcode->voxel_num[2];
+      break;
+
+    case GCODE_VOXEL_LAYOUT_BRICK:
+      /* Bricks never straddle a tile */
+      brick = ind >> 9;
+      xyz[0] = (brick % gcode->voxel_brick[0]) * 8 + (ind & 7);
+      xyz[1] = ((brick / gcode->voxel_brick[0]) % gcode->voxel_brick[1]) * 8 + ((ind >> 3) & 7);
+      xyz[2] = (brick / gcode->voxel_brick[0] / gcode->voxel_brick[1]) * 8 + ((ind >> 6) & 7);
+      end = (ind | 511) + 1;
+      break;
+
+    default:
+      xyz[0] = ind % gcode->voxel_num[0];
+      rest = ind / gcode->voxel_num[0];
+      xyz[1] = rest % gcode->voxel_num[1];
+      xyz[2] = rest / gcode->voxel_num[1];
+      end = ind + GCODE_VOXEL_TILE - xyz[0] % GCODE_VOXEL_TILE;
+      if (end > ind - xyz[0] + gcode->voxel_num[0])
+        end = ind - xyz[0] + gcode->voxel_num[0];
+      break;
+  }
+
+  /* Brick padding lies past the last voxel */
+  for (i = 0; i < 3; i++)
+    if (xyz[i] >= (int) gcode->voxel_num[i])
+      xyz[i] = gcode->voxel_num[i] - 1;
+
+  gcode_voxel_dirty (gcode, xyz[0], xyz[0], xyz[1], xyz[1], xyz[2], xyz[2]);
+
+  return (end);
+}
+
+
+void
+gcode_voxel_dirty_fill (gcode_t *gcode, uint8_t value)
+{
+  if (!gcode->voxel_dirty)
+    return;
+
+  memset (gcode->voxel_dirty, value, (size_t) gcode->voxel_tile_num[0] * gcode->voxel_tile_num[1] * gcode->voxel_tile_num[2]);
+}
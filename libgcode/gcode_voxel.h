@@ -0,0 +1,47 @@
+/*
+*  gcode_voxel.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GCODE_VOXEL_H
+#define _GCODE_VOXEL_H
+
+#include "gcode_internal.h"
+
+/* Stocks larger than this are kept in a memory mapped scratch file instead of the heap */
+#define GCODE_VOXEL_CORE_LIMIT		(256 << 20)
+
+/* Bytes of the chunks of a mapped stock accessed before they are handed back to the kernel */
+#define GCODE_VOXEL_RESIDENT_LIMIT	(64 << 20)
+
+/* Bytes of a mapped stock tracked together, as much as the kernel maps in around a fault */
+#define GCODE_VOXEL_CHUNK		(64 << 10)
+
+/* Voxels per side of the tiles tracked in voxel_dirty */
+#define GCODE_VOXEL_TILE		32
+
+int gcode_voxel_alloc (gcode_t *gcode);
+void gcode_voxel_free (gcode_t *gcode);
+void gcode_voxel_set (gcode_t *gcode, size_t ind, size_t len, uint8_t value);
+void gcode_voxel_fill (gcode_t *gcode, uint8_t value);
+void gcode_voxel_touch (gcode_t *gcode, size_t ind, size_t len);
+void gcode_voxel_touch_box (gcode_t *gcode, int x0, int x1, int y0, int y1, int z0, int z1);
+void gcode_voxel_release (gcode_t *gcode);
+void gcode_voxel_dirty (gcode_t *gcode, int x0, int x1, int y0, int y1, int z0, int z1);
+size_t gcode_voxel_dirty_index (gcode_t *gcode, size_t ind);
+void gcode_voxel_dirty_fill (gcode_t *gcode, uint8_t value);
+
+#endif
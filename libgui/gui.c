@@ -78,7 +78,10 @@ comment_cell_edited (GtkCellRendererText *cell,
   get_selected_block (&gui, &selected_block, &iter);
 
   if (selected_block)
+  {
+    gui_undo_block (&gui.undo, selected_block);
     strcpy (selected_block->comment, modified_text);
+  }
 
   gtk_tree_path_free (path);
   free (modified_text);
@@ -111,23 +114,81 @@ gcode_tree_row_collapsed_event (GtkTreeView *tree_view, GtkTreeIter *iter, GtkTr
 }
 
 
-static void
-opengl_context_expose_event (GtkWidget *widget, gpointer data)
+static gboolean
+gcode_tree_test_expand_row_event (GtkTreeView *tree_view, GtkTreeIter *iter, GtkTreePath *path, gpointer user_data)
+{
+  populate_block_row (&gui, iter);
+
+  return (FALSE);
+}
+
+
+static gboolean
+opengl_context_redraw_idle (gpointer data)
 {
   gcode_block_t *selected_block;
   GtkTreeIter iter;
+  double start, end;
+  char string[64];
+
+  gui.redraw_source = 0;
 
   get_selected_block (&gui, &selected_block, &iter);
 
+  start = g_timer_elapsed (gui.timer, NULL);
+  gui_opengl_context_redraw (&gui.opengl, selected_block);
+  end = g_timer_elapsed (gui.timer, NULL);
+
+  /* A pause between frames starts a new average */
+  if (start - gui.frame_last > 0.5)
+  {
+    gui.frame_start = start;
+    gui.frame_busy = 0.0;
+    gui.frame_num = 0;
+  }
+  gui.frame_last = end;
+  gui.frame_busy += end - start;
+  gui.frame_num++;
+
+  if (end - gui.frame_start >= 1.0)
+  {
+    sprintf (string, "%.1f fps, %.1f ms per frame", (double) gui.frame_num / (end - gui.frame_start), 1000.0 * gui.frame_busy / (double) gui.frame_num);
+    gtk_statusbar_pop (GTK_STATUSBAR (gui.status_bar), 0);
+    gtk_statusbar_push (GTK_STATUSBAR (gui.status_bar), 0, string);
+
+    gui.frame_start = end;
+    gui.frame_busy = 0.0;
+    gui.frame_num = 0;
+  }
+
+  return (FALSE);
+}
+
+
+/*
+* Mark the opengl context as needing a redraw.  The redraw happens once, after
+* every pending event has been handled, so a burst of motion events or exposes
+* produces a single frame drawn from the latest view.
+*/
+static void
+opengl_context_schedule_redraw (void)
+{
+  if (gui.redraw_source)
+    return;
+
+  gui.redraw_source = g_idle_add_full (GDK_PRIORITY_REDRAW, opengl_context_redraw_idle, NULL, NULL);
+}
+
+
+static void
+opengl_context_expose_event (GtkWidget *widget, gpointer data)
+{
   /*
   * When resizing the exposed event is triggered.
-  * It's not guaranteed what order the opengl context callback will be called in.
-  * Refresh the opengl context a few times while the rest of the window is being redrawn.
-  * This is kind of nasty, but it's the only solution I can think of right now without a using timer.
+  * It's not guaranteed what order the opengl context callback will be called in,
+  * drawing from idle runs after the rest of the window has been redrawn.
   */
-  gui_opengl_context_redraw (&gui.opengl, selected_block);
-  gui_opengl_context_redraw (&gui.opengl, selected_block);
-  gui_opengl_context_redraw (&gui.opengl, selected_block);
+  opengl_context_schedule_redraw ();
 /*  printf ("expose\n"); */
 }
 
@@ -152,10 +213,6 @@ opengl_context_button_event (GtkWidget *widget, GdkEventButton *event)
 
   modifiers = gtk_accelerator_get_default_mod_mask ();
 
-
-  /* Accurate to within 1/100th of a second, good 'nuff for frame dropping */
-  gui.event_time = 0.001 * (double) gtk_get_current_event_time () - g_timer_elapsed (gui.timer, NULL);
-
   gui.mouse_x = event->x;
   gui.mouse_y = event->y;
 
@@ -188,7 +245,7 @@ opengl_context_button_event (GtkWidget *widget, GdkEventButton *event)
           gui.opengl.view[GUI_OPENGL_VIEW_REGULAR].grid = GCODE_UNITS ((&gui.gcode), GUI_OPENGL_MIN_ZOOM);
       }
 
-      gui_opengl_context_redraw (&gui.opengl, selected_block);
+      opengl_context_schedule_redraw ();
     }
   }
   else if (event->type == GDK_BUTTON_PRESS)
@@ -208,7 +265,6 @@ opengl_context_motion_event (GtkWidget *widget, GdkEventMotion *event)
 {
   int16_t dx, dy;
   uint8_t update;
-  gfloat_t delay;
   gcode_block_t *selected_block;
   GtkTreeIter iter;
   guint modifiers;
@@ -313,12 +369,10 @@ opengl_context_motion_event (GtkWidget *widget, GdkEventMotion *event)
     update = 1;
   }
 
-  delay = (gui.event_time + g_timer_elapsed (gui.timer, NULL)) - 0.001 * (double) gtk_get_current_event_time ();
-
-  /* Drop frames that are older than 20ms old */
-  if (update && delay < 0.02)
+  /* Events arriving before the next frame only move the view further */
+  if (update)
   {
-    gui_opengl_context_redraw (&gui.opengl, selected_block);
+    opengl_context_schedule_redraw ();
     gui.mouse_x = event->x;
     gui.mouse_y = event->y;
   }
@@ -357,7 +411,7 @@ opengl_context_scroll_event (GtkWidget *widget, GdkEventScroll *event)
       gui.opengl.view[GUI_OPENGL_VIEW_REGULAR].grid = GCODE_UNITS ((&gui.gcode), GUI_OPENGL_MIN_ZOOM);
   }
 
-  gui_opengl_context_redraw (&gui.opengl, selected_block);
+  opengl_context_schedule_redraw ();
 
   return (TRUE);
 }
@@ -394,10 +448,11 @@ suppress_toggled (GtkCellRendererToggle *cell, gchar *path_str, gpointer data)
   gtk_tree_path_free (path);
 
   /* update block flag bits */
+  gui_undo_block (&gui.undo, selected_block);
   selected_block->flags = (selected_block->flags & ~GCODE_FLAGS_SUPPRESS) | toggle_item << 1;
 
   /* Update OpenGL context */
-  gui.opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui.opengl, selected_block);
   gui_opengl_context_redraw (&gui.opengl, selected_block);
 
   gui_menu_util_modified (&gui, 1);
@@ -444,6 +499,30 @@ row_drop_possible (GtkTreeDragDest *drag_dest, GtkTreePath *dest_path, GtkSelect
   */
   gtk_tree_view_get_drag_dest_row (GTK_TREE_VIEW (gui.gcode_block_treeview), &drop_path, &drop_pos);
 
+  /*
+  * Rows standing in for children not shown yet, a drop into a collapsed
+  * row lands on one.  Only lines and arcs go into a collapsed sketch, they
+  * are appended to it.
+  */
+  if (!dest_block)
+  {
+    GtkTreePath *parent_path;
+
+    parent_path = gtk_tree_path_copy (dest_path);
+    gtk_tree_path_up (parent_path);
+    gtk_tree_model_get_iter (model, &iter, parent_path);
+    gtk_tree_path_free (parent_path);
+
+    gtk_tree_model_get_value (model, &iter, 5, &value);
+    index_block = (gcode_block_t *) g_value_get_pointer (&value);
+    g_value_unset (&value);
+
+    if (!index_block || index_block->type != GCODE_TYPE_SKETCH)
+      return (FALSE);
+
+    return (src_block->type == GCODE_TYPE_ARC || src_block->type == GCODE_TYPE_LINE);
+  }
+
   /* Prevent BEGIN and END blocks from being moved */
   if (src_block->type == GCODE_TYPE_BEGIN || src_block->type == GCODE_TYPE_END)
     return (FALSE);
@@ -575,6 +654,47 @@ drag_data_received (GtkTreeDragDest *drag_dest, GtkTreePath *dest_path, GtkSelec
   dest_block = (gcode_block_t *) g_value_get_pointer (&value);
   g_value_unset (&value);
 
+  /*
+  * Dropped into a collapsed sketch, onto the row standing in for its children.
+  * Fill in the children and append the block after the last of them.
+  */
+  if (!dest_block)
+  {
+    gcode_block_t *last_block;
+    GtkTreeIter last_iter;
+
+    gtk_tree_path_up (dest_path);
+    gtk_tree_model_get_iter (model, &iter, dest_path);
+    gtk_tree_model_get_value (model, &iter, 5, &value);
+    dest_block = (gcode_block_t *) g_value_get_pointer (&value);
+    g_value_unset (&value);
+
+    populate_block_row (&gui, &iter);
+
+    gcode_list_splice (src_block->parent_list, src_block);
+    gtk_tree_store_remove (GTK_TREE_STORE (model), &src_iter);
+
+    last_block = ((gcode_sketch_t *) dest_block->pdata)->list;
+    while (last_block && last_block->next)
+      last_block = last_block->next;
+
+    if (last_block && find_block_row (&gui, last_block, &last_iter))
+    {
+      insert_primitive (&gui, src_block, last_block, &last_iter, GUI_INSERT_AFTER);
+    }
+    else
+    {
+      insert_primitive (&gui, src_block, dest_block, &iter, GUI_INSERT_INTO);
+    }
+
+    gui.opengl.rebuild_view_display_list = 1;
+    gui_opengl_context_redraw (&gui.opengl, dest_block);
+
+    gui_menu_util_modified (&gui, 1);
+
+    return (TRUE);
+  }
+
   /*
   * Before doing the following check, make sure the path provided is not one of the
   * special case paths where the last item in a list, e.g. 1:0:4 (AFTER) is not
@@ -707,6 +827,8 @@ gui_init ()
   gui_settings_init (&gui.settings);
   gui_settings_read (&gui.settings);
 
+  gui_undo_init (&gui.undo);
+
   /*
   * Opengl Display Defaults
   */
@@ -716,6 +838,7 @@ gui_init ()
   gui.opengl.ready = 0;
   gui.opengl.projection = GUI_OPENGL_PROJECTION_ORTHOGRAPHIC;
   gui.opengl.progress_callback = &update_progress;
+  gcode_toolpath_init (&gui.opengl.toolpath);
 
   gui.timer = g_timer_new ();
   g_timer_start (gui.timer);
@@ -856,6 +979,7 @@ gui_init ()
     g_object_unref (tree);
     g_signal_connect (G_OBJECT (gui.gcode_block_treeview), "cursor-changed", G_CALLBACK (gcode_tree_cursor_changed_event), NULL);
     g_signal_connect (G_OBJECT (gui.gcode_block_treeview), "row-collapsed", G_CALLBACK (gcode_tree_row_collapsed_event), NULL);
+    g_signal_connect (G_OBJECT (gui.gcode_block_treeview), "test-expand-row", G_CALLBACK (gcode_tree_test_expand_row_event), NULL);
     gtk_container_add (GTK_CONTAINER (sw), gui.gcode_block_treeview);
 
 
@@ -902,6 +1026,12 @@ gui_init ()
     gtk_tree_view_append_column (GTK_TREE_VIEW (gui.gcode_block_treeview), column);
   }
 
+  /* Status Bar */
+  {
+    gui.status_bar = gtk_statusbar_new ();
+    gtk_box_pack_end (GTK_BOX (window_vbox_main), gui.status_bar, FALSE, FALSE, 0);
+  }
+
   /* Progress Bar */
   {
     gui.progress_bar = gtk_progress_bar_new ();
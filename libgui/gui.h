@@ -23,6 +23,7 @@
 #include "gui_settings.h"
 #include "gui_endmills.h"
 #include "gui_machines.h"
+#include "gui_undo.h"
 #include <inttypes.h>
 #include <gtk/gtk.h>
 #include <gtk/gtkgl.h>
@@ -32,9 +33,14 @@ typedef struct gui_s
   gcode_t gcode;
   gui_opengl_t opengl;
   gui_settings_t settings;
+  gui_undo_t undo;
 
   GTimer *timer;
-  double event_time;
+  guint redraw_source;		/* pending idle redraw of the opengl context, 0 for none */
+  double frame_start;		/* frame rate is averaged over frames since this time */
+  double frame_last;
+  double frame_busy;		/* seconds spent drawing since frame_start */
+  int frame_num;
 
   GtkWidget *window;
   GtkUIManager *ui_manager;
@@ -47,9 +53,12 @@ typedef struct gui_s
 
   GtkTreeStore *gcode_block_store;
   GtkWidget *gcode_block_treeview;
+  GtkTreeRowReference **block_row;	/* by block handle, rows looked up so far */
+  uint32_t block_row_num;
   GtkCellRenderer *comment_cell;
 
   GtkWidget *progress_bar;
+  GtkWidget *status_bar;
   gcode_block_t *selected_block;
 
   char title[64];
@@ -38,6 +38,8 @@
 
 #define MANTISSA			5	/* Length of Mantissa */
 
+#define RENDER_PREVIEW_INTERVAL		0.5	/* Seconds between redraws of the stock while rendering */
+
 #define GUI_INSERT_AFTER		0
 #define	GUI_INSERT_INTO			1
 #define	GUI_INSERT_WITH_TANGENCY	2
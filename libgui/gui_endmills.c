@@ -52,6 +52,9 @@ start (void *data, const char *el, const char **attr)
 
   endmill_list->endmill = realloc (endmill_list->endmill, (endmill_list->num+1) * sizeof (gui_endmill_t));
   strcpy (endmill_list->endmill[endmill_list->num].description, "");
+  endmill_list->endmill[endmill_list->num].shape = GCODE_TOOL_SHAPE_FLAT;
+  endmill_list->endmill[endmill_list->num].angle = 90.0;
+  endmill_list->endmill[endmill_list->num].corner = 0.0;
 
   for (i = 0; attr[i]; i+= 2)
   {
@@ -73,6 +76,28 @@ start (void *data, const char *el, const char **attr)
       }
     }
 
+    if (!strcmp ("type", attr[i]))
+    {
+      if (!strcmp ("ball nose", attr[i+1]))
+      {
+        endmill_list->endmill[endmill_list->num].shape = GCODE_TOOL_SHAPE_BALL;
+      }
+      else if (!strcmp ("v-bit", attr[i+1]))
+      {
+        endmill_list->endmill[endmill_list->num].shape = GCODE_TOOL_SHAPE_VBIT;
+      }
+      else if (!strcmp ("bull nose", attr[i+1]))
+      {
+        endmill_list->endmill[endmill_list->num].shape = GCODE_TOOL_SHAPE_BULL;
+      }
+    }
+
+    if (!strcmp ("angle", attr[i]))
+      endmill_list->endmill[endmill_list->num].angle = atof (attr[i+1]);
+
+    if (!strcmp ("corner_radius", attr[i]))
+      endmill_list->endmill[endmill_list->num].corner = atof (attr[i+1]);
+
     if (!strcmp ("description", attr[i]))
       strcpy (endmill_list->endmill[endmill_list->num].description, attr[i+1]);
   }
@@ -146,10 +171,16 @@ gui_endmills_read (gui_endmill_list_t *endmill_list, gcode_t *gcode)
   for (i = 0; i < endmill_list->num; i++)
   {
     if (endmill_list->endmill[i].unit == GCODE_UNITS_INCH && gcode->units == GCODE_UNITS_MILLIMETER)
+    {
       endmill_list->endmill[i].diameter *= GCODE_INCH2MM;
+      endmill_list->endmill[i].corner *= GCODE_INCH2MM;
+    }
 
     if (endmill_list->endmill[i].unit == GCODE_UNITS_MILLIMETER && gcode->units == GCODE_UNITS_INCH)
+    {
       endmill_list->endmill[i].diameter *= GCODE_MM2INCH;
+      endmill_list->endmill[i].corner *= GCODE_MM2INCH;
+    }
   }
 
   return (0);
@@ -26,6 +26,9 @@ typedef struct gui_endmill_s
   uint8_t number;
   gfloat_t diameter;
   uint8_t unit;
+  uint8_t shape;
+  gfloat_t angle;
+  gfloat_t corner;
   char description[64];
 } gui_endmill_t;
 
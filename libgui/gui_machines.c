@@ -61,6 +61,8 @@ start (void *data, const char *el, const char **attr)
     machine_list->machine[machine_list->num].maxipm[1] = 0.0;
     machine_list->machine[machine_list->num].maxipm[2] = 0.0;
 
+    machine_list->machine[machine_list->num].accel = 0.0;
+
     machine_list->machine[machine_list->num].options = 0;
 
     if (!strcmp ("name", attr[0]))
@@ -89,6 +91,9 @@ start (void *data, const char *el, const char **attr)
       if (!strcmp ("max_ipm_z", attr[i]))
         machine_list->machine[machine_list->num].maxipm[2] = atof (attr[i+1]);
 
+      if (!strcmp ("accel", attr[i]))
+        machine_list->machine[machine_list->num].accel = atof (attr[i+1]);
+
       if (!strcmp ("spindle_control", attr[i]))
       {
         if (!strcmp (attr[i+1], "yes"))
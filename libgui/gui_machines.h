@@ -26,6 +26,7 @@ typedef struct gui_machine_s
   char name[64];
   gfloat_t travel[3];
   gfloat_t maxipm[3];
+  gfloat_t accel;	/* inches per second squared, 0 if unknown */
   unsigned char options;
 } gui_machine_t;
 
@@ -42,6 +42,8 @@ static GtkActionEntry gui_menu_entries[] = {
   { "Import STL",			GTK_STOCK_OPEN,		"Import STL",			NULL,			"Import STL",			G_CALLBACK (gui_menu_file_import_stl_menuitem_callback) },
   { "Quit",				GTK_STOCK_QUIT,		"_Quit",			"<control>Q",		"Quit GCAM", 				G_CALLBACK (gui_menu_file_quit_menuitem_callback) },
   { "EditMenu",				NULL,			"_Edit" },
+  { "Undo",				GTK_STOCK_UNDO,		"_Undo",			"<control>Z",		"Undo",					G_CALLBACK (gui_menu_edit_undo_menuitem_callback) },
+  { "Redo",				GTK_STOCK_REDO,		"Re_do",			"<control>Y",		"Redo",					G_CALLBACK (gui_menu_edit_redo_menuitem_callback) },
   { "Remove",				GTK_STOCK_DELETE,	"_Remove",			"<control>R",		"Remove",				G_CALLBACK (gui_menu_edit_remove_menuitem_callback) },
   { "Duplicate",			GTK_STOCK_COPY,		"_Duplicate",			"<control>D",		"Duplicate",				G_CALLBACK (gui_menu_edit_duplicate_menuitem_callback) },
   { "Scale",				NULL,			"_Scale",			NULL,			"Scale",				G_CALLBACK (gui_menu_edit_scale_menuitem_callback) },
@@ -72,8 +74,13 @@ static GtkActionEntry gui_menu_entries[] = {
   { "Right",				NULL,			"_Right",			NULL,			"View Right",				G_CALLBACK (gui_menu_view_right_menuitem_callback) },
   { "Front",				NULL,			"_Front",			NULL,			"View Front",				G_CALLBACK (gui_menu_view_front_menuitem_callback) },
   { "Back",				NULL,			"_Back",			NULL,			"View Back",				G_CALLBACK (gui_menu_view_back_menuitem_callback) },
+  { "Memory Usage",			NULL,			"_Memory Usage",		NULL,			"View Memory Usage",			G_CALLBACK (gui_menu_view_memory_usage_menuitem_callback) },
+  { "Trim Memory",			NULL,			"T_rim Memory",			NULL,			"Release Unused G-Code Buffer Space",	G_CALLBACK (gui_menu_view_trim_memory_menuitem_callback) },
   { "RenderMenu", 			NULL,			"_Render" },
   { "FinalPart",			NULL,			"_Final Part",			"<control>F",		"Render Final Part",			G_CALLBACK (gui_menu_view_render_final_part_menuitem_callback) },
+  { "RegionPart",			NULL,			"_Region...",			NULL,			"Render a Region of the Part at its own Resolution",	G_CALLBACK (gui_menu_view_render_region_menuitem_callback) },
+  { "CycleTime",			NULL,			"_Cycle Time",			NULL,			"Estimate Cycle Time",			G_CALLBACK (gui_menu_view_cycle_time_menuitem_callback) },
+  { "Toolpath",				NULL,			"_Toolpath...",			NULL,			"Show the Moves of the Generated Code",	G_CALLBACK (gui_menu_view_toolpath_menuitem_callback) },
   { "HelpMenu", 			NULL,			"_Help" },
   { "Manual",				GTK_STOCK_HELP, 	"_Manual",			NULL,			"GCAM Manual",				G_CALLBACK (gui_menu_help_manual_menuitem_callback) },
   { "About",				0, 			"_About",			NULL,			"About GCAM",				G_CALLBACK (gui_menu_help_about_menuitem_callback) },
@@ -101,6 +108,9 @@ static const char *gui_menu_description =
 "      <menuitem action='Quit'/>"
 "    </menu>"
 "    <menu action='EditMenu'>"
+"      <menuitem action='Undo'/>"
+"      <menuitem action='Redo'/>"
+"      <separator/>"
 "      <menuitem action='Remove'/>"
 "      <menuitem action='Duplicate'/>"
 "      <separator/>"
@@ -146,9 +156,15 @@ static const char *gui_menu_description =
 "      <menuitem action='Right'/>"
 "      <menuitem action='Front'/>"
 "      <menuitem action='Back'/>"
+"      <separator/>"
+"      <menuitem action='Memory Usage'/>"
+"      <menuitem action='Trim Memory'/>"
 "    </menu>"
 "    <menu action='RenderMenu'>"
 "      <menuitem action='FinalPart'/>"
+"      <menuitem action='RegionPart'/>"
+"      <menuitem action='CycleTime'/>"
+"      <menuitem action='Toolpath'/>"
 "    </menu>"
 "    <menu action='HelpMenu'>"
 "      <menuitem action='Manual'/>"
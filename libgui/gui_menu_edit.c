@@ -24,14 +24,63 @@
 #include "gui_tab.h"
 
 
+/* Show the project as the step left it, the tree is rebuilt as blocks may have come and gone */
+static void
+show_undo_step (gui_t *gui, gcode_block_t *block)
+{
+  GtkTreeIter iter;
+
+  refresh_gcode_block_tree (gui);
+
+  set_selected_row_with_block (gui, block ? block : gui->gcode.list);
+  get_selected_block (gui, &block, &iter);
+  gui_tab_display (gui, block, 1);
+  update_menu_options (gui, block);
+
+  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_context_redraw (&gui->opengl, block);
+
+  gui_menu_util_modified (gui, 1);
+}
+
+
+void
+gui_menu_edit_undo_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  gui_t *gui;
+
+  gui = (gui_t *) data;
+
+  if (!gui->undo.step_done)
+    return;
+
+  show_undo_step (gui, gui_undo_undo (&gui->undo));
+}
+
+
+void
+gui_menu_edit_redo_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  gui_t *gui;
+
+  gui = (gui_t *) data;
+
+  if (gui->undo.step_done == gui->undo.step_num)
+    return;
+
+  show_undo_step (gui, gui_undo_redo (&gui->undo));
+}
+
+
 void
 gui_menu_edit_remove_menuitem_callback (GtkWidget *widget, gpointer data)
 {
   gcode_block_t *selected_block;
-  GtkTreeIter iter;
+  GtkTreeIter iter, parent_iter;
   GtkTreeModel *model;
   GtkTreePath *path;
   gui_t *gui;
+  int has_parent;
 
   gui = (gui_t *) data;
 
@@ -45,6 +94,7 @@ gui_menu_edit_remove_menuitem_callback (GtkWidget *widget, gpointer data)
 
   model = gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview));
   path = gtk_tree_model_get_path (model, &iter);
+  has_parent = gtk_tree_model_iter_parent (model, &parent_iter, &iter);
 
   if (selected_block->prev)
   {
@@ -61,10 +111,10 @@ gui_menu_edit_remove_menuitem_callback (GtkWidget *widget, gpointer data)
 
   gtk_tree_selection_select_path (gtk_tree_view_get_selection (GTK_TREE_VIEW (gui->gcode_block_treeview)), path);
 
-  gcode_list_remove (selected_block);
+  gui_undo_remove (&gui->undo, selected_block);
   gtk_tree_store_remove (gui->gcode_block_store, &iter);
 
-  update_block_tree_order (gui);
+  update_block_tree_order (gui, has_parent ? &parent_iter : NULL);
 
   get_selected_block (gui, &selected_block, &iter);
   gui_tab_display (gui, selected_block, 0);
@@ -84,7 +134,7 @@ generate_pattern_callback (GtkWidget *widget, gpointer data)
 {
   GtkWidget **wlist;
   GtkTreeIter iter, parent_iter, child_iter;
-  gcode_block_t *selected_block, *block_ind;
+  gcode_block_t *selected_block, *block_ind, *old_list;
   gui_t *gui;
   int i;
 
@@ -96,23 +146,25 @@ generate_pattern_callback (GtkWidget *widget, gpointer data)
 
   if (selected_block->type == GCODE_TYPE_SKETCH)
   {
-    gcode_sketch_pattern (selected_block,
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[2])),
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3])),
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4])),
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[5])),
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[6])),
-			  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[7])));
+    old_list = gcode_sketch_pattern (selected_block,
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[2])),
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3])),
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4])),
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[5])),
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[6])),
+				     gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[7])));
+    gui_undo_list (&gui->undo, selected_block, &((gcode_sketch_t *) selected_block->pdata)->list, old_list);
   }
   else if (selected_block->type == GCODE_TYPE_DRILL_HOLES)
   {
-    gcode_drill_holes_pattern (selected_block,
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[2])),
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3])),
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4])),
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[5])),
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[6])),
-			       gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[7])));
+    old_list = gcode_drill_holes_pattern (selected_block,
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[2])),
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3])),
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4])),
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[5])),
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[6])),
+					  gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[7])));
+    gui_undo_list (&gui->undo, selected_block, &((gcode_drill_holes_t *) selected_block->pdata)->list, old_list);
   }
 
   /* Destroy the window along with all of its widgets */
@@ -255,6 +307,8 @@ gui_menu_edit_flip_direction_menuitem_callback (GtkWidget *widget, gpointer data
 
   get_selected_block (gui, &selected_block, &iter);
 
+  gui_undo_block (&gui->undo, selected_block);
+
   if (selected_block->type == GCODE_TYPE_LINE)
   {
     gcode_line_flip_direction (selected_block);
@@ -750,6 +804,7 @@ gui_menu_edit_join_previous_menuitem_callback (GtkWidget *widget, gpointer data)
     {
       if (selected_block->prev->ends)
       {
+        gui_undo_block (&gui->undo, selected_block->prev);
         selected_block->prev->ends (selected_block->prev, t0, t1, GCODE_GET);
         selected_block->prev->ends (selected_block->prev, t0, p0, GCODE_SET);
       }
@@ -785,6 +840,7 @@ gui_menu_edit_join_next_menuitem_callback (GtkWidget *widget, gpointer data)
     {
       if (selected_block->next->ends)
       {
+        gui_undo_block (&gui->undo, selected_block->next);
         selected_block->next->ends (selected_block->next, t0, t1, GCODE_GET);
         selected_block->next->ends (selected_block->next, p1, t1, GCODE_SET);
       }
@@ -840,6 +896,8 @@ fillet_previous_on_assistant_apply (GtkWidget *widget, gpointer data)
 
   gcode_arc_init (&gui->gcode, &fillet_block, selected_block->parent);
 
+  gui_undo_block (&gui->undo, prev_connected_block);
+  gui_undo_block (&gui->undo, selected_block);
   gcode_util_fillet (prev_connected_block, selected_block, fillet_block, radius);
 
   insert_primitive (gui, fillet_block, prev_connected_block, &iter, GUI_INSERT_AFTER);
@@ -886,6 +944,8 @@ fillet_next_on_assistant_apply (GtkWidget *widget, gpointer data)
 
   gcode_arc_init (&gui->gcode, &fillet_block, selected_block->parent);
 
+  gui_undo_block (&gui->undo, selected_block);
+  gui_undo_block (&gui->undo, next_connected_block);
   gcode_util_fillet (selected_block, next_connected_block, fillet_block, radius);
 
   insert_primitive (gui, fillet_block, selected_block, &iter, GUI_INSERT_AFTER);
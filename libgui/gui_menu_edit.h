@@ -21,6 +21,8 @@
 
 #include <gtk/gtk.h>
 
+void gui_menu_edit_undo_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_edit_redo_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_edit_remove_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_edit_cut_block_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_edit_paste_block_menuitem_callback (GtkWidget *widget, gpointer data);
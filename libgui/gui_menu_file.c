@@ -21,6 +21,7 @@
 #include "gui.h"
 #include "gui_define.h"
 #include "gui_tab.h"
+#include "gcode_sim.h"
 
 
 static void
@@ -211,6 +212,7 @@ create_project_callback (GtkWidget *widget, gpointer data)
 
   gui->gcode.progress_callback = update_progress;
   gui->gcode.voxel_res = gui->settings.voxel_resolution;
+  gui->gcode.voxel_layout = gui->settings.voxel_layout;
   gcode_prep (&gui->gcode);
   prep_project (gui);
 
@@ -392,6 +394,24 @@ gui_menu_file_new_project_menuitem_callback (GtkWidget *widget, gpointer data)
 }
 
 
+/*
+* The simulated stock is kept next to the project so reopening it does not
+* mean simulating again.  A stock rendered before the project had a file
+* name is written out straight away.
+*/
+static void
+set_sim_cache (gui_t *gui)
+{
+  int num;
+
+  sprintf (gui->gcode.sim_cache, "%s.sim", gui->save_filename);
+
+  num = gui->gcode.sim_snapshot_num;
+  if (num > 0 && gui->gcode.sim_snapshot[num-1].rle && !gui->gcode.voxel_roi)
+    gcode_sim_cache_save (&gui->gcode, &gui->gcode.sim_snapshot[num-1], gui->gcode.sim_cache);
+}
+
+
 void
 gui_menu_file_load_project_menuitem_callback (GtkWidget *widget, gpointer data)
 {
@@ -425,9 +445,11 @@ gui_menu_file_load_project_menuitem_callback (GtkWidget *widget, gpointer data)
     {
       gui->gcode.progress_callback = update_progress;
       gui->gcode.voxel_res = gui->settings.voxel_resolution;
+      gui->gcode.voxel_layout = gui->settings.voxel_layout;
       gcode_prep (&gui->gcode);
 
       strcpy (gui->save_filename, filename);
+      set_sim_cache (gui);
 
       gtk_action_set_sensitive (gtk_ui_manager_get_action (gui->ui_manager, "/MainMenu/FileMenu/Save"), 1);
 
@@ -493,6 +515,7 @@ gui_menu_file_save_project_as_menuitem_callback (GtkWidget *widget, gpointer dat
     strcpy (gui->save_filename, filename);
     gtk_action_set_sensitive (gtk_ui_manager_get_action (gui->ui_manager, "/MainMenu/FileMenu/Save"), 1);
     gcode_save (&gui->gcode, filename);
+    set_sim_cache (gui);
 
     gui_menu_util_modified (gui, 0);
 
@@ -526,6 +549,7 @@ close_callback (GtkDialog *dialog, gint arg1, gpointer ptr)
     }
   }
 
+  gui_undo_free (&gui->undo);
   gcode_free (&gui->gcode);
 
   /* Refresh G-Code Block Tree */
@@ -558,6 +582,7 @@ gui_menu_file_close_project_menuitem_callback (GtkWidget *widget, gpointer data)
 
   if (!gui->modified)
   {
+    gui_undo_free (&gui->undo);
     gcode_free (&gui->gcode);
 
     /* Refresh G-Code Block Tree */
@@ -596,6 +621,8 @@ export_gcode_file_selector (GtkWidget *widget, gpointer ptr)
   GtkWidget **wlist;
   GtkFileFilter *filter;
   gui_t *gui;
+  gcode_vec3d_t roi_min, roi_span;
+  uint32_t roi_res;
   char proposed_filename[64];
   char *format;
 
@@ -619,6 +646,29 @@ export_gcode_file_selector (GtkWidget *widget, gpointer ptr)
     gui->gcode.driver = GCODE_DRIVER_HAAS;
   }
 
+  /* Feed rates are raised no further than the slower of the machine's X and Y rates */
+  gui->gcode.feed_max = 0.0;
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[4])))
+  {
+    gui_machine_list_t machine_list;
+    int i;
+
+    gui_machines_init (&machine_list);
+    gui_machines_read (&machine_list);
+
+    for (i = 0; i < machine_list.num; i++)
+    {
+      if (!strcmp (gui->gcode.machine_name, machine_list.machine[i].name))
+      {
+        gui->gcode.feed_max = machine_list.machine[i].maxipm[0] < machine_list.machine[i].maxipm[1] ? machine_list.machine[i].maxipm[0] : machine_list.machine[i].maxipm[1];
+        if (gui->gcode.units == GCODE_UNITS_MILLIMETER)
+          gui->gcode.feed_max *= GCODE_INCH2MM;
+      }
+    }
+
+    gui_machines_free (&machine_list);
+  }
+
   gtk_widget_destroy (wlist[1]);
   free (wlist);
 
@@ -643,7 +693,31 @@ export_gcode_file_selector (GtkWidget *widget, gpointer ptr)
 
     filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (dialog));
 
-    gcode_export (&gui->gcode, filename);
+    /* Engagement has to be measured over all of the material */
+    if (gui->gcode.feed_max > 0.0 && gui->gcode.voxel_roi)
+    {
+      roi_res = gui->gcode.voxel_res;
+      GCODE_MATH_VEC3D_COPY (roi_min, gui->gcode.voxel_min);
+      GCODE_MATH_VEC3D_COPY (roi_span, gui->gcode.voxel_span);
+
+      gui->gcode.voxel_roi = 0;
+      gui->gcode.voxel_res = gui->settings.voxel_resolution;
+      gcode_prep (&gui->gcode);
+
+      gcode_export (&gui->gcode, filename);
+
+      /* Then go back to the region, which has to be rendered again */
+      gui->gcode.voxel_roi = 1;
+      gui->gcode.voxel_res = roi_res;
+      GCODE_MATH_VEC3D_COPY (gui->gcode.voxel_min, roi_min);
+      GCODE_MATH_VEC3D_COPY (gui->gcode.voxel_span, roi_span);
+      gcode_prep (&gui->gcode);
+      gui->first_render = 1;
+    }
+    else
+    {
+      gcode_export (&gui->gcode, filename);
+    }
 
     g_free (filename);
   }
@@ -688,13 +762,14 @@ gui_menu_file_export_gcode_menuitem_callback (GtkWidget *widget, gpointer data)
   GtkWidget *label;
   GtkWidget *export_format_combo;
   GtkWidget *project_number_spin;
+  GtkWidget *optimize_feed_check_button;
   GtkWidget *export_button;
   GtkWidget **wlist;
   gui_t *gui;
 
   gui = (gui_t *) data;
 
-  wlist = (GtkWidget **) malloc (4 * sizeof (GtkWidget *));
+  wlist = (GtkWidget **) malloc (5 * sizeof (GtkWidget *));
 
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_window_set_modal (GTK_WINDOW (window), TRUE);
@@ -703,7 +778,7 @@ gui_menu_file_export_gcode_menuitem_callback (GtkWidget *widget, gpointer data)
   gtk_window_set_title (GTK_WINDOW (window), "Export Format");
   gtk_window_set_resizable (GTK_WINDOW (window), FALSE);
   
-  table = gtk_table_new (3, 2, FALSE);
+  table = gtk_table_new (4, 2, FALSE);
   gtk_table_set_col_spacings (GTK_TABLE (table), TABLE_SPACING);
   gtk_table_set_row_spacings (GTK_TABLE (table), TABLE_SPACING);
   gtk_container_set_border_width (GTK_CONTAINER (table), 4);
@@ -726,15 +801,22 @@ gui_menu_file_export_gcode_menuitem_callback (GtkWidget *widget, gpointer data)
   gtk_spin_button_set_value (GTK_SPIN_BUTTON (project_number_spin), 100.0);
   gtk_table_attach_defaults (GTK_TABLE (table), project_number_spin, 1, 2, 1, 2);
 
+  label = gtk_label_new ("Optimize Feed Rates");
+  gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 1, 2, 3);
+  optimize_feed_check_button = gtk_check_button_new ();
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (optimize_feed_check_button), 0);
+  gtk_table_attach_defaults (GTK_TABLE (table), optimize_feed_check_button, 1, 2, 2, 3);
+
   wlist[0] = (GtkWidget *) gui;
   wlist[1] = window;
   wlist[2] = export_format_combo;
   wlist[3] = project_number_spin;
+  wlist[4] = optimize_feed_check_button;
 
   gtk_widget_set_sensitive (wlist[3], 0);
 
   export_button = gtk_button_new_with_label ("Export");
-  gtk_table_attach_defaults (GTK_TABLE (table), export_button, 0, 2, 2, 3);
+  gtk_table_attach_defaults (GTK_TABLE (table), export_button, 0, 2, 3, 4);
   g_signal_connect (G_OBJECT (export_button), "clicked", G_CALLBACK (export_gcode_file_selector), wlist);
   gtk_widget_show_all (window);
 }
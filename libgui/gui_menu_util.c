@@ -190,6 +190,12 @@ insert_primitive (gui_t *gui, gcode_block_t *block, gcode_block_t *selected_bloc
   GtkTreeIter child_iter, parent_iter;
   int i;
 
+  /* Rows of the blocks it goes in beside have to be there before it is added */
+  if ((selected_block->type == GCODE_TYPE_SKETCH && (block->type == GCODE_TYPE_ARC || block->type == GCODE_TYPE_LINE)) ||
+      selected_block->type == GCODE_TYPE_EXTRUSION ||
+      (selected_block->type == GCODE_TYPE_TEMPLATE && action == GUI_INSERT_INTO && block->type != GCODE_TYPE_TEMPLATE) ||
+      (selected_block->type == GCODE_TYPE_DRILL_HOLES && block->type == GCODE_TYPE_POINT))
+    populate_block_row (gui, iter);
 
   if (selected_block->type == GCODE_TYPE_SKETCH)
   {
@@ -419,16 +425,23 @@ insert_primitive (gui_t *gui, gcode_block_t *block, gcode_block_t *selected_bloc
     }
   }
 
+  gui_undo_insert (&gui->undo, block);
+
   if (action & GUI_INSERT_WITH_TANGENCY)
     set_tangent_to_previous (block);
 
   if (gtk_tree_model_iter_parent (gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview)), &parent_iter, &child_iter))
+  {
     gtk_tree_view_expand_to_path (GTK_TREE_VIEW (gui->gcode_block_treeview), gtk_tree_model_get_path (gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview)), &parent_iter));
+    update_block_tree_order (gui, &parent_iter);
+  }
+  else
+  {
+    update_block_tree_order (gui, NULL);
+  }
 
   update_menu_options (gui, block);
 
-  update_block_tree_order (gui);
-
   set_selected_row_with_iter (gui, &child_iter);
   /*
   * Set the Comment cell for this block to be in editing mode as a default behavior.
@@ -452,68 +465,83 @@ destroy ()
 }
 
 
-GtkTreeIter
-refresh_gcode_block_tree_recursion (gui_t *gui, gcode_block_t *block, GtkTreeIter *parent_iter, uint16_t ind, uint8_t single)
+/*
+* Blocks holding other blocks, with the extrusion shown as their first row
+* and the list of blocks shown after it.  Bolt hole arcs are not exposed.
+*/
+static int
+block_children (gcode_block_t *block, gcode_block_t **list, gcode_block_t **extrusion)
 {
-  GtkTreeIter child_iter;
+  *list = NULL;
+  *extrusion = NULL;
 
-  for (; block; ind++)
+  switch (block->type)
   {
-    gtk_tree_store_insert (gui->gcode_block_store, &child_iter, parent_iter, ind);
+    case GCODE_TYPE_SKETCH:
+      *list = ((gcode_sketch_t *) block->pdata)->list;
+      *extrusion = ((gcode_sketch_t *) block->pdata)->extrusion;
+      return (1);
 
-/*    gtk_tree_store_append (gui->gcode_block_store, &child_iter, parent_iter); */
-    gtk_tree_store_set (gui->gcode_block_store, &child_iter, 0, ind, 1, GCODE_TYPE_STRING[block->type], 2, block->status, 3, block->flags & GCODE_FLAGS_SUPPRESS, 4, block->comment, 5, block, -1);
+    case GCODE_TYPE_BOLT_HOLES:
+      *extrusion = ((gcode_bolt_holes_t *) block->pdata)->extrusion;
+      return (1);
 
-    if (block->type == GCODE_TYPE_SKETCH)
-    {
-      gcode_sketch_t *sketch;
-      gcode_extrusion_t *extrusion;
-      GtkTreeIter extrusion_iter;
+    case GCODE_TYPE_EXTRUSION:
+      *list = ((gcode_extrusion_t *) block->pdata)->list;
+      return (1);
 
-      sketch = (gcode_sketch_t *) block->pdata;
-      extrusion = (gcode_extrusion_t *) sketch->extrusion->pdata;
+    case GCODE_TYPE_TEMPLATE:
+      *list = ((gcode_template_t *) block->pdata)->list;
+      return (1);
 
-      refresh_gcode_block_tree_recursion (gui, sketch->list, &child_iter, 1, 0);
+    case GCODE_TYPE_DRILL_HOLES:
+      *list = ((gcode_drill_holes_t *) block->pdata)->list;
+      return (1);
 
-      /* Extrusion */
-      gtk_tree_store_insert (gui->gcode_block_store, &extrusion_iter, &child_iter, 0);
-      gtk_tree_store_set (gui->gcode_block_store, &extrusion_iter, 0, 0, 1, GCODE_TYPE_STRING[sketch->extrusion->type], 2, sketch->extrusion->status, 3, sketch->extrusion->flags & GCODE_FLAGS_SUPPRESS, 4, sketch->extrusion->comment, 5, sketch->extrusion, -1);
-      refresh_gcode_block_tree_recursion (gui, extrusion->list, &extrusion_iter, 1, 0);
-    }
-    else if (block->type == GCODE_TYPE_BOLT_HOLES)
-    {
-      gcode_bolt_holes_t *bolt_holes;
-      gcode_extrusion_t *extrusion;
-      GtkTreeIter extrusion_iter;
+    default:
+      return (0);
+  }
+}
 
-      bolt_holes = (gcode_bolt_holes_t *) block->pdata;
-      extrusion = (gcode_extrusion_t *) bolt_holes->extrusion->pdata;
 
-      gtk_tree_store_insert (gui->gcode_block_store, &extrusion_iter, &child_iter, 0);
+static void
+set_block_row (gui_t *gui, GtkTreeIter *iter, gcode_block_t *block, uint32_t ind)
+{
+  gcode_block_t *list, *extrusion;
+  GtkTreeIter child_iter;
 
-      /* Extrusion */
-      gtk_tree_store_set (gui->gcode_block_store, &extrusion_iter, 0, 0, 1, GCODE_TYPE_STRING[bolt_holes->extrusion->type], 2, bolt_holes->extrusion->status, 3, bolt_holes->extrusion->flags & GCODE_FLAGS_SUPPRESS, 4, bolt_holes->extrusion->comment, 5, bolt_holes->extrusion, -1);
-      refresh_gcode_block_tree_recursion (gui, extrusion->list, &extrusion_iter, 1, 0);
+  gtk_tree_store_set (gui->gcode_block_store, iter, 0, ind, 1, GCODE_TYPE_STRING[block->type], 2, block->status, 3, block->flags & GCODE_FLAGS_SUPPRESS, 4, block->comment, 5, block, -1);
 
-      /* Do not expose bolt hole arcs */
-    }
-    else if (block->type == GCODE_TYPE_TEMPLATE)
-    {
-      gcode_template_t *template;
+  /*
+  * Children are only added when the row is first expanded, until then an
+  * empty row without a block stands in for them so the row can be expanded.
+  */
+  if (block_children (block, &list, &extrusion) && (list || extrusion))
+    gtk_tree_store_append (gui->gcode_block_store, &child_iter, iter);
+}
 
-      template = (gcode_template_t *) block->pdata;
 
-      refresh_gcode_block_tree_recursion (gui, template->list, &child_iter, 1, 0);
+GtkTreeIter
+refresh_gcode_block_tree_recursion (gui_t *gui, gcode_block_t *block, GtkTreeIter *parent_iter, uint32_t ind, uint8_t single)
+{
+  GtkTreeIter child_iter, prev_iter;
+  int first;
+
+  /* Rows after the first go in after the last one, not by walking to their position */
+  for (first = 1; block; ind++, first = 0)
+  {
+    if (first)
+    {
+      gtk_tree_store_insert (gui->gcode_block_store, &child_iter, parent_iter, ind);
     }
-    else if (block->type == GCODE_TYPE_DRILL_HOLES)
+    else
     {
-      gcode_drill_holes_t *drill_holes;
-
-      drill_holes = (gcode_drill_holes_t *) block->pdata;
-
-      refresh_gcode_block_tree_recursion (gui, drill_holes->list, &child_iter, 1, 0);
+      gtk_tree_store_insert_after (gui->gcode_block_store, &child_iter, parent_iter, &prev_iter);
     }
 
+    set_block_row (gui, &child_iter, block, ind);
+    prev_iter = child_iter;
+
     block = single ? NULL : block->next;
   }
 
@@ -521,9 +549,68 @@ refresh_gcode_block_tree_recursion (gui_t *gui, gcode_block_t *block, GtkTreeIte
 }
 
 
+/*
+* Add the rows of a block's children in place of the empty row standing in
+* for them, if not already there.
+*/
+void
+populate_block_row (gui_t *gui, GtkTreeIter *iter)
+{
+  GtkTreeModel *model;
+  GtkTreeIter child_iter;
+  gcode_block_t *block, *list, *extrusion;
+  GValue value = { 0, };
+
+  model = GTK_TREE_MODEL (gui->gcode_block_store);
+
+  gtk_tree_model_get_value (model, iter, 5, &value);
+  block = (gcode_block_t *) g_value_get_pointer (&value);
+  g_value_unset (&value);
+
+  if (!block || !gtk_tree_model_iter_children (model, &child_iter, iter))
+    return;
+
+  gtk_tree_model_get_value (model, &child_iter, 5, &value);
+  if (g_value_get_pointer (&value))
+  {
+    g_value_unset (&value);
+    return;
+  }
+  g_value_unset (&value);
+
+  gtk_tree_store_remove (gui->gcode_block_store, &child_iter);
+
+  block_children (block, &list, &extrusion);
+
+  if (extrusion)
+  {
+    gtk_tree_store_insert (gui->gcode_block_store, &child_iter, iter, 0);
+    set_block_row (gui, &child_iter, extrusion, 0);
+  }
+
+  refresh_gcode_block_tree_recursion (gui, list, iter, 1, 0);
+}
+
+
+static void
+free_block_rows (gui_t *gui)
+{
+  uint32_t i;
+
+  for (i = 0; i < gui->block_row_num; i++)
+    if (gui->block_row[i])
+      gtk_tree_row_reference_free (gui->block_row[i]);
+
+  free (gui->block_row);
+  gui->block_row = NULL;
+  gui->block_row_num = 0;
+}
+
+
 void
 refresh_gcode_block_tree (gui_t *gui)
 {
+  free_block_rows (gui);
   gtk_tree_store_clear (gui->gcode_block_store);
 
   refresh_gcode_block_tree_recursion (gui, gui->gcode.list, NULL, 1, 0);
@@ -559,29 +646,115 @@ set_selected_row_with_iter (gui_t *gui, GtkTreeIter *iter)
 }
 
 
-static void
-find_tree_row_iter_with_block_recursion (gui_t *gui, GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *found_iter, gcode_block_t *block)
+/*
+* Row of a block, worked out from where the block sits in its parent's list
+* and kept as a row reference by block handle, so later lookups go straight
+* to it.  Rows of the parents are populated on the way.
+*/
+int
+find_block_row (gui_t *gui, gcode_block_t *block, GtkTreeIter *iter)
 {
-  gcode_block_t *test_block;
-  GtkTreeIter child_iter;
+  GtkTreeModel *model;
+  GtkTreeIter parent_iter;
+  GtkTreeRowReference **block_row;
+  GtkTreePath *path;
+  gcode_block_t *block_ind, *list, *extrusion, *test_block;
   GValue value = { 0, };
+  uint32_t num;
+  int pos, found;
 
-  do
+  model = GTK_TREE_MODEL (gui->gcode_block_store);
+
+  if (block->handle < gui->block_row_num && gui->block_row[block->handle])
+  {
+    path = gtk_tree_row_reference_get_path (gui->block_row[block->handle]);
+    if (path)
+    {
+      found = gtk_tree_model_get_iter (model, iter, path);
+      gtk_tree_path_free (path);
+
+      if (found)
+      {
+        gtk_tree_model_get_value (model, iter, 5, &value);
+        test_block = (gcode_block_t *) g_value_get_pointer (&value);
+        g_value_unset (&value);
+
+        if (test_block == block)
+          return (1);
+      }
+    }
+
+    /* The row went away or the handle was given to another block */
+    gtk_tree_row_reference_free (gui->block_row[block->handle]);
+    gui->block_row[block->handle] = NULL;
+  }
+
+  if (block->parent)
+  {
+    if (!find_block_row (gui, block->parent, &parent_iter))
+      return (0);
+    populate_block_row (gui, &parent_iter);
+
+    block_children (block->parent, &list, &extrusion);
+  }
+  else
+  {
+    extrusion = NULL;
+  }
+
+  if (block == extrusion)
+  {
+    pos = 0;
+  }
+  else
+  {
+    pos = extrusion ? 1 : 0;
+    for (block_ind = block->prev; block_ind; block_ind = block_ind->prev)
+      pos++;
+  }
+
+  found = gtk_tree_model_iter_nth_child (model, iter, block->parent ? &parent_iter : NULL, pos);
+  if (found)
   {
     gtk_tree_model_get_value (model, iter, 5, &value);
-    test_block = (gcode_block_t *) g_value_get_pointer (&value);
+    found = g_value_get_pointer (&value) == block;
     g_value_unset (&value);
+  }
 
-    if (block == test_block)
+  /* Look through the rows beside it for anything not where it was expected */
+  if (!found && gtk_tree_model_iter_children (model, iter, block->parent ? &parent_iter : NULL))
+  {
+    do
     {
-      *found_iter = *iter;
-      return;
-    }
+      gtk_tree_model_get_value (model, iter, 5, &value);
+      found = g_value_get_pointer (&value) == block;
+      g_value_unset (&value);
+    } while (!found && gtk_tree_model_iter_next (model, iter));
+  }
+
+  if (!found)
+    return (0);
 
-    if (gtk_tree_model_iter_children (model, &child_iter, iter))
-      find_tree_row_iter_with_block_recursion (gui, model, &child_iter, found_iter, block);
+  if (block->handle >= gui->block_row_num)
+  {
+    num = gui->block_row_num ? 2 * gui->block_row_num : 256;
+    while (num <= block->handle)
+      num *= 2;
+
+    block_row = (GtkTreeRowReference **) realloc (gui->block_row, num * sizeof (GtkTreeRowReference *));
+    if (!block_row)
+      return (1);
+
+    memset (&block_row[gui->block_row_num], 0, (num - gui->block_row_num) * sizeof (GtkTreeRowReference *));
+    gui->block_row = block_row;
+    gui->block_row_num = num;
+  }
+
+  path = gtk_tree_model_get_path (model, iter);
+  gui->block_row[block->handle] = gtk_tree_row_reference_new (model, path);
+  gtk_tree_path_free (path);
 
-  } while (gtk_tree_model_iter_next (model, iter));
+  return (1);
 }
 
 
@@ -589,68 +762,72 @@ void
 set_selected_row_with_block (gui_t *gui, gcode_block_t *block)
 {
   GtkTreeModel *model;
-  GtkTreeIter iter, found_iter;
+  GtkTreeIter iter, parent_iter;
+  GtkTreePath *path;
 
-  model = gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview));
-
-  gtk_tree_model_get_iter_first (model, &iter);
+  if (!find_block_row (gui, block, &iter))
+    return;
 
-  find_tree_row_iter_with_block_recursion (gui, model, &iter, &found_iter, block);
+  model = gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview));
 
-  gtk_tree_view_expand_to_path (GTK_TREE_VIEW (gui->gcode_block_treeview), gtk_tree_model_get_path (model, &found_iter));
+  /* Open the rows above it, the block's own children stay as they are */
+  if (gtk_tree_model_iter_parent (model, &parent_iter, &iter))
+  {
+    path = gtk_tree_model_get_path (model, &parent_iter);
+    gtk_tree_view_expand_to_path (GTK_TREE_VIEW (gui->gcode_block_treeview), path);
+    gtk_tree_path_free (path);
+  }
 
-  gtk_tree_selection_select_iter (gtk_tree_view_get_selection (GTK_TREE_VIEW (gui->gcode_block_treeview)), &found_iter);
+  gtk_tree_selection_select_iter (gtk_tree_view_get_selection (GTK_TREE_VIEW (gui->gcode_block_treeview)), &iter);
 
-  gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (gui->gcode_block_treeview), gtk_tree_model_get_path (model, &found_iter), NULL, TRUE, 0.0, 0.0);
+  path = gtk_tree_model_get_path (model, &iter);
+  gtk_tree_view_scroll_to_cell (GTK_TREE_VIEW (gui->gcode_block_treeview), path, NULL, TRUE, 0.0, 0.0);
+  gtk_tree_path_free (path);
 
   update_menu_options (gui, block);
 
-  gui->opengl.rebuild_view_display_list = 1;
   gui_opengl_context_redraw (&gui->opengl, block);
 }
 
 
+/*
+* Number the rows beside each other under parent_iter, or the top-level rows
+* when NULL, after one of them was inserted or removed.  Rows elsewhere in
+* the tree keep their numbers.
+*/
 void
-update_block_tree_order_recursion (gui_t *gui, GtkTreeModel *model, GtkTreeIter *iter)
+update_block_tree_order (gui_t *gui, GtkTreeIter *parent_iter)
 {
+  GtkTreeModel *model;
+  GtkTreeIter iter;
   gcode_block_t *block;
-  GtkTreeIter child_iter;
   GValue value = { 0, };
-  int i = 1;
+  uint32_t i = 1;
+
+  model = GTK_TREE_MODEL (gui->gcode_block_store);
+
+  if (!gtk_tree_model_iter_children (model, &iter, parent_iter))
+    return;
 
   do
   {
-    gtk_tree_model_get_value (model, iter, 5, &value);
+    gtk_tree_model_get_value (model, &iter, 5, &value);
     block = (gcode_block_t *) g_value_get_pointer (&value);
     g_value_unset (&value);
 
+    if (!block)
+      continue;
+
     if (block->type == GCODE_TYPE_EXTRUSION)
     {
-      gtk_tree_store_set (gui->gcode_block_store, iter, 0, 0, -1);
+      gtk_tree_store_set (gui->gcode_block_store, &iter, 0, 0, -1);
     }
     else
     {
-      gtk_tree_store_set (gui->gcode_block_store, iter, 0, i, -1);
+      gtk_tree_store_set (gui->gcode_block_store, &iter, 0, i, -1);
       i++;
     }
-
-    if (gtk_tree_model_iter_children (model, &child_iter, iter))
-      update_block_tree_order_recursion (gui, model, &child_iter);
-
-  } while (gtk_tree_model_iter_next (model, iter));
-}
-
-
-void
-update_block_tree_order (gui_t *gui)
-{
-  GtkTreeModel *model;
-  GtkTreeIter iter;
-
-  model = gtk_tree_view_get_model (GTK_TREE_VIEW (gui->gcode_block_treeview));
-
-  gtk_tree_model_get_iter_first (model, &iter);
-  update_block_tree_order_recursion (gui, model, &iter);
+  } while (gtk_tree_model_iter_next (model, &iter));
 }
 
 
@@ -886,6 +1063,11 @@ gui_menu_util_modified (gui_t *gui, int mod)
 {
   if (mod)
   {
+    /* The toolpath shown no longer matches the code */
+    gui->opengl.toolpath_show = 0;
+
+    gui_undo_modified (&gui->undo);
+
     if (gui->project_state == PROJECT_OPEN)
       gtk_action_set_sensitive (gtk_ui_manager_get_action (gui->ui_manager, "/MainMenu/FileMenu/Save"), 1);
 
@@ -27,13 +27,14 @@ void update_progress (void *gui, gfloat_t progress);
 void generic_dialog (void *gui, char *message);
 int insert_primitive (gui_t *gui, gcode_block_t *block, gcode_block_t *selected_block, GtkTreeIter *iter, int action);
 void destroy (void);
-GtkTreeIter refresh_gcode_block_tree_recursion (gui_t *gui, gcode_block_t *block, GtkTreeIter *parent_iter, uint16_t ind, uint8_t single);
+GtkTreeIter refresh_gcode_block_tree_recursion (gui_t *gui, gcode_block_t *block, GtkTreeIter *parent_iter, uint32_t ind, uint8_t single);
+void populate_block_row (gui_t *gui, GtkTreeIter *iter);
 void refresh_gcode_block_tree (gui_t *gui);
 void get_selected_block (gui_t *gui, gcode_block_t **selected_block, GtkTreeIter *iter);
 void set_selected_row_with_iter (gui_t *gui, GtkTreeIter *iter);
+int find_block_row (gui_t *gui, gcode_block_t *block, GtkTreeIter *iter);
 void set_selected_row_with_block (gui_t *gui, gcode_block_t *block);
-void update_block_tree_order_recursion (gui_t *gui, GtkTreeModel *model, GtkTreeIter *iter);
-void update_block_tree_order (gui_t *gui);
+void update_block_tree_order (gui_t *gui, GtkTreeIter *parent_iter);
 void project_menu_options (gui_t *gui, uint8_t state);
 void update_menu_options (gui_t *gui, gcode_block_t *selected_block);
 void gui_menu_util_modified (gui_t *gui, int mod);
@@ -18,8 +18,10 @@
 */
 #include "gui_menu_view.h"
 #include "gui.h"
+#include "gui_define.h"
 #include "gui_menu_util.h"
 #include "gcode.h"
+#include "gcode_estimate.h"
 
 void
 gui_menu_view_perspective_menuitem_callback (GtkWidget *widget, gpointer data)
@@ -143,6 +145,85 @@ gui_menu_view_back_menuitem_callback (GtkWidget *widget, gpointer data)
 }
 
 
+void
+gui_menu_view_memory_usage_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  gui_t *gui;
+  gcode_block_t *block;
+  gcode_memory_t memory, block_memory;
+  char *message, line[256];
+  int len;
+
+  gui = (gui_t *) data;
+
+  gcode_memory (&gui->gcode, &memory);
+
+  len = 1024;
+  for (block = gui->gcode.list; block; block = block->next)
+    len += 256;
+  message = (char *) malloc (len);
+
+  sprintf (message, "Geometry: %lu kB\nG-Code: %lu kB (%lu kB unused)\nCache: %lu kB\nStock: %lu kB\n\n",
+           (unsigned long) (memory.geometry >> 10),
+           (unsigned long) (memory.code >> 10),
+           (unsigned long) (memory.slack >> 10),
+           (unsigned long) (memory.cache >> 10),
+           (unsigned long) (memory.stock >> 10));
+
+  for (block = gui->gcode.list; block; block = block->next)
+  {
+    gcode_block_memory (block, &block_memory);
+    sprintf (line, "%s (%s): %lu kB\n", GCODE_TYPE_STRING[block->type], block->comment,
+             (unsigned long) ((block_memory.geometry + block_memory.code + block_memory.cache) >> 10));
+    strcat (message, line);
+  }
+
+  generic_dialog (gui, message);
+  free (message);
+}
+
+
+void
+gui_menu_view_trim_memory_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  gui_t *gui;
+  gcode_memory_t memory;
+  char message[128];
+
+  gui = (gui_t *) data;
+
+  gcode_memory (&gui->gcode, &memory);
+  gcode_list_trim (gui->gcode.list);
+
+  sprintf (message, "Released %lu kB of unused G-Code buffer space.", (unsigned long) (memory.slack >> 10));
+  generic_dialog (gui, message);
+}
+
+
+/*
+* Called for every line simulated, redraws the stock as it is being cut
+* at most every RENDER_PREVIEW_INTERVAL seconds.
+*/
+static void
+render_preview (void *data)
+{
+  static gdouble last = 0.0;
+  gui_t *gui;
+  gdouble now;
+
+  gui = (gui_t *) data;
+
+  now = g_timer_elapsed (gui->timer, NULL);
+  if (now - last < RENDER_PREVIEW_INTERVAL)
+    return;
+  last = now;
+
+  gui_opengl_build_simulate_mesh (&gui->opengl);
+  gui->opengl.mode = GUI_OPENGL_MODE_RENDER;
+  gui_opengl_context_redraw (&gui->opengl, NULL);
+}
+
+
 void
 gui_menu_view_render_final_part_menuitem_callback (GtkWidget *widget, gpointer data)
 {
@@ -153,11 +234,22 @@ gui_menu_view_render_final_part_menuitem_callback (GtkWidget *widget, gpointer d
 
   gui = (gui_t *) data;
 
+  /* Go back to simulating all of the material after rendering a region */
+  if (gui->gcode.voxel_roi)
+  {
+    gui->gcode.voxel_roi = 0;
+    gui->gcode.voxel_res = gui->settings.voxel_resolution;
+    gcode_prep (&gui->gcode);
+    gui->first_render = 1;
+  }
+
   if (gui->modified || gui->first_render)
   {
     gui->first_render = 0;
+    gui->gcode.preview_callback = render_preview;
     gcode_render_final (&gui->gcode, &time_elapsed);
-    gui_opengl_build_simulate_display_list (&gui->opengl);
+    gui->gcode.preview_callback = NULL;
+    gui_opengl_build_simulate_mesh (&gui->opengl);
   }
 
   gui->opengl.mode = GUI_OPENGL_MODE_RENDER;
@@ -171,3 +263,368 @@ gui_menu_view_render_final_part_menuitem_callback (GtkWidget *widget, gpointer d
 
   update_progress (gui, 0.0);
 }
+
+
+static void
+render_region_callback (GtkWidget *widget, gpointer data)
+{
+  GtkWidget **wlist;
+  gui_t *gui;
+  gfloat_t lo, hi, time_elapsed;
+  int i;
+
+  wlist = (GtkWidget **) data;
+  gui = (gui_t *) wlist[0];
+
+  for (i = 0; i < 3; i++)
+  {
+    lo = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[2+2*i]));
+    hi = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3+2*i]));
+    if (hi < lo)
+    {
+      gfloat_t t = lo;
+      lo = hi;
+      hi = t;
+    }
+    if (hi - lo < GCODE_PRECISION)
+      hi = lo + GCODE_PRECISION;
+
+    gui->gcode.voxel_min[i] = lo;
+    gui->gcode.voxel_span[i] = hi - lo;
+  }
+
+  gui->gcode.voxel_roi = 1;
+  gui->gcode.voxel_res = (uint32_t) gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[8]));
+
+  gtk_widget_destroy (wlist[1]);
+  free (wlist);
+
+  gcode_prep (&gui->gcode);
+
+  gui->gcode.preview_callback = render_preview;
+  gcode_render_final (&gui->gcode, &time_elapsed);
+  gui->gcode.preview_callback = NULL;
+  gui_opengl_build_simulate_mesh (&gui->opengl);
+
+  /* The whole part has to be simulated again next time it is asked for */
+  gui->first_render = 1;
+
+  gui->opengl.mode = GUI_OPENGL_MODE_RENDER;
+  gui_opengl_context_redraw (&gui->opengl, NULL);
+
+  update_progress (gui, 0.0);
+}
+
+
+/*
+* Simulate only a box of the material, by default the middle of the last
+* region rendered, with a resolution of its own.  Moves that cannot reach
+* the box are skipped by the simulator.
+*/
+void
+gui_menu_view_render_region_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  GtkWidget *window;
+  GtkWidget *table;
+  GtkWidget *label;
+  GtkWidget *spin;
+  GtkWidget *render_button;
+  GtkWidget **wlist;
+  gui_t *gui;
+  gfloat_t lo, hi;
+  char *axis[3] = { "X", "Y", "Z" };
+  char string[32];
+  int i;
+
+  gui = (gui_t *) data;
+
+  wlist = (GtkWidget **) malloc (9 * sizeof (GtkWidget *));
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_modal (GTK_WINDOW (window), TRUE);
+  gtk_window_set_transient_for (GTK_WINDOW (window), GTK_WINDOW (gui->window));
+  gtk_window_set_position (GTK_WINDOW (window), GTK_WIN_POS_MOUSE);
+  gtk_window_set_title (GTK_WINDOW (window), "Render Region");
+  gtk_window_set_resizable (GTK_WINDOW (window), FALSE);
+
+  table = gtk_table_new (8, 2, FALSE);
+  gtk_table_set_col_spacings (GTK_TABLE (table), TABLE_SPACING);
+  gtk_table_set_row_spacings (GTK_TABLE (table), TABLE_SPACING);
+  gtk_container_set_border_width (GTK_CONTAINER (table), 4);
+  gtk_container_add (GTK_CONTAINER (window), table);
+
+  wlist[0] = (GtkWidget *) gui;
+  wlist[1] = window;
+
+  /* Measured from the left, back, bottom corner of the material */
+  for (i = 0; i < 3; i++)
+  {
+    if (gui->gcode.voxel_roi)
+    {
+      lo = gui->gcode.voxel_min[i];
+      hi = gui->gcode.voxel_min[i] + gui->gcode.voxel_span[i];
+    }
+    else
+    {
+      lo = i < 2 ? 0.375 * gui->gcode.material_size[i] : 0.0;
+      hi = i < 2 ? 0.625 * gui->gcode.material_size[i] : gui->gcode.material_size[i];
+    }
+
+    sprintf (string, "%s Min", axis[i]);
+    label = gtk_label_new (string);
+    gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 1, 2*i, 2*i+1);
+    spin = gtk_spin_button_new_with_range (0.0, gui->gcode.material_size[i], 0.01);
+    gtk_spin_button_set_digits (GTK_SPIN_BUTTON (spin), 3);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin), lo);
+    gtk_table_attach_defaults (GTK_TABLE (table), spin, 1, 2, 2*i, 2*i+1);
+    wlist[2+2*i] = spin;
+
+    sprintf (string, "%s Max", axis[i]);
+    label = gtk_label_new (string);
+    gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 1, 2*i+1, 2*i+2);
+    spin = gtk_spin_button_new_with_range (0.0, gui->gcode.material_size[i], 0.01);
+    gtk_spin_button_set_digits (GTK_SPIN_BUTTON (spin), 3);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin), hi);
+    gtk_table_attach_defaults (GTK_TABLE (table), spin, 1, 2, 2*i+1, 2*i+2);
+    wlist[3+2*i] = spin;
+  }
+
+  label = gtk_label_new ("Resolution");
+  gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 1, 6, 7);
+  spin = gtk_spin_button_new_with_range (10.0, 10000.0, 10.0);
+  gtk_spin_button_set_digits (GTK_SPIN_BUTTON (spin), 0);
+  gtk_spin_button_set_value (GTK_SPIN_BUTTON (spin), gui->settings.voxel_resolution);
+  gtk_table_attach_defaults (GTK_TABLE (table), spin, 1, 2, 6, 7);
+  wlist[8] = spin;
+
+  render_button = gtk_button_new_with_label ("Render");
+  gtk_table_attach_defaults (GTK_TABLE (table), render_button, 0, 2, 7, 8);
+  g_signal_connect (G_OBJECT (render_button), "clicked", G_CALLBACK (render_region_callback), wlist);
+  gtk_widget_show_all (window);
+}
+
+
+static void
+format_time (char *string, gfloat_t seconds)
+{
+  int h, m;
+
+  h = (int) (seconds / 3600.0);
+  m = (int) ((seconds - h*3600) / 60);
+  sprintf (string, "%dH %dM %.1f sec", h, m, seconds - h*3600 - m*60);
+}
+
+
+/*
+* Quote the job from the generated code alone using the rapid rates and
+* acceleration of the selected machine, no simulation needed.
+*/
+void
+gui_menu_view_cycle_time_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  gui_t *gui;
+  gui_machine_list_t machine_list;
+  gcode_estimate_t estimate;
+  gfloat_t rapid[3], accel, scale;
+  GTimer *timer;
+  char *message, line[256], time_string[64];
+  int i, len;
+
+  gui = (gui_t *) data;
+
+  rapid[0] = rapid[1] = rapid[2] = 0.0;
+  accel = 0.0;
+
+  gui_machines_init (&machine_list);
+  gui_machines_read (&machine_list);
+  for (i = 0; i < machine_list.num; i++)
+  {
+    if (!strcmp (gui->gcode.machine_name, machine_list.machine[i].name))
+    {
+      rapid[0] = machine_list.machine[i].maxipm[0];
+      rapid[1] = machine_list.machine[i].maxipm[1];
+      rapid[2] = machine_list.machine[i].maxipm[2];
+      accel = machine_list.machine[i].accel;
+    }
+  }
+  gui_machines_free (&machine_list);
+
+  /* machines.xml is in inches */
+  scale = gui->gcode.units == GCODE_UNITS_MILLIMETER ? GCODE_INCH2MM : 1.0;
+  rapid[0] *= scale;
+  rapid[1] *= scale;
+  rapid[2] *= scale;
+  accel *= scale;
+
+  gcode_estimate_init (&estimate, rapid, accel);
+
+  timer = g_timer_new ();
+  g_timer_start (timer);
+  gcode_estimate (&gui->gcode, &estimate);
+  g_timer_stop (timer);
+
+  len = 1024 + 256 * (estimate.block_num + estimate.tool_num);
+  message = (char *) malloc (len);
+
+  format_time (time_string, estimate.time);
+  sprintf (message, "Estimated Cycle Time: %s\n", time_string);
+  format_time (time_string, estimate.rapid_time);
+  sprintf (line, "Rapid: %s\n", time_string);
+  strcat (message, line);
+  format_time (time_string, estimate.feed_time);
+  sprintf (line, "Feed: %s\n\n", time_string);
+  strcat (message, line);
+
+  for (i = 0; i < estimate.block_num; i++)
+  {
+    format_time (time_string, estimate.block[i].time);
+    sprintf (line, "%s: %s\n", estimate.block[i].label, time_string);
+    strcat (message, line);
+  }
+
+  strcat (message, "\n");
+  for (i = 0; i < estimate.tool_num; i++)
+  {
+    format_time (time_string, estimate.tool[i].time);
+    sprintf (line, "Tool %s: %s\n", estimate.tool[i].label, time_string);
+    strcat (message, line);
+  }
+
+  sprintf (line, "\nComputed in %.1f ms", 1000.0 * g_timer_elapsed (timer, NULL));
+  strcat (message, line);
+
+  generic_dialog (gui, message);
+
+  free (message);
+  g_timer_destroy (timer);
+  gcode_estimate_free (&estimate);
+}
+
+
+static void
+toolpath_label (GtkWidget **wlist)
+{
+  gui_t *gui;
+  gcode_toolpath_t *toolpath;
+  char string[256];
+
+  gui = (gui_t *) wlist[0];
+  toolpath = &gui->opengl.toolpath;
+
+  sprintf (string, "%u Rapid (red), %u Feed (blue), %u Plunge (yellow)", toolpath->kind_num[GCODE_TOOLPATH_RAPID], toolpath->kind_num[GCODE_TOOLPATH_FEED], toolpath->kind_num[GCODE_TOOLPATH_PLUNGE]);
+  gtk_label_set_text (GTK_LABEL (wlist[3]), string);
+}
+
+
+/*
+* Scrubbing after the code has changed reads the toolpath back again, the
+* moves shown always come from the latest code.
+*/
+static void
+toolpath_scale_callback (GtkWidget *widget, gpointer data)
+{
+  GtkWidget **wlist;
+  GtkTreeIter iter;
+  gui_t *gui;
+  gcode_block_t *selected_block;
+
+  wlist = (GtkWidget **) data;
+  gui = (gui_t *) wlist[0];
+
+  if (!gui->opengl.toolpath_show)
+  {
+    gui_opengl_build_toolpath (&gui->opengl);
+    gtk_range_set_range (GTK_RANGE (wlist[2]), 0.0, gui->opengl.toolpath.move_num > 0 ? gui->opengl.toolpath.move_num : 1.0);
+    toolpath_label (wlist);
+  }
+
+  gui->opengl.toolpath_move = (uint32_t) gtk_range_get_value (GTK_RANGE (wlist[2]));
+
+  get_selected_block (gui, &selected_block, &iter);
+  gui_opengl_context_redraw (&gui->opengl, selected_block);
+}
+
+
+static void
+toolpath_destroy_callback (GtkWidget *widget, gpointer data)
+{
+  GtkWidget **wlist;
+  GtkTreeIter iter;
+  gui_t *gui;
+  gcode_block_t *selected_block;
+
+  wlist = (GtkWidget **) data;
+  gui = (gui_t *) wlist[0];
+
+  gui_opengl_free_toolpath (&gui->opengl);
+
+  get_selected_block (gui, &selected_block, &iter);
+  gui_opengl_context_redraw (&gui->opengl, selected_block);
+
+  free (wlist);
+}
+
+
+/*
+* Show the moves of the generated code over the part, rapids, feeds and
+* plunges each in a color of their own, with a slider to stop the
+* toolpath after any move.  The window stays open while the view is moved
+* around, closing it hides the toolpath.
+*/
+void
+gui_menu_view_toolpath_menuitem_callback (GtkWidget *widget, gpointer data)
+{
+  GtkWidget *window;
+  GtkWidget *table;
+  GtkWidget *label;
+  GtkWidget *scale;
+  GtkWidget **wlist;
+  gui_t *gui;
+  gfloat_t move_num;
+
+  gui = (gui_t *) data;
+
+  /* One toolpath window at a time */
+  if (gui->opengl.toolpath.move)
+    return;
+
+  gui_opengl_build_toolpath (&gui->opengl);
+
+  wlist = (GtkWidget **) malloc (4 * sizeof (GtkWidget *));
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_transient_for (GTK_WINDOW (window), GTK_WINDOW (gui->window));
+  gtk_window_set_position (GTK_WINDOW (window), GTK_WIN_POS_MOUSE);
+  gtk_window_set_title (GTK_WINDOW (window), "Toolpath");
+  gtk_window_set_default_size (GTK_WINDOW (window), 480, -1);
+
+  table = gtk_table_new (2, 2, FALSE);
+  gtk_table_set_col_spacings (GTK_TABLE (table), TABLE_SPACING);
+  gtk_table_set_row_spacings (GTK_TABLE (table), TABLE_SPACING);
+  gtk_container_set_border_width (GTK_CONTAINER (table), 4);
+  gtk_container_add (GTK_CONTAINER (window), table);
+
+  wlist[0] = (GtkWidget *) gui;
+  wlist[1] = window;
+
+  label = gtk_label_new ("Moves");
+  gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 1, 0, 1);
+
+  move_num = gui->opengl.toolpath.move_num > 0 ? gui->opengl.toolpath.move_num : 1.0;
+  scale = gtk_hscale_new_with_range (0.0, move_num, 1.0);
+  gtk_scale_set_digits (GTK_SCALE (scale), 0);
+  gtk_range_set_value (GTK_RANGE (scale), gui->opengl.toolpath.move_num);
+  gtk_table_attach_defaults (GTK_TABLE (table), scale, 1, 2, 0, 1);
+  wlist[2] = scale;
+
+  label = gtk_label_new ("");
+  gtk_table_attach_defaults (GTK_TABLE (table), label, 0, 2, 1, 2);
+  wlist[3] = label;
+  toolpath_label (wlist);
+
+  g_signal_connect (G_OBJECT (scale), "value-changed", G_CALLBACK (toolpath_scale_callback), wlist);
+  g_signal_connect (G_OBJECT (window), "destroy", G_CALLBACK (toolpath_destroy_callback), wlist);
+  gtk_widget_show_all (window);
+
+  toolpath_scale_callback (scale, wlist);
+}
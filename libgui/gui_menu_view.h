@@ -29,6 +29,11 @@ void gui_menu_view_right_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_view_front_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_view_back_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_view_back_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_view_memory_usage_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_view_trim_memory_menuitem_callback (GtkWidget *widget, gpointer data);
 void gui_menu_view_render_final_part_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_view_render_region_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_view_cycle_time_menuitem_callback (GtkWidget *widget, gpointer data);
+void gui_menu_view_toolpath_menuitem_callback (GtkWidget *widget, gpointer data);
 
 #endif
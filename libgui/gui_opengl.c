@@ -21,6 +21,8 @@
 #include "gui_tab.h"
 #include "gui_menu_util.h"
 #include <GL/glu.h>
+#include <stddef.h>
+#include <string.h>
 
 #define GRID_BORDER_LINE_COLOR	0.7
 #define GRID_MAJOR_LINE_COLOR	0.4
@@ -287,221 +289,674 @@ draw_mill (gui_opengl_t *opengl)
 }
 
 
+/*
+* Vertex buffer objects are core in OpenGL 1.5 but only reachable through
+* the extension entry points on older Windows headers, so they are always
+* looked up at runtime.  Without them the mesh is drawn from client side
+* vertex arrays, which every OpenGL 1.1 implementation has.
+*/
+#ifndef GL_ARRAY_BUFFER_ARB
+  #define GL_ARRAY_BUFFER_ARB		0x8892
+  #define GL_ELEMENT_ARRAY_BUFFER_ARB	0x8893
+  #define GL_STATIC_DRAW_ARB		0x88E4
+#endif
+
+#ifndef APIENTRY
+  #define APIENTRY
+#endif
+
+typedef void (APIENTRY *gui_opengl_gen_buffers_t) (GLsizei n, GLuint *buffers);
+typedef void (APIENTRY *gui_opengl_delete_buffers_t) (GLsizei n, const GLuint *buffers);
+typedef void (APIENTRY *gui_opengl_bind_buffer_t) (GLenum target, GLuint buffer);
+typedef void (APIENTRY *gui_opengl_buffer_data_t) (GLenum target, ptrdiff_t size, const GLvoid *data, GLenum usage);
+
+static gui_opengl_gen_buffers_t gui_opengl_gen_buffers;
+static gui_opengl_delete_buffers_t gui_opengl_delete_buffers;
+static gui_opengl_bind_buffer_t gui_opengl_bind_buffer;
+static gui_opengl_buffer_data_t gui_opengl_buffer_data;
+
+
+/* Requires a current context */
+static int
+vbo_supported (void)
+{
+  static int checked = 0;
+
+  if (!checked)
+  {
+    checked = 1;
+
+    if (gdk_gl_query_gl_extension ("GL_ARB_vertex_buffer_object"))
+    {
+      gui_opengl_gen_buffers = (gui_opengl_gen_buffers_t) gdk_gl_get_proc_address ("glGenBuffersARB");
+      gui_opengl_delete_buffers = (gui_opengl_delete_buffers_t) gdk_gl_get_proc_address ("glDeleteBuffersARB");
+      gui_opengl_bind_buffer = (gui_opengl_bind_buffer_t) gdk_gl_get_proc_address ("glBindBufferARB");
+      gui_opengl_buffer_data = (gui_opengl_buffer_data_t) gdk_gl_get_proc_address ("glBufferDataARB");
+    }
+
+    if (!gui_opengl_gen_buffers || !gui_opengl_delete_buffers || !gui_opengl_bind_buffer || !gui_opengl_buffer_data)
+      gui_opengl_gen_buffers = NULL;
+  }
+
+  return (gui_opengl_gen_buffers != NULL);
+}
+
+
+static void
+free_simulate_buffers (gui_opengl_t *opengl)
+{
+  if (!opengl->simulate_buffers)
+    return;
+
+  gui_opengl_delete_buffers (2 * opengl->simulate_buffer_num, opengl->simulate_buffers);
+
+  free (opengl->simulate_buffers);
+  opengl->simulate_buffers = NULL;
+  opengl->simulate_buffer_num = 0;
+}
+
+
 static void
-sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
+upload_simulate_tile (gui_opengl_t *opengl, uint32_t ind)
 {
-  int ind;
+  gcode_mesh_tile_t *tile;
 
-  if (i < 0 || j < 0 || k < 0 || i >= opengl->gcode->voxel_num[0] || j >= opengl->gcode->voxel_num[1] || k >= opengl->gcode->voxel_num[2])
+  if (!opengl->simulate_buffers)
     return;
 
-  ind = i + j * opengl->gcode->voxel_num[0] + k * (opengl->gcode->voxel_num[0] * opengl->gcode->voxel_num[1]);
+  tile = &opengl->simulate_mesh.tile[ind];
 
+  gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, opengl->simulate_buffers[2*ind+0]);
+  gui_opengl_buffer_data (GL_ARRAY_BUFFER_ARB, (ptrdiff_t) tile->vert_num * GCODE_MESH_VERTEX_SIZE * sizeof (float), tile->vert, GL_STATIC_DRAW_ARB);
 
-  /*
-  * Compute Normal Based on Existance of Neighbors
-  * -x = -1
-  * +x = +1
-  * -y = -opengl->gcode->voxel_num[1]
-  * +y = +opengl->gcode->voxel_num[1]
-  * -z = -(opengl->gcode->voxel_num[0] * opengl->gcode->voxel_num[1])
-  * +z = +(opengl->gcode->voxel_num[0] * opengl->gcode->voxel_num[1])
-  */
+  gui_opengl_bind_buffer (GL_ELEMENT_ARRAY_BUFFER_ARB, opengl->simulate_buffers[2*ind+1]);
+  gui_opengl_buffer_data (GL_ELEMENT_ARRAY_BUFFER_ARB, (ptrdiff_t) tile->index_num * sizeof (uint32_t), tile->index, GL_STATIC_DRAW_ARB);
 
-  /* X */
-  if (i > 0)
-  {
-    if (!opengl->gcode->voxel_map[ind-1])
-      nor[0] += -1.0;
-  }
-  else
+  gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, 0);
+  gui_opengl_bind_buffer (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+}
+
+
+/*
+* Bring the triangle mesh of the simulated stock up to date.  Only tiles
+* the simulator has written to since the last call are extracted again and
+* handed to the card, so this is cheap enough to call while rendering.
+*/
+void
+gui_opengl_build_simulate_mesh (gui_opengl_t *opengl)
+{
+  uint32_t i, tile_num;
+
+  if (!opengl->gcode->voxel_map)
+    return;
+
+  gdk_gl_drawable_gl_begin (opengl->gl_drawable, opengl->gl_context);
+
+  if (gcode_mesh_update (&opengl->simulate_mesh, opengl->gcode))
   {
-    nor[0] += -1.0;
+    free_simulate_buffers (opengl);
+    gdk_gl_drawable_gl_end (opengl->gl_drawable);
+    return;
   }
 
-  if (i < opengl->gcode->voxel_num[0]-1)
+  tile_num = opengl->simulate_mesh.tile_num[0] * opengl->simulate_mesh.tile_num[1] * opengl->simulate_mesh.tile_num[2];
+
+  /* The stock changed size, every tile was extracted again */
+  if (vbo_supported () && tile_num != opengl->simulate_buffer_num)
   {
-    if (!opengl->gcode->voxel_map[ind+1])
-      nor[0] += 1.0;
+    free_simulate_buffers (opengl);
+
+    opengl->simulate_buffers = (uint32_t *) malloc (2 * tile_num * sizeof (uint32_t));
+    if (opengl->simulate_buffers)
+    {
+      gui_opengl_gen_buffers (2 * tile_num, opengl->simulate_buffers);
+      opengl->simulate_buffer_num = tile_num;
+    }
   }
-  else
+
+  for (i = 0; i < tile_num; i++)
   {
-    nor[0] += 1.0;
+    if (!opengl->simulate_mesh.tile[i].updated)
+      continue;
+
+    upload_simulate_tile (opengl, i);
+    opengl->simulate_mesh.tile[i].updated = 0;
   }
 
-  /* Y */
-  if (j > 0)
+  gdk_gl_drawable_gl_end (opengl->gl_drawable);
+}
+
+
+static void
+draw_simulate (gui_opengl_t *opengl)
+{
+  gcode_mesh_tile_t *tile;
+  uint32_t i, tile_num;
+  GLfloat mat_ambient[] = { 1.0, 1.0, 1.0, 1.0 };
+  GLfloat mat_diffuse[] = { 0.6, 0.6, 0.6, 1.0 };
+  GLfloat mat_specular[] = { 0.0, 0.0, 0.0, 1.0 };
+  GLfloat mat_shininess[] = { 0.0 };
+  GLfloat mat_emission[] = { 0.0, 0.0, 0.0, 1.0 };
+
+  if (!opengl->simulate_mesh.tile)
+    return;
+
+  glLightModeli (GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+
+  glEnable (GL_LIGHTING);
+  glEnable (GL_LIGHT0);
+
+  glMaterialfv (GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
+  glMaterialfv (GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
+  glMaterialfv (GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
+  glMaterialfv (GL_FRONT_AND_BACK, GL_SHININESS, mat_shininess);
+  glMaterialfv (GL_FRONT_AND_BACK, GL_EMISSION, mat_emission);
+
+  glEnableClientState (GL_VERTEX_ARRAY);
+  glEnableClientState (GL_NORMAL_ARRAY);
+
+  tile_num = opengl->simulate_mesh.tile_num[0] * opengl->simulate_mesh.tile_num[1] * opengl->simulate_mesh.tile_num[2];
+  for (i = 0; i < tile_num; i++)
   {
-    if (!opengl->gcode->voxel_map[ind-opengl->gcode->voxel_num[0]])
-      nor[1] += -1.0;
+    tile = &opengl->simulate_mesh.tile[i];
+    if (!tile->index_num)
+      continue;
+
+    if (opengl->simulate_buffers)
+    {
+      gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, opengl->simulate_buffers[2*i+0]);
+      gui_opengl_bind_buffer (GL_ELEMENT_ARRAY_BUFFER_ARB, opengl->simulate_buffers[2*i+1]);
+      glVertexPointer (3, GL_FLOAT, GCODE_MESH_VERTEX_SIZE * sizeof (float), (GLvoid *) 0);
+      glNormalPointer (GL_FLOAT, GCODE_MESH_VERTEX_SIZE * sizeof (float), (GLvoid *) (3 * sizeof (float)));
+      glDrawElements (GL_TRIANGLES, tile->index_num, GL_UNSIGNED_INT, (GLvoid *) 0);
+    }
+    else
+    {
+      glVertexPointer (3, GL_FLOAT, GCODE_MESH_VERTEX_SIZE * sizeof (float), &tile->vert[0]);
+      glNormalPointer (GL_FLOAT, GCODE_MESH_VERTEX_SIZE * sizeof (float), &tile->vert[3]);
+      glDrawElements (GL_TRIANGLES, tile->index_num, GL_UNSIGNED_INT, tile->index);
+    }
   }
-  else
+
+  if (opengl->simulate_buffers)
   {
-    nor[1] += -1.0;
+    gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, 0);
+    gui_opengl_bind_buffer (GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
   }
 
-  if (j < opengl->gcode->voxel_num[1]-1)
+  glDisableClientState (GL_VERTEX_ARRAY);
+  glDisableClientState (GL_NORMAL_ARRAY);
+}
+
+
+/*
+* Read the toolpath back from the code and hand it to the card in one
+* buffer.  Arcs are broken up at the level of detail last drawn.
+*/
+void
+gui_opengl_build_toolpath (gui_opengl_t *opengl)
+{
+  gcode_toolpath_t *toolpath;
+
+  toolpath = &opengl->toolpath;
+
+  gcode_toolpath_build (toolpath, opengl->gcode);
+
+  gdk_gl_drawable_gl_begin (opengl->gl_drawable, opengl->gl_context);
+
+  if (vbo_supported ())
   {
-    if (!opengl->gcode->voxel_map[ind+opengl->gcode->voxel_num[0]])
-      nor[1] += 1.0;
+    if (!opengl->toolpath_buffer)
+      gui_opengl_gen_buffers (1, &opengl->toolpath_buffer);
+
+    gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, opengl->toolpath_buffer);
+    gui_opengl_buffer_data (GL_ARRAY_BUFFER_ARB, (ptrdiff_t) toolpath->vertex_num * sizeof (gcode_toolpath_vertex_t), toolpath->vertex, GL_STATIC_DRAW_ARB);
+    gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, 0);
   }
-  else
+
+  gdk_gl_drawable_gl_end (opengl->gl_drawable);
+
+  opengl->toolpath_move = toolpath->move_num;
+  opengl->toolpath_show = 1;
+}
+
+
+void
+gui_opengl_free_toolpath (gui_opengl_t *opengl)
+{
+  if (opengl->toolpath_buffer)
   {
-    nor[1] += 1.0;
+    gdk_gl_drawable_gl_begin (opengl->gl_drawable, opengl->gl_context);
+    gui_opengl_delete_buffers (1, &opengl->toolpath_buffer);
+    gdk_gl_drawable_gl_end (opengl->gl_drawable);
+    opengl->toolpath_buffer = 0;
   }
 
-  /* Z */
-  if (k > 0)
+  gcode_toolpath_free (&opengl->toolpath);
+  opengl->toolpath_move = 0;
+  opengl->toolpath_show = 0;
+}
+
+
+/*
+* The first toolpath_move moves as one line strip, flat shaded so every
+* segment has the color of its move, and a point where the tool is after
+* the last of them.
+*/
+static void
+draw_toolpath (gui_opengl_t *opengl)
+{
+  gcode_toolpath_t *toolpath;
+  uint32_t count;
+
+  toolpath = &opengl->toolpath;
+
+  if (!opengl->toolpath_show || !opengl->toolpath_move || opengl->toolpath_move > toolpath->move_num)
+    return;
+
+  count = toolpath->move[opengl->toolpath_move - 1] + 1;
+
+  glDisable (GL_LIGHTING);
+  glShadeModel (GL_FLAT);
+
+  glEnableClientState (GL_VERTEX_ARRAY);
+  glEnableClientState (GL_COLOR_ARRAY);
+
+  if (opengl->toolpath_buffer)
   {
-    if (!opengl->gcode->voxel_map[ind-opengl->gcode->voxel_num[0]*opengl->gcode->voxel_num[1]])
-      nor[2] += -1.0;
+    gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, opengl->toolpath_buffer);
+    glColorPointer (4, GL_UNSIGNED_BYTE, sizeof (gcode_toolpath_vertex_t), (GLvoid *) offsetof (gcode_toolpath_vertex_t, color));
+    glVertexPointer (3, GL_FLOAT, sizeof (gcode_toolpath_vertex_t), (GLvoid *) offsetof (gcode_toolpath_vertex_t, pos));
   }
   else
   {
-    nor[2] += -1.0;
+    glColorPointer (4, GL_UNSIGNED_BYTE, sizeof (gcode_toolpath_vertex_t), toolpath->vertex[0].color);
+    glVertexPointer (3, GL_FLOAT, sizeof (gcode_toolpath_vertex_t), toolpath->vertex[0].pos);
   }
 
-  if (k < opengl->gcode->voxel_num[2]-1)
+  glDrawArrays (GL_LINE_STRIP, 0, count);
+
+  if (opengl->toolpath_buffer)
+    gui_opengl_bind_buffer (GL_ARRAY_BUFFER_ARB, 0);
+
+  glDisableClientState (GL_VERTEX_ARRAY);
+  glDisableClientState (GL_COLOR_ARRAY);
+
+  glShadeModel (GL_SMOOTH);
+
+  glPointSize (6.0);
+  glColor3f (1.0, 1.0, 1.0);
+  glBegin (GL_POINTS);
+    glVertex3fv (toolpath->vertex[count - 1].pos);
+  glEnd ();
+  glPointSize (1.0);
+}
+
+
+static gcode_block_t *
+top_level_block (gcode_block_t *block)
+{
+  while (block->parent)
+    block = block->parent;
+
+  return (block);
+}
+
+
+static void
+free_block_list (gui_opengl_block_list_t *block_list)
+{
+  int i;
+
+  for (i = 0; i < GUI_OPENGL_LOD_NUM; i++)
   {
-    if (!opengl->gcode->voxel_map[ind+opengl->gcode->voxel_num[0]*opengl->gcode->voxel_num[1]])
-      nor[2] += 1.0;
+    if (block_list->display_list[i])
+      glDeleteLists (block_list->display_list[i], 1);
+    block_list->display_list[i] = 0;
   }
-  else
+}
+
+
+static void
+free_block_lists (gui_opengl_t *opengl)
+{
+  uint32_t i;
+
+  for (i = 0; i < opengl->block_list_num; i++)
+    free_block_list (&opengl->block_list[i]);
+
+  free (opengl->block_list);
+  opengl->block_list = NULL;
+  opengl->block_list_num = 0;
+
+  if (opengl->selection_display_list)
+    glDeleteLists (opengl->selection_display_list, 1);
+  opengl->selection_display_list = 0;
+  opengl->selection_block = NULL;
+  opengl->selection_selected = NULL;
+}
+
+
+static gui_opengl_block_list_t *
+find_block_list (gui_opengl_t *opengl, gcode_block_t *block, int top)
+{
+  gui_opengl_block_list_t *block_list;
+  uint32_t i;
+
+  /* Entries are made in list order, so they usually sit at the block's position */
+  if (top < opengl->block_list_num && opengl->block_list[top].block == block)
+    return (&opengl->block_list[top]);
+
+  for (i = 0; i < opengl->block_list_num; i++)
+    if (opengl->block_list[i].block == block)
+      return (&opengl->block_list[i]);
+
+  opengl->block_list = (gui_opengl_block_list_t *) realloc (opengl->block_list, (opengl->block_list_num + 1) * sizeof (gui_opengl_block_list_t));
+  block_list = &opengl->block_list[opengl->block_list_num++];
+  block_list->block = block;
+  memset (block_list->display_list, 0, sizeof (block_list->display_list));
+  block_list->dirty = 0;
+
+  return (block_list);
+}
+
+
+/*
+* Highlight by scaling each channel of the unselected color up to the selected
+* one in the texture stage, so the cached geometry is drawn again as is.  The
+* scale is halved to fit in a texel and doubled back with GL_RGB_SCALE.
+*/
+static void
+highlight_begin (gui_opengl_t *opengl)
+{
+  GLfloat texel[3];
+  int i;
+
+  if (!opengl->highlight_texture)
   {
-    nor[2] += 1.0;
+    for (i = 0; i < 3; i++)
+      texel[i] = 0.5 * GCODE_OPENGL_COLOR[1][i] / GCODE_OPENGL_COLOR[0][i];
+
+    glGenTextures (1, (GLuint *) &opengl->highlight_texture);
+    glBindTexture (GL_TEXTURE_2D, opengl->highlight_texture);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_FLOAT, texel);
   }
+
+  glBindTexture (GL_TEXTURE_2D, opengl->highlight_texture);
+  glEnable (GL_TEXTURE_2D);
+  glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_COMBINE);
+  glTexEnvi (GL_TEXTURE_ENV, GL_COMBINE_RGB, GL_MODULATE);
+  glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE0_RGB, GL_PRIMARY_COLOR);
+  glTexEnvi (GL_TEXTURE_ENV, GL_SOURCE1_RGB, GL_TEXTURE);
+  glTexEnvf (GL_TEXTURE_ENV, GL_RGB_SCALE, 2.0);
 }
 
 
-void
-gui_opengl_build_simulate_display_list (gui_opengl_t *opengl)
+static void
+highlight_end (void)
 {
-  int16_t i, j, k;
-  gfloat_t vx, vy, vz;
-  gcode_vec3d_t nor;
-  int ind;
-  GLfloat mat_ambient[] = { 1.0, 1.0, 1.0, 1.0 };
-  GLfloat mat_diffuse[] = { 0.6, 0.6, 0.6, 1.0 };
-  GLfloat mat_specular[] = { 0.0, 0.0, 0.0, 1.0 };
-  GLfloat mat_shininess[] = { 0.0 };
+  glTexEnvf (GL_TEXTURE_ENV, GL_RGB_SCALE, 1.0);
+  glTexEnvi (GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glDisable (GL_TEXTURE_2D);
+}
 
 
-  if (!opengl->gcode->voxel_map)
+/*
+* Mark the geometry of the top-level block holding this block as stale, it is
+* compiled again the next time it is drawn.  Blocks elsewhere keep theirs.
+*/
+void
+gui_opengl_block_changed (gui_opengl_t *opengl, gcode_block_t *block)
+{
+  uint32_t i;
+
+  if (!block)
     return;
 
-  opengl->simulate_display_list = glGenLists (5);
-  glNewList (opengl->simulate_display_list, GL_COMPILE);
+  /* Tool diameters shape the blocks that follow the tool */
+  if (block->type == GCODE_TYPE_TOOL)
+  {
+    opengl->rebuild_view_display_list = 1;
+    return;
+  }
 
-  glLightModeli (GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+  block = top_level_block (block);
 
-  glEnable (GL_LIGHTING);
-  glEnable (GL_LIGHT0);
+  for (i = 0; i < opengl->block_list_num; i++)
+    if (opengl->block_list[i].block == block)
+      opengl->block_list[i].dirty = 1;
 
-  glMaterialfv (GL_FRONT_AND_BACK, GL_DIFFUSE, mat_diffuse);
-  glMaterialfv (GL_FRONT_AND_BACK, GL_AMBIENT, mat_ambient);
-  glMaterialfv (GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
-  glMaterialfv (GL_FRONT_AND_BACK, GL_SHININESS, mat_shininess);
+  if (opengl->selection_block == block)
+    opengl->selection_block = NULL;
+}
 
-  glPointSize (2);
-  glBegin (GL_POINTS);
 
-  ind = 0;
-  for (k = 0; k < opengl->gcode->voxel_num[2]; k++)
-  {
-    vz = ((gfloat_t) k/(gfloat_t) opengl->gcode->voxel_num[2]) * opengl->gcode->material_size[2] - opengl->gcode->material_size[2];
+/*
+* Planes of the view volume from the current projection and modelview, each
+* a, b, c, d with the inside where ax + by + cz + d >= 0.
+*/
+static void
+get_frustum (GLfloat plane[24])
+{
+  GLfloat proj[16], model[16], m[16];
+  int i, j, k;
 
-    /* Update Progress based on Z for now */
-    opengl->progress_callback (opengl->gcode->gui, (gfloat_t)(k+1) / (gfloat_t)opengl->gcode->voxel_num[2]);
+  glGetFloatv (GL_PROJECTION_MATRIX, proj);
+  glGetFloatv (GL_MODELVIEW_MATRIX, model);
 
-    for (j = 0; j < opengl->gcode->voxel_num[1]; j++)
+  for (i = 0; i < 4; i++)
+  {
+    for (j = 0; j < 4; j++)
     {
-      vy = -opengl->gcode->material_size[1]*0.5 + ((gfloat_t)j/(gfloat_t)opengl->gcode->voxel_num[1]) * opengl->gcode->material_size[1];
-      for (i = 0; i < opengl->gcode->voxel_num[0]; i++)
-      {
-        vx = -opengl->gcode->material_size[0]*0.5 + ((gfloat_t)i/(gfloat_t)opengl->gcode->voxel_num[0]) * opengl->gcode->material_size[0];
+      m[i*4+j] = 0.0;
+      for (k = 0; k < 4; k++)
+        m[i*4+j] += proj[k*4+j] * model[i*4+k];
+    }
+  }
 
-        if (opengl->gcode->voxel_map[ind])
-        {
-          nor[0] = 0.0;
-          nor[1] = 0.0;
-          nor[2] = 0.0;
+  /* Rows of the combined matrix added to or taken from the w row */
+  for (i = 0; i < 3; i++)
+  {
+    for (k = 0; k < 4; k++)
+    {
+      plane[(2*i+0)*4+k] = m[k*4+3] + m[k*4+i];
+      plane[(2*i+1)*4+k] = m[k*4+3] - m[k*4+i];
+    }
+  }
+}
 
-          sum_normal (opengl, i, j, k, nor);
 
-          sum_normal (opengl, i-1, j, k, nor);
-          sum_normal (opengl, i+1, j, k, nor);
-          sum_normal (opengl, i, j-1, k, nor);
-          sum_normal (opengl, i, j+1, k, nor);
-          sum_normal (opengl, i, j, k-1, nor);
-          sum_normal (opengl, i, j, k+1, nor);
-#if 0
-          sum_normal (opengl, i-2, j, k, nor);
-          sum_normal (opengl, i+2, j, k, nor);
+static int
+frustum_test (gfloat_t min[3], gfloat_t max[3], void *data)
+{
+  GLfloat *plane;
+  int i;
 
-          sum_normal (opengl, i-2, j+1, k, nor);
-          sum_normal (opengl, i+2, j+1, k, nor);
+  plane = (GLfloat *) data;
 
-          sum_normal (opengl, i-2, j-1, k, nor);
-          sum_normal (opengl, i+2, j-1, k, nor);
+  /* Outside when the corner furthest along the normal is behind any plane */
+  for (i = 0; i < 6; i++)
+    if (plane[i*4+0] * (plane[i*4+0] < 0.0 ? min[0] : max[0]) +
+        plane[i*4+1] * (plane[i*4+1] < 0.0 ? min[1] : max[1]) +
+        plane[i*4+2] * (plane[i*4+2] < 0.0 ? min[2] : max[2]) + plane[i*4+3] < 0.0)
+      return (0);
 
-          sum_normal (opengl, i, j+2, k, nor);
-          sum_normal (opengl, i, j-2, k, nor);
+  return (1);
+}
 
-          sum_normal (opengl, i+1, j+2, k, nor);
-          sum_normal (opengl, i+1, j-2, k, nor);
 
-          sum_normal (opengl, i-1, j+2, k, nor);
-          sum_normal (opengl, i-1, j-2, k, nor);
-#endif
+/*
+* Level of detail for the current view, from the size of a pixel where the
+* material is.  Each level allows twice the chord error of the one before,
+* so curves are tessellated again only when the zoom crosses a power of two.
+*/
+static int
+get_lod (gui_opengl_t *opengl)
+{
+  GLfloat proj[16], model[16];
+  GLint viewport[4];
+  gfloat_t pixel, tol;
+  int lod;
 
-/*          GCODE_MATH_VEC3D_UNITIZE(nor) */
+  glGetFloatv (GL_PROJECTION_MATRIX, proj);
+  glGetFloatv (GL_MODELVIEW_MATRIX, model);
+  glGetIntegerv (GL_VIEWPORT, viewport);
 
-          if (fabs (nor[0]) + fabs (nor[1]) + fabs (nor[2]) > 0.0)
-          {
-            glNormal3f (nor[0], nor[1], nor[2]);
-            glVertex3f (vx, vy, vz);
-          }
-        }
-        ind++;
-      }
-    }
-  }
+  /* Perspective divides by the distance in front of the eye */
+  pixel = 2.0 / (proj[0] * viewport[2]);
+  if (proj[15] == 0.0)
+    pixel *= fabs (model[14]);
 
-  glEnd ();
+  tol = GUI_OPENGL_LOD_ERROR * pixel / GCODE_UNITS (opengl->gcode, GUI_OPENGL_LOD_MIN);
+  for (lod = 0; lod < GUI_OPENGL_LOD_NUM-1 && tol >= 2.0; lod++)
+    tol *= 0.5;
 
-  glEndList ();
+  return (lod);
 }
 
 
 static void
 draw_top_level_blocks (gui_opengl_t *opengl, gcode_block_t *selected_block)
 {
-  gcode_block_t *block;
+  gui_opengl_block_list_t *block_list;
+  gcode_block_t *block, *selection;
+  GLfloat plane[24];
+  uint8_t picking;
+  int top, lod;
 
   glEnable (GL_DEPTH_TEST);
   if (opengl->rebuild_view_display_list)
   {
-    if (opengl->view_display_list)
-      glDeleteLists (opengl->view_display_list, 1);
-    opengl->view_display_list = glGenLists (6);
-    glNewList (opengl->view_display_list, GL_COMPILE);
+    free_block_lists (opengl);
+    opengl->rebuild_view_display_list = 0;
+    opengl->rebuild_bvh = 1;
+  }
 
-    glTranslatef (opengl->matx_origin + opengl->gcode->material_origin[0], opengl->maty_origin + opengl->gcode->material_origin[1], 0.0);
-    block = opengl->gcode->list;
-    while (block)
+  selection = selected_block ? top_level_block (selected_block) : NULL;
+
+  lod = get_lod (opengl);
+  opengl->gcode->draw_tol = GCODE_UNITS (opengl->gcode, GUI_OPENGL_LOD_MIN) * (gfloat_t) (1 << lod);
+
+  /*
+  * Compile whatever is missing or stale first, drawing a block leaves the
+  * offsets its boxes are taken from, then bring the hierarchy up to date.
+  * Lists are always compiled as the view draws them, even when picking.
+  */
+  picking = gcode_internal_draw_picking ();
+  gcode_internal_draw_pick (0);
+
+  for (top = 0, block = opengl->gcode->list; block; top++, block = block->next)
+  {
+    if (top >= opengl->bvh.top_num || opengl->bvh.top[top] != block)
+      opengl->rebuild_bvh = 1;
+
+    if (!block->draw)
+      continue;
+
+    /*
+    * Selecting a child changes what its top-level block draws (a sketch only
+    * shows its top layer), so that one block is compiled with the selection.
+    */
+    if (block == selection && block != selected_block)
     {
-      if (block->draw)
+      if (opengl->selection_block != block || opengl->selection_selected != selected_block || opengl->selection_lod != lod)
+      {
+        if (!opengl->selection_display_list)
+          opengl->selection_display_list = glGenLists (1);
+        glNewList (opengl->selection_display_list, GL_COMPILE);
         block->draw (block, selected_block);
+        glEndList ();
 
-      block = block->next;
+        opengl->selection_block = block;
+        opengl->selection_selected = selected_block;
+        opengl->selection_lod = lod;
+      }
+
+      /* An edit of the selection leaves the unselected geometry stale too */
+      block_list = find_block_list (opengl, block, top);
+      if (block_list->dirty)
+      {
+        free_block_list (block_list);
+
+        if (!opengl->rebuild_bvh)
+          if (gcode_bvh_refit (&opengl->bvh, block))
+            opengl->rebuild_bvh = 1;
+      }
+      block_list->dirty = 0;
+      continue;
     }
-    glTranslatef (-opengl->matx_origin - opengl->gcode->material_origin[0], -opengl->maty_origin - opengl->gcode->material_origin[1], 0.0);
-    glEndList ();
 
-    opengl->rebuild_view_display_list = 0;
+    block_list = find_block_list (opengl, block, top);
+    if (block_list->dirty)
+      free_block_list (block_list);
+
+    /* Levels compiled before stay until the block changes */
+    if (!block_list->display_list[lod])
+    {
+      block_list->display_list[lod] = glGenLists (1);
+      glNewList (block_list->display_list[lod], GL_COMPILE);
+      block->draw (block, NULL);
+      glEndList ();
+
+      if (block_list->dirty && !opengl->rebuild_bvh)
+        if (gcode_bvh_refit (&opengl->bvh, block))
+          opengl->rebuild_bvh = 1;
+    }
+    block_list->dirty = 0;
+  }
+  if (top != opengl->bvh.top_num)
+    opengl->rebuild_bvh = 1;
+
+  gcode_internal_draw_pick (picking);
+
+  if (opengl->rebuild_bvh)
+  {
+    gcode_bvh_build (&opengl->bvh, opengl->gcode);
+    opengl->rebuild_bvh = 0;
   }
 
-  glCallList (opengl->view_display_list);
+  glTranslatef (opengl->matx_origin + opengl->gcode->material_origin[0], opengl->maty_origin + opengl->gcode->material_origin[1], 0.0);
+
+  /* Only what is inside the view, which is just around the cursor when picking */
+  get_frustum (plane);
+  gcode_bvh_query (&opengl->bvh, frustum_test, plane);
+
+  for (top = 0, block = opengl->gcode->list; block; top++, block = block->next)
+  {
+    if (!block->draw || !opengl->bvh.visible[top])
+      continue;
+
+    /* Blocks that do not name what they draw are picked as a whole */
+    gcode_internal_draw_name (block->name);
+
+    /* STL is compiled with its own lighting, which would hide the name */
+    if (picking && block->type == GCODE_TYPE_STL)
+    {
+      block->draw (block, NULL);
+      continue;
+    }
+
+    if (block == selection && block != selected_block)
+    {
+      glCallList (opengl->selection_display_list);
+      continue;
+    }
+
+    block_list = find_block_list (opengl, block, top);
+    if (block == selected_block)
+    {
+      highlight_begin (opengl);
+      glCallList (block_list->display_list[lod]);
+      highlight_end ();
+    }
+    else
+    {
+      glCallList (block_list->display_list[lod]);
+    }
+  }
+  glTranslatef (-opengl->matx_origin - opengl->gcode->material_origin[0], -opengl->maty_origin - opengl->gcode->material_origin[1], 0.0);
 }
 
 
@@ -637,6 +1092,7 @@ draw_all (gui_opengl_t *opengl, gcode_block_t *block)
     {
       draw_grid (opengl, view);
       draw_top_level_blocks (opengl, block);
+      draw_toolpath (opengl);
     }
     else if (block->parent->type == GCODE_TYPE_EXTRUSION)
     {
@@ -653,6 +1109,7 @@ draw_all (gui_opengl_t *opengl, gcode_block_t *block)
     glEnable (GL_DEPTH_TEST);
 /* block->draw (block, block); old behavior */
     draw_top_level_blocks (opengl, block); /* new behavior, show everything now that suppress exists */
+    draw_toolpath (opengl);
 /* glTranslatef (-opengl->matx_origin, -opengl->maty_origin, 0.0); */
   }
 
@@ -724,6 +1181,7 @@ set_projection (opengl, view);
             draw_grid (opengl, view);
 
             draw_top_level_blocks (opengl, block->parent);
+            draw_toolpath (opengl);
           }
         }
         break;
@@ -753,7 +1211,8 @@ set_projection (opengl, view);
             glPointSize (size);
             glPointSize (1);
 */
-          glCallList (opengl->simulate_display_list);
+          draw_simulate (opengl);
+          draw_toolpath (opengl);
         }
         break;
 
@@ -766,24 +1225,46 @@ set_projection (opengl, view);
 }
 
 
-void gui_opengl_pick (gui_opengl_t *opengl, int x, int y)
+/*
+* Draw the scene into the corner of the back buffer with each name as a color,
+* through a projection that covers only the pixels around the cursor, and
+* take the name nearest the cursor.  The buffer is never swapped, the next
+* redraw clears it.
+*/
+void
+gui_opengl_pick (gui_opengl_t *opengl, int x, int y)
 {
   gfloat_t aspect, fov;
-  GLuint buff[64];
-  int viewport[4], hits;
+  GLubyte pixel[GUI_OPENGL_PICK_SIZE * GUI_OPENGL_PICK_SIZE * 4];
+  GLfloat black[4] = { 0.0, 0.0, 0.0, 1.0 };
+  gcode_block_t *block;
+  int viewport[4], i, j, d, dmin;
+  uint32_t name, pick;
   uint8_t view;
 
   view = GUI_OPENGL_VIEW_REGULAR;
 
-  glSelectBuffer (64, buff);
+  gdk_gl_drawable_gl_begin (opengl->gl_drawable, opengl->gl_context);
 
   glGetIntegerv (GL_VIEWPORT, viewport);
 
-  glRenderMode(GL_SELECT);
+  glPushAttrib (GL_ENABLE_BIT | GL_LIGHTING_BIT | GL_VIEWPORT_BIT | GL_SCISSOR_BIT | GL_COLOR_BUFFER_BIT);
 
-  glInitNames ();
+  glViewport (0, 0, GUI_OPENGL_PICK_SIZE, GUI_OPENGL_PICK_SIZE);
+  glScissor (0, 0, GUI_OPENGL_PICK_SIZE, GUI_OPENGL_PICK_SIZE);
+  glEnable (GL_SCISSOR_TEST);
 
-  glPushName (0);
+  /* Only emission reaches the pixels, see gcode_internal_draw_name */
+  glDisable (GL_DITHER);
+  glDisable (GL_TEXTURE_2D);
+  glDisable (GL_COLOR_MATERIAL);
+  glEnable (GL_LIGHTING);
+  for (i = 0; i < 8; i++)
+    glDisable (GL_LIGHT0 + i);
+  glLightModelfv (GL_LIGHT_MODEL_AMBIENT, black);
+
+  glClearColor (0.0, 0.0, 0.0, 0.0);
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   /* View Configuration and Draw */
   glMatrixMode (GL_PROJECTION);
@@ -792,7 +1273,7 @@ void gui_opengl_pick (gui_opengl_t *opengl, int x, int y)
 
   glLoadIdentity ();
 
-  gluPickMatrix (x, viewport[3] - y, 15.0, 15.0, viewport);
+  gluPickMatrix (x, viewport[3] - y, GUI_OPENGL_PICK_SIZE, GUI_OPENGL_PICK_SIZE, viewport);
 
   aspect = (gfloat_t) opengl->context_h / (gfloat_t) opengl->context_w;
   if (opengl->projection == GUI_OPENGL_PROJECTION_PERSPECTIVE)
@@ -807,55 +1288,58 @@ void gui_opengl_pick (gui_opengl_t *opengl, int x, int y)
 
   glMatrixMode (GL_MODELVIEW);
 
-  glLoadIdentity ();
+  glPushMatrix ();
 
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glLoadIdentity ();
 
   glTranslatef (0, 0, -opengl->view[view].zoom);
   glRotatef (opengl->view[view].elev-90.0, 1, 0, 0);
   glRotatef (opengl->view[view].azim, 0, 0, 1);
   glTranslatef (-opengl->view[view].pos[0], -opengl->view[view].pos[1], -opengl->view[view].pos[2]);
 
-
+  gcode_internal_draw_pick (1);
   draw_top_level_blocks (opengl, NULL);
+  gcode_internal_draw_pick (0);
 
   glPopMatrix ();
 
-  hits = glRenderMode (GL_RENDER);
+  glMatrixMode (GL_PROJECTION);
+  glPopMatrix ();
+  glMatrixMode (GL_MODELVIEW);
 
-#if 0
-{
-  int i;
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glReadPixels (0, 0, GUI_OPENGL_PICK_SIZE, GUI_OPENGL_PICK_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
 
-  printf ("x: %d, y: %d, hits: %d\n", x, y, hits);
-  for (i = 0; i < hits; i++)
-  {
-    printf ("hit[%d]: %d, min: %d, max: %d, name: %x\n", i, buff[i*4], buff[i*4+1], buff[i*4+2], buff[i*4+3]);
-  }
-}
-#endif
+  glPopAttrib ();
 
-  /*
-  * For now, take the first hit and search the entire block treeview for the block ptr whose value
-  * matches the name value from the first hit in the list.  Once located, highlight that row.
-  */
-  if (hits > 0)
-  {
-    gcode_block_t *ptr;
+  gdk_gl_drawable_gl_end (opengl->gl_drawable);
 
-    ptr = (gcode_block_t *) ((((uint64_t) buff[3]) << 3) + (uint64_t) opengl->gcode);
+  /* Take the name drawn nearest the cursor */
+  pick = 0;
+  dmin = GUI_OPENGL_PICK_SIZE * GUI_OPENGL_PICK_SIZE;
+  for (j = 0; j < GUI_OPENGL_PICK_SIZE; j++)
+  {
+    for (i = 0; i < GUI_OPENGL_PICK_SIZE; i++)
+    {
+      name = pixel[4*(j*GUI_OPENGL_PICK_SIZE + i)+0] | pixel[4*(j*GUI_OPENGL_PICK_SIZE + i)+1] << 8 | pixel[4*(j*GUI_OPENGL_PICK_SIZE + i)+2] << 16;
+      if (!name)
+        continue;
 
-    set_selected_row_with_block (opengl->gcode->gui, ptr);
-    gui_tab_display (opengl->gcode->gui, ptr, 0);
+      d = (i - GUI_OPENGL_PICK_SIZE/2) * (i - GUI_OPENGL_PICK_SIZE/2) + (j - GUI_OPENGL_PICK_SIZE/2) * (j - GUI_OPENGL_PICK_SIZE/2);
+      if (d < dmin)
+      {
+        dmin = d;
+        pick = name;
+      }
+    }
   }
 
-/*
-glGetIntegerv(GL_MAX_NAME_STACK_DEPTH, &foo);
-printf ("MAX_DEPTH: %d\n", foo);
-
-glGetIntegerv(GL_NAME_STACK_DEPTH, &foo);
-printf ("foo: %d\n", foo);
-*/
+  block = gcode_internal_lookup (pick);
+  if (block)
+  {
+    set_selected_row_with_block (opengl->gcode->gui, block);
+    gui_tab_display (opengl->gcode->gui, block, 0);
+  }
 }
 
 
@@ -882,6 +1366,8 @@ gui_opengl_context_prep (gui_opengl_t *opengl)
   opengl->view[GUI_OPENGL_VIEW_REGULAR].pos[0] = 0.0;
   opengl->view[GUI_OPENGL_VIEW_REGULAR].pos[1] = 0.0;
   opengl->view[GUI_OPENGL_VIEW_REGULAR].pos[2] = 0.0;
+
+  opengl->toolpath_show = 0;
 }
 
 
@@ -899,7 +1385,6 @@ gui_opengl_context_init (GtkWidget *widget, GdkEventConfigure *event, gpointer d
   opengl->gl_drawable = gtk_widget_get_gl_drawable (widget);
 
   opengl->rebuild_view_display_list = 1;
-  opengl->view_display_list = 0;
 
   gdk_gl_drawable_gl_begin (opengl->gl_drawable, opengl->gl_context);
 
@@ -20,6 +20,9 @@
 #define _GUI_OPENGL_H
 
 #include "gcode.h"
+#include "gcode_mesh.h"
+#include "gcode_bvh.h"
+#include "gcode_toolpath.h"
 #include <GL/gl.h>
 #include <gtk/gtk.h>
 #include <gtk/gtkgl.h>
@@ -34,6 +37,13 @@
 #define GUI_OPENGL_MODE_EDIT			0x0
 #define	GUI_OPENGL_MODE_RENDER			0x1
 
+/* Curves are drawn within LOD_ERROR pixels, levels start at LOD_MIN inches of chord error */
+#define GUI_OPENGL_LOD_NUM			16
+#define GUI_OPENGL_LOD_MIN			0.0001
+#define GUI_OPENGL_LOD_ERROR			0.5
+
+#define GUI_OPENGL_PICK_SIZE			15 /* pixels around the cursor drawn when picking */
+
 #define	GUI_OPENGL_VIEW_REGULAR			0x0
 #define	GUI_OPENGL_VIEW_EXTRUSION		0x1
 
@@ -49,6 +59,14 @@ typedef struct gui_opengl_view_s
 } gui_opengl_view_t;
 
 
+typedef struct gui_opengl_block_list_s
+{
+  gcode_block_t *block;		/* Top-level block */
+  uint32_t display_list[GUI_OPENGL_LOD_NUM];	/* Geometry of the block drawn unselected, per level of detail */
+  uint8_t dirty;
+} gui_opengl_block_list_t;
+
+
 typedef struct gui_opengl_s 
 {
   uint16_t context_w;
@@ -65,10 +83,28 @@ typedef struct gui_opengl_s
   uint32_t gridxy_2_display_list;
   uint32_t gridxy_3_display_list;
   uint32_t gridxz_display_list;
-  uint32_t simulate_display_list;
 
-  uint32_t view_display_list;
-  uint32_t rebuild_view_display_list;
+  gcode_mesh_t simulate_mesh;
+  uint32_t *simulate_buffers;	/* Vertex and index buffer object of each mesh tile */
+  uint32_t simulate_buffer_num;
+
+  gui_opengl_block_list_t *block_list;	/* One per top-level block, compiled on first draw */
+  uint32_t block_list_num;
+  uint32_t rebuild_view_display_list;	/* Discard the geometry of every block */
+
+  gcode_block_t *selection_block;	/* Top-level block holding the selection */
+  gcode_block_t *selection_selected;
+  uint32_t selection_display_list;
+  int selection_lod;
+  uint32_t highlight_texture;
+
+  gcode_bvh_t bvh;		/* Boxes of what the top-level blocks draw, for culling */
+  uint8_t rebuild_bvh;
+
+  gcode_toolpath_t toolpath;	/* Moves of the generated code */
+  uint32_t toolpath_buffer;	/* Vertex buffer object of the toolpath, 0 without one */
+  uint32_t toolpath_move;	/* Moves drawn, counted from the first */
+  uint8_t toolpath_show;	/* Cleared when the code changes */
 
   gfloat_t matx_origin;
   gfloat_t maty_origin;
@@ -84,8 +120,11 @@ typedef struct gui_opengl_s
 
 void gui_opengl_build_gridxy_display_list (gui_opengl_t *opengl);
 void gui_opengl_build_gridxz_display_list (gui_opengl_t *opengl);
-void gui_opengl_build_simulate_display_list (gui_opengl_t *opengl);
+void gui_opengl_build_simulate_mesh (gui_opengl_t *opengl);
+void gui_opengl_build_toolpath (gui_opengl_t *opengl);
+void gui_opengl_free_toolpath (gui_opengl_t *opengl);
 void gui_opengl_context_redraw (gui_opengl_t *opengl, gcode_block_t *block);
+void gui_opengl_block_changed (gui_opengl_t *opengl, gcode_block_t *block);
 
 void gui_opengl_pick (gui_opengl_t *opengl, int x, int y);
 
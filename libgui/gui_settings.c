@@ -26,6 +26,7 @@ void
 gui_settings_init (gui_settings_t *settings)
 {
  settings->voxel_resolution = 250;
+ settings->voxel_layout = GCODE_VOXEL_LAYOUT_COLUMN;
 }
 
 
@@ -50,6 +51,16 @@ start (void *data, const char *el, const char **attr)
   {
     if (!strcmp ("voxel_resolution", attr[i]))
       settings->voxel_resolution = atoi (attr[i+1]);
+
+    if (!strcmp ("voxel_layout", attr[i]))
+    {
+      if (!strcmp ("row", attr[i+1]))
+        settings->voxel_layout = GCODE_VOXEL_LAYOUT_ROW;
+      if (!strcmp ("column", attr[i+1]))
+        settings->voxel_layout = GCODE_VOXEL_LAYOUT_COLUMN;
+      if (!strcmp ("brick", attr[i+1]))
+        settings->voxel_layout = GCODE_VOXEL_LAYOUT_BRICK;
+    }
   }
 }
 
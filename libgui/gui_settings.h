@@ -24,6 +24,7 @@
 typedef struct gui_settings_s
 {
   int voxel_resolution;
+  uint8_t voxel_layout;
 } gui_settings_t;
 
 
@@ -57,6 +57,8 @@ begin_update_callback (GtkWidget *widget, gpointer data)
   begin = (gcode_begin_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   if (!strcmp ("None", gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[wind]))))
   {
     begin->coordinate_system = GCODE_BEGIN_COORDINATE_SYSTEM_NONE;
@@ -86,7 +88,7 @@ begin_update_callback (GtkWidget *widget, gpointer data)
     begin->coordinate_system = GCODE_BEGIN_COORDINATE_SYSTEM_WORKSPACE6;
   }
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -175,13 +177,15 @@ end_update_callback (GtkWidget *widget, gpointer data)
   end = (gcode_end_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   end->pos[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3]));
   end->pos[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4]));
   end->pos[2] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[5]));
 
   end->home = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[6]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -304,6 +308,7 @@ line_update_callback (GtkWidget *widget, gpointer data)
   block = (gcode_block_t *) wlist[2];
   line = (gcode_line_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
 
   p0[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3]));
   p0[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4]));
@@ -400,7 +405,7 @@ line_update_callback (GtkWidget *widget, gpointer data)
     }
   }
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -595,6 +600,8 @@ arc_update_callback (GtkWidget *widget, gpointer data)
   block = (gcode_block_t *) wlist[2];
   arc = (gcode_arc_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
+
   if (!strcmp ("Sweep", gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[3]))))
   {
     if (wlist[25])
@@ -732,7 +739,7 @@ arc_update_callback (GtkWidget *widget, gpointer data)
 
 /*  arc->auto_join = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (auto_join_check_button)); */
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -744,14 +751,18 @@ arc_interface_update_callback (GtkWidget *widget, gpointer data)
 {
   GtkWidget **wlist;
   gulong *hids;
+  gui_t *gui;
   gcode_block_t *block;
   gcode_arc_t *arc;
 
   wlist = (GtkWidget **) data;
   hids = (gulong *) wlist[0];
+  gui = (gui_t *) wlist[1];
   block = (gcode_block_t *) wlist[2];
   arc = (gcode_arc_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
+
   if (!strcmp ("Sweep", gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[3]))))
   {
     arc->interface = GCODE_ARC_INTERFACE_SWEEP;
@@ -1176,6 +1187,8 @@ bolt_holes_update_callback (GtkWidget *widget, gpointer data)
   block = (gcode_block_t *) wlist[2];
   bolt_holes = (gcode_bolt_holes_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
+
   posx_spin = wlist[3];
   posy_spin = wlist[4];
   hole_diameter_spin = wlist[5];
@@ -1240,7 +1253,7 @@ bolt_holes_update_callback (GtkWidget *widget, gpointer data)
 
   gcode_bolt_holes_rebuild (block);
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -1412,11 +1425,13 @@ drill_holes_update_callback (GtkWidget *widget, gpointer data)
   block = (gcode_block_t *) wlist[2];
   drill_holes = (gcode_drill_holes_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
+
   drill_holes->depth = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3]));
   drill_holes->increment = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4]));
   drill_holes->optimal_path = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[5]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -1515,10 +1530,12 @@ point_update_callback (GtkWidget *widget, gpointer data)
   point = (gcode_point_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   point->p[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
   point->p[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -1612,11 +1629,13 @@ template_update_callback (GtkWidget *widget, gpointer data)
   template = (gcode_template_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   template->position[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
   template->position[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
   template->rotation = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -1716,10 +1735,25 @@ sketch_update_callback (GtkWidget *widget, gpointer data)
   block = (gcode_block_t *) wlist[2];
   sketch = (gcode_sketch_t *) block->pdata;
 
+  gui_undo_block (&gui->undo, block);
+
   sketch->taper_offset[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[3]));
   sketch->taper_offset[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[4]));
   sketch->zero_pass = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[6]));
 
+  if (!strcmp ("Rings", gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[8]))))
+  {
+    sketch->pocket_style = GCODE_SKETCH_POCKET_RINGS;
+  }
+  else if (!strcmp ("Adaptive", gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[8]))))
+  {
+    sketch->pocket_style = GCODE_SKETCH_POCKET_ADAPTIVE;
+  }
+  else
+  {
+    sketch->pocket_style = GCODE_SKETCH_POCKET_ZIGZAG;
+  }
+
   if (fabs (sketch->taper_offset[0]) > 0.0 || fabs (sketch->taper_offset[1]) > 0.0)
   {
     gtk_widget_set_sensitive (wlist[7], 0);
@@ -1750,7 +1784,7 @@ sketch_update_callback (GtkWidget *widget, gpointer data)
     sketch->helical = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[7]));
   }
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -1769,6 +1803,7 @@ gui_tab_sketch (gui_t *gui, gcode_block_t *block)
   GtkWidget *taper_offsetx_spin;
   GtkWidget *taper_offsety_spin;
   GtkWidget *pocket_check_button;
+  GtkWidget *pocket_style_combo;
   GtkWidget *zero_pass_check_button;
   GtkWidget *helical_check_button;
   gcode_sketch_t *sketch;
@@ -1782,7 +1817,7 @@ gui_tab_sketch (gui_t *gui, gcode_block_t *block)
   sketch = (gcode_sketch_t *) block->pdata;
 
   wind = 0;
-  wlist = (GtkWidget **) malloc (8 * sizeof (GtkWidget *));
+  wlist = (GtkWidget **) malloc (9 * sizeof (GtkWidget *));
   hids = (gulong *) malloc (4 * sizeof (gulong));
   row = 0;
 
@@ -1825,6 +1860,17 @@ gui_tab_sketch (gui_t *gui, gcode_block_t *block)
   gtk_table_attach_defaults (GTK_TABLE (sketch_table), pocket_check_button, 1, 2, row, row+1);
   row++;
 
+  label = gtk_label_new ("Pocket Style");
+  gtk_table_attach_defaults (GTK_TABLE (sketch_table), label, 0, 1, row, row+1);
+  pocket_style_combo = gtk_combo_box_new_text ();
+  gtk_combo_box_append_text (GTK_COMBO_BOX (pocket_style_combo), "Zig Zag");
+  gtk_combo_box_append_text (GTK_COMBO_BOX (pocket_style_combo), "Rings");
+  gtk_combo_box_append_text (GTK_COMBO_BOX (pocket_style_combo), "Adaptive");
+  gtk_combo_box_set_active (GTK_COMBO_BOX (pocket_style_combo), sketch->pocket_style);
+  g_signal_connect (pocket_style_combo, "changed", G_CALLBACK (sketch_update_callback), wlist);
+  gtk_table_attach_defaults (GTK_TABLE (sketch_table), pocket_style_combo, 1, 2, row, row+1);
+  row++;
+
   label = gtk_label_new ("Zero Pass");
   gtk_table_attach_defaults (GTK_TABLE (sketch_table), label, 0, 1, row, row+1);
   zero_pass_check_button = gtk_check_button_new ();
@@ -1856,6 +1902,7 @@ gui_tab_sketch (gui_t *gui, gcode_block_t *block)
   wlist[wind++] = pocket_check_button;
   wlist[wind++] = zero_pass_check_button;
   wlist[wind++] = helical_check_button;
+  wlist[wind++] = pocket_style_combo;
 }
 
 
@@ -1883,6 +1930,8 @@ extrusion_update_callback (GtkWidget *widget, gpointer data)
   extrusion = (gcode_extrusion_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   extrusion->resolution = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
 
   cut_side = gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[wind++]));
@@ -1900,7 +1949,7 @@ extrusion_update_callback (GtkWidget *widget, gpointer data)
     extrusion->cut_side = GCODE_EXTRUSION_ALONG;
   }
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -2019,6 +2068,8 @@ tool_update_callback (GtkWidget *widget, gpointer data)
   tool = (gcode_tool_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
 
   emd = gtk_combo_box_get_active_text (GTK_COMBO_BOX (wlist[3]));
   strcpy (tool->label, &emd[6]);
@@ -2036,6 +2087,9 @@ tool_update_callback (GtkWidget *widget, gpointer data)
       {
         tool->diam = endmill_list.endmill[i].diameter;
         tool->number = endmill_list.endmill[i].number;
+        tool->shape = endmill_list.endmill[i].shape;
+        tool->angle = endmill_list.endmill[i].angle;
+        tool->corner = endmill_list.endmill[i].corner;
       }
     }
 
@@ -2074,7 +2128,7 @@ tool_update_callback (GtkWidget *widget, gpointer data)
 
   tool->coolant = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (wlist[11]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -2311,11 +2365,13 @@ image_update_callback (GtkWidget *widget, gpointer data)
   image = (gcode_image_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   image->size[0] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
   image->size[1] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
   image->size[2] = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -2420,11 +2476,13 @@ stl_update_callback (GtkWidget *widget, gpointer data)
   stl = (gcode_stl_t *) block->pdata;
   wind++;
 
+  gui_undo_block (&gui->undo, block);
+
   stl->slices = gtk_spin_button_get_value (GTK_SPIN_BUTTON (wlist[wind++]));
 
   gcode_stl_generate_slice_contours (block);
 
-  gui->opengl.rebuild_view_display_list = 1;
+  gui_opengl_block_changed (&gui->opengl, block);
   gui_opengl_context_redraw (&gui->opengl, block);
 
   gui_menu_util_modified (gui, 1);
@@ -2564,6 +2622,5 @@ gui_tab_display (gui_t *gui, gcode_block_t *block, int force)
   gui->opengl.mode = GUI_OPENGL_MODE_EDIT;
   gui->selected_block = block;
 
-  gui->opengl.rebuild_view_display_list = 1;
   gui_opengl_context_redraw (&gui->opengl, block);
 }
@@ -0,0 +1,570 @@
+/*
+*  gui_undo.c
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "gui_undo.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static size_t
+pdata_size (gcode_block_t *block)
+{
+  switch (block->type)
+  {
+    case GCODE_TYPE_BEGIN:
+      return (sizeof (gcode_begin_t));
+
+    case GCODE_TYPE_END:
+      return (sizeof (gcode_end_t));
+
+    case GCODE_TYPE_TEMPLATE:
+      return (sizeof (gcode_template_t));
+
+    case GCODE_TYPE_TOOL:
+      return (sizeof (gcode_tool_t));
+
+    case GCODE_TYPE_EXTRUSION:
+      return (sizeof (gcode_extrusion_t));
+
+    case GCODE_TYPE_SKETCH:
+      return (sizeof (gcode_sketch_t));
+
+    case GCODE_TYPE_LINE:
+      return (sizeof (gcode_line_t));
+
+    case GCODE_TYPE_ARC:
+      return (sizeof (gcode_arc_t));
+
+    case GCODE_TYPE_IMAGE:
+      return (sizeof (gcode_image_t));
+
+    case GCODE_TYPE_BOLT_HOLES:
+      return (sizeof (gcode_bolt_holes_t));
+
+    case GCODE_TYPE_DRILL_HOLES:
+      return (sizeof (gcode_drill_holes_t));
+
+    case GCODE_TYPE_POINT:
+      return (sizeof (gcode_point_t));
+
+    case GCODE_TYPE_STL:
+      return (sizeof (gcode_stl_t));
+
+    default:
+      return (0);
+  }
+}
+
+
+/*
+* Children, depth maps and triangles stay with the block, only the
+* parameters around them are restored.  Copy the live pointers into the
+* snapshot so swapping the two leaves them where they are.
+*/
+static void
+keep_shared (gcode_block_t *block, void *pdata)
+{
+  switch (block->type)
+  {
+    case GCODE_TYPE_TEMPLATE:
+      ((gcode_template_t *) pdata)->list = ((gcode_template_t *) block->pdata)->list;
+      break;
+
+    case GCODE_TYPE_EXTRUSION:
+      ((gcode_extrusion_t *) pdata)->list = ((gcode_extrusion_t *) block->pdata)->list;
+      break;
+
+    case GCODE_TYPE_SKETCH:
+      ((gcode_sketch_t *) pdata)->extrusion = ((gcode_sketch_t *) block->pdata)->extrusion;
+      ((gcode_sketch_t *) pdata)->list = ((gcode_sketch_t *) block->pdata)->list;
+      break;
+
+    case GCODE_TYPE_IMAGE:
+      ((gcode_image_t *) pdata)->res[0] = ((gcode_image_t *) block->pdata)->res[0];
+      ((gcode_image_t *) pdata)->res[1] = ((gcode_image_t *) block->pdata)->res[1];
+      ((gcode_image_t *) pdata)->dmap = ((gcode_image_t *) block->pdata)->dmap;
+      break;
+
+    case GCODE_TYPE_BOLT_HOLES:
+      ((gcode_bolt_holes_t *) pdata)->extrusion = ((gcode_bolt_holes_t *) block->pdata)->extrusion;
+      ((gcode_bolt_holes_t *) pdata)->arc_list = ((gcode_bolt_holes_t *) block->pdata)->arc_list;
+      break;
+
+    case GCODE_TYPE_DRILL_HOLES:
+      ((gcode_drill_holes_t *) pdata)->list = ((gcode_drill_holes_t *) block->pdata)->list;
+      break;
+
+    case GCODE_TYPE_STL:
+      ((gcode_stl_t *) pdata)->tri_num = ((gcode_stl_t *) block->pdata)->tri_num;
+      ((gcode_stl_t *) pdata)->tri_list = ((gcode_stl_t *) block->pdata)->tri_list;
+      ((gcode_stl_t *) pdata)->alloc_slices = ((gcode_stl_t *) block->pdata)->alloc_slices;
+      ((gcode_stl_t *) pdata)->slice_list = ((gcode_stl_t *) block->pdata)->slice_list;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+static int
+entry_changed (gui_undo_entry_t *entry)
+{
+  gcode_block_t *block;
+
+  block = entry->block;
+  keep_shared (block, entry->pdata);
+
+  return (entry->flags != block->flags || strcmp (entry->comment, block->comment) || memcmp (entry->pdata, block->pdata, entry->size));
+}
+
+
+static void
+swap_block (gui_undo_entry_t *entry)
+{
+  gcode_block_t *block;
+  char comment[64];
+  uint8_t flags;
+  void *pdata;
+
+  block = entry->block;
+
+  keep_shared (block, entry->pdata);
+  pdata = malloc (entry->size);
+  memcpy (pdata, block->pdata, entry->size);
+  memcpy (block->pdata, entry->pdata, entry->size);
+  memcpy (entry->pdata, pdata, entry->size);
+  free (pdata);
+
+  flags = block->flags;
+  block->flags = entry->flags;
+  entry->flags = flags;
+
+  strcpy (comment, block->comment);
+  strcpy (block->comment, entry->comment);
+  strcpy (entry->comment, comment);
+
+  /* Blocks generating children from their parameters generate them again */
+  if (block->type == GCODE_TYPE_BOLT_HOLES)
+    gcode_bolt_holes_rebuild (block);
+
+  if (block->type == GCODE_TYPE_STL)
+    gcode_stl_generate_slice_contours (block);
+}
+
+
+static void
+attach (gui_undo_entry_t *entry)
+{
+  gcode_block_t *block;
+
+  block = entry->block;
+
+  if (entry->prev)
+  {
+    block->next = entry->prev->next;
+    entry->prev->next = block;
+  }
+  else
+  {
+    block->next = *entry->parent_list;
+    *entry->parent_list = block;
+  }
+
+  if (block->next)
+    block->next->prev = block;
+
+  block->prev = entry->prev;
+  block->parent = entry->parent;
+  block->parent_list = entry->parent_list;
+}
+
+
+static void
+detach (gui_undo_entry_t *entry)
+{
+  gcode_block_t *block;
+
+  block = entry->block;
+
+  entry->parent = block->parent;
+  entry->parent_list = block->parent_list;
+  entry->prev = block->prev;
+
+  if (block->prev)
+  {
+    block->prev->next = block->next;
+  }
+  else
+  {
+    *block->parent_list = block->next;
+  }
+
+  if (block->next)
+    block->next->prev = block->prev;
+
+  block->prev = NULL;
+  block->next = NULL;
+}
+
+
+static void
+apply (gui_undo_entry_t *entry, int undo)
+{
+  gcode_block_t *list;
+
+  switch (entry->kind)
+  {
+    case GUI_UNDO_BLOCK:
+      swap_block (entry);
+      break;
+
+    case GUI_UNDO_INSERT:
+    case GUI_UNDO_REMOVE:
+      if ((entry->kind == GUI_UNDO_REMOVE) == undo)
+      {
+        attach (entry);
+      }
+      else
+      {
+        detach (entry);
+      }
+      break;
+
+    case GUI_UNDO_LIST:
+      list = *entry->list;
+      *entry->list = entry->other;
+      entry->other = list;
+      break;
+  }
+}
+
+
+/*
+* Blocks out of the project belong to the entry holding them: removed
+* blocks while the removal is done, inserted blocks once it is undone.
+*/
+static void
+free_entry (gui_undo_entry_t *entry, int done)
+{
+  switch (entry->kind)
+  {
+    case GUI_UNDO_BLOCK:
+      free (entry->pdata);
+      break;
+
+    case GUI_UNDO_INSERT:
+    case GUI_UNDO_REMOVE:
+      if ((entry->kind == GUI_UNDO_REMOVE) == done)
+        entry->block->free (&entry->block);
+      break;
+
+    case GUI_UNDO_LIST:
+      gcode_list_free (&entry->other);
+      break;
+  }
+}
+
+
+static void
+free_step (gui_undo_step_t *step, int done)
+{
+  int i;
+
+  for (i = 0; i < step->entry_num; i++)
+    free_entry (&step->entry[i], done);
+
+  free (step->entry);
+  step->entry = NULL;
+  step->entry_num = 0;
+}
+
+
+static gboolean
+commit_idle (gpointer data)
+{
+  gui_undo_t *undo;
+  gui_undo_step_t *step;
+  int i, j;
+
+  undo = (gui_undo_t *) data;
+  undo->commit_source = 0;
+  undo->touched = 0;
+
+  /* Parameters set back to what they were are not worth a step */
+  for (i = j = 0; i < undo->open.entry_num; i++)
+  {
+    if (undo->open.entry[i].kind == GUI_UNDO_BLOCK && !entry_changed (&undo->open.entry[i]))
+    {
+      free (undo->open.entry[i].pdata);
+    }
+    else
+    {
+      undo->open.entry[j++] = undo->open.entry[i];
+    }
+  }
+  undo->open.entry_num = j;
+
+  if (!undo->open.entry_num)
+  {
+    free (undo->open.entry);
+    undo->open.entry = NULL;
+    return (FALSE);
+  }
+
+  /* Forget the oldest step to make room */
+  if (undo->step_num == GUI_UNDO_STEP_MAX)
+  {
+    free_step (&undo->step[0], 1);
+    memmove (&undo->step[0], &undo->step[1], (GUI_UNDO_STEP_MAX - 1) * sizeof (gui_undo_step_t));
+    undo->step_num--;
+    undo->step_done--;
+  }
+
+  step = &undo->step[undo->step_num];
+  *step = undo->open;
+  step->time = g_timer_elapsed (undo->timer, NULL);
+
+  undo->merge = undo->step_num;
+  undo->step_num++;
+  undo->step_done = undo->step_num;
+
+  undo->open.entry_num = 0;
+  undo->open.entry = NULL;
+
+  return (FALSE);
+}
+
+
+/*
+* Everything recorded while handling one event is one step, committed once
+* the handler returns and before the next event is looked at.
+*/
+static void
+touch (gui_undo_t *undo)
+{
+  undo->touched = 1;
+
+  if (!undo->commit_source)
+    undo->commit_source = g_idle_add_full (G_PRIORITY_HIGH, commit_idle, undo, NULL);
+}
+
+
+static void
+flush (gui_undo_t *undo)
+{
+  if (undo->commit_source)
+  {
+    g_source_remove (undo->commit_source);
+    commit_idle (undo);
+  }
+}
+
+
+static gui_undo_entry_t *
+add_entry (gui_undo_t *undo, uint8_t kind, gcode_block_t *block)
+{
+  gui_undo_entry_t *entry;
+
+  /* A new edit takes the place of whatever was undone */
+  while (undo->step_num > undo->step_done)
+    free_step (&undo->step[--undo->step_num], 0);
+
+  if (undo->merge >= undo->step_num)
+    undo->merge = -1;
+
+  touch (undo);
+
+  undo->open.entry = (gui_undo_entry_t *) realloc (undo->open.entry, (undo->open.entry_num + 1) * sizeof (gui_undo_entry_t));
+  entry = &undo->open.entry[undo->open.entry_num++];
+  memset (entry, 0, sizeof (gui_undo_entry_t));
+  entry->kind = kind;
+  entry->block = block;
+
+  return (entry);
+}
+
+
+void
+gui_undo_init (gui_undo_t *undo)
+{
+  undo->step_num = 0;
+  undo->step_done = 0;
+  undo->open.entry_num = 0;
+  undo->open.entry = NULL;
+  undo->touched = 0;
+  undo->commit_source = 0;
+  undo->merge = -1;
+  undo->timer = g_timer_new ();
+}
+
+
+/* Forget every step, called whenever the project is replaced */
+void
+gui_undo_free (gui_undo_t *undo)
+{
+  flush (undo);
+
+  while (undo->step_num > undo->step_done)
+    free_step (&undo->step[--undo->step_num], 0);
+
+  while (undo->step_num)
+    free_step (&undo->step[--undo->step_num], 1);
+
+  undo->step_done = 0;
+  undo->merge = -1;
+}
+
+
+/* Call before changing the parameters, comment or flags of a block */
+void
+gui_undo_block (gui_undo_t *undo, gcode_block_t *block)
+{
+  gui_undo_entry_t *entry;
+  gui_undo_step_t *step;
+  double time;
+  int i;
+
+  for (i = 0; i < undo->open.entry_num; i++)
+    if (undo->open.entry[i].kind == GUI_UNDO_BLOCK && undo->open.entry[i].block == block)
+      return;
+
+  /* Spin buttons change a block many times a second, keep that one step */
+  time = g_timer_elapsed (undo->timer, NULL);
+  if (!undo->open.entry_num && undo->merge >= 0 && undo->merge == undo->step_done - 1)
+  {
+    step = &undo->step[undo->merge];
+    if (step->entry_num == 1 && step->entry[0].kind == GUI_UNDO_BLOCK && step->entry[0].block == block && time - step->time < GUI_UNDO_MERGE_TIME)
+    {
+      step->time = time;
+      touch (undo);
+      return;
+    }
+  }
+
+  entry = add_entry (undo, GUI_UNDO_BLOCK, block);
+  entry->flags = block->flags;
+  strcpy (entry->comment, block->comment);
+  entry->size = pdata_size (block);
+  entry->pdata = malloc (entry->size);
+  memcpy (entry->pdata, block->pdata, entry->size);
+}
+
+
+/* Call after the block is in its list */
+void
+gui_undo_insert (gui_undo_t *undo, gcode_block_t *block)
+{
+  gui_undo_entry_t *entry;
+
+  entry = add_entry (undo, GUI_UNDO_INSERT, block);
+  entry->parent = block->parent;
+  entry->parent_list = block->parent_list;
+  entry->prev = block->prev;
+}
+
+
+/* Takes the block out of its list, kept rather than freed so it can be put back */
+void
+gui_undo_remove (gui_undo_t *undo, gcode_block_t *block)
+{
+  gui_undo_entry_t *entry;
+
+  entry = add_entry (undo, GUI_UNDO_REMOVE, block);
+  detach (entry);
+}
+
+
+/* Call after old_list at *list was replaced, block being the one holding it */
+void
+gui_undo_list (gui_undo_t *undo, gcode_block_t *block, gcode_block_t **list, gcode_block_t *old_list)
+{
+  gui_undo_entry_t *entry;
+
+  entry = add_entry (undo, GUI_UNDO_LIST, block);
+  entry->list = list;
+  entry->other = old_list;
+}
+
+
+/*
+* Called for every change to the project.  A change made without recording
+* it leaves earlier steps applying to a project that is no longer there.
+*/
+void
+gui_undo_modified (gui_undo_t *undo)
+{
+  if (!undo->touched)
+    gui_undo_free (undo);
+}
+
+
+/* Returns the block the step was about, NULL when there is nothing to undo */
+gcode_block_t *
+gui_undo_undo (gui_undo_t *undo)
+{
+  gui_undo_step_t *step;
+  gui_undo_entry_t *entry;
+  int i;
+
+  flush (undo);
+
+  if (!undo->step_done)
+    return (NULL);
+
+  step = &undo->step[--undo->step_done];
+  for (i = step->entry_num - 1; i >= 0; i--)
+    apply (&step->entry[i], 1);
+
+  undo->merge = -1;
+  touch (undo);
+
+  entry = &step->entry[0];
+  if (entry->kind == GUI_UNDO_INSERT)
+    return (entry->prev ? entry->prev : entry->parent);
+
+  return (entry->block);
+}
+
+
+/* Returns the block the step was about, NULL when there is nothing to redo */
+gcode_block_t *
+gui_undo_redo (gui_undo_t *undo)
+{
+  gui_undo_step_t *step;
+  gui_undo_entry_t *entry;
+  int i;
+
+  flush (undo);
+
+  if (undo->step_done == undo->step_num)
+    return (NULL);
+
+  step = &undo->step[undo->step_done++];
+  for (i = 0; i < step->entry_num; i++)
+    apply (&step->entry[i], 0);
+
+  undo->merge = -1;
+  touch (undo);
+
+  entry = &step->entry[0];
+  if (entry->kind == GUI_UNDO_REMOVE)
+    return (entry->prev ? entry->prev : entry->parent);
+
+  return (entry->block);
+}
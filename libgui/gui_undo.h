@@ -0,0 +1,88 @@
+/*
+*  gui_undo.h
+*  Source code file for G-Code generation, simulation, and visualization
+*  library. This software is Copyright (C) 2006 by Justin Shumaker
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef _GUI_UNDO_H
+#define _GUI_UNDO_H
+
+#include "gcode.h"
+#include <gtk/gtk.h>
+
+#define GUI_UNDO_BLOCK		0x0	/* parameters of a block */
+#define GUI_UNDO_INSERT		0x1
+#define GUI_UNDO_REMOVE		0x2
+#define GUI_UNDO_LIST		0x3	/* list of a block replaced by another */
+
+#define GUI_UNDO_STEP_MAX	100
+#define GUI_UNDO_MERGE_TIME	1.0	/* seconds, edits of the same block closer than this are one step */
+
+/*
+* Entries only hold what an edit touched.  Undoing or redoing one swaps
+* the live state with the held state, so the same entry serves both ways.
+*/
+typedef struct gui_undo_entry_s
+{
+  uint8_t kind;
+  gcode_block_t *block;
+
+  /* GUI_UNDO_BLOCK */
+  uint8_t flags;
+  char comment[64];
+  size_t size;
+  void *pdata;			/* copy of the parameters, pointers into the block are left alone */
+
+  /* GUI_UNDO_INSERT and GUI_UNDO_REMOVE */
+  gcode_block_t *parent;
+  gcode_block_t **parent_list;
+  gcode_block_t *prev;		/* block it follows, NULL for the head of the list */
+
+  /* GUI_UNDO_LIST */
+  gcode_block_t **list;		/* head of the list in the block */
+  gcode_block_t *other;		/* list not in the block */
+} gui_undo_entry_t;
+
+typedef struct gui_undo_step_s
+{
+  int entry_num;
+  gui_undo_entry_t *entry;
+  double time;
+} gui_undo_step_t;
+
+typedef struct gui_undo_s
+{
+  int step_num;			/* steps recorded */
+  int step_done;		/* steps applied, those after are redone */
+  gui_undo_step_t step[GUI_UNDO_STEP_MAX];
+
+  gui_undo_step_t open;		/* entries of the edit in progress */
+  int touched;			/* something was recorded since the last commit */
+  int merge;			/* step later edits of the same block may join, -1 for none */
+  guint commit_source;		/* pending idle commit, 0 for none */
+  GTimer *timer;
+} gui_undo_t;
+
+void gui_undo_init (gui_undo_t *undo);
+void gui_undo_free (gui_undo_t *undo);
+void gui_undo_block (gui_undo_t *undo, gcode_block_t *block);
+void gui_undo_insert (gui_undo_t *undo, gcode_block_t *block);
+void gui_undo_remove (gui_undo_t *undo, gcode_block_t *block);
+void gui_undo_list (gui_undo_t *undo, gcode_block_t *block, gcode_block_t **list, gcode_block_t *old_list);
+void gui_undo_modified (gui_undo_t *undo);
+gcode_block_t *gui_undo_undo (gui_undo_t *undo);
+gcode_block_t *gui_undo_redo (gui_undo_t *undo);
+
+#endif